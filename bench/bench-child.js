@@ -0,0 +1,23 @@
+
+// The other end of bench.js's round trips. Answers every count the parent
+// puts at offset 0 by copying it to offset 4, till it sees -1.
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var shared = new IPCBuffer(4096,"*"+process.argv[2]);
+var seen = 0,seq;
+
+shared.store(8,1);
+shared.notify(8);
+
+for(;;){
+    seq = shared.load(0);
+    if(seq === -1) break;
+    if(seq === seen){
+	shared.waitSync(0,seen,1000);
+	continue;
+    }
+    seen = seq;
+    shared.store(4,seq);
+    shared.notify(4);
+}
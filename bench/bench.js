@@ -0,0 +1,405 @@
+// Benchmarks for the buffers.
+//
+//   node bench/bench.js [--filter regex] [--samples n] [--quick]
+//                       [--json out.json] [--baseline old.json] [--threshold 10]
+//   node bench/bench.js --compare new.json old.json
+//
+// Every case is run in batches big enough to time properly, and each
+// batch's time per operation is one sample. It prints the percentiles of
+// those, and with --json writes them out so a later run can be checked
+// against them with --baseline. Anything whose median got slower by more
+// than threshold percent is reported, and the exit code is 1. --compare
+// does the same for two saved runs, bench/native's included.
+
+var spawn = require("child_process").spawn;
+var fs = require("fs");
+
+var options = {
+    filter: null,
+    samples: 30,
+    json: null,
+    baseline: null,
+    compare: null,
+    threshold: 10,
+    minSample: 10		// ms, at least this long per batch
+};
+
+(function(argv){
+    for(var i = 2;i < argv.length;i++){
+	switch(argv[i]){
+	case "--filter": options.filter = new RegExp(argv[++i]); break;
+	case "--samples": options.samples = parseInt(argv[++i],10); break;
+	case "--json": options.json = argv[++i]; break;
+	case "--baseline": options.baseline = argv[++i]; break;
+	case "--compare": options.compare = argv[++i]; options.baseline = argv[++i]; break;
+	case "--threshold": options.threshold = parseFloat(argv[++i]); break;
+	case "--quick": options.samples = 10; options.minSample = 5; break;
+	default:
+	    console.error("Unknown option "+argv[i]);
+	    process.exit(2);
+	}
+    }
+})(process.argv);
+
+var results = [];
+
+// Two saved runs don't need the module, they could be from anywhere
+if(options.compare){
+    results = load(options.compare);
+    process.exit(compare(options.baseline) ? 1 : 0);
+}
+
+var ipc = require("../lib/ipcbuffer");
+var IPCBuffer = ipc.Buffer;
+
+// hrtime if this node has it, milliseconds either way
+var now = process.hrtime ? function(){
+    var t = process.hrtime();
+    return t[0]*1e3 + t[1]/1e6;
+} : function(){
+    return Date.now();
+};
+
+var KB = 1024, MB = 1024*1024;
+var SIZES = [4*KB, 64*KB, MB, 16*MB];
+
+function sizeName(n){
+    if(n >= MB) return (n/MB)+"M";
+    if(n >= KB) return (n/KB)+"K";
+    return n+"";
+}
+
+function percentile(sorted,p){
+    var i = Math.min(sorted.length - 1,Math.floor(sorted.length*p/100));
+    return sorted[i];
+}
+
+function summarize(name,samples,ops,bytes){
+    samples.sort(function(a,b){return a - b});
+    var sum = 0;
+    samples.forEach(function(s){sum += s});
+    var r = {
+	name: name,
+	ops: ops,		// Per sample
+	samples: samples.length,
+	unit: "us/op",
+	min: samples[0],
+	p50: percentile(samples,50),
+	p90: percentile(samples,90),
+	p99: percentile(samples,99),
+	max: samples[samples.length - 1],
+	mean: sum/samples.length
+    };
+    if(bytes) r.mbps = bytes/MB/(r.p50/1e6);
+    return r;
+}
+
+var queue = [];
+
+function report(r){
+    results.push(r);
+    console.log(pad(r.name,36)+pad(fix(r.p50),12)+pad(fix(r.p90),12)+
+		pad(fix(r.p99),12)+(r.mbps ? fix(r.mbps)+" MB/s" : ""));
+}
+
+function pad(s,n){
+    s = String(s);
+    while(s.length < n) s += " ";
+    return s;
+}
+
+function fix(n){
+    return n < 10 ? n.toFixed(3) : n < 1000 ? n.toFixed(1) : n.toFixed(0);
+}
+
+function wanted(name){
+    return !options.filter || options.filter.test(name);
+}
+
+// bench(name,fn,[bytes],[setup]) - fn() is one operation, bytes is how much
+// one operation moves if throughput means anything
+function bench(name,fn,bytes,setup){
+    if(!wanted(name)) return;
+    queue.push(function(next){
+	if(setup) setup();
+	var ops = 1,t,i;
+	// Grow the batch till it's long enough to time
+	for(;;){
+	    t = now();
+	    for(i = 0;i < ops;i++) fn();
+	    t = now() - t;
+	    if(t >= options.minSample || ops >= 1<<30) break;
+	    ops *= t > 0 ? Math.min(10,Math.ceil(options.minSample*1.2/t)) : 10;
+	}
+	var samples = [];
+	for(var s = 0;s < options.samples;s++){
+	    t = now();
+	    for(i = 0;i < ops;i++) fn();
+	    samples.push((now() - t)*1000/ops);
+	}
+	report(summarize(name,samples,ops,bytes));
+	next();
+    });
+}
+
+// benchAsync(name,fn,count) - fn(done) is one operation, count a batch
+function benchAsync(name,fn,count,start,stop){
+    if(!wanted(name)) return;
+    queue.push(function(next){
+	var samples = [];
+	start(function(){
+	    (function batch(){
+		var i = 0,t = now();
+		(function one(){
+		    if(i++ < count) return fn(one);
+		    samples.push((now() - t)*1000/count);
+		    if(samples.length < options.samples) return batch();
+		    stop();
+		    report(summarize(name,samples,count));
+		    next();
+		})();
+	    })();
+	});
+    });
+}
+
+
+// Creating buffers. The POSIX and file ones get a new name each time so
+// it's really creating, and are unlinked straight away. System V has no
+// unlink here, so it's one key per size and every one after the first is
+// an attach.
+
+var serial = 0;
+function unique(){
+    return "bench"+process.pid+"-"+(serial++);
+}
+
+var backends = {
+    heap: function(size){ return new IPCBuffer(size,{}) },
+    shm: function(size){
+	var name = unique();
+	var b = new IPCBuffer(size,"*"+name);
+	try{ fs.unlinkSync("/dev/shm/"+name) }catch(e){}
+	return b;
+    },
+    file: function(size){
+	var name = unique()+".buf";
+	var b = new IPCBuffer(size,name);
+	fs.unlinkSync(name);
+	return b;
+    },
+    sysv: function(size){ return new IPCBuffer(size,0x1b0000 + SIZES.indexOf(size)) }
+};
+if(process.platform === "linux"){
+    backends.memfd = function(size){ return new IPCBuffer(size,"&"+unique()) };
+}
+
+Object.keys(backends).forEach(function(backend){
+    SIZES.forEach(function(size){
+	if(backend === "sysv" && size > MB) return;	// shmmax is often 32M
+	bench("create "+backend+" "+sizeName(size),function(){
+	    backends[backend](size);
+	});
+    });
+});
+
+
+// Filling with a JS loop, what tests/test.js times
+
+SIZES.slice(0,3).forEach(function(size){
+    var b = new IPCBuffer(size);
+    bench("fill loop "+sizeName(size),function(){
+	for(var i = 0;i < size;i++) b[i] = i & 255;
+    },size);
+});
+
+
+// The same done natively, and comparing and searching
+
+SIZES.forEach(function(size){
+    var b = new IPCBuffer(size),c = new IPCBuffer(size);
+    bench("fill "+sizeName(size),function(){
+	b.fill(7);
+    },size);
+    bench("equals "+sizeName(size),function(){
+	b.equals(c);
+    },size,function(){
+	b.fill(7);
+	c.fill(7);
+    });
+    bench("indexOf byte "+sizeName(size),function(){
+	b.indexOf(10);
+    },size,function(){
+	b.fill(7);
+	b[size - 1] = 10;
+    });
+    bench("indexOf string "+sizeName(size),function(){
+	b.indexOf("\r\n\r\n");
+    },size,function(){
+	b.fill("GET / HTTP/1.1\r\nHost: x\r\n");
+	b.write("\r\n\r\n",size - 4);
+    });
+});
+
+
+// Checksums
+
+SIZES.forEach(function(size){
+    var b = new IPCBuffer(size);
+    b.fill("checksum me ");
+    bench("crc32c "+sizeName(size),function(){
+	b.crc32c();
+    },size);
+    bench("hash64 "+sizeName(size),function(){
+	b.hash64();
+    },size);
+});
+
+
+// copy
+
+SIZES.forEach(function(size){
+    var src = new IPCBuffer(size),dst = new IPCBuffer(size);
+    bench("copy "+sizeName(size),function(){
+	src.copy(dst,0,0,size);
+    },size);
+});
+
+// Past the cache, where streaming and the threadpool come in
+(function(){
+    var size = 256*MB,src,dst;
+    function start(ready){
+	src = new IPCBuffer(size);
+	dst = new IPCBuffer(size);
+	src.fill(1);
+	dst.fill(2);
+	ready();
+    }
+    function stop(){ src = dst = null }
+    benchAsync("copy "+sizeName(size),function(done){
+	src.copy(dst,0,0,size);
+	done();
+    },4,start,stop);
+    benchAsync("copyAsync "+sizeName(size),function(done){
+	src.copyAsync(dst,0,0,size,done);
+    },4,start,stop);
+    benchAsync("crc32c async "+sizeName(size),function(done){
+	src.crc32c(done);
+    },4,start,stop);
+})();
+
+
+// toString and write in every encoding, over text that suits each
+
+function text(size,multibyte){
+    var chunk = multibyte ? "héllo wörld € " : "hello world ";
+    var s = "";
+    while(s.length < size) s += chunk;
+    return s;
+}
+
+[64*KB, MB].forEach(function(size){
+    var cases = {
+	ascii: text(size),
+	utf8: text(size),
+	"utf8 multibyte": text(size/2,true),
+	binary: text(size),
+	base64: new IPCBuffer(text(size*3/4)).toString("base64")
+    };
+    Object.keys(cases).forEach(function(label){
+	var encoding = label.split(" ")[0];
+	var s = cases[label];
+	var b = new IPCBuffer(s,encoding);
+	var len = b.length;
+	bench("toString "+label+" "+sizeName(size),function(){
+	    b.toString(encoding,0,len);
+	},len);
+	bench("write "+label+" "+sizeName(size),function(){
+	    b.write(s,0,encoding);
+	},len);
+    });
+});
+
+
+// Round trips to another process through a shared buffer, the parent
+// waits on the threadpool and the child with waitSync like a worker would
+
+(function(){
+    var name = "benchrt"+process.pid;
+    var shared,child;
+    // 0 is the parent's count, 4 the child's answer, 8 says it's ready
+    benchAsync("round trip wait/notify",function(done){
+	var seq = shared.load(0) + 1;
+	shared.store(0,seq);
+	shared.notify(0);
+	(function check(){
+	    var seen = shared.load(4);
+	    if(seen === seq) return done();
+	    shared.wait(4,seen,function(){ check() });
+	})();
+    },200,function(ready){
+	shared = new IPCBuffer(4096,"*"+name);
+	for(var i = 0;i < 12;i++) shared[i] = 0;
+	child = spawn("node",[__dirname+"/bench-child.js",name]);
+	child.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+	(function started(){
+	    if(shared.load(8)) return ready();
+	    shared.wait(8,0,100,function(){ started() });
+	})();
+    },function(){
+	shared.store(0,-1);
+	shared.notify(0);
+	try{ fs.unlinkSync("/dev/shm/"+name) }catch(e){}
+    });
+})();
+
+
+// Checking against a baseline
+
+function load(file){
+    return JSON.parse(fs.readFileSync(file,"utf8")).results;
+}
+
+function compare(file){
+    var old = load(file),
+	byName = {},worse = 0;
+    old.forEach(function(r){ byName[r.name] = r });
+    console.log("\nAgainst "+file+" (median, + is slower)");
+    results.forEach(function(r){
+	var o = byName[r.name];
+	if(!o) return;
+	var change = (r.p50 - o.p50)/o.p50*100;
+	var flag = change > options.threshold ? "  REGRESSION" : "";
+	if(flag) worse++;
+	console.log(pad(r.name,36)+pad(fix(o.p50),12)+pad(fix(r.p50),12)+
+		    (change >= 0 ? "+" : "")+change.toFixed(1)+"%"+flag);
+    });
+    return worse;
+}
+
+function finish(){
+    if(options.json){
+	fs.writeFileSync(options.json,JSON.stringify({
+	    node: process.version,
+	    platform: process.platform,
+	    arch: process.arch,
+	    base64Kernel: ipc._IPCbuffer.base64Kernel,
+	    utf8Kernel: ipc._IPCbuffer.utf8Kernel,
+	    swapKernel: ipc._IPCbuffer.swapKernel,
+	    searchKernel: ipc._IPCbuffer.searchKernel,
+	    hashKernel: ipc._IPCbuffer.hashKernel,
+	    date: new Date().toISOString(),
+	    samples: options.samples,
+	    results: results
+	},null,2));
+    }
+    var worse = options.baseline ? compare(options.baseline) : 0;
+    process.exit(worse ? 1 : 0);
+}
+
+console.log(pad("",36)+pad("p50 us",12)+pad("p90 us",12)+pad("p99 us",12));
+(function next(){
+    var job = queue.shift();
+    if(!job) return finish();
+    job(function(){ setTimeout(next,0) });
+})();
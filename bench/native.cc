@@ -0,0 +1,336 @@
+/*
+ * Microbenchmarks for the native kernels, with no node or V8 in the way.
+ *
+ *   make bench-native
+ *   bench/native [filter] [--json out.json]
+ *
+ * Each kernel is timed first as it runs before the CPU has been looked at,
+ * which is the plain C++, and then with whatever vector code it picked.
+ * The JSON is the same shape bench.js writes, so bench.js --compare can
+ * check one run against another.
+ */
+
+#include "../src/ipcbase64.h"
+#include "../src/ipcutf8.h"
+#include "../src/ipcpool.h"
+#include "../src/ipcswap.h"
+#include "../src/ipcsearch.h"
+#include "../src/ipccopy.h"
+#include "../src/ipchash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+using namespace node;
+
+#define SAMPLES     30
+#define MIN_SAMPLE  10e6    // ns, at least this long per batch
+#define KB          1024
+#define MB          (1024 * 1024)
+
+struct Result {
+  std::string name;
+  double ops, min, p50, p90, p99, max, mean, mbps;
+};
+
+static std::vector<Result> results;
+static const char *filter = NULL;
+static volatile size_t sink;    // Keeps the compiler from dropping the work
+
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static std::string SizeName(size_t n) {
+  char s[32];
+  if (n >= MB) snprintf(s, sizeof(s), "%luM", (unsigned long)(n / MB));
+  else if (n >= KB) snprintf(s, sizeof(s), "%luK", (unsigned long)(n / KB));
+  else snprintf(s, sizeof(s), "%lu", (unsigned long)n);
+  return s;
+}
+
+
+/*
+ * Runs fn() in batches long enough to time and keeps the time per call
+ * of each batch. bytes is what one call gets through, 0 if that means
+ * nothing.
+ */
+template <typename F>
+static void Bench(const std::string &name, size_t bytes, F fn) {
+  if (filter && name.find(filter) == std::string::npos) return;
+
+  double ops = 1, t;
+  for (;;) {
+    t = Now();
+    for (double i = 0; i < ops; i++) fn();
+    t = Now() - t;
+    if (t >= MIN_SAMPLE || ops >= 1e9) break;
+    ops *= t > 0 ? std::min(10.0, MIN_SAMPLE * 1.2 / t + 1) : 10;
+    ops = (double)(long)ops;
+  }
+
+  std::vector<double> samples;
+  for (int s = 0; s < SAMPLES; s++) {
+    t = Now();
+    for (double i = 0; i < ops; i++) fn();
+    samples.push_back((Now() - t) / 1000 / ops);   // us, like bench.js
+  }
+  std::sort(samples.begin(), samples.end());
+
+  Result r;
+  double sum = 0;
+  for (size_t i = 0; i < samples.size(); i++) sum += samples[i];
+  r.name = name;
+  r.ops = ops;
+  r.min = samples[0];
+  r.p50 = samples[SAMPLES * 50 / 100];
+  r.p90 = samples[SAMPLES * 90 / 100];
+  r.p99 = samples[std::min(SAMPLES - 1, SAMPLES * 99 / 100)];
+  r.max = samples[SAMPLES - 1];
+  r.mean = sum / SAMPLES;
+  r.mbps = bytes ? bytes / (double)MB / (r.p50 / 1e6) : 0;
+  results.push_back(r);
+
+  printf("%-36s%-12.3f%-12.3f%-12.3f", name.c_str(), r.p50, r.p90, r.p99);
+  if (bytes) printf("%.1f MB/s", r.mbps);
+  printf("\n");
+}
+
+
+static std::string Text(size_t size, bool multibyte) {
+  const char *chunk = multibyte ? "h\xc3\xa9llo w\xc3\xb6rld \xe2\x82\xac "
+                                : "hello world ";
+  std::string s;
+  while (s.size() < size) s += chunk;
+  s.resize(size);
+  if (multibyte) {
+    // Don't leave half a character on the end
+    size_t end = ipc_utf8_prefix(s.data(), s.size());
+    s.resize(end);
+  }
+  return s;
+}
+
+
+struct Encode {
+  const std::string *src;
+  char *dst;
+  void operator()() { sink += ipc_base64_encode(src->data(), src->size(), dst); }
+};
+
+struct Decode {
+  const char *src;
+  size_t length;
+  char *dst;
+  void operator()() { sink += ipc_base64_decode(src, length, dst, length); }
+};
+
+struct Ascii {
+  const std::string *src;
+  void operator()() { sink += ipc_ascii_prefix(src->data(), src->size()); }
+};
+
+struct Utf8 {
+  const std::string *src;
+  void operator()() { sink += ipc_utf8_prefix(src->data(), src->size()); }
+};
+
+struct Copy {
+  char *src, *dst;
+  size_t length;
+  void operator()() { memcpy(dst, src, length); sink += dst[length - 1]; }
+};
+
+struct Swap {
+  char *src, *dst;
+  size_t count;
+  int width;
+  void operator()() { ipc_swap_copy(dst, src, count, width); sink += dst[0]; }
+};
+
+struct Search {
+  const std::string *hay;
+  const char *needle;
+  void operator()() {
+    sink += ipc_search_first(hay->data(), hay->size(), needle, strlen(needle));
+  }
+};
+
+struct Stream {
+  char *src, *dst;
+  size_t length;
+  void operator()() { ipc_copy_stream(dst, src, length); sink += dst[length - 1]; }
+};
+
+struct Crc {
+  const std::string *src;
+  void operator()() { sink += ipc_crc32c(0, src->data(), src->size()); }
+};
+
+struct Hash {
+  const std::string *src;
+  void operator()() { sink += ipc_hash64(src->data(), src->size(), 0); }
+};
+
+struct PoolAlloc {
+  size_t length;
+  void operator()() {
+    size_t capacity;
+    char *p = ipc_pool_alloc(length, &capacity);
+    p[0] = 1;
+    sink += p[0];
+    ipc_pool_free(p, capacity);
+  }
+};
+
+struct NewDelete {
+  size_t length;
+  void operator()() {
+    char *p = new char[length];
+    p[0] = 1;
+    sink += p[0];
+    delete [] p;
+  }
+};
+
+
+static void Codecs() {
+  size_t sizes[] = { 64 * KB, MB };
+
+  for (int i = 0; i < 2; i++) {
+    size_t size = sizes[i];
+    std::string base64 = std::string(" ") + SizeName(size) + " " +
+                         ipc_base64_kernel();
+    std::string utf8 = std::string(" ") + SizeName(size) + " " +
+                       ipc_utf8_kernel();
+    std::string text = Text(size, false);
+    std::string multi = Text(size, true);
+    std::vector<char> b64(ipc_base64_encoded_size(size));
+    std::vector<char> out(size + 16);
+
+    Encode e = { &text, &b64[0] };
+    Bench("base64 encode" + base64, size, e);
+
+    size_t n = ipc_base64_encode(text.data(), text.size(), &b64[0]);
+    Decode d = { &b64[0], n, &out[0] };
+    Bench("base64 decode" + base64, n, d);
+
+    Ascii a = { &text };
+    Bench("ascii scan" + utf8, size, a);
+
+    Utf8 u = { &multi };
+    Bench("utf8 validate" + utf8, multi.size(), u);
+
+    // Text that's full of the first byte, and the match right at the end
+    std::string request = Text(size - 4, false) + "\r\n\r\n";
+    Search f = { &request, "\r\n\r\n" };
+    Bench("search" + std::string(" ") + SizeName(size) + " " +
+          ipc_search_kernel(), size, f);
+    Search w = { &request, "world\r" };
+    Bench("search first byte common" + std::string(" ") + SizeName(size) +
+          " " + ipc_search_kernel(), size, w);
+
+    Crc c = { &text };
+    Bench("crc32c " + SizeName(size) + " " + ipc_hash_kernel(), size, c);
+
+    std::vector<char> words(size);
+    for (int width = 2; width <= 8; width *= 2) {
+      char name[32];
+      snprintf(name, sizeof(name), "bswap%d", width * 8);
+      Swap s = { &words[0], &out[0], size / width, width };
+      Bench(name + std::string(" ") + SizeName(size) + " " +
+            ipc_swap_kernel(), size, s);
+    }
+  }
+}
+
+
+static void WriteJson(const char *file) {
+  FILE *f = fopen(file, "w");
+  if (f == NULL) {
+    perror(file);
+    exit(2);
+  }
+  fprintf(f, "{\n  \"native\": true,\n  \"base64Kernel\": \"%s\",\n"
+             "  \"utf8Kernel\": \"%s\",\n  \"swapKernel\": \"%s\",\n"
+             "  \"searchKernel\": \"%s\",\n  \"hashKernel\": \"%s\",\n"
+             "  \"samples\": %d,\n  \"results\": [\n",
+          ipc_base64_kernel(), ipc_utf8_kernel(), ipc_swap_kernel(),
+          ipc_search_kernel(), ipc_hash_kernel(), SAMPLES);
+  for (size_t i = 0; i < results.size(); i++) {
+    Result &r = results[i];
+    fprintf(f, "    { \"name\": \"%s\", \"ops\": %.0f, \"samples\": %d, "
+               "\"unit\": \"us/op\", \"min\": %g, \"p50\": %g, \"p90\": %g, "
+               "\"p99\": %g, \"max\": %g, \"mean\": %g",
+            r.name.c_str(), r.ops, SAMPLES, r.min, r.p50, r.p90, r.p99,
+            r.max, r.mean);
+    if (r.mbps) fprintf(f, ", \"mbps\": %g", r.mbps);
+    fprintf(f, " }%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+}
+
+
+int main(int argc, char **argv) {
+  const char *json = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+      json = argv[++i];
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  printf("%-36s%-12s%-12s%-12s\n", "", "p50 us", "p90 us", "p99 us");
+
+  Codecs();
+  ipc_base64_init();
+  ipc_utf8_init();
+  ipc_swap_init();
+  ipc_search_init();
+  ipc_copy_init();
+  ipc_hash_init();
+  Codecs();
+
+  size_t copies[] = { 4 * KB, 64 * KB, MB, 16 * MB, 256 * MB };
+  for (int i = 0; i < 5; i++) {
+    std::vector<char> src(copies[i], 1), dst(copies[i]);
+    Copy c = { &src[0], &dst[0], copies[i] };
+    Bench("memcpy " + SizeName(copies[i]), copies[i], c);
+    if (copies[i] >= MB) {
+      Stream st = { &src[0], &dst[0], copies[i] };
+      Bench("stream " + SizeName(copies[i]) + " " + ipc_copy_kernel(),
+            copies[i], st);
+    }
+  }
+
+  // No vector kernel to compare it with, so just the once
+  size_t hashes[] = { 64 * KB, MB };
+  for (int i = 0; i < 2; i++) {
+    std::string text = Text(hashes[i], false);
+    Hash h = { &text };
+    Bench("hash64 " + SizeName(hashes[i]), hashes[i], h);
+  }
+
+  size_t blocks[] = { 256, 4 * KB, 64 * KB };
+  for (int i = 0; i < 3; i++) {
+    PoolAlloc p = { blocks[i] };
+    Bench("pool alloc/free " + SizeName(blocks[i]), 0, p);
+    NewDelete n = { blocks[i] };
+    Bench("new/delete " + SizeName(blocks[i]), 0, n);
+  }
+
+  if (json) WriteJson(json);
+  return 0;
+}
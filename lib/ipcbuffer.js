@@ -1,5 +1,12 @@
 
-var _IPCbuffer = require(__dirname+"/_ipcbuffer")._IPCbuffer;
+var fs = require('fs');
+var binding = require(__dirname+"/_ipcbuffer");
+var _IPCbuffer = binding._IPCbuffer;
+var _IPCring = binding._IPCring;
+var _IPCqueue = binding._IPCqueue;
+var _IPCheap = binding._IPCheap;
+var _IPCtable = binding._IPCtable;
+var _IPCsnapshot = binding._IPCsnapshot;
 
 function toHex(n) {
   if (n < 16) return '0' + n.toString(16);
@@ -95,10 +102,19 @@ _IPCbuffer.prototype.slice = function(start, end) {
 
 function Buffer(subject, encoding, offset, ipc) {
   if (!(this instanceof Buffer)) {
-    return new Buffer(subject, encoding, offset, ipc);
+    // Keep the argument count, the parsing below depends on it
+    var b = Object.create(Buffer.prototype);
+    Buffer.apply(b, arguments);
+    return b;
   }
 
-  var type,pages,free;
+  var type,pages,free,options,argc = arguments.length;
+
+  // An options object can go on the end of any of the forms below
+  if (argc > 1 && isOptions(arguments[argc - 1])) {
+    options = arguments[--argc];
+    arguments[argc] = undefined;
+  }
   if (subject instanceof Buffer) {
     this.parent = subject;
   } else if (subject instanceof Array) {
@@ -122,21 +138,21 @@ function Buffer(subject, encoding, offset, ipc) {
     }else{
       this.ipc = encoding;	// This is an IPC filename
     }
-  } else if (arguments.length > 1) {
+  } else if (argc > 1) {
     throw new Error("Argument 2 needs to be a number(Offset or ipc key) "
 		    +"or string(Encoding or ipc filename).");
   }
   if (((type = typeof(offset)) === "number") && (subject instanceof Buffer)) {
       this.offset = offset;
-  } else if (((type === "string") || (type === "number")) && arguments.length === 3) {
+  } else if (((type === "string") || (type === "number")) && argc === 3) {
       this.ipc = offset;
-  } else if (arguments.length > 2) {
+  } else if (argc > 2) {
     throw new Error("Argument 3 needs to be a number(Offset or ipc key) "
 		    +"or string(ipc filename).");
   }
   if (((type = typeof(ipc)) === "number") || (type === "string")) {
     this.ipc = ipc;
-  } else if(arguments.length > 3) {
+  } else if(argc > 3) {
     throw new Error("Argument 4 needs to be a number(ipc key) "
 		    +"or string(ipc filename).");
   }
@@ -144,9 +160,12 @@ function Buffer(subject, encoding, offset, ipc) {
     this.length = Buffer.byteLength(subject,encoding);
   }
 
-  if (this.ipc) {
-      this.parent = new _IPCbuffer(this.length,this.ipc);
+  var how = 'whole';
+  if (this.ipc || options) {
+      this.parent = new _IPCbuffer(this.length,this.ipc,options);
       this.offset = 0;
+      this.length = this.parent.length;	// { fd: n } can leave it to the fd
+      this.PageSize = this.parent.pageSize;
   } else if (this.length > Buffer.poolSize) {
     // Big buffer, just alloc one.
     this.parent = new _IPCbuffer(this.length, this.ipc);
@@ -157,6 +176,7 @@ function Buffer(subject, encoding, offset, ipc) {
     this.parent = pool;
     this.offset = pool.used;
     pool.used += this.length;
+    how = 'pooled';
   }
 
   // Assume object is an array
@@ -170,20 +190,115 @@ function Buffer(subject, encoding, offset, ipc) {
   }
 
 
-  _IPCbuffer.makeFastBuffer(this.parent, this, this.offset, this.length);
+  _IPCbuffer.makeFastBuffer(this.parent, this, this.offset, this.length,
+                            how);
 }
 
-Buffer.prototype.PageSize = 4096;	// OS/Hardware dependant
+Buffer.prototype.PageSize = _IPCbuffer.pageSize;	// OS/Hardware dependant
+
+// Buffer.open(length, [ipc], [options], [callback]) - new Buffer(length,
+// ipc, options) without blocking. Opening, sizing, mapping and populate
+// happen on the threadpool, then callback(err, buffer). Leave out the
+// callback and it returns a promise of the buffer, where there are
+// promises.
+Buffer.open = function(length, ipc, options, callback) {
+  if (typeof(ipc) === "function") {
+    callback = ipc;
+    ipc = options = undefined;
+  } else if (typeof(options) === "function") {
+    callback = options;
+    options = undefined;
+  }
+  if (isOptions(ipc)) {
+    options = ipc;
+    ipc = undefined;
+  }
+  if (!callback) {
+    if (typeof(Promise) !== "function") {
+      throw new TypeError("Buffer.open needs a callback");
+    }
+    return new Promise(function(resolve, reject) {
+      Buffer.open(length, ipc, options, function(err, b) {
+        if (err) return reject(err);
+        resolve(b);
+      });
+    });
+  }
+
+  var parent;
+  try {
+    parent = new _IPCbuffer(length, ipc, options || {}, function(err) {
+      if (err) return callback(err);
+      var b = fastView(parent, 0, parent.length, 'whole');
+      b.PageSize = parent.pageSize;
+      callback(null, b);
+    });
+  } catch (e) {
+    // Bad arguments, still only ever reported through the callback
+    process.nextTick(function() { callback(e); });
+  }
+};
+
+// Anything else that's an object on the end of the arguments is options
+function isOptions(o) {
+  return o !== null && typeof(o) === "object" && !Array.isArray(o) &&
+         !(o instanceof Buffer) && !(o instanceof _IPCbuffer);
+}
 
 Buffer.poolSize = 8 * 1024;
 var pool;
 
+// Buffer.pool({ slab: bytes, cache: bytes, maxBlock: bytes })
+// slab is what small Buffers are carved out of, same as poolSize. Native
+// memory for in process buffers up to maxBlock is recycled by size, and up
+// to cache bytes of it are kept on hand. Trim with cache: 0.
+Buffer.pool = function(options) {
+  options = options || {};
+  if (options.slab !== undefined) {
+    Buffer.poolSize = options.slab;
+    pool = undefined;
+  }
+  _IPCbuffer.poolConfig(options.cache, options.maxBlock);
+};
+
+// How well the native pool is doing, to size it by
+Buffer.poolStats = function() {
+  return _IPCbuffer.poolStats();
+};
+
+// Counts for every buffer in the process: how many of each backing were
+// made, how long that took and how many are left, bytes through each
+// encoding, copies, flushes and resizes
+Buffer.stats = function() {
+  return _IPCbuffer.stats();
+};
+
+// stats() - the same for this buffer's memory, slices included, and how
+// much of it is resident
+Buffer.prototype.stats = function() {
+  return this.parent.stats();
+};
+
 function allocPool() {
   pool = new _IPCbuffer(Buffer.poolSize,null);
   pool.used = 0;
 }
 
 
+// A Buffer looking straight at part of an _IPCbuffer. Nothing is copied.
+// Unless it's the 'whole' Buffer for a new parent the parent can't move
+// any more.
+function fastView(parent, offset, length, how) {
+  var b = Object.create(Buffer.prototype);
+  b.parent = parent;
+  b.offset = offset;
+  b.length = length;
+  b.encoding = "utf8";
+  _IPCbuffer.makeFastBuffer(parent, b, offset, length, how);
+  return b;
+}
+
+
 // Static methods
 Buffer.isBuffer = function isBuffer(b) {
   return b instanceof Buffer || b instanceof _IPCbuffer;
@@ -257,8 +372,9 @@ Buffer.prototype.write = function(string, offset, encoding) {
 };
 
 
-// toString(encoding, start=0, end=buffer.length)
-Buffer.prototype.toString = function(encoding, start, end) {
+// toString(encoding, start=0, end=buffer.length, [strict])
+// strict makes bad UTF-8 throw rather than quietly turn into U+FFFD
+Buffer.prototype.toString = function(encoding, start, end, strict) {
   encoding = String(encoding || 'utf8').toLowerCase();
 
   if (start === undefined || !start || start < 0) {
@@ -279,7 +395,7 @@ Buffer.prototype.toString = function(encoding, start, end) {
   switch (encoding) {
     case 'utf8':
     case 'utf-8':
-      return this.parent.utf8Slice(start, end);
+      return this.parent.utf8Slice(start, end, strict, this.offset);
 
     case 'ascii':
       return this.parent.asciiSlice(start, end);
@@ -296,6 +412,80 @@ Buffer.prototype.toString = function(encoding, start, end) {
 };
 
 
+// sharedString([start], [end]) - a string that is the bytes in the buffer
+// rather than a copy of them, if they're ASCII in a segment sealed read
+// only. Anything else is copied. Keeps the buffer alive.
+Buffer.prototype.sharedString = function(start, end) {
+  start = +start || 0;
+  if (end === undefined) end = this.length;
+  if (start > end || end > this.length) throw new Error('oob');
+
+  return this.parent.sharedSlice(this.offset + start, this.offset + end);
+};
+
+
+// utf8Check([start], [end]) - where the bytes stop being valid UTF-8, or -1
+Buffer.prototype.utf8Check = function(start, end) {
+  start = +start || 0;
+  if (end === undefined) end = this.length;
+  if (start > end || end > this.length) throw new Error('oob');
+
+  var bad = this.parent.utf8Check(this.offset + start, this.offset + end);
+  return bad < 0 ? bad : bad - this.offset;
+};
+
+
+// writeMany([[string, offset, encoding], ...]) - a whole record of fields
+// in one call. Leave out an offset and the field goes straight after the
+// one before, the encoding defaults to utf8. Returns [offset, length, ...],
+// where each one went and how many bytes it took.
+Buffer.prototype.writeMany = function(items) {
+  return this.parent.writeMany(items, this.offset, this.offset + this.length);
+};
+
+
+// sliceMany(ranges, [encoding]) - strings for a list of ranges in one call,
+// ranges as [start, end, start, end, ...] or [[start, end], ...]
+Buffer.prototype.sliceMany = function(ranges, encoding) {
+  if (ranges.length && Array.isArray(ranges[0])) {
+    var flat = new Array(ranges.length * 2);
+    for (var i = 0; i < ranges.length; i++) {
+      flat[i * 2] = ranges[i][0];
+      flat[i * 2 + 1] = ranges[i][1];
+    }
+    ranges = flat;
+  }
+  return this.parent.sliceMany(ranges, encoding || 'utf8', this.offset,
+                               this.offset + this.length);
+};
+
+
+// crc32c([start], [end], [crc], [callback]) - CRC-32C of the range, crc
+// carrying on from an earlier one. With a callback it's done on the
+// threadpool, callback(err, crc), and big ranges are split between threads.
+Buffer.prototype.crc32c = function(start, end, crc, callback) {
+  return checksum(this, 'crc32c', arguments);
+};
+
+
+// hash64([start], [end], [seed], [callback]) - XXH64 of the range, as 16 hex
+// digits. With a callback it's done on the threadpool, callback(err, hash).
+Buffer.prototype.hash64 = function(start, end, seed, callback) {
+  return checksum(this, 'hash64', arguments);
+};
+
+
+function checksum(b, method, args) {
+  args = Array.prototype.slice.call(args);
+  var callback = typeof(args[args.length - 1]) === 'function'
+               ? args.pop() : undefined;
+  var start = +args[0] || 0,
+      end = args[1] === undefined ? b.length : +args[1];
+  if (start < 0 || start > end || end > b.length) throw new Error('oob');
+  return b.parent[method](start + b.offset, end + b.offset, args[2], callback);
+}
+
+
 // byteLength
 Buffer.byteLength = _IPCbuffer.byteLength;
 
@@ -341,6 +531,464 @@ Buffer.prototype.copy = function(target, target_start, start, end) {
 };
 
 
+// copyAsync(targetBuffer, [targetStart], [sourceStart], [sourceEnd], callback)
+// Copies on the threadpool, a big copy split across all of it, then
+// callback(err, copied). Neither buffer can be resized meanwhile.
+Buffer.prototype.copyAsync = function(target) {
+  var args = Array.prototype.slice.call(arguments, 1);
+  var callback = args.pop();
+  var target_start = args[0] || 0,
+      start = args[1] || 0,
+      end = args[2] || this.length;
+
+  if (typeof(callback) !== 'function') {
+    throw new TypeError('Callback required');
+  }
+  if (end < start) throw new Error('sourceEnd < sourceStart');
+
+  if (end > start && target.length && this.length) {
+    if (target_start < 0 || target_start >= target.length) {
+      throw new Error('targetStart out of bounds');
+    }
+    if (start < 0 || start >= this.length) {
+      throw new Error('sourceStart out of bounds');
+    }
+    if (end > this.length) throw new Error('sourceEnd out of bounds');
+    if (target.length - target_start < end - start) {
+      end = target.length - target_start + start;
+    }
+  } else {
+    end = start = target_start = 0;
+  }
+
+  this.parent.copyAsync(target.parent || target,
+                        target_start + (target.offset || 0),
+                        start + this.offset,
+                        end + this.offset,
+                        callback);
+};
+
+
+// copyConfig({streamThreshold: n}) - copies of n bytes or more use
+// non-temporal stores and don't go through the cache. 0 is the default,
+// half the last level cache. Returns the settings.
+Buffer.copyConfig = function(options) {
+  return _IPCbuffer.copyConfig((options || {}).streamThreshold);
+};
+
+
+// fill(value, [start], [end]) - value is a byte, or a string that's
+// repeated over the range
+Buffer.prototype.fill = function(value, start, end) {
+  value || (value = 0);
+  start || (start = 0);
+  if (end === undefined) end = this.length;
+
+  if (end < start) throw new Error('end < start');
+  if (start < 0 || end > this.length) throw new Error('oob');
+
+  if (end > start) {
+    this.parent.fill(value, start + this.offset, end + this.offset);
+  }
+  return this;
+};
+
+
+// compare(other, [otherStart], [otherEnd], [start], [end]) - -1, 0 or 1,
+// other can be any Buffer, shared or not
+Buffer.prototype.compare = function(other, other_start, other_end,
+                                    start, end) {
+  start || (start = 0);
+  if (end === undefined) end = this.length;
+  if (start > end || end > this.length) throw new Error('oob');
+  return this.parent.compare(other, start + this.offset, end + this.offset,
+                             other_start, other_end);
+};
+
+Buffer.compare = function(a, b) {
+  return a.compare(b);
+};
+
+
+// equals(other) - the same bytes
+Buffer.prototype.equals = function(other) {
+  return this.parent.equals(other, this.offset, this.offset + this.length);
+};
+
+
+// indexOf(value, [from]) - where a byte, string or Buffer first is, or -1.
+// A negative from counts back from the end.
+Buffer.prototype.indexOf = function(value, from) {
+  from = +from || 0;
+  if (from < 0) from = Math.max(0, this.length + from);
+  return this.parent.indexOf(value, Math.min(from, this.length),
+                             this.offset, this.offset + this.length);
+};
+
+
+// lastIndexOf(value, [from]) - the last one starting at from or before
+Buffer.prototype.lastIndexOf = function(value, from) {
+  from = from === undefined ? this.length : +from || 0;
+  if (from < 0) from = this.length + from;
+  if (from < 0) return -1;
+  return this.parent.lastIndexOf(value, Math.min(from, this.length),
+                                 this.offset, this.offset + this.length);
+};
+
+
+// wait(offset, expected, [timeoutMs], callback)
+// Sleeps on the threadpool until notify() or the int32 at offset changes,
+// holding one of its threads all that time.
+// callback(err, "ok" | "not-equal" | "timed-out")
+Buffer.prototype.wait = function(offset, expected, timeout, callback) {
+  if (typeof(timeout) === "function") {
+    callback = timeout;
+    timeout = undefined;
+  }
+  checkRange(this, offset, 4);
+  return this.parent.wait(this.offset + offset, expected, timeout, callback);
+};
+
+
+// waitSync(offset, expected, [timeoutMs]) - blocks the event loop
+Buffer.prototype.waitSync = function(offset, expected, timeout) {
+  checkRange(this, offset, 4);
+  return this.parent.waitSync(this.offset + offset, expected, timeout);
+};
+
+
+// notify(offset, [count]) - wake up to count waiters, returns how many woke
+Buffer.prototype.notify = function(offset, count) {
+  checkRange(this, offset, 4);
+  return this.parent.notify(this.offset + offset, count);
+};
+
+
+// advise(advice, [start], [end]) - "normal", "sequential", "random",
+// "willneed" or "dontneed" for that part of the buffer
+Buffer.prototype.advise = function(advice, start, end) {
+  start = +start || 0;
+  if (end === undefined) end = this.length;
+  if (start > end || end > this.length) throw new Error('oob');
+
+  this.parent.advise(advice, this.offset + start, this.offset + end);
+};
+
+
+// prefault([start], [end], [callback]) - fault the pages in now. With a
+// callback it's done on the threadpool and callback(err) when it's done.
+Buffer.prototype.prefault = function(start, end, callback) {
+  if (typeof(start) === "function") {
+    callback = start;
+    start = undefined;
+  } else if (typeof(end) === "function") {
+    callback = end;
+    end = undefined;
+  }
+  start = +start || 0;
+  if (end === undefined) end = this.length;
+  if (start > end || end > this.length) throw new Error('oob');
+
+  if (callback) {
+    this.parent.prefault(this.offset + start, this.offset + end, callback);
+  } else {
+    this.parent.prefault(this.offset + start, this.offset + end);
+  }
+};
+
+
+// flush([start], [end], callback) - write a file backed buffer back to
+// disk on the threadpool, callback(err) once it's there. Without a range
+// the whole file goes, or with the trackDirty option only the pages written
+// since the last flush.
+Buffer.prototype.flush = function(start, end, callback) {
+  if (typeof(start) === "function") {
+    callback = start;
+    start = undefined;
+  } else if (typeof(end) === "function") {
+    callback = end;
+    end = undefined;
+  }
+  if (start === undefined) {
+    if (this.offset === 0 && this.length === this.parent.length) {
+      return this.parent.flush(callback);
+    }
+    start = 0;
+  }
+  start = +start || 0;
+  if (end === undefined) end = this.length;
+  if (start > end || end > this.length) throw new Error('oob');
+
+  this.parent.flush(this.offset + start, this.offset + end, callback);
+};
+
+
+// flushSync([start], [end])
+Buffer.prototype.flushSync = function(start, end) {
+  if (start === undefined &&
+      this.offset === 0 && this.length === this.parent.length) {
+    return this.parent.flushSync();
+  }
+  start = +start || 0;
+  if (end === undefined) end = this.length;
+  if (start > end || end > this.length) throw new Error('oob');
+
+  this.parent.flushSync(this.offset + start, this.offset + end);
+};
+
+
+// markDirty([start], [end]) - for writes a trackDirty buffer can't see,
+// buff[i] = x
+Buffer.prototype.markDirty = function(start, end) {
+  start = +start || 0;
+  if (end === undefined) end = this.length;
+  if (start > end || end > this.length) throw new Error('oob');
+
+  this.parent.markDirty(this.offset + start, this.offset + end);
+};
+
+
+// resize(newLength, [sizeWord]) - grow or shrink the buffer without copying
+// it. Only a Buffer that is the whole of its parent can. Once it's been
+// sliced, or anything like a ring's peek() has handed out a view of it, the
+// memory stays where it is for good, so it can only grow in place and
+// throws if it can't. Whether the slices are still about doesn't matter,
+// that's up to the GC and this shouldn't be. With sizeWord the new length is stored
+// as an int32 at that offset and anyone wait()ing on it woken, for the
+// other processes to remap(sizeWord).
+Buffer.prototype.resize = function(length, sizeWord) {
+  whole(this, 'resized');
+  if (sizeWord !== undefined) sizeWordFits(this, sizeWord, length);
+  this.parent.resize(length);
+  refit(this);
+  if (sizeWord !== undefined) {
+    this.store(sizeWord, length);
+    this.notify(sizeWord);
+  }
+  return this.length;
+};
+
+
+// remap([sizeWord]) - catch up after another process resized the segment,
+// to the length it stored at sizeWord or else the size of the segment
+Buffer.prototype.remap = function(sizeWord) {
+  whole(this, 'remapped');
+  var length;
+  if (sizeWord !== undefined) {
+    sizeWordFits(this, sizeWord, this.length);
+    length = this.load(sizeWord) >>> 0;
+  }
+  this.parent.remap(length);
+  return refit(this);
+};
+
+
+function whole(b, what) {
+  if (b.offset !== 0 || b.length !== b.parent.length) {
+    throw new Error('Only a whole buffer can be ' + what);
+  }
+}
+
+
+function sizeWordFits(b, sizeWord, length) {
+  if (sizeWord < 0 || sizeWord % 4 ||
+      sizeWord + 4 > Math.min(b.length, length)) {
+    throw new Error('sizeWord has to be an aligned int32 inside the buffer');
+  }
+}
+
+
+function refit(b) {
+  b.length = b.parent.length;
+  _IPCbuffer.makeFastBuffer(b.parent, b, 0, b.length, 'refit');
+  return b.length;
+}
+
+
+// memfd segments, new Buffer(length, "&label"). They have no name anyone
+// else can open, the fd is handed over instead.
+
+// fd([inheritable]) - inheritable lets spawned children have it too
+Buffer.prototype.fd = function(inheritable) {
+  return this.parent.fd(inheritable);
+};
+
+
+// seal([readOnly]) - no more resizing, and with readOnly no more writing.
+// Read only it's mapped PROT_READ, in here and in every process that has
+// it. write(), fill(), copy() into it, the atomics and the rest throw, but
+// buff[i] = x goes straight to the memory and THE PROCESS SEGFAULTS. There's
+// no catching that, so nothing may index-assign into a sealed buffer, and
+// that goes for anything built on one too.
+Buffer.prototype.seal = function(readOnly) {
+  this.parent.seal(readOnly);
+  return this;
+};
+
+
+// A sealed segment can be read in place, nobody can change it underneath
+Buffer.prototype.isSealed = function() {
+  return this.parent.sealed === true;
+};
+
+
+// sendFd(socketFd) - over a unix socket, to a Buffer.receive() at the
+// other end
+Buffer.prototype.sendFd = function(socketFd) {
+  this.parent.sendFd(socketFd);
+};
+
+
+// Buffer.receive(socket, [options], callback) - callback(err, buffer)
+// for the next segment sent down the socket. socket is a file descriptor
+// node isn't reading, or a net.Socket, which is paused till it's arrived
+// so libuv doesn't read the message first.
+Buffer.receive = function(socket, options, callback) {
+  if (typeof(options) === "function") {
+    callback = options;
+    options = undefined;
+  }
+  var socketFd = socket, paused = false;
+  if (socket && socket._handle) {
+    socketFd = socket._handle.fd;
+    socket.pause();
+    paused = true;
+  }
+  _IPCbuffer.receiveFd(socketFd, function(err, fd, length) {
+    if (paused) socket.resume();
+    if (err) return callback(err);
+
+    var o = {}, b;
+    for (var k in options) o[k] = options[k];
+    o.fd = fd;
+    try {
+      b = new Buffer(length, o);
+    } catch (e) {
+      err = e;
+    }
+    fs.closeSync(fd);	// The mapping keeps its own
+    callback(err, b);
+  });
+};
+
+
+// Atomics. bits is 32 (default, signed) or 64, order is one of 'relaxed',
+// 'acquire', 'release', 'acq_rel' or 'seq_cst' (default).
+
+// The offset has to be inside this Buffer, not just inside its parent
+function checkAtomic(b, offset, bits) {
+  checkRange(b, offset, bits == 64 ? 8 : 4);
+}
+
+// load(offset, [bits], [order])
+Buffer.prototype.load = function(offset, bits, order) {
+  checkAtomic(this, offset, bits);
+  return this.parent.load(this.offset + offset, bits, order);
+};
+
+// store(offset, value, [bits], [order])
+Buffer.prototype.store = function(offset, value, bits, order) {
+  checkAtomic(this, offset, bits);
+  return this.parent.store(this.offset + offset, value, bits, order);
+};
+
+// exchange(offset, value, [bits], [order]) - returns the old value
+Buffer.prototype.exchange = function(offset, value, bits, order) {
+  checkAtomic(this, offset, bits);
+  return this.parent.exchange(this.offset + offset, value, bits, order);
+};
+
+// fetchAdd(offset, value, [bits], [order]) - returns the old value
+Buffer.prototype.fetchAdd = function(offset, value, bits, order) {
+  checkAtomic(this, offset, bits);
+  return this.parent.fetchAdd(this.offset + offset, value, bits, order);
+};
+
+// fetchOr(offset, value, [bits], [order]) - returns the old value
+Buffer.prototype.fetchOr = function(offset, value, bits, order) {
+  checkAtomic(this, offset, bits);
+  return this.parent.fetchOr(this.offset + offset, value, bits, order);
+};
+
+// compareExchange(offset, expected, desired, [bits], [order])
+// returns the old value, it worked if that was expected
+Buffer.prototype.compareExchange = function(offset, expected, desired,
+                                            bits, order) {
+  checkAtomic(this, offset, bits);
+  return this.parent.compareExchange(this.offset + offset, expected, desired,
+                                     bits, order);
+};
+
+
+// Numbers. readUInt8(offset) through readDoubleBE(offset), and
+// writeUInt8(value, offset) and so on, for every type in numberTypes. 64 bit
+// integers come back as Numbers, exact up to 2^53. Writes return the offset
+// after the value.
+var numberTypes = _IPCbuffer.numberTypes;
+Buffer.numberTypes = Object.keys(numberTypes);
+
+// The typed array that holds each type, where there is one
+var arrayTypes = {
+  UInt8: 'Uint8Array', Int8: 'Int8Array',
+  UInt16: 'Uint16Array', Int16: 'Int16Array',
+  UInt32: 'Uint32Array', Int32: 'Int32Array',
+  Float: 'Float32Array', Double: 'Float64Array'
+};
+
+function numberType(name) {
+  var type = numberTypes[name];
+  if (type === undefined) throw new TypeError('Unknown number type ' + name);
+  return type;
+}
+
+function checkRange(b, offset, bytes) {
+  if (offset !== offset >>> 0 || offset + bytes > b.length) {
+    throw new RangeError('Trying to access beyond buffer length');
+  }
+}
+
+Buffer.numberTypes.forEach(function(name) {
+  var type = numberTypes[name], width = type & 0x0F;
+
+  Buffer.prototype['read' + name] = function(offset) {
+    checkRange(this, offset, width);
+    return this.parent.readNumber(this.offset + offset, type);
+  };
+
+  Buffer.prototype['write' + name] = function(value, offset) {
+    checkRange(this, offset, width);
+    return this.parent.writeNumber(this.offset + offset, value, type) -
+           this.offset;
+  };
+});
+
+
+// readArray(type, offset, count) - count numbers in one call, as a typed
+// array where there's one for the type and a plain array otherwise.
+// readArray(type, offset, array) fills array instead.
+Buffer.prototype.readArray = function(type, offset, count) {
+  var code = numberType(type), array = count;
+  if (typeof(count) === 'number') {
+    var TypedArray = global[arrayTypes[type.replace(/[LB]E$/, '')]];
+    array = TypedArray ? new TypedArray(count) : new Array(count);
+  } else {
+    count = array.length;
+  }
+  checkRange(this, offset, count * (code & 0x0F));
+  return this.parent.readArray(this.offset + offset, code, array, count);
+};
+
+
+// writeArray(type, offset, array) - all of array, a typed or plain one.
+// Returns the offset after the last.
+Buffer.prototype.writeArray = function(type, offset, array) {
+  var code = numberType(type);
+  checkRange(this, offset, array.length * (code & 0x0F));
+  return this.parent.writeArray(this.offset + offset, code, array,
+                                array.length) - this.offset;
+};
+
+
 // slice(start, end)
 Buffer.prototype.slice = function(start, end) {
   if (end === undefined) end = this.length;
@@ -377,5 +1025,351 @@ Buffer.prototype.asciiWrite = function(string, offset) {
   return this.write(string, offset, 'ascii');
 };
 
+// Where a shared structure lives: an _IPCbuffer, a Buffer, or a length and
+// ipc name for a new Buffer. Sets self.parent, self.offset and self.buffer.
+// Returns true if it was handed a buffer, when ipc isn't a name and the
+// structure can take it as its next argument instead.
+function attach(self, subject, ipc) {
+  var given = subject instanceof _IPCbuffer || subject instanceof Buffer;
+
+  if (subject instanceof _IPCbuffer) {
+    self.parent = subject;
+    self.offset = 0;
+  } else {
+    if (!given) subject = new Buffer(subject, ipc);
+    self.parent = subject.parent;
+    self.offset = subject.offset;
+  }
+  self.buffer = subject;
+  return given;
+}
+
+// Ring
+// Single producer/single consumer queue of records between two processes.
+// Ring(length, ipc) or Ring(buffer) to lay it over an existing buffer.
+
+function Ring(subject, ipc) {
+  if (!(this instanceof Ring)) {
+    return new Ring(subject, ipc);
+  }
+
+  attach(this, subject, ipc);
+  this.ring = new _IPCring(this.parent, this.offset, this.buffer.length);
+  this.capacity = this.ring.capacity;
+}
+
+
+// push(data, encoding = 'utf8'), false if the ring is full
+Ring.prototype.push = function(data, encoding) {
+  if (typeof(data) === "string") {
+    encoding = String(encoding || 'utf8').toLowerCase();
+    switch (encoding) {
+      case 'utf8':
+      case 'utf-8':
+      case 'ascii':
+      case 'binary':
+        return this.ring.pushString(data, encoding);
+
+      default:
+        data = new Buffer(data, encoding);
+    }
+  }
+
+  if (data instanceof _IPCbuffer) {
+    return this.ring.push(data, 0, data.length);
+  }
+  return this.ring.push(data.parent, data.offset, data.offset + data.length);
+};
+
+
+// peek() - the oldest record in place, or null. Valid until consume().
+Ring.prototype.peek = function() {
+  var at = this.ring.peek();
+  if (at < 0) return null;
+
+  return fastView(this.parent, at, _IPCring._recordLength);
+};
+
+
+Ring.prototype.consume = function() {
+  this.ring.consume();
+};
+
+
+// pop(encoding) - a string if an encoding is given, otherwise a Buffer copy
+Ring.prototype.pop = function(encoding) {
+  var view, ret;
+
+  if (encoding) {
+    encoding = String(encoding).toLowerCase();
+    if (encoding !== 'base64') {
+      return this.ring.popString(encoding);
+    }
+  }
+
+  if (!(view = this.peek())) return null;
+
+  if (encoding) {
+    ret = view.toString(encoding);
+  } else {
+    ret = new Buffer(view.length);
+    view.copy(ret, 0, 0);
+  }
+  this.ring.consume();
+
+  return ret;
+};
+
+
+Ring.prototype.size = function() {
+  return this.ring.size();
+};
+
+
+// Queue
+// Bounded many producer/many consumer queue of records for worker pools.
+// Queue(length, ipc, slotSize = 256) or Queue(buffer, slotSize).
+// Strings are queued as utf8, each record has to fit in a slot.
+
+function Queue(subject, ipc, slotSize) {
+  if (!(this instanceof Queue)) {
+    return new Queue(subject, ipc, slotSize);
+  }
+
+  if (attach(this, subject, ipc)) slotSize = ipc;
+  this.queue = new _IPCqueue(this.parent, this.offset, this.buffer.length,
+                             slotSize);
+  this.slots = this.queue.slots;
+  this.maxRecord = this.queue.maxRecord;
+}
+
+
+function fromSlow(record) {
+  if (record instanceof _IPCbuffer) {
+    return fastView(record, 0, record.length);
+  }
+  return record;
+}
+
+
+// enqueue(bufferOrString), false if the queue is full
+Queue.prototype.enqueue = function(data) {
+  return this.queue.enqueue(data);
+};
+
+
+// enqueueMany([bufferOrString, ...]), how many made it in before it filled
+Queue.prototype.enqueueMany = function(list) {
+  return this.queue.enqueueMany(list);
+};
+
+
+// dequeue(encoding) - a string if an encoding is given, otherwise a Buffer
+Queue.prototype.dequeue = function(encoding) {
+  return fromSlow(this.queue.dequeue(encoding));
+};
+
+
+// dequeueMany(max, encoding) - up to max records, maybe none
+Queue.prototype.dequeueMany = function(max, encoding) {
+  var list = this.queue.dequeueMany(max, encoding);
+  if (!encoding) {
+    for (var i = 0; i < list.length; i++) {
+      list[i] = fromSlow(list[i]);
+    }
+  }
+  return list;
+};
+
+
+// Heap
+// Allocator living inside a shared buffer, for every process attached.
+// Heap(length, ipc) or Heap(buffer). Blocks are offsets from the heap.
+
+function Heap(subject, ipc) {
+  if (!(this instanceof Heap)) {
+    return new Heap(subject, ipc);
+  }
+
+  attach(this, subject, ipc);
+  this.heap = new _IPCheap(this.parent, this.offset, this.buffer.length);
+}
+
+
+// alloc(size) - offset of the new block, null if the heap is full
+Heap.prototype.alloc = function(size) {
+  return this.heap.alloc(size);
+};
+
+
+Heap.prototype.free = function(offset) {
+  this.heap.free(offset);
+};
+
+
+// view(offset, [length]) - a Buffer over the block itself, no copying
+Heap.prototype.view = function(offset, length) {
+  var usable = this.heap.usable(offset);
+  if (length === undefined) length = usable;
+  if (length > usable) throw new Error('oob');
+
+  return fastView(this.parent, this.offset + offset, length);
+};
+
+
+Heap.prototype.used = function() {
+  return this.heap.used();
+};
+
+
+// Table
+// Hash table of keys to values for every process attached, a shared cache.
+// Table(length, ipc, slots) or Table(buffer, slots). Keys and values are
+// strings (utf8) or Buffers.
+
+function Table(subject, ipc, slots) {
+  if (!(this instanceof Table)) {
+    return new Table(subject, ipc, slots);
+  }
+
+  if (attach(this, subject, ipc)) slots = ipc;
+  this.table = new _IPCtable(this.parent, this.offset, this.buffer.length,
+                             slots);
+  this.slots = this.table.slots;
+}
+
+
+// get(key, [encoding]) - a string if an encoding is given, otherwise a
+// Buffer over the value where it sits. null if there's no such key.
+Table.prototype.get = function(key, encoding) {
+  if (encoding) {
+    encoding = String(encoding).toLowerCase();
+    if (encoding === 'utf8' || encoding === 'utf-8') {
+      return this.table.getString(key);
+    }
+  }
+
+  var at = this.table.get(key);
+  if (at < 0) return null;
+
+  var view = fastView(this.parent, at, _IPCtable._valueLength);
+  return encoding ? view.toString(encoding) : view;
+};
+
+
+Table.prototype.has = function(key) {
+  return this.table.get(key) >= 0;
+};
+
+
+// set(key, value), false if the table or its heap is full
+Table.prototype.set = function(key, value) {
+  return this.table.set(key, value);
+};
+
+
+// delete(key), false if it wasn't there
+Table.prototype['delete'] = function(key) {
+  return this.table['delete'](key);
+};
+
+
+Table.prototype.size = function() {
+  return this.table.size();
+};
+
+
+// Snapshot
+// One writer publishing whole versions of a blob to lots of readers, who
+// never see one half written. Snapshot(length, ipc) or Snapshot(buffer).
+// Each version can be up to capacity bytes, a bit under half of length.
+
+function Snapshot(subject, ipc) {
+  if (!(this instanceof Snapshot)) {
+    return new Snapshot(subject, ipc);
+  }
+
+  attach(this, subject, ipc);
+  this.snapshot = new _IPCsnapshot(this.parent, this.offset,
+                                   this.buffer.length);
+  this.capacity = this.snapshot.capacity;
+}
+
+
+// publish(bufferOrString) - the new version number
+Snapshot.prototype.publish = function(data) {
+  return this.snapshot.publish(data);
+};
+
+
+// begin() - a Buffer to build the next version in, then commit(length).
+// Saves a copy when it can be written in place.
+Snapshot.prototype.begin = function() {
+  return fastView(this.parent, this.snapshot.begin(), this.capacity);
+};
+
+
+Snapshot.prototype.commit = function(length) {
+  return this.snapshot.commit(length);
+};
+
+
+// acquire() - the latest version where it sits, null if there's none yet.
+// view.version says which, check valid(view.version) once done with it.
+Snapshot.prototype.acquire = function() {
+  var at = this.snapshot.acquire();
+  if (at < 0) return null;
+
+  var view = fastView(this.parent, at, _IPCsnapshot._length);
+  view.version = _IPCsnapshot._version;
+  return view;
+};
+
+
+// valid(version) - false if the writer has started overwriting it
+Snapshot.prototype.valid = function(version) {
+  return this.snapshot.valid(version);
+};
+
+
+// read(fn) - fn(view, version) until it runs over a version that stayed
+// valid throughout, and whatever it returned that time
+Snapshot.prototype.read = function(fn) {
+  for (;;) {
+    var view = this.acquire();
+    if (!view) return fn(null, 0);
+
+    var ret = fn(view, view.version);
+    if (this.snapshot.valid(view.version)) return ret;
+  }
+};
+
+
+// copy() - the latest version in a Buffer of its own
+Snapshot.prototype.copy = function() {
+  return this.read(function(view) {
+    if (!view) return null;
+    var b = new Buffer(view.length);
+    view.copy(b, 0, 0);
+    return b;
+  });
+};
+
+
+Snapshot.prototype.version = function() {
+  return this.snapshot.version();
+};
+
+
 exports._IPCbuffer = _IPCbuffer;
+exports._IPCring = _IPCring;
+exports._IPCqueue = _IPCqueue;
+exports._IPCheap = _IPCheap;
+exports._IPCtable = _IPCtable;
+exports._IPCsnapshot = _IPCsnapshot;
 exports.Buffer = Buffer;
+exports.Ring = Ring;
+exports.Queue = Queue;
+exports.Heap = Heap;
+exports.Table = Table;
+exports.Snapshot = Snapshot;
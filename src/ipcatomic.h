@@ -0,0 +1,62 @@
+#ifndef NODE_IPCATOMIC_H_
+#define NODE_IPCATOMIC_H_
+
+#include <stdint.h>
+
+namespace node {
+
+/* Thin wrappers over the GCC __atomic builtins for the structures that live
+ * inside a shared segment. Everything in a segment is touched by more than
+ * one process so plain loads and stores are never good enough there; these
+ * keep the memory ordering explicit at every call site.
+ */
+
+#define IPC_CACHELINE 64
+
+#define IPC_RELAXED __ATOMIC_RELAXED
+#define IPC_ACQUIRE __ATOMIC_ACQUIRE
+#define IPC_RELEASE __ATOMIC_RELEASE
+#define IPC_ACQ_REL __ATOMIC_ACQ_REL
+#define IPC_SEQ_CST __ATOMIC_SEQ_CST
+
+template <typename T>
+static inline T ipc_load(const volatile T *p, int order) {
+  return __atomic_load_n(p, order);
+}
+
+template <typename T>
+static inline void ipc_store(volatile T *p, T v, int order) {
+  __atomic_store_n(p, v, order);
+}
+
+template <typename T>
+static inline bool ipc_cas(volatile T *p, T *expected, T desired,
+                           int success, int failure) {
+  return __atomic_compare_exchange_n(p, expected, desired, false,
+                                     success, failure);
+}
+
+template <typename T>
+static inline T ipc_fetch_add(volatile T *p, T v, int order) {
+  return __atomic_fetch_add(p, v, order);
+}
+
+// Orders the plain reads and writes around it, for seqlocks
+static inline void ipc_fence(int order) {
+  __atomic_thread_fence(order);
+}
+
+// Tell the core we are spinning, so a hyperthread sibling can get on
+static inline void ipc_cpu_relax() {
+#if defined(__i386__) || defined(__x86_64__)
+  __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield" ::: "memory");
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+}  // namespace node
+
+#endif  // NODE_IPCATOMIC_H_
@@ -0,0 +1,420 @@
+#include "ipcbase64.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define IPC_BASE64_X86 1
+# include <immintrin.h>
+#elif defined(__aarch64__)
+# define IPC_BASE64_NEON 1
+# include <arm_neon.h>
+#endif
+
+namespace node {
+
+static const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                   "abcdefghijklmnopqrstuvwxyz"
+                                   "0123456789+/";
+
+static const int8_t unbase64_table[] =
+  {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-2,-1,-1,-2,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  ,-2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63
+  ,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1
+  ,-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14
+  ,15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1
+  ,-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40
+  ,41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  };
+#define unbase64(x) unbase64_table[(uint8_t)(x)]
+
+
+/*
+ * The kernels only ever do whole blocks. An encoder returns how many input
+ * bytes it got through, always a multiple of three, and a decoder how many
+ * characters, always a multiple of four, stopping at the first block with
+ * anything but alphabet in it.
+ */
+typedef size_t (*encode_kernel)(const uint8_t *src, size_t length, char *dst);
+typedef size_t (*decode_kernel)(const char *src, size_t length,
+                                uint8_t *dst, size_t room);
+
+static encode_kernel encode_fast = NULL;
+static decode_kernel decode_fast = NULL;
+static const char *kernel_name = "scalar";
+
+
+#ifdef IPC_BASE64_X86
+/*
+ * Wojciech Muła's pshufb method. Bytes are shuffled so each 32 bit lane
+ * holds one triplet, the four 6 bit fields are pulled apart with a pair
+ * of multiplies, and the 0-63 values are turned into characters by adding
+ * an offset looked up from which of the five alphabet ranges they're in.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i EncodeSplit128(__m128i in) {
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                         4, 5, 3, 4, 1, 2, 0, 1));
+  __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i EncodeChars128(__m128i values) {
+  __m128i result = _mm_subs_epu8(values, _mm_set1_epi8(51));
+  __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), values);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                      '/' - 63, 'A', 0, 0);
+  return _mm_add_epi8(_mm_shuffle_epi8(shift, result), values);
+}
+
+// Reads 16 bytes to use 12, so it stops while there are still 4 over
+__attribute__((target("ssse3")))
+static size_t EncodeSSSE3(const uint8_t *src, size_t length, char *dst) {
+  size_t done = 0;
+  while (length - done >= 16) {
+    __m128i in = _mm_loadu_si128((const __m128i*)(src + done));
+    _mm_storeu_si128((__m128i*)dst, EncodeChars128(EncodeSplit128(in)));
+    dst += 16;
+    done += 12;
+  }
+  return done;
+}
+
+
+/*
+ * Classifies each character by its two nibbles; a character is in the
+ * alphabet when the bits looked up for both don't overlap. The value is the
+ * character plus an offset picked by the high nibble, with '/' the only
+ * one that needs telling apart from its neighbours.
+ */
+__attribute__((target("ssse3")))
+static inline bool DecodeValues128(__m128i in, __m128i *values) {
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+                                       0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                       0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                       0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+
+  __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+  __m128i lo = _mm_and_si128(in, nibble);
+  __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo),
+                              _mm_shuffle_epi8(lut_hi, hi));
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xFFFF) {
+    return false;
+  }
+
+  __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+  __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(slash, hi));
+  *values = _mm_add_epi8(in, roll);
+  return true;
+}
+
+// Packs sixteen 6 bit values into the first 12 bytes
+__attribute__((target("ssse3")))
+static inline __m128i DecodePack128(__m128i values) {
+  __m128i ab_bc = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  __m128i out = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                             14, 13, 12, -1, -1, -1, -1));
+}
+
+// Writes 16 bytes to use 12
+__attribute__((target("ssse3")))
+static size_t DecodeSSSE3(const char *src, size_t length,
+                          uint8_t *dst, size_t room) {
+  size_t done = 0;
+  while (length - done >= 16 && room >= 16) {
+    __m128i values;
+    if (!DecodeValues128(_mm_loadu_si128((const __m128i*)(src + done)),
+                         &values)) {
+      break;
+    }
+    _mm_storeu_si128((__m128i*)dst, DecodePack128(values));
+    dst += 12;
+    room -= 12;
+    done += 16;
+  }
+  return done;
+}
+
+
+// The same again, a lane of 12 bytes in each half of a 256 bit register
+__attribute__((target("avx2")))
+static size_t EncodeAVX2(const uint8_t *src, size_t length, char *dst) {
+  const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                          4, 5, 3, 4, 1, 2, 0, 1,
+                                          10, 11, 9, 10, 7, 8, 6, 7,
+                                          4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i shift = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+      '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+      '/' - 63, 'A', 0, 0);
+  size_t done = 0;
+
+  // The second half is loaded from 12 on, so 28 bytes get read for 24
+  while (length - done >= 28) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(src + done));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(src + done + 12));
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    in = _mm256_shuffle_epi8(in, shuffle);
+    __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    __m256i values = _mm256_or_si256(t1, t3);
+
+    __m256i result = _mm256_subs_epu8(values, _mm256_set1_epi8(51));
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), values);
+    result = _mm256_or_si256(result,
+                             _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    result = _mm256_add_epi8(_mm256_shuffle_epi8(shift, result), values);
+
+    _mm256_storeu_si256((__m256i*)dst, result);
+    dst += 32;
+    done += 24;
+  }
+
+  return done + EncodeSSSE3(src + done, length - done, dst);
+}
+
+
+// Writes 32 bytes to use 24
+__attribute__((target("avx2")))
+static size_t DecodeAVX2(const char *src, size_t length,
+                         uint8_t *dst, size_t room) {
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  size_t done = 0;
+
+  while (length - done >= 32 && room >= 32) {
+    __m256i in = _mm256_loadu_si256((const __m256i*)(src + done));
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+    __m256i lo = _mm256_and_si256(in, nibble);
+    __m256i bad = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo),
+                                   _mm256_shuffle_epi8(lut_hi, hi));
+    if (!_mm256_testz_si256(bad, bad)) break;
+
+    __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+    __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(slash, hi));
+    __m256i values = _mm256_add_epi8(in, roll);
+
+    __m256i ab_bc = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i out = _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+    out = _mm256_shuffle_epi8(out, pack);
+    // 12 bytes at the bottom of each lane, close the gap between them
+    out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6,
+                                                            3, 7));
+    _mm256_storeu_si256((__m256i*)dst, out);
+    dst += 24;
+    room -= 24;
+    done += 32;
+  }
+
+  return done + DecodeSSSE3(src + done, length - done, dst, room);
+}
+#endif
+
+
+#ifdef IPC_BASE64_NEON
+// vld3 and vst4 do the shuffling for free, and a 64 byte table lookup does
+// the alphabet in one go
+static size_t EncodeNEON(const uint8_t *src, size_t length, char *dst) {
+  uint8x16x4_t table;
+  table.val[0] = vld1q_u8((const uint8_t*)base64_table);
+  table.val[1] = vld1q_u8((const uint8_t*)base64_table + 16);
+  table.val[2] = vld1q_u8((const uint8_t*)base64_table + 32);
+  table.val[3] = vld1q_u8((const uint8_t*)base64_table + 48);
+  const uint8x16_t mask = vdupq_n_u8(0x3F);
+  size_t done = 0;
+
+  while (length - done >= 48) {
+    uint8x16x3_t in = vld3q_u8(src + done);
+    uint8x16x4_t out;
+    out.val[0] = vshrq_n_u8(in.val[0], 2);
+    out.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4),
+                                   vshrq_n_u8(in.val[1], 4)), mask);
+    out.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2),
+                                   vshrq_n_u8(in.val[2], 6)), mask);
+    out.val[3] = vandq_u8(in.val[2], mask);
+    for (int i = 0; i < 4; i++) {
+      out.val[i] = vqtbl4q_u8(table, out.val[i]);
+    }
+    vst4q_u8((uint8_t*)dst, out);
+    dst += 64;
+    done += 48;
+  }
+  return done;
+}
+
+
+// Anything out of the 128 entry table or 0xFF in it isn't alphabet
+static size_t DecodeNEON(const char *src, size_t length,
+                         uint8_t *dst, size_t room) {
+  uint8_t values[128];
+  for (int i = 0; i < 128; i++) {
+    values[i] = unbase64_table[i] < 0 ? 0xFF : unbase64_table[i];
+  }
+  uint8x16x4_t table_lo, table_hi;
+  for (int i = 0; i < 4; i++) {
+    table_lo.val[i] = vld1q_u8(values + i * 16);
+    table_hi.val[i] = vld1q_u8(values + 64 + i * 16);
+  }
+  const uint8x16_t offset = vdupq_n_u8(64);
+  size_t done = 0;
+
+  while (length - done >= 64 && room >= 48) {
+    uint8x16x4_t in = vld4q_u8((const uint8_t*)src + done);
+    uint8x16_t bad = vdupq_n_u8(0);
+    for (int i = 0; i < 4; i++) {
+      uint8x16_t c = in.val[i];
+      uint8x16_t v = vorrq_u8(vqtbl4q_u8(table_lo, c),
+                              vqtbl4q_u8(table_hi, vsubq_u8(c, offset)));
+      bad = vorrq_u8(bad, vorrq_u8(vcgeq_u8(c, vdupq_n_u8(128)),
+                                   vceqq_u8(v, vdupq_n_u8(0xFF))));
+      in.val[i] = v;
+    }
+    if (vmaxvq_u8(bad)) break;
+
+    uint8x16x3_t out;
+    out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+    out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+    out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+    vst3q_u8(dst, out);
+    dst += 48;
+    room -= 48;
+    done += 64;
+  }
+  return done;
+}
+#endif
+
+
+void ipc_base64_init() {
+#ifdef IPC_BASE64_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    encode_fast = EncodeAVX2;
+    decode_fast = DecodeAVX2;
+    kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("ssse3")) {
+    encode_fast = EncodeSSSE3;
+    decode_fast = DecodeSSSE3;
+    kernel_name = "ssse3";
+  }
+#elif defined(IPC_BASE64_NEON)
+  encode_fast = EncodeNEON;
+  decode_fast = DecodeNEON;
+  kernel_name = "neon";
+#endif
+}
+
+
+const char* ipc_base64_kernel() {
+  return kernel_name;
+}
+
+
+size_t ipc_base64_encode(const char *src, size_t length, char *dst) {
+  const uint8_t *in = (const uint8_t*) src;
+  char *out = dst;
+  size_t i = 0;
+
+  if (encode_fast) {
+    i = encode_fast(in, length, out);
+    out += i / 3 * 4;
+  }
+
+  for (; i + 3 <= length; i += 3) {
+    *out++ = base64_table[in[i] >> 2];
+    *out++ = base64_table[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+    *out++ = base64_table[((in[i + 1] & 0x0F) << 2) | (in[i + 2] >> 6)];
+    *out++ = base64_table[in[i + 2] & 0x3F];
+  }
+
+  if (i < length) {
+    uint8_t b1 = i + 1 < length ? in[i + 1] : 0;
+    *out++ = base64_table[in[i] >> 2];
+    *out++ = base64_table[((in[i] & 0x03) << 4) | (b1 >> 4)];
+    *out++ = i + 1 < length ? base64_table[(b1 & 0x0F) << 2] : '=';
+    *out++ = '=';
+  }
+
+  return out - dst;
+}
+
+
+size_t ipc_base64_decode(const char *src, size_t length,
+                         char *dst, size_t room) {
+  const char *end = src + length;
+  char *out = dst;
+  char *out_end = dst + room;
+
+  while (src < end) {
+    // As far as the vector kernel will go, then a quantum by hand to get
+    // past whatever stopped it
+    if (decode_fast) {
+      size_t done = decode_fast(src, end - src, (uint8_t*) out, out_end - out);
+      src += done;
+      out += done / 4 * 3;
+    }
+
+    // Padding ends it, whatever comes after, so there's never a second
+    // quantum glued on the end
+    int v[4];
+    int n = 0;
+    while (n < 4 && src < end && *src != '=') {
+      int c = unbase64(*src++);
+      if (c >= 0) v[n++] = c;
+    }
+    if (src < end && *src == '=') end = src;
+    if (n < 2 || out == out_end) break;
+    *out++ = (v[0] << 2) | ((v[1] & 0x30) >> 4);
+    if (n < 3 || out == out_end) break;
+    *out++ = ((v[1] & 0x0F) << 4) | ((v[2] & 0x3C) >> 2);
+    if (n < 4 || out == out_end) break;
+    *out++ = ((v[2] & 0x03) << 6) | (v[3] & 0x3F);
+  }
+
+  return out - dst;
+}
+
+}  // namespace node
@@ -0,0 +1,35 @@
+#ifndef NODE_IPCBASE64_H_
+#define NODE_IPCBASE64_H_
+
+#include <stddef.h>
+
+namespace node {
+
+/* Base64 for the buffers, with SSSE3 and AVX2 kernels picked at run time
+ * on x86 and NEON ones on 64 bit ARM. Whatever the vector kernels can't
+ * take, the ends of the input and anything that isn't plain alphabet, goes
+ * through the old byte at a time code, so the results are the same either
+ * way. Decoding skips anything that isn't in the alphabet, line breaks
+ * and the like, and stops at the first '='.
+ */
+
+// Picks the kernels for this CPU. Until it's called everything is scalar.
+void ipc_base64_init();
+
+// "avx2", "ssse3", "neon" or "scalar"
+const char* ipc_base64_kernel();
+
+static inline size_t ipc_base64_encoded_size(size_t length) {
+  return (length + 2) / 3 * 4;
+}
+
+// dst needs ipc_base64_encoded_size(length) bytes. Returns what it wrote.
+size_t ipc_base64_encode(const char *src, size_t length, char *dst);
+
+// Never writes more than room bytes. Returns what it wrote.
+size_t ipc_base64_decode(const char *src, size_t length,
+                         char *dst, size_t room);
+
+}  // namespace node
+
+#endif  // NODE_IPCBASE64_H_
@@ -1,12 +1,28 @@
 
 #include <node.h>
 #include "ipcbuffer.h"
+#include "ipcring.h"
+#include "ipcqueue.h"
+#include "ipcheap.h"
+#include "ipctable.h"
+#include "ipcsnapshot.h"
+#include "ipcatomic.h"
+#include "ipcbase64.h"
+#include "ipcutf8.h"
+#include "ipcpool.h"
+#include "ipcmaps.h"
+#include "ipcswap.h"
+#include "ipcsearch.h"
+#include "ipccopy.h"
+#include "ipchash.h"
 
 #include <v8.h>
 
 #include <assert.h>
 #include <stdlib.h> // malloc, free
 #include <string.h> // memcpy
+#include <stdio.h> // snprintf, fopen
+#include <limits.h> // PATH_MAX
 
 #ifdef __MINGW32__
 # include <platform.h>
@@ -24,12 +40,59 @@
 #endif
 #ifdef __POSIX__
 # include <sys/mman.h>	// mmap, munmap...
+# include <sys/stat.h>	// fstat
+# include <sys/socket.h>	// sendmsg, recvmsg
+# include <sys/uio.h>
+# include <poll.h>
 #endif
 #endif
 
+#ifdef __linux__
+# include <errno.h>
+# include <time.h>
+# include <sys/syscall.h>	// futex
+# include <sys/vfs.h>	// fstatfs
+# include <linux/futex.h>
+#endif
+
+#ifndef HUGETLBFS_MAGIC
+# define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
+// memfd_create and sealing, for headers older than the kernel
+#ifndef MFD_CLOEXEC
+# define MFD_CLOEXEC       0x0001U
+# define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef MFD_HUGETLB
+# define MFD_HUGETLB       0x0004U
+#endif
+#ifndef F_ADD_SEALS
+# define F_ADD_SEALS       1033
+# define F_GET_SEALS       1034
+# define F_SEAL_SEAL       0x0001
+# define F_SEAL_SHRINK     0x0002
+# define F_SEAL_GROW       0x0004
+# define F_SEAL_WRITE      0x0008
+#endif
+
 
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+#define IPC_BACKING_NONE      0
+#define IPC_BACKING_HEAP      1   // new char[]
+#define IPC_BACKING_ANON      2   // Private anonymous mmap, for huge pages
+#define IPC_BACKING_SHM       3   // "*name", shm_open
+#define IPC_BACKING_HUGETLB   4   // "*name", but a file on hugetlbfs
+#define IPC_BACKING_FILE      5   // "name", open
+#define IPC_BACKING_SYSV      6   // key, shmget
+#define IPC_BACKING_MEMFD     7   // "&name" or an fd, memfd_create
+
+static const char *backing_names[IPC_BACKINGS] = {
+  "none", "heap", "anon", "shm", "hugetlb", "file", "sysv", "memfd"
+};
 
 namespace node {
 
@@ -57,13 +120,19 @@ using namespace v8;
 
 
 static Persistent<String> length_symbol;
+static Persistent<String> page_size_sym;
+static size_t base_page_size = 4096;
+IPCstats ipc_stats;
 static Persistent<String> chars_written_sym;
 static Persistent<String> write_sym;
 Persistent<FunctionTemplate> IPCbuffer::constructor_template;
 
 
+// What ipc_base64_decode() will make of it, which stops at the first '='
 static inline size_t base64_decoded_size(const char *src, size_t size) {
-  const char *const end = src + size;
+  const char *pad = (const char*) memchr(src, '=', size);
+  if (pad) size = pad - src;
+
   const int remainder = size % 4;
 
   size = (size / 4) * 3;
@@ -77,12 +146,6 @@ static inline size_t base64_decoded_size(const char *src, size_t size) {
     }
   }
 
-  // check for trailing padding (1 or 2 bytes)
-  if (size > 0) {
-    if (end[-1] == '=') size--;
-    if (end[-2] == '=') size--;
-  }
-
   return size;
 }
 
@@ -117,6 +180,24 @@ Handle<Object> IPCbuffer::New(Handle<String> string) {
 }
 
 
+/*
+ * V8 only hears about external memory a megabyte at a time. Every call can
+ * set off a collection, and buffers come and go far too often for that.
+ */
+#define EXTERNAL_BATCH (1024 * 1024)
+
+static intptr_t external_pending = 0;
+
+static void AccountExternal(intptr_t change) {
+  external_pending += change;
+  if (external_pending >= EXTERNAL_BATCH ||
+      external_pending <= -EXTERNAL_BATCH) {
+    V8::AdjustAmountOfExternalAllocatedMemory(external_pending);
+    external_pending = 0;
+  }
+}
+
+
 IPCbuffer* IPCbuffer::New(size_t length) {
   HandleScope scope;
 
@@ -153,6 +234,20 @@ IPCbuffer* IPCbuffer::New(char *data, size_t length,
   return buffer;
 }
 
+// "sequential" etc. to the matching madvise() flag, -1 if it isn't one
+static int ParseAdvice(Handle<Value> arg) {
+#ifdef __POSIX__
+  String::AsciiValue name(arg->ToString());
+  if (!strcmp(*name, "normal")) return MADV_NORMAL;
+  if (!strcmp(*name, "sequential")) return MADV_SEQUENTIAL;
+  if (!strcmp(*name, "random")) return MADV_RANDOM;
+  if (!strcmp(*name, "willneed")) return MADV_WILLNEED;
+  if (!strcmp(*name, "dontneed")) return MADV_DONTNEED;
+#endif
+  return -1;
+}
+
+
 Handle<Value> IPCbuffer::New(const Arguments &args) {
   if (!args.IsConstructCall()) {
     return FromConstructorTemplate(constructor_template, args);
@@ -162,6 +257,7 @@ Handle<Value> IPCbuffer::New(const Arguments &args) {
 
   uint32_t key = 0;
   char *filename = NULL;
+  IPCoptions options = { IPC_HUGE_OFF, NULL, false, -1, -1, false };
   IPCbuffer *buffer;
 
   if (args[0]->IsInt32() || args[0]->IsNumber()) {
@@ -182,6 +278,13 @@ Handle<Value> IPCbuffer::New(const Arguments &args) {
 	// I do a local copy of the filename as it's likely to dissappear
         filename = new char[(path.length()+1)];
         memcpy(filename,*path,path.length()+1);
+#ifndef __linux__
+        if (filename[0] == '&') {
+          delete [] filename;
+          return ThrowException(Exception::RangeError(String::New(
+              "This OS can't handle memfd segments")));
+        }
+#endif
 #else
         return ThrowException(Exception::RangeError(String::New(
 	    "This OS can't handle Posix (mmap style) shared memory")));
@@ -195,7 +298,76 @@ Handle<Value> IPCbuffer::New(const Arguments &args) {
 	  "This OS can't handle shared memory")));
 #endif
     }
-    buffer = new IPCbuffer(args.This(), length, filename, key);
+    if (args[2]->IsObject()) {
+      // var buffer = new IPCbuffer(1024, "*name", { hugePages: true });
+      Local<Object> opts = args[2]->ToObject();
+      Local<Value> huge = opts->Get(String::NewSymbol("hugePages"));
+      if (huge->IsString()) {
+        String::AsciiValue mode(huge);
+        if (!strcmp(*mode, "require")) {
+          options.huge_pages = IPC_HUGE_REQUIRE;
+        } else if (!strcmp(*mode, "transparent")) {
+          options.huge_pages = IPC_HUGE_TRANSPARENT;
+        } else {
+          delete [] filename;
+          return ThrowException(Exception::TypeError(String::New(
+              "hugePages should be true, \"require\" or \"transparent\"")));
+        }
+      } else if (huge->BooleanValue()) {
+        options.huge_pages = IPC_HUGE_TRY;
+      }
+      Local<Value> mount = opts->Get(String::NewSymbol("hugetlbfs"));
+      String::Utf8Value path(mount->IsString() ? mount->ToString()
+                                               : String::New("/dev/hugepages"));
+      options.huge_path = new char[path.length() + 1];
+      memcpy(options.huge_path, *path, path.length() + 1);
+
+      options.populate = opts->Get(String::NewSymbol("populate"))->BooleanValue();
+      options.track_dirty =
+          opts->Get(String::NewSymbol("trackDirty"))->BooleanValue();
+      Local<Value> advice = opts->Get(String::NewSymbol("advice"));
+      if (!advice->IsUndefined() &&
+          (options.advice = ParseAdvice(advice)) < 0) {
+        delete [] filename;
+        delete [] options.huge_path;
+        return ThrowException(Exception::TypeError(String::New(
+            "Unknown advice")));
+      }
+
+      Local<Value> fd = opts->Get(String::NewSymbol("fd"));
+      if (!fd->IsUndefined()) {
+#ifdef __linux__
+        struct stat st;
+        if (!fd->IsInt32() || fd->Int32Value() < 0) {
+          delete [] filename;
+          delete [] options.huge_path;
+          return ThrowException(Exception::TypeError(String::New(
+              "fd should be a file descriptor")));
+        }
+        options.fd = fd->Int32Value();
+        if (length == 0) {	// Whatever size the sender made it
+          if (fstat(options.fd, &st) < 0) {
+            delete [] filename;
+            delete [] options.huge_path;
+            return ThrowException(ErrnoException(errno, "fstat"));
+          }
+          length = st.st_size;
+        }
+#else
+        delete [] filename;
+        delete [] options.huge_path;
+        return ThrowException(Exception::RangeError(String::New(
+            "This OS can't handle memfd segments")));
+#endif
+      }
+    }
+    if (args[3]->IsFunction()) {
+      // new _IPCbuffer(length, name, options, callback), done off the loop
+      buffer = new IPCbuffer(args.This(), 0, filename, key, options);
+      buffer->Open(length, Local<Function>::Cast(args[3]));
+    } else {
+      buffer = new IPCbuffer(args.This(), length, filename, key, options);
+    }
   } else {
     return ThrowException(Exception::TypeError(String::New(
 	"Length needs to be an integer")));
@@ -204,308 +376,3417 @@ Handle<Value> IPCbuffer::New(const Arguments &args) {
 }
 
 
-IPCbuffer::IPCbuffer(Handle<Object> wrapper, size_t length, char* path, uint32_t id) : ObjectWrap() {
+IPCbuffer::IPCbuffer(Handle<Object> wrapper, size_t length, char* path, uint32_t id,
+                     const IPCoptions &options) : ObjectWrap() {
   Wrap(wrapper);
 
-  fileName_ = path;
-  id_ = id;
-  length_ = 0;
-  callback_ = NULL;
+  fileName_ = path;
+  id_ = id;
+  options_ = options;
+  length_ = 0;
+  callback_ = NULL;
+  backing_ = IPC_BACKING_NONE;
+  mapPath_ = NULL;
+  dirty_ = NULL;
+  pins_ = 0;
+  fixed_ = false;
+  pooled_ = false;
+  fd_ = -1;
+  sealed_ = false;
+  opening_ = false;
+  mapping_ = NULL;
+  memset(&stats_, 0, sizeof(stats_));
+  ipc_count(&ipc_stats.buffers, 1);
+
+  Replace(NULL, length, NULL, NULL);
+}
+
+
+IPCbuffer::~IPCbuffer() {
+  Replace(NULL, 0, NULL, NULL);
+  ipc_count(&ipc_stats.buffers, -1);
+  delete [] fileName_;
+  delete [] options_.huge_path;
+  delete [] mapPath_;
+}
+
+
+static inline size_t RoundUp(size_t n, size_t to) {
+  return (n + to - 1) / to * to;
+}
+
+
+#ifdef __linux__
+// Reads a number out of a /proc or /sys file, after prefix if there is one
+static size_t ReadSysValue(const char *file, const char *prefix) {
+  char line[256];
+  size_t value = 0;
+  FILE *f = fopen(file, "r");
+
+  if (f == NULL) return 0;
+  while (fgets(line, sizeof(line), f)) {
+    size_t skip = prefix ? strlen(prefix) : 0;
+    if (prefix == NULL || !strncmp(line, prefix, skip)) {
+      value = strtoul(line + skip, NULL, 10);
+      break;
+    }
+  }
+  fclose(f);
+
+  return value;
+}
+
+
+// Default huge page size, 0 if the kernel doesn't do them
+static size_t HugePageSize() {
+  static size_t size = (size_t)-1;
+  if (size == (size_t)-1) {
+    size = ReadSysValue("/proc/meminfo", "Hugepagesize:") * 1024;
+  }
+  return size;
+}
+
+
+// The page size the kernel really gave the mapping at addr, from its
+// KernelPageSize in smaps. 0 if it can't be found.
+static size_t MappedPageSize(const char *addr) {
+  char line[256];
+  size_t size = 0;
+  bool found = false;
+  FILE *f = fopen("/proc/self/smaps", "r");
+
+  if (f == NULL) return 0;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long start, end;
+    if (!found) {
+      found = sscanf(line, "%lx-%lx ", &start, &end) == 2 &&
+              (uintptr_t)addr >= start && (uintptr_t)addr < end;
+    } else if (!strncmp(line, "KernelPageSize:", 15)) {
+      size = strtoul(line + 15, NULL, 10) * 1024;
+      break;
+    }
+  }
+  fclose(f);
+
+  return size;
+}
+
+
+// Ask for transparent huge pages over a mapping. Returns the size they come
+// in, or 0 if the kernel wasn't having it.
+static size_t AdviseHuge(char *data, size_t length) {
+# ifdef MADV_HUGEPAGE
+  if (madvise(data, length, MADV_HUGEPAGE) == 0) {
+    size_t size = ReadSysValue(
+        "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", NULL);
+    return size ? size : HugePageSize();
+  }
+# endif
+  return 0;
+}
+#endif
+
+
+#ifdef __linux__
+// glibc only grew a wrapper in 2.27, the system call's been there since 3.17
+static int MemfdCreate(const char *name, unsigned int flags) {
+# ifdef SYS_memfd_create
+  return syscall(SYS_memfd_create, name, flags);
+# else
+  errno = ENOSYS;
+  return -1;
+# endif
+}
+#endif
+
+
+#ifdef __POSIX__
+/*
+ * madvise() over part of a buffer. madvise wants whole pages, so for memory
+ * that came from new[] only the pages entirely inside the range are
+ * touched, anything else could be sharing a page with someone's malloc.
+ */
+static int AdviseRange(char *start, size_t length, int advice, bool inner) {
+  uintptr_t mask = base_page_size - 1;
+  uintptr_t from = (uintptr_t)start;
+  uintptr_t to = (uintptr_t)start + length;
+
+  if (inner) {
+    from = (from + mask) & ~mask;
+    to &= ~mask;
+  } else {
+    from &= ~mask;
+  }
+  if (to <= from) return 0;
+
+  return madvise((void*)from, to - from, advice);
+}
+#endif
+
+
+// Faulting in private memory has to write, a read just maps the zero page.
+// Shared memory only needs reading and a write would dirty file pages.
+static inline bool WritePrefault(int backing) {
+  return backing == IPC_BACKING_HEAP || backing == IPC_BACKING_ANON;
+}
+
+
+/*
+ * Fault in every page of a range now rather than on first touch. Newer
+ * kernels can do it in one call, otherwise poke a byte per page. The write
+ * is an atomic or of nothing so it can't trample anyone writing for real.
+ */
+static void PrefaultRange(char *start, size_t length, bool write) {
+  if (length == 0) return;
+
+#if defined(MADV_POPULATE_READ) && defined(MADV_POPULATE_WRITE)
+  uintptr_t from = (uintptr_t)start & ~(uintptr_t)(base_page_size - 1);
+  if (madvise((void*)from, (uintptr_t)start + length - from,
+              write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0) {
+    return;
+  }
+#endif
+
+  char *end = start + length;
+  char *p = start;
+  while (p < end) {
+    if (write) {
+      __atomic_fetch_or(p, 0, __ATOMIC_RELAXED);
+    } else {
+      (void) *(volatile char*)p;
+    }
+    p = (char*)(((uintptr_t)p + base_page_size) & ~(uintptr_t)(base_page_size - 1));
+  }
+}
+
+
+#if __POSIX__ || __SYSV__
+/*
+ * Which segment a name or key means right now, as device and inode or the
+ * shmid. False if there isn't one. A mapping that's still about from before
+ * the segment was removed and made again mustn't be handed out as the new
+ * one. Only costs a stat(), not the open, ftruncate and mmap.
+ */
+static bool SegmentId(int backing, const char *name, const char *map_path,
+                      uint32_t key, uint64_t id[2]) {
+  id[0] = id[1] = 0;
+  switch (backing) {
+#ifdef __POSIX__
+    case IPC_BACKING_FILE:
+    case IPC_BACKING_HUGETLB:
+    case IPC_BACKING_SHM: {
+      struct stat st;
+      const char *path = backing == IPC_BACKING_HUGETLB ? map_path : name;
+#ifdef __linux__
+      char shm_path[PATH_MAX];
+      if (backing == IPC_BACKING_SHM) {
+        snprintf(shm_path, sizeof(shm_path), "/dev/shm/%s", &name[1]);
+        path = shm_path;
+      }
+#else
+      if (backing == IPC_BACKING_SHM) return true;  // No way to look
+#endif
+      if (stat(path, &st) < 0) return false;
+      id[0] = st.st_dev;
+      id[1] = st.st_ino;
+      return true;
+    }
+#endif
+#ifdef __SYSV__
+    case IPC_BACKING_SYSV: {
+      int shmid = shmget((key_t)key, 0, 0);
+      if (shmid < 0) return false;
+      id[0] = shmid;
+      return true;
+    }
+#endif
+  }
+  return false;
+}
+#endif
+
+
+// Whether other buffers can be after the same segment, by name or key
+bool IPCbuffer::Shareable() {
+  return options_.fd < 0 && (fileName_ != NULL || id_ != 0) &&
+         !(fileName_ && fileName_[0] == '&');
+}
+
+
+/*
+ * A mapping this process already has of the segment this buffer is after,
+ * NULL if there isn't one.
+ */
+IPCmapping* IPCbuffer::FindMapping(size_t length) {
+#if __POSIX__ || __SYSV__
+  if (!Shareable()) return NULL;
+
+  IPCmapping *m = NULL;
+  uint64_t id[2];
+  while ((m = ipc_maps_find(fileName_, id_, length, options_.huge_pages,
+                            m)) != NULL) {
+    if (SegmentId(m->backing, fileName_, m->map_path, id_, id) &&
+        id[0] == m->id[0] && id[1] == m->id[1]) {
+      return m;
+    }
+  }
+#endif
+  return NULL;
+}
+
+
+/*
+ * What went wrong getting the memory. Kept clear of V8 till it's thrown,
+ * the getting can happen on the threadpool.
+ */
+struct IPCmapError {
+  int err;                // errno, 0 if the message says it all
+  const char *syscall;
+  const char *message;
+  const char *path;
+  bool reference;         // A ReferenceError, as it always has been
+};
+
+
+static bool MapFailed(IPCmapError *error, int err, const char *syscall,
+                      const char *message, const char *path = NULL,
+                      bool reference = false) {
+  error->err = err;
+  error->syscall = syscall;
+  error->message = message;
+  error->path = path;
+  error->reference = reference;
+  return false;
+}
+
+
+static Local<Value> MapException(const IPCmapError &error) {
+  if (error.err) {
+    return ErrnoException(error.err, error.syscall, error.message, error.path);
+  }
+  if (error.reference) {
+    return Exception::ReferenceError(String::New(error.message));
+  }
+  return Exception::Error(String::New(error.message));
+}
+
+
+/*
+ * Gets length bytes from wherever fileName_, id_ and the options say and
+ * sets data_, mapped_, backing_ and pageSize_ to match. Fills in error if
+ * it couldn't, and leaves data_ NULL. No V8 and nothing shared with other
+ * buffers, so open() can run it on the threadpool. populated says whether
+ * mmap already faulted it all in.
+ */
+bool IPCbuffer::MapSegment(size_t length, IPCmapError *error,
+                           bool *populated) {
+  int huge = options_.huge_pages;
+  size_t huge_size = 0;
+#ifdef __linux__
+  if (huge != IPC_HUGE_OFF && huge != IPC_HUGE_TRANSPARENT) {
+    huge_size = HugePageSize();
+  }
+#endif
+
+  data_ = NULL;
+  mapped_ = length;
+  pageSize_ = base_page_size;
+
+  // Let mmap fault everything in, unless transparent huge pages might
+  // still be on the cards, in which case that has to be asked for first
+  int populate = 0;
+#ifdef MAP_POPULATE
+  if (options_.populate &&
+      huge != IPC_HUGE_TRY && huge != IPC_HUGE_TRANSPARENT) {
+    populate = MAP_POPULATE;
+  }
+#endif
+
+#ifdef __linux__
+  if (options_.fd >= 0 || (fileName_ && fileName_[0] == '&')) {
+    int fd = -1;
+    bool hugetlb = false;
+    struct stat st;
+
+    if (options_.fd >= 0) {		// Somebody else's, passed to us
+      if ((fd = fcntl(options_.fd, F_DUPFD_CLOEXEC, 0)) == -1) {
+        return MapFailed(error, errno, "fcntl",
+                         "Couldn't attach to the segment");
+      }
+      struct statfs fs;
+      if (fstatfs(fd, &fs) == 0 && (uint32_t)fs.f_type == HUGETLBFS_MAGIC) {
+        hugetlb = true;
+        huge_size = fs.f_bsize;
+      }
+    } else {				// New, the name is only a label
+      if (huge_size) {
+        fd = MemfdCreate(&fileName_[1],
+                         MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB);
+        if (fd != -1) {
+          hugetlb = true;
+        } else if (huge == IPC_HUGE_REQUIRE) {
+          return MapFailed(error, errno, "memfd_create",
+                                "Couldn't get huge pages");
+        }
+      }
+      if (fd == -1 &&
+          (fd = MemfdCreate(&fileName_[1], MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) {
+        return MapFailed(error, errno, "memfd_create",
+                              "Couldn't create shared memory");
+      }
+    }
+
+    if (hugetlb) {
+      mapped_ = RoundUp(length, huge_size);
+      pageSize_ = huge_size;
+    } else if (huge == IPC_HUGE_REQUIRE) {
+      close(fd);
+      return MapFailed(error, 0, NULL,
+                       "Couldn't get huge pages for this segment");
+    }
+
+    if (fstat(fd, &st) < 0 ||
+        (st.st_size < (off_t)mapped_ && ftruncate(fd, mapped_) < 0)) {
+      int err = errno;
+      close(fd);
+      return MapFailed(error, err, "ftruncate", "Couldn't size the segment");
+    }
+
+    // A write sealed segment can't be mapped writable, so it's mapped read
+    // only and a write to it faults rather than quietly going nowhere
+    int seals = fcntl(fd, F_GET_SEALS);
+    sealed_ = seals != -1 && (seals & F_SEAL_WRITE);
+    data_ = (char*) mmap(NULL, mapped_,
+                         sealed_ ? PROT_READ : PROT_READ|PROT_WRITE,
+                         MAP_SHARED | populate, fd, 0);
+    if (data_ == (char*) MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      data_ = NULL;
+      return MapFailed(error, err, "mmap", "Couldn't map shared memory");
+    }
+    fd_ = fd;		// Its only name, so hang on to it
+    backing_ = IPC_BACKING_MEMFD;
+  } else
+#endif
+#ifdef __POSIX__
+  if (fileName_) {
+    int fd = -1;
+    bool hugetlb = false;
+
+    if (fileName_[0] == '*') { 		// Not file backed
+#ifdef __linux__
+      if (huge_size && options_.huge_path) {
+        // The only way to give huge pages a name is a file on hugetlbfs
+        size_t dir = strlen(options_.huge_path);
+        delete [] mapPath_;
+        mapPath_ = new char[dir + strlen(fileName_) + 1];
+        memcpy(mapPath_, options_.huge_path, dir);
+        mapPath_[dir] = '/';
+        strcpy(mapPath_ + dir + 1, &fileName_[1]);
+
+        if ((fd = open(mapPath_, O_RDWR|O_CREAT, S_IWUSR|S_IRUSR)) != -1) {
+          hugetlb = true;
+          backing_ = IPC_BACKING_HUGETLB;
+        } else if (huge == IPC_HUGE_REQUIRE) {
+          return MapFailed(error, errno, "open",
+                                "Couldn't get huge pages", mapPath_);
+        }
+      }
+#endif
+      if (fd == -1) {
+        fd = shm_open(&fileName_[1], O_RDWR|O_CREAT, S_IWUSR|S_IRUSR);
+        backing_ = IPC_BACKING_SHM;
+      }
+    } else {				// File Backed
+      fd = open(fileName_, O_RDWR|O_CREAT, S_IWUSR|S_IRUSR);
+      backing_ = IPC_BACKING_FILE;
+#ifdef __linux__
+      struct statfs fs;
+      if (fd != -1 && huge_size && fstatfs(fd, &fs) == 0 &&
+          (uint32_t)fs.f_type == HUGETLBFS_MAGIC) {
+        hugetlb = true;
+        huge_size = fs.f_bsize;
+      }
+#endif
+    }
+
+    if (fd == -1) {
+      return MapFailed(error, 0, NULL, "Couldn't open share file", NULL,
+                       true);
+    }
+    if (hugetlb) {
+      // hugetlbfs only deals in whole huge pages
+      mapped_ = RoundUp(length, huge_size);
+      pageSize_ = huge_size;
+    } else if (huge == IPC_HUGE_REQUIRE) {
+      close(fd);
+      return MapFailed(error, 0, NULL,
+                       "Couldn't get huge pages for this segment");
+    }
+
+    ftruncate(fd, mapped_);		// Bus Error avoidance
+    data_ = (char*) mmap(NULL, mapped_, PROT_READ|PROT_WRITE,
+                         MAP_SHARED | populate, fd, 0);
+    close(fd);	// We don't need fd anymore.
+
+    if (data_ == (char*) MAP_FAILED) {
+      data_ = NULL;
+      return MapFailed(error, errno, "mmap", "Couldn't create shared memory");
+    }
+  } else
+#endif
+#ifdef __SYSV__
+  if (id_)  {
+    int shmid = -1;
+#if defined(__linux__) && defined(SHM_HUGETLB)
+    if (huge_size) {
+      mapped_ = RoundUp(length, huge_size);
+      if ((shmid = shmget((key_t)id_, mapped_,
+                          IPC_CREAT | SHM_HUGETLB | 0666)) >= 0) {
+        pageSize_ = huge_size;
+      } else if (huge == IPC_HUGE_REQUIRE) {
+        return MapFailed(error, errno, "shmget", "Couldn't get huge pages");
+      } else {
+        mapped_ = length;
+      }
+    }
+#endif
+    if (shmid < 0) {
+      shmid = shmget((key_t)id_, length, IPC_CREAT | 0666);
+    }
+    if (shmid < 0 || (data_ = (char*) shmat(shmid, NULL, 0)) == (char*) -1) {
+      data_ = NULL;
+      return MapFailed(error, 0, NULL, "Couldn't create shared memory", NULL,
+                       true);
+    }
+    backing_ = IPC_BACKING_SYSV;
+
+#ifdef __linux__
+    // A key someone else made keeps the pages they made it with, huge or
+    // not whatever was asked for here, and may be bigger than length
+    size_t real = MappedPageSize(data_);
+    if (real) pageSize_ = real;
+    struct shmid_ds ds;
+    mapped_ = RoundUp(shmctl(shmid, IPC_STAT, &ds) == 0 ?
+                      MAX((size_t)ds.shm_segsz, length) : length, pageSize_);
+#endif
+    if (huge == IPC_HUGE_REQUIRE && pageSize_ == base_page_size) {
+      shmdt(data_);
+      data_ = NULL;
+      return MapFailed(error, 0, NULL,
+          "Couldn't get huge pages, the segment was made without them");
+    }
+  } else
+#endif
+  {
+#ifdef __linux__
+    if (huge != IPC_HUGE_OFF) {
+      int flags = MAP_PRIVATE | MAP_ANONYMOUS | populate;
+# ifdef MAP_HUGETLB
+      if (huge_size) {
+        mapped_ = RoundUp(length, huge_size);
+        data_ = (char*) mmap(NULL, mapped_, PROT_READ|PROT_WRITE,
+                             flags | MAP_HUGETLB, -1, 0);
+        if (data_ != (char*) MAP_FAILED) {
+          pageSize_ = huge_size;
+        } else if (huge == IPC_HUGE_REQUIRE) {
+          data_ = NULL;
+          return MapFailed(error, errno, "mmap", "Couldn't get huge pages");
+        } else {
+          mapped_ = length;
+        }
+      }
+# endif
+      if (huge == IPC_HUGE_REQUIRE && pageSize_ == base_page_size) {
+        return MapFailed(error, 0, NULL,
+            "Couldn't get huge pages, the kernel has none configured");
+      }
+      if (pageSize_ == base_page_size) {
+        data_ = (char*) mmap(NULL, mapped_, PROT_READ|PROT_WRITE,
+                             flags, -1, 0);
+      }
+      if (data_ == (char*) MAP_FAILED) {
+        data_ = NULL;
+        return MapFailed(error, errno, "mmap", "Couldn't allocate memory");
+      }
+      backing_ = IPC_BACKING_ANON;
+    } else
+#endif
+    {
+      data_ = ipc_pool_alloc(length, &mapped_);
+      backing_ = IPC_BACKING_HEAP;
+    }
+  }
+
+#ifdef __linux__
+  // Nothing better on offer, so try for transparent huge pages instead
+  if (huge == IPC_HUGE_TRY || huge == IPC_HUGE_TRANSPARENT) {
+    if (pageSize_ == base_page_size && backing_ != IPC_BACKING_HEAP) {
+      size_t size = AdviseHuge(data_, mapped_);
+      if (size) pageSize_ = size;
+    }
+  }
+#endif
+
+  *populated = populate != 0;
+  return true;
+}
+
+
+
+// Becomes another view of a mapping this process already has
+void IPCbuffer::Join(IPCmapping *mapping) {
+  ipc_maps_hold(mapping);
+  mapping_ = mapping;
+  data_ = mapping->data;
+  mapped_ = mapping->mapped;
+  pageSize_ = mapping->page_size;
+  backing_ = mapping->backing;
+  if (mapping->map_path) {
+    delete [] mapPath_;
+    mapPath_ = new char[strlen(mapping->map_path) + 1];
+    strcpy(mapPath_, mapping->map_path);
+  }
+}
+
+
+/*
+ * What any new mapping or view needs before it's used: the dirty page map
+ * for a file that asked for one, the advice and the prefault. No V8 either.
+ */
+void IPCbuffer::Prepare(size_t length, bool populated) {
+#ifdef __POSIX__
+  if (backing_ == IPC_BACKING_FILE && options_.track_dirty) {
+    size_t words = (mapped_ / pageSize_ + 32) / 32;
+    dirty_ = new uint32_t[words];
+    memset(dirty_, 0, words * sizeof(uint32_t));
+  }
+  if (options_.advice >= 0) {
+    AdviseRange(data_, length, options_.advice, backing_ == IPC_BACKING_HEAP);
+  }
+#endif
+  if (options_.populate && !populated) {
+    PrefaultRange(data_, length, WritePrefault(backing_));
+  }
+}
+
+
+/*
+ * The loop thread's half of a new mapping: V8 hears about private memory,
+ * and a shared segment goes in the registry for the next buffer after it.
+ */
+void IPCbuffer::Mapped() {
+  if (backing_ == IPC_BACKING_HEAP || backing_ == IPC_BACKING_ANON) {
+    AccountExternal(sizeof(IPCbuffer) + length_);
+  }
+
+#if __POSIX__ || __SYSV__
+  if (mapping_ == NULL &&
+      (backing_ == IPC_BACKING_FILE || backing_ == IPC_BACKING_SHM ||
+       backing_ == IPC_BACKING_HUGETLB || backing_ == IPC_BACKING_SYSV)) {
+    IPCmapping m;
+    memset(&m, 0, sizeof(m));
+    if (SegmentId(backing_, fileName_, mapPath_, id_, m.id)) {
+      m.name = fileName_;
+      m.key = id_;
+      m.length = length_;
+      m.huge_pages = options_.huge_pages;
+      m.backing = backing_;
+      m.data = data_;
+      m.mapped = mapped_;
+      m.page_size = pageSize_;
+      m.map_path = backing_ == IPC_BACKING_HUGETLB ? mapPath_ : NULL;
+      mapping_ = ipc_maps_add(m);
+    }
+  }
+#endif
+}
+
+
+/*
+ * All of the above in one go. Hands back an exception if it couldn't get
+ * the memory.
+ */
+Local<Value> IPCbuffer::Map() {
+  IPCmapping *mapping = FindMapping(length_);
+  bool populated = false;
+
+  if (mapping) {
+    Join(mapping);
+  } else {
+    IPCmapError error;
+    if (!MapSegment(length_, &error, &populated)) return MapException(error);
+  }
+  Prepare(length_, populated);
+  Mapped();
+
+  return Local<Value>();
+}
+
+
+/*
+ * Lets go of data_ in whatever way it was got
+ */
+void IPCbuffer::Unmap() {
+  delete [] dirty_;
+  dirty_ = NULL;
+
+  ipc_count(&ipc_stats.backing[backing_].alive, -1);
+
+  // Other buffers here still using the mapping keep it as it is
+  if (mapping_ && !ipc_maps_release(mapping_)) {
+    mapping_ = NULL;
+    backing_ = IPC_BACKING_NONE;
+    return;
+  }
+  mapping_ = NULL;
+  ipc_count(&ipc_stats.backing[backing_].mapped, -(int64_t)mapped_);
+
+  switch (backing_) {
+#ifdef __POSIX__
+    case IPC_BACKING_FILE:
+      msync(data_, mapped_, MS_ASYNC);  // Make sure it syncs
+      munmap(data_, mapped_);
+      break;
+
+    case IPC_BACKING_SHM:
+      munmap(data_, mapped_);
+      // Remove the shared block. But only if not open elsewhere
+      shm_unlink(&fileName_[1]);
+      break;
+
+    case IPC_BACKING_HUGETLB:
+      munmap(data_, mapped_);
+      unlink(mapPath_);
+      break;
+
+    case IPC_BACKING_MEMFD:
+      munmap(data_, mapped_);
+      close(fd_);	// Gone once every process closes it and unmaps
+      fd_ = -1;
+      sealed_ = false;
+      break;
+
+    case IPC_BACKING_ANON:
+      munmap(data_, mapped_);
+      AccountExternal(-(intptr_t)(sizeof(IPCbuffer) + length_));
+      break;
+#endif
+#ifdef __SYSV__
+    case IPC_BACKING_SYSV:
+      shmdt(data_);		// Detach SYS V memory
+      break;
+#endif
+    case IPC_BACKING_HEAP:
+      ipc_pool_free(data_, mapped_);
+      AccountExternal(-(intptr_t)(sizeof(IPCbuffer) + length_));
+      break;
+  }
+
+  backing_ = IPC_BACKING_NONE;
+}
+
+
+/*
+ * This is where most of the allocation action takes place
+ */
+void IPCbuffer::Replace(char *data, size_t length,
+                     free_callback callback, void *hint) {
+  HandleScope scope;
+
+  if (callback_) {
+    callback_(data_, callback_hint_);
+  } else if (length_) {
+    Unmap();
+  }
+
+  length_ = length;
+  callback_ = callback;
+  callback_hint_ = hint;
+  pageSize_ = base_page_size;
+
+  if (callback_) {
+    data_ = data;
+  } else if (length_) {
+    uint64_t start = uv_hrtime();
+    Local<Value> error = Map();
+    if (!error.IsEmpty()) {
+      Failed();
+      ThrowException(error);
+    } else {
+      Created(uv_hrtime() - start);
+      if (data) memcpy(data_, data, length_);
+    }
+  } else {
+    data_ = NULL;
+  }
+
+  Expose();
+}
+
+
+void IPCbuffer::Created(uint64_t ns) {
+  IPCbackingStats *b = &ipc_stats.backing[backing_];
+
+  stats_.create_ns = ns;
+  ipc_count(&b->created, 1);
+  ipc_count(&b->create_ns, ns);
+  ipc_count(&b->alive, 1);
+  if (mapping_ && mapping_->views > 1) {
+    ipc_count(&b->reused, 1);
+  } else {
+    ipc_count(&b->mapped, mapped_);
+    if (options_.huge_pages != IPC_HUGE_OFF && pageSize_ == base_page_size) {
+      ipc_count(&ipc_stats.huge_fallbacks, 1);
+    }
+  }
+}
+
+
+// Don't leave a buffer claiming memory it hasn't got
+void IPCbuffer::Failed() {
+  length_ = 0;
+  data_ = NULL;
+  backing_ = IPC_BACKING_NONE;
+  ipc_count(&ipc_stats.create_failures, 1);
+}
+
+
+// Lets JS see whatever the buffer has now
+void IPCbuffer::Expose() {
+  handle_->SetIndexedPropertiesToExternalArrayData(data_,
+                                                   kExternalUnsignedByteArray,
+                                                   length_);
+  handle_->Set(length_symbol, Integer::NewFromUnsigned(length_));
+  handle_->Set(page_size_sym, Integer::NewFromUnsigned(pageSize_));
+  if (backing_ == IPC_BACKING_MEMFD) {
+    handle_->Set(String::NewSymbol("sealed"), Boolean::New(sealed_));
+  }
+}
+
+
+struct open_req {
+  uv_work_t req;
+  IPCbuffer *buffer;              // Held, and nobody else has it till the callback
+  Persistent<Function> callback;
+  size_t length;                  // length_ stays 0 till it's all there
+  uint64_t start;
+  bool mapped;                    // Done already, only Prepare() left
+  bool ok;
+  bool populated;
+  IPCmapError error;
+  open_req *next;                 // In opening, or in its leader's followers
+  open_req *followers;            // Opens of the same segment waiting on this
+};
+
+// Opens of shareable segments under way, so a second open of one while the
+// first is still on the threadpool waits for it rather than mapping it again
+static open_req *opening = NULL;
+
+
+/*
+ * Replace() for a buffer made with a callback, new _IPCbuffer(length,
+ * name, options, callback). The open, truncate, mmap and prefault are done
+ * on the threadpool and callback(err) is called once it's ready. Only the
+ * pool and the registry have to stay on the loop thread, and neither of
+ * those blocks. Till then the buffer is empty and can't be resized.
+ */
+void IPCbuffer::Open(size_t length, Handle<Function> callback) {
+  open_req *o = new open_req;
+  o->req.data = o;
+  o->buffer = this;
+  o->callback = Persistent<Function>::New(callback);
+  o->length = length;
+  o->start = uv_hrtime();
+  o->mapped = false;
+  o->ok = true;
+  o->populated = false;
+  o->next = NULL;
+  o->followers = NULL;
+
+  Hold();
+  opening_ = true;
+
+  bool pooled = fileName_ == NULL && id_ == 0 && options_.fd < 0;
+#ifdef __linux__
+  pooled = pooled && options_.huge_pages == IPC_HUGE_OFF;
+#endif
+  IPCmapping *mapping = FindMapping(length);
+
+  if (length == 0) {
+    o->mapped = true;
+  } else if (mapping) {
+    Join(mapping);
+    o->mapped = true;
+  } else if (pooled) {
+    o->ok = MapSegment(length, &o->error, &o->populated);
+    o->mapped = true;
+  } else if (Shareable()) {
+    for (open_req *p = opening; p; p = p->next) {
+      IPCbuffer *b = p->buffer;
+      if (p->length == length && b->id_ == id_ &&
+          b->options_.huge_pages == options_.huge_pages &&
+          (b->fileName_ == fileName_ ||
+           (b->fileName_ && fileName_ && strcmp(b->fileName_, fileName_) == 0))) {
+        o->next = p->followers;
+        p->followers = o;
+        return;
+      }
+    }
+    o->next = opening;
+    opening = o;
+  }
+
+  uv_queue_work(uv_default_loop(), &o->req, OpenWork, OpenAfter);
+}
+
+
+void IPCbuffer::OpenWork(uv_work_t *req) {
+  open_req *o = (open_req*) req->data;
+  IPCbuffer *buffer = o->buffer;
+
+  if (!o->mapped) o->ok = buffer->MapSegment(o->length, &o->error, &o->populated);
+  if (o->ok && o->length) buffer->Prepare(o->length, o->populated);
+}
+
+
+void IPCbuffer::OpenAfter(uv_work_t *req) {
+  HandleScope scope;
+  open_req *o = (open_req*) req->data;
+  IPCbuffer *buffer = o->buffer;
+
+  for (open_req **p = &opening; *p; p = &(*p)->next) {
+    if (*p == o) {
+      *p = o->next;
+      break;
+    }
+  }
+
+  Local<Value> argv[1];
+  if (!o->ok) {
+    buffer->Failed();
+    argv[0] = MapException(o->error);
+  } else {
+    buffer->length_ = o->length;
+    if (buffer->length_) {
+      buffer->Mapped();
+      buffer->Created(uv_hrtime() - o->start);
+    }
+    argv[0] = Local<Value>::New(Null());
+  }
+  buffer->opening_ = false;
+  buffer->Expose();
+
+  // Anyone after the same segment meanwhile joins the mapping, or has a
+  // go themselves if there isn't one
+  for (open_req *f = o->followers, *next; f; f = next) {
+    next = f->next;
+    f->next = NULL;
+    if (buffer->mapping_) {
+      f->buffer->Join(buffer->mapping_);
+      f->mapped = true;
+    } else {
+      f->next = opening;
+      opening = f;
+    }
+    uv_queue_work(uv_default_loop(), &f->req, OpenWork, OpenAfter);
+  }
+
+  TryCatch try_catch;
+  o->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+
+  o->callback.Dispose();
+  buffer->Release();
+  delete o;
+
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+}
+
+
+void IPCbuffer::Pin(Handle<Object> obj) {
+  if (constructor_template->HasInstance(obj)) {
+    ObjectWrap::Unwrap<IPCbuffer>(obj)->pins_++;
+  }
+}
+
+
+void IPCbuffer::Unpin(Handle<Object> obj) {
+  if (constructor_template->HasInstance(obj)) {
+    ObjectWrap::Unwrap<IPCbuffer>(obj)->pins_--;
+  }
+}
+
+
+#ifdef __POSIX__
+// Opens whatever a shared buffer was mapped from again
+int IPCbuffer::OpenBacking() {
+  switch (backing_) {
+    case IPC_BACKING_FILE:
+      return open(fileName_, O_RDWR);
+    case IPC_BACKING_SHM:
+      return shm_open(&fileName_[1], O_RDWR, 0);
+    case IPC_BACKING_HUGETLB:
+      return open(mapPath_, O_RDWR);
+#ifdef __linux__
+    case IPC_BACKING_MEMFD:
+      return fcntl(fd_, F_DUPFD_CLOEXEC, 0);
+#endif
+  }
+  errno = EINVAL;
+  return -1;
+}
+#endif
+
+
+static Local<Value> MoveError() {
+  return Exception::Error(String::New(
+      "No room to grow it in place, and it's been sliced so it can't move"));
+}
+
+
+/*
+ * Moves the mapping so it covers length bytes, or with follow however big
+ * the segment is now (length, if given, being what the resizer says it is).
+ * A resize makes the segment itself that size, a follow leaves it alone.
+ * With can_move unset it's been sliced and there may be Buffers about still
+ * looking at the old memory, so it has to stay put: only growing in place
+ * is allowed.
+ * Leaves the buffer as it was and hands back an exception if it can't.
+ */
+Local<Value> IPCbuffer::Remap(size_t length, bool follow, bool can_move) {
+  size_t mapped = length;
+  char *data;
+  bool others = false;
+
+  if (!can_move && length && length < length_ &&
+      backing_ != IPC_BACKING_HEAP) {
+    return Exception::Error(String::New(
+        "Can't shrink it once it's been sliced"));
+  }
+
+  switch (backing_) {
+#ifdef __POSIX__
+    case IPC_BACKING_FILE:
+    case IPC_BACKING_SHM:
+    case IPC_BACKING_HUGETLB:
+    case IPC_BACKING_MEMFD: {
+      int fd = OpenBacking();
+      struct stat st;
+      if (fd == -1) {
+        return ErrnoException(errno, "open", "Couldn't reopen the segment");
+      }
+      if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        return ErrnoException(err, "fstat");
+      }
+      if (follow && length == 0) length = st.st_size;
+      mapped = length;
+
+      bool hugetlb = backing_ == IPC_BACKING_HUGETLB;
+#ifdef __linux__
+      struct statfs fs;
+      if (!hugetlb && fstatfs(fd, &fs) == 0 &&
+          (uint32_t)fs.f_type == HUGETLBFS_MAGIC) {
+        hugetlb = true;
+      }
+#endif
+      if (hugetlb) mapped = RoundUp(length, pageSize_);
+
+      if (length == 0 || length == length_) {
+        close(fd);
+        return Local<Value>();
+      }
+      if (!can_move && length < length_) {
+        close(fd);
+        return Exception::Error(String::New(
+            "Can't shrink it once it's been sliced"));
+      }
+      // Shrinking too, so a peer's remap() sees the new size. Anyone
+      // following a resize leaves the size to whoever did it.
+      if (!follow && (off_t)mapped != st.st_size &&
+          ftruncate(fd, mapped) < 0) {
+        int err = errno;
+        close(fd);
+        return ErrnoException(err, "ftruncate", "Couldn't resize the segment");
+      }
+
+      // Other buffers here using the old mapping keep it, this one gets
+      // a new one
+      others = mapping_ && mapping_->views > 1;
+      data = (char*) MAP_FAILED;
+#ifdef __linux__
+      if (!others) {
+        // Grows in place if there's room after it, moves it if it may
+        data = (char*) mremap(data_, mapped_, mapped,
+                              can_move ? MREMAP_MAYMOVE : 0);
+      } else
+#endif
+      if (can_move) {
+        data = (char*) mmap(NULL, mapped,
+                            sealed_ ? PROT_READ : PROT_READ|PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+        if (data != (char*) MAP_FAILED && !others) munmap(data_, mapped_);
+      } else {
+        errno = ENOMEM;
+      }
+      int err = errno;
+      close(fd);
+      if (data == (char*) MAP_FAILED) {
+        if (!can_move) return MoveError();
+        return ErrnoException(err, "mremap", "Couldn't resize the mapping");
+      }
+      break;
+    }
+#endif
+#ifdef __linux__
+    case IPC_BACKING_ANON:
+      if (pageSize_ != base_page_size) mapped = RoundUp(length, pageSize_);
+      data = (char*) mremap(data_, mapped_, mapped,
+                            can_move ? MREMAP_MAYMOVE : 0);
+      if (data == (char*) MAP_FAILED) {
+        if (!can_move) return MoveError();
+        return ErrnoException(errno, "mremap", "Couldn't resize the mapping");
+      }
+      AccountExternal((intptr_t)length - (intptr_t)length_);
+      break;
+#endif
+    case IPC_BACKING_HEAP:
+      // Nothing to remap, it only lives here so a copy does no harm. Often
+      // the pool's block had room to spare anyway.
+      mapped = mapped_;
+      data = data_;
+      if (length > mapped_) {
+        if (!can_move) return MoveError();
+        data = ipc_pool_alloc(length, &mapped);
+        memcpy(data, data_, length_);
+        ipc_pool_free(data_, mapped_);
+      }
+      AccountExternal((intptr_t)length - (intptr_t)length_);
+      break;
+
+    default:
+      return Exception::Error(String::New(
+          "Only POSIX and in process buffers can be resized"));
+  }
+
+  if (dirty_) {
+    size_t words = (mapped_ / pageSize_ + 32) / 32;
+    size_t new_words = (mapped / pageSize_ + 32) / 32;
+    uint32_t *dirty = new uint32_t[new_words];
+    memset(dirty, 0, new_words * sizeof(uint32_t));
+    memcpy(dirty, dirty_, MIN(words, new_words) * sizeof(uint32_t));
+    delete [] dirty_;
+    dirty_ = dirty;
+  }
+
+  ipc_count(&ipc_stats.backing[backing_].mapped,
+            (int64_t)mapped - (others ? 0 : (int64_t)mapped_));
+  ipc_count(&ipc_stats.resizes, 1);
+
+  if (mapping_) {
+    // A different length is a different key
+    IPCmapping m = *mapping_;
+    m.length = length;
+    m.data = data;
+    m.mapped = mapped;
+    IPCmapping *moved = ipc_maps_add(m);
+    ipc_maps_release(mapping_);
+    mapping_ = moved;
+  }
+
+  data_ = data;
+  mapped_ = mapped;
+  length_ = length;
+
+  handle_->SetIndexedPropertiesToExternalArrayData(data_,
+                                                   kExternalUnsignedByteArray,
+                                                   length_);
+  handle_->Set(length_symbol, Integer::NewFromUnsigned(length_));
+
+  return Local<Value>();
+}
+
+
+// buffer.resize(newLength);
+// Other processes on the same segment follow with buffer.remap().
+Handle<Value> IPCbuffer::Resize(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  if (!args[0]->IsUint32() || args[0]->Uint32Value() == 0) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Length needs to be a positive integer")));
+  }
+  if (buffer->callback_) {
+    return ThrowException(Exception::Error(String::New(
+            "Can't resize memory the buffer doesn't own")));
+  }
+  if (buffer->pooled_) {
+    return ThrowException(Exception::Error(String::New(
+            "Can't resize the pool small Buffers are carved from")));
+  }
+  if (buffer->pins_) {
+    return ThrowException(Exception::Error(String::New(
+            "Can't resize while a ring, queue, heap, string or callback is using it")));
+  }
+
+  Local<Value> error = buffer->Remap(args[0]->Uint32Value(), false,
+                                     !buffer->fixed_);
+  if (!error.IsEmpty()) return ThrowException(error);
+
+  return scope.Close(Integer::NewFromUnsigned(buffer->length_));
+}
+
+
+// var length = buffer.remap([length]);
+// Catches up with however big the segment is now, or with length when the
+// resizer published one
+Handle<Value> IPCbuffer::Remap(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  if (buffer->backing_ == IPC_BACKING_FILE ||
+      buffer->backing_ == IPC_BACKING_SHM ||
+      buffer->backing_ == IPC_BACKING_HUGETLB ||
+      buffer->backing_ == IPC_BACKING_MEMFD) {
+    if (buffer->pins_) {
+      return ThrowException(Exception::Error(String::New(
+              "Can't remap while a ring, queue, heap, string or callback is using it")));
+    }
+    size_t length = args[0]->IsUint32() ? args[0]->Uint32Value() : 0;
+    Local<Value> error = buffer->Remap(length, true, !buffer->fixed_);
+    if (!error.IsEmpty()) return ThrowException(error);
+  }
+
+  return scope.Close(Integer::NewFromUnsigned(buffer->length_));
+}
+
+
+#define MEMFD_ONLY(buffer, what)                                     \
+  if (buffer->opening_ || buffer->backing_ != IPC_BACKING_MEMFD) {   \
+    return ThrowException(Exception::Error(String::New(              \
+            "Only memfd segments can " what)));                      \
+  }
+
+// A write sealed segment is mapped read only, so every native write checks
+// first rather than taking the process down with a segfault
+#define NOT_SEALED(buffer)                                           \
+  if ((buffer)->sealed_) {                                           \
+    return ThrowException(Exception::Error(String::New(              \
+            "Buffer is sealed read only")));                         \
+  }
+
+
+// buffer.seal([readOnly]);
+// Fixes the segment's size for good, and with readOnly what's in it too.
+// Nobody can undo it, so a reader can trust a sealed segment without
+// copying anything out first.
+Handle<Value> IPCbuffer::Seal(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+#ifdef __linux__
+  MEMFD_ONLY(buffer, "be sealed")
+
+  int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+  if (args[0]->BooleanValue() && !buffer->sealed_) seals |= F_SEAL_WRITE;
+
+  int have = fcntl(buffer->fd_, F_GET_SEALS);
+  if (have != -1 && (have & seals) == seals) return Undefined();
+
+  if (seals & F_SEAL_WRITE) {
+    // The kernel won't seal writes while anyone has it mapped shared and
+    // writable, us included. Swap ours for a read only view of the same
+    // pages, so a write from here faults too.
+    if (mmap(buffer->data_, buffer->mapped_, PROT_READ,
+             MAP_SHARED | MAP_FIXED, buffer->fd_, 0) == MAP_FAILED) {
+      return ThrowException(ErrnoException(errno, "mmap"));
+    }
+  }
+  if (fcntl(buffer->fd_, F_ADD_SEALS, seals) < 0) {
+    int err = errno;
+    if (seals & F_SEAL_WRITE) {
+      mmap(buffer->data_, buffer->mapped_, PROT_READ|PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, buffer->fd_, 0);
+    }
+    return ThrowException(ErrnoException(err, "fcntl",
+                                         "Couldn't seal the segment"));
+  }
+  if (seals & F_SEAL_WRITE) {
+    buffer->sealed_ = true;
+    buffer->handle_->Set(String::NewSymbol("sealed"), True());
+  }
+  return Undefined();
+#else
+  return ThrowException(Exception::RangeError(String::New(
+      "This OS can't handle memfd segments")));
+#endif
+}
+
+
+// var fd = buffer.fd([inheritable]);
+// With inheritable, children spawned from now on get it as well
+Handle<Value> IPCbuffer::Fd(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  MEMFD_ONLY(buffer, "hand out a descriptor")
+
+  if (args[0]->BooleanValue()) {
+    int flags = fcntl(buffer->fd_, F_GETFD);
+    if (flags < 0 || fcntl(buffer->fd_, F_SETFD, flags & ~FD_CLOEXEC) < 0) {
+      return ThrowException(ErrnoException(errno, "fcntl"));
+    }
+  }
+  return scope.Close(Integer::New(buffer->fd_));
+}
+
+
+// buffer.sendFd(socketFd);
+// Passes the segment and its length down a unix socket, the other end
+// picks it up with _IPCbuffer.receiveFd()
+Handle<Value> IPCbuffer::SendFd(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  MEMFD_ONLY(buffer, "be sent")
+
+  if (!args[0]->IsInt32()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Socket needs to be a file descriptor")));
+  }
+
+#ifdef __POSIX__
+  uint64_t length = buffer->length_;
+  struct iovec iov = { &length, sizeof(length) };
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &buffer->fd_, sizeof(int));
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(args[0]->Int32Value(), &msg, 0);
+  } while (sent < 0 && errno == EINTR);
+  if (sent < 0) {
+    return ThrowException(ErrnoException(errno, "sendmsg"));
+  }
+#endif
+
+  return Undefined();
+}
+
+
+// How many threads the threadpool has. libuv makes 4 unless
+// UV_THREADPOOL_SIZE says otherwise, and keeps it between 1 and 128. Older
+// ones ignore it, in which case splitting too finely only queues the extra
+// pieces behind the first few.
+static size_t PoolThreads() {
+  static size_t threads = 0;
+  if (threads == 0) {
+    const char *size = getenv("UV_THREADPOOL_SIZE");
+    long n = size ? strtol(size, NULL, 10) : 0;
+    threads = n < 1 ? 4 : n > 128 ? 128 : (size_t) n;
+  }
+  return threads;
+}
+
+// How many pieces to split length bytes of work into for the threadpool:
+// one a thread, but none smaller than piece
+static size_t PoolPieces(size_t length, size_t piece) {
+  size_t pieces = length / piece;
+  if (pieces > PoolThreads()) pieces = PoolThreads();
+  return pieces < 1 ? 1 : pieces;
+}
+
+
+/*
+ * Waiting on the threadpool for a descriptor that may never come is done
+ * in slices this long, handing the thread back and queueing up again in
+ * between. There are only PoolThreads() threads, 4 unless told otherwise,
+ * and a few receives would otherwise take them all and leave every other
+ * copy, flush and open stuck behind them. Nothing's lost in the gaps, a
+ * message sits in the socket until it's read.
+ */
+#define POOL_SLICE_MS 50
+
+
+#ifdef __POSIX__
+#define RECEIVE_FDS 8           // Room for a sender that sends too many
+
+struct receive_req {
+  uv_work_t req;
+  Persistent<Function> callback;
+  int socket;
+  int fd;
+  uint64_t length;
+  int err;
+  const char *syscall;
+  bool again;                     // Nothing yet, queue up for another slice
+};
+
+
+static void ReceiveWork(uv_work_t *req) {
+  receive_req *r = (receive_req*) req->data;
+  struct pollfd p = { r->socket, POLLIN, 0 };
+  struct iovec iov = { &r->length, sizeof(r->length) };
+  char control[CMSG_SPACE(sizeof(int) * RECEIVE_FDS)];
+  struct msghdr msg;
+  ssize_t got;
+
+  r->again = false;
+  for (;;) {
+    // Node's sockets are non blocking, so wait for something first
+    int ready = poll(&p, 1, POOL_SLICE_MS);
+    if (ready == 0) {
+      r->again = true;
+      return;
+    }
+    if (ready < 0) {
+      if (errno == EINTR) continue;
+      r->err = errno;
+      r->syscall = "poll";
+      return;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+#ifdef MSG_CMSG_CLOEXEC
+    got = recvmsg(r->socket, &msg, MSG_CMSG_CLOEXEC);
+#else
+    got = recvmsg(r->socket, &msg, 0);
+#endif
+    if (got < 0 && errno == EINTR) continue;
+    if (got < 0 && errno == EAGAIN) {
+      r->again = true;      // Somebody else read it first
+      return;
+    }
+    break;
+  }
+
+  if (got < 0) {
+    r->err = errno;
+    r->syscall = "recvmsg";
+    return;
+  }
+
+  // Keep the first descriptor and close any others, whatever else is wrong
+  // with the message, so nothing sent to us leaks
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    int *fds = (int*) CMSG_DATA(cmsg);
+    size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < n; i++) {
+      int fd;
+      memcpy(&fd, fds + i, sizeof(int));
+      if (r->fd == -1) {
+        r->fd = fd;
+      } else {
+        close(fd);
+      }
+    }
+  }
+
+  if (got != sizeof(r->length) || r->fd == -1 ||
+      (msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC))) {
+    if (r->fd != -1) close(r->fd);
+    r->fd = -1;
+    r->err = got == 0 ? ECONNRESET : EPROTO;
+    r->syscall = "recvmsg";
+  }
+}
+
+
+static void ReceiveAfter(uv_work_t *req) {
+  HandleScope scope;
+  receive_req *r = (receive_req*) req->data;
+
+  if (r->again) {
+    uv_queue_work(uv_default_loop(), &r->req, ReceiveWork, ReceiveAfter);
+    return;
+  }
+
+  Local<Value> argv[3];
+  if (r->err) {
+    argv[0] = ErrnoException(r->err, r->syscall);
+    argv[1] = Local<Value>::New(Undefined());
+    argv[2] = Local<Value>::New(Undefined());
+  } else {
+    argv[0] = Local<Value>::New(Null());
+    argv[1] = Integer::New(r->fd);
+    argv[2] = Number::New((double)r->length);
+  }
+
+  TryCatch try_catch;
+  r->callback->Call(Context::GetCurrent()->Global(), 3, argv);
+
+  r->callback.Dispose();
+  delete r;
+
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+}
+#endif
+
+
+// _IPCbuffer.receiveFd(socketFd, callback);
+// callback(err, fd, length) once a segment comes down the socket. It sits on
+// a threadpool thread till then, and the fd is the caller's to close.
+Handle<Value> IPCbuffer::ReceiveFd(const Arguments &args) {
+  HandleScope scope;
+
+  if (!args[0]->IsInt32()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Socket needs to be a file descriptor")));
+  }
+  if (!args[1]->IsFunction()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Last argument must be a callback")));
+  }
+
+#ifdef __POSIX__
+  receive_req *r = new receive_req;
+  r->req.data = r;
+  r->callback = Persistent<Function>::New(Local<Function>::Cast(args[1]));
+  r->socket = args[0]->Int32Value();
+  r->fd = -1;
+  r->length = 0;
+  r->err = 0;
+  r->syscall = NULL;
+  r->again = false;
+
+  uv_queue_work(uv_default_loop(), &r->req, ReceiveWork, ReceiveAfter);
+  return Undefined();
+#else
+  return ThrowException(Exception::RangeError(String::New(
+      "This OS can't pass file descriptors")));
+#endif
+}
+
+
+#define BASE64_STACK 1024
+
+// Strings this long are worth building outside the V8 heap
+#define EXTERNAL_STRING_MIN 1024
+
+/*
+ * A one byte string whose characters V8 leaves where we put them. V8
+ * deletes it when the string is collected.
+ */
+class ExternalAscii : public String::ExternalAsciiStringResource {
+ public:
+  explicit ExternalAscii(size_t length) : length_(length) {
+    data_ = new char[length];
+    AccountExternal(length);
+  }
+
+  ~ExternalAscii() {
+    delete [] data_;
+    AccountExternal(-(intptr_t)length_);
+  }
+
+  char* buffer() { return data_; }
+  const char* data() const { return data_; }
+  size_t length() const { return length_; }
+
+ private:
+  char *data_;
+  size_t length_;
+};
+
+
+
+// Plain ASCII has no decoding to do, so big ones are just copied straight
+// into an external string
+static Local<String> AsciiString(const char *data, size_t length) {
+  if (length < EXTERNAL_STRING_MIN) return String::New(data, length);
+
+  ExternalAscii *s = new ExternalAscii(length);
+  memcpy(s->buffer(), data, length);
+  return String::NewExternal(s);
+}
+
+
+static Local<String> Utf8String(const char *data, size_t length) {
+  if (ipc_ascii_prefix(data, length) == length) {
+    return AsciiString(data, length);
+  }
+  return String::New(data, length);
+}
+
+
+// Small ones go through the stack, big ones are encoded straight into the
+// string's own memory rather than copied into it afterwards
+static Local<String> Base64String(const char *data, size_t length) {
+  size_t out_len = ipc_base64_encoded_size(length);
+
+  if (out_len <= BASE64_STACK) {
+    char out[BASE64_STACK];
+    ipc_base64_encode(data, length, out);
+    return String::New(out, out_len);
+  }
+
+  ExternalAscii *out = new ExternalAscii(out_len);
+  ipc_base64_encode(data, length, out->buffer());
+  return String::NewExternal(out);
+}
+
+
+Handle<Value> IPCbuffer::BinarySlice(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  SLICE_ARGS(args[0], args[1])
+
+  char *data = parent->data_ + start;
+  //Local<String> string = String::New(data, end - start);
+  parent->CountSliced(IPC_CODEC_BINARY, end - start);
+
+  Local<Value> b =  Encode(data, end - start, BINARY);
+
+  return scope.Close(b);
+}
+
+
+Handle<Value> IPCbuffer::AsciiSlice(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  SLICE_ARGS(args[0], args[1])
+
+  char* data = parent->data_ + start;
+  Local<String> string = String::New(data, end - start);
+  parent->CountSliced(IPC_CODEC_ASCII, end - start);
+
+  return scope.Close(string);
+}
+
+
+// Throws if the bytes from start aren't all UTF-8, saying where they stop
+#define UTF8_CHECK(data, length, start)                              \
+  size_t valid = ipc_utf8_prefix(data, length);                      \
+  if (valid != length) {                                             \
+    char message[64];                                                \
+    snprintf(message, sizeof(message), "Invalid UTF-8 at byte %lu",  \
+             (unsigned long)(start + valid));                        \
+    return ThrowException(Exception::TypeError(String::New(message))); \
+  }
+
+
+// var string = buffer.utf8Slice(start, end, [strict], [base]);
+// Strict throws on bad UTF-8 rather than letting it turn into U+FFFD,
+// naming the byte counting from base, where the caller's Buffer starts
+Handle<Value> IPCbuffer::Utf8Slice(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  SLICE_ARGS(args[0], args[1])
+  char *data = parent->data_ + start;
+  size_t length = end - start;
+
+  parent->CountSliced(IPC_CODEC_UTF8, length);
+
+  size_t ascii = ipc_ascii_prefix(data, length);
+  if (ascii == length) {
+    return scope.Close(AsciiString(data, length));
+  }
+
+  if (args[2]->BooleanValue()) {
+    size_t base = args[3]->IsUint32() ? args[3]->Uint32Value() : 0;
+    UTF8_CHECK(data + ascii, length - ascii, start + ascii - base)
+  }
+
+  Local<String> string = String::New(data, length);
+  return scope.Close(string);
+}
+
+
+/*
+ * A one byte string whose characters stay where they are in the mapping.
+ * V8 deletes these in the middle of a collection, where handles can't be
+ * touched, so the hold on the buffer is let go of afterwards from a check
+ * handle instead.
+ */
+class ExternalSegment : public String::ExternalAsciiStringResource {
+ public:
+  ExternalSegment(IPCbuffer *buffer, const char *data, size_t length)
+      : buffer_(buffer), data_(data), length_(length) {
+    buffer_->Hold();
+  }
+
+  ~ExternalSegment();
+
+  const char* data() const { return data_; }
+  size_t length() const { return length_; }
+
+ private:
+  IPCbuffer *buffer_;
+  const char *data_;
+  size_t length_;
+};
+
+
+static IPCbuffer **released = NULL;
+static size_t released_count = 0;
+static size_t released_size = 0;
+static uv_check_t release_check;
+
+
+static void ReleaseSegments(uv_check_t *handle, int status) {
+  for (size_t i = 0; i < released_count; i++) {
+    released[i]->Release();
+  }
+  released_count = 0;
+  uv_check_stop(&release_check);
+}
+
+
+ExternalSegment::~ExternalSegment() {
+  if (released_count == released_size) {
+    released_size = released_size ? released_size * 2 : 16;
+    released = (IPCbuffer**) realloc(released,
+                                     released_size * sizeof(IPCbuffer*));
+  }
+  released[released_count++] = buffer_;
+  if (released_count == 1) {
+    uv_check_start(&release_check, ReleaseSegments);
+  }
+}
+
+
+// var string = buffer.sharedSlice(start, end);
+// No copy, the string is the bytes in the segment. V8 takes a string's
+// characters never changing as read, so that's only done for ASCII in a
+// segment sealed read only, which nobody can write, this process included.
+// Anything else is decoded as UTF-8 the usual way.
+Handle<Value> IPCbuffer::SharedSlice(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  SLICE_ARGS(args[0], args[1])
+  char *data = parent->data_ + start;
+  size_t length = end - start;
+
+  if (!parent->sealed_ || length == 0 ||
+      ipc_ascii_prefix(data, length) != length) {
+    parent->CountSliced(IPC_CODEC_UTF8, length);
+    return scope.Close(String::New(data, length));
+  }
+
+  parent->CountSliced(IPC_CODEC_SHARED, length);
+  return scope.Close(String::NewExternal(
+        new ExternalSegment(parent, data, length)));
+}
+
+
+// var bad = buffer.utf8Check(start, end);
+// Where the bytes stop being UTF-8, or -1 if they never do
+Handle<Value> IPCbuffer::Utf8Check(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  SLICE_ARGS(args[0], args[1])
+
+  size_t valid = ipc_utf8_prefix(parent->data_ + start, end - start);
+  if (valid == (size_t)(end - start)) {
+    return scope.Close(Integer::New(-1));
+  }
+  return scope.Close(Integer::NewFromUnsigned(start + valid));
+}
+
+
+Handle<Value> IPCbuffer::Base64Slice(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  SLICE_ARGS(args[0], args[1])
+
+  parent->CountSliced(IPC_CODEC_BASE64, end - start);
+
+  return scope.Close(Base64String(parent->data_ + start, end - start));
+}
+
+
+// Only these can be written and sliced here
+static inline bool KnownEncoding(enum encoding enc) {
+  return enc == UTF8 || enc == ASCII || enc == BINARY || enc == BASE64;
+}
+
+
+// Which of the IPC_CODEC_* counters an encoding goes in
+static inline int Codec(enum encoding enc) {
+  switch (enc) {
+    case ASCII:  return IPC_CODEC_ASCII;
+    case BASE64: return IPC_CODEC_BASE64;
+    case BINARY: return IPC_CODEC_BINARY;
+    default:     return IPC_CODEC_UTF8;
+  }
+}
+
+
+// var strings = buffer.sliceMany([start, end, start, end, ...], encoding,
+//                                [base], [limit]);
+// Ranges are from base and can't go past limit, so a view can pass its own
+Handle<Value> IPCbuffer::SliceMany(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  if (!args[0]->IsArray()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Ranges should be an array of start and end offsets")));
+  }
+  Local<Array> ranges = Local<Array>::Cast(args[0]);
+  enum encoding enc = ParseEncoding(args[1], UTF8);
+  size_t base = args[2]->IsUint32() ? args[2]->Uint32Value() : 0;
+  size_t limit = args[3]->IsUint32() ? args[3]->Uint32Value() : parent->length_;
+  uint32_t count = ranges->Length() / 2;
+
+  if (!KnownEncoding(enc)) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Unknown encoding")));
+  }
+  if (limit > parent->length_ || base > limit) {
+    return ThrowException(Exception::RangeError(String::New(
+            "base or limit out of bounds")));
+  }
+
+  // All checked before any are made, it's all or nothing
+  for (uint32_t i = 0; i < count * 2; i += 2) {
+    Local<Value> start = ranges->Get(i), end = ranges->Get(i + 1);
+    if (!start->IsUint32() || !end->IsUint32() ||
+        start->Uint32Value() > end->Uint32Value() ||
+        end->Uint32Value() > limit - base) {
+      return ThrowException(Exception::RangeError(String::New(
+              "Range out of bounds")));
+    }
+  }
+
+  Local<Array> strings = Array::New(count);
+  for (uint32_t i = 0; i < count; i++) {
+    size_t start = base + ranges->Get(i * 2)->Uint32Value();
+    size_t length = base + ranges->Get(i * 2 + 1)->Uint32Value() - start;
+    char *data = parent->data_ + start;
+    Local<Value> s;
+
+    switch (enc) {
+      case BINARY: s = Encode(data, length, BINARY); break;
+      case ASCII:  s = String::New(data, length); break;
+      case BASE64: s = Base64String(data, length); break;
+      default:     s = Utf8String(data, length); break;
+    }
+    strings->Set(i, s);
+    parent->CountSliced(Codec(enc), length);
+  }
+
+  return scope.Close(strings);
+}
+
+
+// var bytesCopied = buffer.copy(target, targetStart, sourceStart, sourceEnd);
+// Checks copy()'s arguments and works out how much it copies, NULL if
+// they're all right and what's wrong if not
+static const char* CopyRange(size_t source_length, size_t target_length,
+                             size_t target_start, size_t source_start,
+                             size_t source_end, size_t *to_copy) {
+  *to_copy = 0;
+  if (source_end < source_start) return "sourceEnd < sourceStart";
+
+  // Copy 0 bytes; we're done
+  if (source_end == source_start) return NULL;
+
+  if (target_start >= target_length) return "targetStart out of bounds";
+  if (source_start >= source_length) return "sourceStart out of bounds";
+  if (source_end > source_length) return "sourceEnd out of bounds";
+
+  *to_copy = MIN(MIN(source_end - source_start,
+                     target_length - target_start),
+                     source_length - source_start);
+  return NULL;
+}
+
+
+#define COPY_ARGS                                                    \
+  if (!IPCbuffer::HasInstance(args[0])) {                            \
+    return ThrowException(Exception::TypeError(String::New(          \
+            "First arg should be a Buffer")));                       \
+  }                                                                  \
+  Local<Object> target = args[0]->ToObject();                        \
+  if (constructor_template->HasInstance(target)) {                   \
+    NOT_SEALED(ObjectWrap::Unwrap<IPCbuffer>(target))                \
+  }                                                                  \
+  char *target_data = IPCbuffer::Data(target);                       \
+  size_t target_start = args[1]->Uint32Value();                      \
+  size_t source_start = args[2]->Uint32Value();                      \
+  size_t source_end = args[3]->IsUint32() ? args[3]->Uint32Value()   \
+                                          : source->length_;         \
+  size_t to_copy;                                                    \
+  const char *bad = CopyRange(source->length_, IPCbuffer::Length(target), \
+                              target_start, source_start, source_end, \
+                              &to_copy);                             \
+  if (bad) {                                                         \
+    return ThrowException(Exception::Error(String::New(bad)));       \
+  }
+
+
+void IPCbuffer::Copied(Handle<Object> target, size_t target_start,
+                       size_t length) {
+  ipc_count(&ipc_stats.copied, length);
+  ipc_count(&stats_.copied, length);
+
+  if (length && constructor_template->HasInstance(target)) {
+    ObjectWrap::Unwrap<IPCbuffer>(target)->MarkDirty(target_start,
+                                                      target_start + length);
+  }
+}
+
+
+// var copied = buffer.copy(target, targetStart, sourceStart, sourceEnd);
+Handle<Value> IPCbuffer::Copy(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *source = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  COPY_ARGS
+
+  if (to_copy == 0) {
+    return scope.Close(Integer::New(0));
+  }
+
+  // memmove if the ranges might overlap, and streamed past the cache if
+  // it's big
+  ipc_copy(target_data + target_start, source->data_ + source_start,
+           to_copy);
+  source->Copied(target, target_start, to_copy);
+
+  return scope.Close(Integer::New(to_copy));
+}
+
+
+#define COPY_PIECE (8 * 1024 * 1024)    // Not worth a thread for less
+
+struct copy_job {
+  Persistent<Object> source;      // Both kept alive and pinned meanwhile
+  Persistent<Object> target;
+  Persistent<Function> callback;
+  size_t target_start;
+  size_t length;
+  int pending;
+};
+
+struct copy_req {
+  uv_work_t req;
+  copy_job *job;
+  char *dst;
+  const char *src;
+  size_t length;
+  bool stream;
+};
+
+
+static void CopyWork(uv_work_t *req) {
+  copy_req *r = (copy_req*) req->data;
+  if (r->stream) {
+    ipc_copy_stream(r->dst, r->src, r->length);
+  } else {
+    ipc_copy(r->dst, r->src, r->length);
+  }
+}
+
+
+static void CopyAfter(uv_work_t *req) {
+  HandleScope scope;
+  copy_req *r = (copy_req*) req->data;
+  copy_job *job = r->job;
+  delete r;
+
+  if (--job->pending) return;
+
+  IPCbuffer *source = ObjectWrap::Unwrap<IPCbuffer>(job->source);
+  source->Copied(job->target, job->target_start, job->length);
+
+  Local<Value> argv[2] = { Local<Value>::New(Null()),
+                           Integer::New(job->length) };
+  // Unpinned first so the callback can resize either of them
+  IPCbuffer::Unpin(job->source);
+  IPCbuffer::Unpin(job->target);
+
+  TryCatch try_catch;
+  job->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+
+  job->callback.Dispose();
+  job->source.Dispose();
+  job->target.Dispose();
+  delete job;
+
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+}
+
+
+/*
+ * buffer.copyAsync(target, targetStart, sourceStart, sourceEnd, callback);
+ *
+ * The same copy done on the threadpool, callback(null, copied) once it's
+ * all there. A big one is split up so every pool thread takes a piece.
+ * Overlapping ranges are one memmove on one thread, pieces done in any
+ * old order would trample each other.
+ */
+Handle<Value> IPCbuffer::CopyAsync(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *source = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  if (!args[4]->IsFunction()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Callback required")));
+  }
+  COPY_ARGS
+
+  char *dst = target_data + target_start;
+  const char *src = source->data_ + source_start;
+  bool overlap = dst < src + to_copy && src < dst + to_copy;
+
+  size_t pieces = overlap ? 1 : PoolPieces(to_copy, COPY_PIECE);
+  // Cache lines, so no two threads store into the same one
+  size_t piece = RoundUp(RoundUp(to_copy, pieces) / pieces, 64);
+
+  copy_job *job = new copy_job;
+  job->source = Persistent<Object>::New(args.This());
+  job->target = Persistent<Object>::New(target);
+  IPCbuffer::Pin(args.This());
+  IPCbuffer::Pin(target);
+  job->callback = Persistent<Function>::New(Local<Function>::Cast(args[4]));
+  job->target_start = target_start;
+  job->length = to_copy;
+  job->pending = 0;
+
+  // Whether to stream goes by the whole copy, not the pieces
+  bool stream = !overlap && ipc_copy_streams(to_copy);
+  size_t at = 0;
+  do {
+    copy_req *r = new copy_req;
+    r->req.data = r;
+    r->job = job;
+    r->dst = dst + at;
+    r->src = src + at;
+    r->length = MIN(piece, to_copy - at);
+    r->stream = stream;
+    job->pending++;
+    uv_queue_work(uv_default_loop(), &r->req, CopyWork, CopyAfter);
+    at += r->length;
+  } while (at < to_copy);
+
+  return Undefined();
+}
+
+
+// IPCbuffer.copyConfig([streamThreshold]);
+// Copies this long or longer bypass the cache, 0 for the default
+Handle<Value> IPCbuffer::CopyConfig(const Arguments &args) {
+  HandleScope scope;
+
+  if (args[0]->IsNumber()) {
+    ipc_copy_configure((size_t) args[0]->NumberValue());
+  }
+
+  Local<Object> o = Object::New();
+  o->Set(String::NewSymbol("kernel"), String::New(ipc_copy_kernel()));
+  o->Set(String::NewSymbol("streamThreshold"),
+         Number::New((double) ipc_copy_threshold()));
+  return scope.Close(o);
+}
+
+
+#ifdef __linux__
+#define WAIT_OK         0
+#define WAIT_NOT_EQUAL  1
+#define WAIT_TIMED_OUT  2
+#define WAIT_ERROR      3
+
+static const char *wait_results[] = { "ok", "not-equal", "timed-out" };
+
+/*
+ * Block while the int32 at addr still holds expected. These are the shared
+ * (not _PRIVATE) futex ops so the waker can be any process with the same
+ * memory mapped. A negative timeout waits forever.
+ */
+static int FutexWait(int32_t *addr, int32_t expected, double timeout_ms,
+                     int *err) {
+  struct timespec now, deadline, left, *tsp = NULL;
+
+  if (timeout_ms >= 0) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)(timeout_ms / 1000);
+    deadline.tv_nsec += (long)((timeout_ms - (int64_t)(timeout_ms / 1000) * 1000.0) * 1e6);
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    tsp = &left;
+  }
+
+  for (;;) {
+    if (tsp) {
+      // FUTEX_WAIT takes a relative timeout, so work out what is left
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      left.tv_sec = deadline.tv_sec - now.tv_sec;
+      left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+      if (left.tv_nsec < 0) {
+        left.tv_sec--;
+        left.tv_nsec += 1000000000L;
+      }
+      if (left.tv_sec < 0) return WAIT_TIMED_OUT;
+    }
+    if (syscall(SYS_futex, addr, FUTEX_WAIT, expected, tsp, NULL, 0) == 0) {
+      return WAIT_OK;
+    }
+    if (errno == EAGAIN) return WAIT_NOT_EQUAL;
+    if (errno == ETIMEDOUT) return WAIT_TIMED_OUT;
+    if (errno != EINTR) {
+      *err = errno;
+      return WAIT_ERROR;
+    }
+  }
+}
+
+
+struct wait_req {
+  uv_work_t req;
+  Persistent<Object> buffer;      // Keeps the memory mapped while we sleep
+  Persistent<Function> callback;
+  int32_t *addr;
+  int32_t expected;
+  uint64_t deadline;               // uv_hrtime() to give up at, 0 never
+  int result;
+  int err;
+};
+
+
+/*
+ * The whole wait in one go, holding the thread till it's over. Unlike a
+ * descriptor a wake isn't kept for whoever looks next, so there can't be
+ * any gaps for a notify() from another process to fall into. The time
+ * spent queued for a thread counts against the timeout.
+ */
+static void WaitWork(uv_work_t *req) {
+  wait_req *w = (wait_req*) req->data;
+  double timeout = -1;
+
+  if (w->deadline) {
+    uint64_t now = uv_hrtime();
+    timeout = now >= w->deadline ? 0 : (w->deadline - now) / 1e6;
+  }
+  w->result = FutexWait(w->addr, w->expected, timeout, &w->err);
+}
+
+
+static void WaitAfter(uv_work_t *req) {
+  HandleScope scope;
+  wait_req *w = (wait_req*) req->data;
+
+  Local<Value> argv[2];
+  if (w->result == WAIT_ERROR) {
+    argv[0] = ErrnoException(w->err, "futex");
+    argv[1] = Local<Value>::New(Undefined());
+  } else {
+    argv[0] = Local<Value>::New(Null());
+    argv[1] = String::New(wait_results[w->result]);
+  }
+
+  // Unpinned first, waking to remap is what the size word is for
+  IPCbuffer::Unpin(w->buffer);
+
+  TryCatch try_catch;
+  w->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+
+  w->callback.Dispose();
+  w->buffer.Dispose();
+  delete w;
+
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+}
+#endif
+
+
+#define FUTEX_ARGS(offset_arg)                                       \
+  if (!offset_arg->IsUint32()) {                                     \
+    return ThrowException(Exception::TypeError(                      \
+          String::New("Bad argument.")));                            \
+  }                                                                  \
+  size_t offset = offset_arg->Uint32Value();                         \
+  if (offset % 4 || offset + 4 > buffer->length_ ||                  \
+      (uintptr_t)(buffer->data_ + offset) % 4) {                     \
+    return ThrowException(Exception::RangeError(                     \
+          String::New("offset must be an aligned int32 in the buffer"))); \
+  }                                                                  \
+  int32_t *addr = (int32_t*)(buffer->data_ + offset);
+
+
+// Anything that isn't a sensible number of milliseconds means forever
+static inline double WaitTimeout(Handle<Value> arg) {
+  if (arg->IsNumber() && arg->NumberValue() >= 0 &&
+      arg->NumberValue() < 1e15) {
+    return arg->NumberValue();
+  }
+  return -1;
+}
+
+
+// buffer.wait(offset, expected, [timeoutMs], callback);
+// callback(err, "ok" | "not-equal" | "timed-out") from the threadpool
+Handle<Value> IPCbuffer::Wait(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+#ifdef __linux__
+  FUTEX_ARGS(args[0])
+
+  Local<Value> cb = args[args.Length() - 1];
+  if (!cb->IsFunction()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Last argument must be a callback")));
+  }
+
+  wait_req *w = new wait_req;
+  w->req.data = w;
+  w->buffer = Persistent<Object>::New(args.This());
+  IPCbuffer::Pin(args.This());
+  w->callback = Persistent<Function>::New(Local<Function>::Cast(cb));
+  w->addr = addr;
+  w->expected = args[1]->Int32Value();
+  double timeout = WaitTimeout(args[2]);
+  w->deadline = timeout < 0 ? 0 : uv_hrtime() + (uint64_t)(timeout * 1e6);
+  w->result = WAIT_ERROR;
+  w->err = 0;
+
+  uv_queue_work(uv_default_loop(), &w->req, WaitWork, WaitAfter);
+
+  return Undefined();
+#else
+  return ThrowException(Exception::Error(String::New(
+          "This OS can't wait on shared memory")));
+#endif
+}
+
+
+// var result = buffer.waitSync(offset, expected, [timeoutMs]);
+// Blocks the whole thread, only for processes with no event loop to speak of
+Handle<Value> IPCbuffer::WaitSync(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+#ifdef __linux__
+  FUTEX_ARGS(args[0])
+
+  int err = 0;
+  int result = FutexWait(addr, args[1]->Int32Value(), WaitTimeout(args[2]),
+                         &err);
+  if (result == WAIT_ERROR) {
+    return ThrowException(ErrnoException(err, "futex"));
+  }
+
+  return scope.Close(String::New(wait_results[result]));
+#else
+  return ThrowException(Exception::Error(String::New(
+          "This OS can't wait on shared memory")));
+#endif
+}
+
+
+// var woken = buffer.notify(offset, [count]);
+Handle<Value> IPCbuffer::Notify(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+#ifdef __linux__
+  FUTEX_ARGS(args[0])
+
+  int count = args[1]->IsUint32() && args[1]->Uint32Value() < 0x7fffffff
+            ? args[1]->Int32Value() : 0x7fffffff;
+
+  long woken = syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+  if (woken < 0) {
+    return ThrowException(ErrnoException(errno, "futex"));
+  }
+
+  return scope.Close(Integer::New(woken));
+#else
+  return ThrowException(Exception::Error(String::New(
+          "This OS can't wait on shared memory")));
+#endif
+}
+
+
+#define ATOMIC_LOAD       0
+#define ATOMIC_STORE      1
+#define ATOMIC_EXCHANGE   2
+#define ATOMIC_FETCH_ADD  3
+#define ATOMIC_FETCH_OR   4
+#define ATOMIC_CAS        5
+
+/*
+ * The __atomic builtins only honour the memory order when it is a compile
+ * time constant (anything else silently becomes seq_cst), so each order
+ * gets its own instantiation. Orders that make no sense for an op are
+ * rejected before we get here, the mapping below just keeps gcc quiet.
+ */
+template <typename T, int order>
+static inline T AtomicApply(int op, volatile T *p, T value, T desired) {
+  const int load_order = (order == IPC_RELEASE || order == IPC_ACQ_REL)
+                       ? IPC_ACQUIRE : order;
+  const int store_order = (order == IPC_ACQUIRE || order == IPC_ACQ_REL)
+                        ? IPC_RELEASE : order;
+  const int fail_order = order == IPC_ACQ_REL ? IPC_ACQUIRE
+                       : order == IPC_RELEASE ? IPC_RELAXED : order;
+
+  switch (op) {
+    case ATOMIC_LOAD:
+      return __atomic_load_n(p, load_order);
+    case ATOMIC_STORE:
+      __atomic_store_n(p, value, store_order);
+      return value;
+    case ATOMIC_EXCHANGE:
+      return __atomic_exchange_n(p, value, order);
+    case ATOMIC_FETCH_ADD:
+      return __atomic_fetch_add(p, value, order);
+    case ATOMIC_FETCH_OR:
+      return __atomic_fetch_or(p, value, order);
+    default:
+      // Returns what was there, which is value if it worked
+      __atomic_compare_exchange_n(p, &value, desired, false,
+                                  order, fail_order);
+      return value;
+  }
+}
+
+
+template <typename T>
+static inline T AtomicDispatch(int op, volatile T *p, T value, T desired,
+                               int order) {
+  switch (order) {
+    case IPC_RELAXED: return AtomicApply<T, IPC_RELAXED>(op, p, value, desired);
+    case IPC_ACQUIRE: return AtomicApply<T, IPC_ACQUIRE>(op, p, value, desired);
+    case IPC_RELEASE: return AtomicApply<T, IPC_RELEASE>(op, p, value, desired);
+    case IPC_ACQ_REL: return AtomicApply<T, IPC_ACQ_REL>(op, p, value, desired);
+    default:          return AtomicApply<T, IPC_SEQ_CST>(op, p, value, desired);
+  }
+}
+
+
+static bool ParseOrder(Handle<Value> arg, int *order) {
+  if (arg->IsUndefined() || arg->IsNull()) {
+    *order = IPC_SEQ_CST;
+    return true;
+  }
+
+  String::AsciiValue name(arg->ToString());
+  if (!strcmp(*name, "seq_cst")) *order = IPC_SEQ_CST;
+  else if (!strcmp(*name, "relaxed")) *order = IPC_RELAXED;
+  else if (!strcmp(*name, "acquire")) *order = IPC_ACQUIRE;
+  else if (!strcmp(*name, "release")) *order = IPC_RELEASE;
+  else if (!strcmp(*name, "acq_rel")) *order = IPC_ACQ_REL;
+  else return false;
+
+  return true;
+}
+
+
+// All the atomics look like op(offset, [value], [desired], [bits], [order])
+// with bits 32 (the default) or 64. 32 bit values are signed like wait().
+Handle<Value> IPCbuffer::Atomic(const Arguments &args, int op) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  int operands = op == ATOMIC_LOAD ? 0 : op == ATOMIC_CAS ? 2 : 1;
+  Local<Value> bits_arg = args[1 + operands];
+  Local<Value> order_arg = args[2 + operands];
+
+  uint32_t bits = bits_arg->IsUndefined() ? 32 : bits_arg->Uint32Value();
+  if (bits != 32 && bits != 64) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Only 32 and 64 bit atomics")));
+  }
+
+  int order;
+  if (!ParseOrder(order_arg, &order)) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Unknown memory order")));
+  }
+  if ((op == ATOMIC_LOAD && (order == IPC_RELEASE || order == IPC_ACQ_REL)) ||
+      (op == ATOMIC_STORE && (order == IPC_ACQUIRE || order == IPC_ACQ_REL))) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Memory order not allowed for this operation")));
+  }
+
+  if (!args[0]->IsUint32()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Bad argument.")));
+  }
+  size_t offset = args[0]->Uint32Value();
+  size_t width = bits / 8;
+  char *p = buffer->data_ + offset;
+  if (offset + width > buffer->length_ || (uintptr_t)p % width) {
+    return ThrowException(Exception::RangeError(String::New(
+            "offset must be aligned and inside the buffer")));
+  }
+
+  if (op != ATOMIC_LOAD) {
+    NOT_SEALED(buffer)
+    buffer->MarkDirty(offset, offset + width);
+  }
+
+  if (bits == 32) {
+    int32_t ret = AtomicDispatch<int32_t>(op, (volatile int32_t*)p,
+                                          args[1]->Int32Value(),
+                                          args[2]->Int32Value(), order);
+    return scope.Close(Integer::New(ret));
+  }
+
+  // Numbers only hold 53 bits, past that it's best effort
+  int64_t ret = AtomicDispatch<int64_t>(op, (volatile int64_t*)p,
+                                        args[1]->IntegerValue(),
+                                        args[2]->IntegerValue(), order);
+  return scope.Close(Number::New((double)ret));
+}
+
+
+// var value = buffer.load(offset, [bits], [order]);
+Handle<Value> IPCbuffer::AtomicLoad(const Arguments &args) {
+  return Atomic(args, ATOMIC_LOAD);
+}
+
+
+// buffer.store(offset, value, [bits], [order]);
+Handle<Value> IPCbuffer::AtomicStore(const Arguments &args) {
+  return Atomic(args, ATOMIC_STORE);
+}
+
+
+// var old = buffer.exchange(offset, value, [bits], [order]);
+Handle<Value> IPCbuffer::AtomicExchange(const Arguments &args) {
+  return Atomic(args, ATOMIC_EXCHANGE);
+}
+
+
+// var old = buffer.fetchAdd(offset, value, [bits], [order]);
+Handle<Value> IPCbuffer::AtomicFetchAdd(const Arguments &args) {
+  return Atomic(args, ATOMIC_FETCH_ADD);
+}
+
+
+// var old = buffer.fetchOr(offset, value, [bits], [order]);
+Handle<Value> IPCbuffer::AtomicFetchOr(const Arguments &args) {
+  return Atomic(args, ATOMIC_FETCH_OR);
+}
+
+
+// var old = buffer.compareExchange(offset, expected, desired, [bits], [order]);
+// It worked if old == expected
+Handle<Value> IPCbuffer::AtomicCompareExchange(const Arguments &args) {
+  return Atomic(args, ATOMIC_CAS);
+}
+
+
+// Numbers as raw bytes. The low bits of a type are its width in bytes.
+#define NUMBER_WIDTH(type)  ((type) & 0x0F)
+#define NUMBER_SIGNED       0x10
+#define NUMBER_FLOAT        0x20
+#define NUMBER_BE           0x40
+
+static const struct {
+  const char *name;
+  int type;
+  ExternalArrayType array;    // What a typed array of them is, 0 for none
+} number_types[] = {
+  { "UInt8",    1,                                     kExternalUnsignedByteArray },
+  { "Int8",     1 | NUMBER_SIGNED,                     kExternalByteArray },
+  { "UInt16LE", 2,                                     kExternalUnsignedShortArray },
+  { "UInt16BE", 2 | NUMBER_BE,                         kExternalUnsignedShortArray },
+  { "Int16LE",  2 | NUMBER_SIGNED,                     kExternalShortArray },
+  { "Int16BE",  2 | NUMBER_SIGNED | NUMBER_BE,         kExternalShortArray },
+  { "UInt32LE", 4,                                     kExternalUnsignedIntArray },
+  { "UInt32BE", 4 | NUMBER_BE,                         kExternalUnsignedIntArray },
+  { "Int32LE",  4 | NUMBER_SIGNED,                     kExternalIntArray },
+  { "Int32BE",  4 | NUMBER_SIGNED | NUMBER_BE,         kExternalIntArray },
+  { "UInt64LE", 8,                                     (ExternalArrayType)0 },
+  { "UInt64BE", 8 | NUMBER_BE,                         (ExternalArrayType)0 },
+  { "Int64LE",  8 | NUMBER_SIGNED,                     (ExternalArrayType)0 },
+  { "Int64BE",  8 | NUMBER_SIGNED | NUMBER_BE,         (ExternalArrayType)0 },
+  { "FloatLE",  4 | NUMBER_FLOAT,                      kExternalFloatArray },
+  { "FloatBE",  4 | NUMBER_FLOAT | NUMBER_BE,          kExternalFloatArray },
+  { "DoubleLE", 8 | NUMBER_FLOAT,                      kExternalDoubleArray },
+  { "DoubleBE", 8 | NUMBER_FLOAT | NUMBER_BE,          kExternalDoubleArray }
+};
+#define NUMBER_TYPES (sizeof(number_types) / sizeof(number_types[0]))
+
+
+static int FindNumberType(Handle<Value> arg) {
+  if (!arg->IsUint32()) return -1;
+  int type = arg->Uint32Value();
+  for (size_t i = 0; i < NUMBER_TYPES; i++) {
+    if (number_types[i].type == type) return i;
+  }
+  return -1;
+}
+
+
+static inline bool NeedsSwap(int type) {
+  return NUMBER_WIDTH(type) > 1 && !(type & NUMBER_BE) != !IPC_BIG_ENDIAN;
+}
+
+
+// memcpy because offsets needn't be aligned, gcc makes it a plain load
+static inline uint64_t LoadRaw(const char *p, int type) {
+  bool swap = NeedsSwap(type);
+  switch (NUMBER_WIDTH(type)) {
+    case 1: return (uint8_t) *p;
+    case 2: {
+      uint16_t v;
+      memcpy(&v, p, 2);
+      return swap ? ipc_bswap16(v) : v;
+    }
+    case 4: {
+      uint32_t v;
+      memcpy(&v, p, 4);
+      return swap ? ipc_bswap32(v) : v;
+    }
+    default: {
+      uint64_t v;
+      memcpy(&v, p, 8);
+      return swap ? ipc_bswap64(v) : v;
+    }
+  }
+}
+
+
+static inline void StoreRaw(char *p, uint64_t raw, int type) {
+  bool swap = NeedsSwap(type);
+  switch (NUMBER_WIDTH(type)) {
+    case 1: *p = (char) raw; break;
+    case 2: {
+      uint16_t v = swap ? ipc_bswap16(raw) : raw;
+      memcpy(p, &v, 2);
+      break;
+    }
+    case 4: {
+      uint32_t v = swap ? ipc_bswap32(raw) : raw;
+      memcpy(p, &v, 4);
+      break;
+    }
+    default: {
+      uint64_t v = swap ? ipc_bswap64(raw) : raw;
+      memcpy(p, &v, 8);
+      break;
+    }
+  }
+}
+
+
+static inline double RawToNumber(uint64_t raw, int type) {
+  if (type & NUMBER_FLOAT) {
+    if (NUMBER_WIDTH(type) == 4) {
+      uint32_t bits = raw;
+      float f;
+      memcpy(&f, &bits, 4);
+      return f;
+    }
+    double d;
+    memcpy(&d, &raw, 8);
+    return d;
+  }
+  if (!(type & NUMBER_SIGNED)) return (double) raw;
+  switch (NUMBER_WIDTH(type)) {
+    case 1: return (int8_t) raw;
+    case 2: return (int16_t) raw;
+    case 4: return (int32_t) raw;
+    default: return (double)(int64_t) raw;
+  }
+}
+
+
+/*
+ * Integers up to 32 bits wrap like they do storing into a typed array. 64
+ * bit ones only have the 53 bits a Number holds, and anything that won't
+ * fit at all is stored as 0 rather than whatever the cast makes of it.
+ */
+static inline uint64_t NumberToRaw(Handle<Value> value, int type) {
+  if (type & NUMBER_FLOAT) {
+    if (NUMBER_WIDTH(type) == 4) {
+      float f = (float) value->NumberValue();
+      uint32_t bits;
+      memcpy(&bits, &f, 4);
+      return bits;
+    }
+    double d = value->NumberValue();
+    uint64_t raw;
+    memcpy(&raw, &d, 8);
+    return raw;
+  }
+  if (NUMBER_WIDTH(type) < 8) return (uint32_t) value->Int32Value();
+
+  double d = value->NumberValue();
+  if (d >= 9223372036854775808.0 && d < 18446744073709551616.0) {
+    return (uint64_t)(d - 9223372036854775808.0) | 0x8000000000000000ULL;
+  }
+  if (d >= -9223372036854775808.0 && d < 9223372036854775808.0) {
+    return (uint64_t)(int64_t) d;
+  }
+  return 0;
+}
+
+
+#define NUMBER_ARGS(type_arg, count)                                 \
+  int index = FindNumberType(type_arg);                              \
+  if (index < 0) {                                                   \
+    return ThrowException(Exception::TypeError(String::New(          \
+            "Unknown number type")));                                \
+  }                                                                  \
+  int type = number_types[index].type;                               \
+  if (!args[0]->IsUint32()) {                                        \
+    return ThrowException(Exception::TypeError(String::New(          \
+            "Bad argument.")));                                      \
+  }                                                                  \
+  size_t offset = args[0]->Uint32Value();                            \
+  size_t bytes = (size_t)(count) * NUMBER_WIDTH(type);               \
+  if (offset > buffer->length_ || bytes > buffer->length_ - offset) { \
+    return ThrowException(Exception::RangeError(String::New(         \
+            "Trying to access beyond buffer length")));              \
+  }
+
+
+// var value = buffer.readNumber(offset, type);
+Handle<Value> IPCbuffer::ReadNumber(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NUMBER_ARGS(args[1], 1)
+
+  uint64_t raw = LoadRaw(buffer->data_ + offset, type);
+  return scope.Close(Number::New(RawToNumber(raw, type)));
+}
+
+
+// buffer.writeNumber(offset, value, type);
+Handle<Value> IPCbuffer::WriteNumber(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NOT_SEALED(buffer)
+  NUMBER_ARGS(args[2], 1)
+
+  StoreRaw(buffer->data_ + offset, NumberToRaw(args[1], type), type);
+  buffer->MarkDirty(offset, offset + bytes);
+  return scope.Close(Integer::NewFromUnsigned(offset + bytes));
+}
+
+
+// The memory behind a typed array of exactly this type with count in it
+static char* ArrayData(Handle<Value> v, int index, uint32_t count) {
+  if (!number_types[index].array || !v->IsObject()) return NULL;
+  Local<Object> o = v->ToObject();
+  if (!o->HasIndexedPropertiesInExternalArrayData() ||
+      o->GetIndexedPropertiesExternalArrayDataType() != number_types[index].array ||
+      (uint32_t) o->GetIndexedPropertiesExternalArrayDataLength() < count) {
+    return NULL;
+  }
+  return (char*) o->GetIndexedPropertiesExternalArrayData();
+}
+
+
+/*
+ * buffer.readArray(offset, type, array, count);
+ * buffer.writeArray(offset, type, array, count);
+ *
+ * Fills count elements of array from the buffer, or the other way. A
+ * typed array of the same type is one copy, byte swapped a vector at a
+ * time if it's the other byte order. Anything else, plain arrays and 64
+ * bit integers, goes a value at a time but still in the one call.
+ */
+Handle<Value> IPCbuffer::ReadArray(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  if (!args[2]->IsObject() || !args[3]->IsUint32()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Bad argument.")));
+  }
+  uint32_t count = args[3]->Uint32Value();
+  NUMBER_ARGS(args[1], count)
+
+  const char *src = buffer->data_ + offset;
+  char *dst = ArrayData(args[2], index, count);
+  if (dst) {
+    if (NeedsSwap(type)) {
+      ipc_swap_copy(dst, src, count, NUMBER_WIDTH(type));
+    } else {
+      memcpy(dst, src, bytes);
+    }
+  } else {
+    Local<Object> array = args[2]->ToObject();
+    for (uint32_t i = 0; i < count; i++) {
+      uint64_t raw = LoadRaw(src + i * NUMBER_WIDTH(type), type);
+      array->Set(i, Number::New(RawToNumber(raw, type)));
+    }
+  }
+
+  return scope.Close(args[2]);
+}
+
+
+Handle<Value> IPCbuffer::WriteArray(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NOT_SEALED(buffer)
+  if (!args[2]->IsObject() || !args[3]->IsUint32()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Bad argument.")));
+  }
+  uint32_t count = args[3]->Uint32Value();
+  NUMBER_ARGS(args[1], count)
+
+  char *dst = buffer->data_ + offset;
+  const char *src = ArrayData(args[2], index, count);
+  if (src) {
+    if (NeedsSwap(type)) {
+      ipc_swap_copy(dst, src, count, NUMBER_WIDTH(type));
+    } else {
+      memmove(dst, src, bytes);   // It could be a view of this buffer
+    }
+  } else {
+    Local<Object> array = args[2]->ToObject();
+    for (uint32_t i = 0; i < count; i++) {
+      StoreRaw(dst + i * NUMBER_WIDTH(type), NumberToRaw(array->Get(i), type),
+               type);
+    }
+  }
+
+  buffer->MarkDirty(offset, offset + bytes);
+  return scope.Close(Integer::NewFromUnsigned(offset + bytes));
+}
+
+
+#define RANGE_ARGS(start_arg, end_arg)                               \
+  size_t start = start_arg->IsUndefined() ? 0 : start_arg->Uint32Value(); \
+  size_t end = end_arg->IsUndefined() ? buffer->length_                 \
+                                      : end_arg->Uint32Value();       \
+  if (start > end || end > buffer->length_) {                        \
+    return ThrowException(Exception::RangeError(                     \
+          String::New("Bad range")));                                \
+  }
+
+
+// buffer.fill(value, start, end);
+// value is a byte, or a string whose UTF-8 is repeated over the range
+Handle<Value> IPCbuffer::Fill(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NOT_SEALED(buffer)
+  RANGE_ARGS(args[1], args[2])
+
+  char *p = buffer->data_ + start;
+  size_t length = end - start;
+
+  if (args[0]->IsString()) {
+    String::Utf8Value pattern(args[0]);
+    size_t n = MIN((size_t) pattern.length(), length);
+    if (n == 0) {
+      memset(p, 0, length);
+    } else {
+      // Once by hand, then double what's there till it's full
+      memcpy(p, *pattern, n);
+      while (n < length) {
+        size_t more = MIN(n, length - n);
+        memcpy(p + n, p, more);
+        n += more;
+      }
+    }
+  } else {
+    memset(p, args[0]->Uint32Value() & 0xFF, length);
+  }
+
+  buffer->MarkDirty(start, end);
+  return Undefined();
+}
+
+
+#define OTHER_ARGS(other_arg, start_arg, end_arg)                    \
+  if (!IPCbuffer::HasInstance(other_arg)) {                          \
+    return ThrowException(Exception::TypeError(String::New(          \
+            "First arg should be a Buffer")));                       \
+  }                                                                  \
+  Local<Object> other = other_arg->ToObject();                       \
+  size_t other_length = IPCbuffer::Length(other);                    \
+  size_t other_start = start_arg->IsUndefined() ? 0 : start_arg->Uint32Value(); \
+  size_t other_end = end_arg->IsUndefined() ? other_length           \
+                                            : end_arg->Uint32Value(); \
+  if (other_start > other_end || other_end > other_length) {         \
+    return ThrowException(Exception::RangeError(                     \
+          String::New("Bad range")));                                \
+  }                                                                  \
+  const char *other_data = IPCbuffer::Data(other) + other_start;     \
+  size_t other_bytes = other_end - other_start;
+
+
+/*
+ * var order = buffer.compare(other, start, end, otherStart, otherEnd);
+ *
+ * -1, 0 or 1, the way memcmp orders them, the shorter first if one is the
+ * start of the other. other is any Buffer, shared or not, from any
+ * segment.
+ */
+Handle<Value> IPCbuffer::Compare(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  RANGE_ARGS(args[1], args[2])
+  OTHER_ARGS(args[0], args[3], args[4])
+
+  size_t bytes = end - start;
+  int order = memcmp(buffer->data_ + start, other_data,
+                     MIN(bytes, other_bytes));
+  if (order == 0) order = bytes < other_bytes ? -1 : bytes > other_bytes;
+  return scope.Close(Integer::New(order < 0 ? -1 : order > 0));
+}
+
+
+// var same = buffer.equals(other, start, end, otherStart, otherEnd);
+Handle<Value> IPCbuffer::Equals(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  RANGE_ARGS(args[1], args[2])
+  OTHER_ARGS(args[0], args[3], args[4])
+
+  const char *p = buffer->data_ + start;
+  bool same = end - start == other_bytes &&
+              (p == other_data || !memcmp(p, other_data, other_bytes));
+  return scope.Close(Boolean::New(same));
+}
+
+
+/*
+ * var at = buffer.indexOf(value, from, base, limit);
+ * var at = buffer.lastIndexOf(value, from, base, limit);
+ *
+ * Looks between base and limit, for a byte, a Buffer or a string's UTF-8.
+ * from and the answer are relative to base, and -1 is not found. indexOf
+ * starts looking at from, lastIndexOf won't find anything starting after
+ * it.
+ */
+Handle<Value> IPCbuffer::Search(const Arguments &args, bool last) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  size_t base = args[2]->IsUint32() ? args[2]->Uint32Value() : 0;
+  size_t limit = args[3]->IsUint32() ? args[3]->Uint32Value()
+                                     : buffer->length_;
+  if (limit > buffer->length_ || base > limit) {
+    return ThrowException(Exception::RangeError(String::New(
+            "base or limit out of bounds")));
+  }
+  size_t length = limit - base;
+  size_t from = args[1]->IsUint32() ? args[1]->Uint32Value()
+                                    : last ? length : 0;
+
+  char byte;
+  const char *needle;
+  size_t needle_length;
+  Handle<Value> value = args[0];
+  String::Utf8Value utf8(value->IsString() ? value
+                                         : Handle<Value>(String::New("")));
+
+  if (value->IsNumber()) {
+    byte = value->Uint32Value() & 0xFF;
+    needle = &byte;
+    needle_length = 1;
+  } else if (value->IsString()) {
+    needle = *utf8;
+    needle_length = utf8.length();
+  } else if (IPCbuffer::HasInstance(value)) {
+    needle = IPCbuffer::Data(value->ToObject());
+    needle_length = IPCbuffer::Length(value->ToObject());
+  } else {
+    return ThrowException(Exception::TypeError(String::New(
+            "value should be a byte, a string or a Buffer")));
+  }
+
+  const char *hay = buffer->data_ + base;
+  ssize_t at;
+  if (last) {
+    // Anything starting at from or before it, so it can end at from + n
+    size_t end = MIN(length, from + needle_length);
+    at = ipc_search_last(hay, end, needle, needle_length);
+  } else if (from > length) {
+    at = -1;
+  } else {
+    at = ipc_search_first(hay + from, length - from, needle, needle_length);
+    if (at >= 0) at += from;
+  }
+
+  return scope.Close(Integer::New(at));
+}
+
+
+Handle<Value> IPCbuffer::IndexOf(const Arguments &args) {
+  return Search(args, false);
+}
+
+
+Handle<Value> IPCbuffer::LastIndexOf(const Arguments &args) {
+  return Search(args, true);
+}
+
+#define CHECKSUM_PIECE (16 * 1024 * 1024)
+
+struct checksum_job {
+  Persistent<Object> buffer;
+  Persistent<Function> callback;
+  bool crc;                 // CRC-32C, or else hash64
+  uint32_t crc_in;
+  uint64_t seed;
+  uint64_t hash;
+  uint32_t *crcs;           // One a piece, joined up once they're all in
+  size_t pieces;
+  size_t piece;
+  size_t length;
+  int pending;
+};
+
+struct checksum_req {
+  uv_work_t req;
+  checksum_job *job;
+  const char *data;
+  size_t length;
+  size_t index;
+};
+
+
+static Local<Value> HashString(uint64_t hash) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+  return String::New(hex);
+}
+
+
+static void ChecksumWork(uv_work_t *req) {
+  checksum_req *r = (checksum_req*) req->data;
+  checksum_job *job = r->job;
+  if (job->crc) {
+    job->crcs[r->index] = ipc_crc32c(0, r->data, r->length);
+  } else {
+    job->hash = ipc_hash64(r->data, r->length, job->seed);
+  }
+}
+
+
+static void ChecksumAfter(uv_work_t *req) {
+  HandleScope scope;
+  checksum_req *r = (checksum_req*) req->data;
+  checksum_job *job = r->job;
+  delete r;
+
+  if (--job->pending) return;
+
+  Local<Value> result;
+  if (job->crc) {
+    uint32_t crc = job->crc_in;
+    for (size_t i = 0; i < job->pieces; i++) {
+      size_t length = MIN(job->piece, job->length - i * job->piece);
+      crc = ipc_crc32c_combine(crc, job->crcs[i], length);
+    }
+    result = Integer::NewFromUnsigned(crc);
+  } else {
+    result = HashString(job->hash);
+  }
+
+  Local<Value> argv[2] = { Local<Value>::New(Null()), result };
+  IPCbuffer::Unpin(job->buffer);
+
+  TryCatch try_catch;
+  job->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+
+  job->callback.Dispose();
+  job->buffer.Dispose();
+  delete [] job->crcs;
+  delete job;
+
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+}
+
+
+/*
+ * var crc = buffer.crc32c([start], [end], [crc], [callback]);
+ * var hash = buffer.hash64([start], [end], [seed], [callback]);
+ *
+ * crc carries on from an earlier range's. The hash is 16 hex digits, a
+ * Number can't hold 64 bits. With a callback it's worked out on the
+ * threadpool and callback(null, crc or hash) gets it, and a big CRC is
+ * split up between the threads and joined up after.
+ */
+Handle<Value> IPCbuffer::Checksum(const Arguments &args, bool crc) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  Local<Value> cb = args[args.Length() - 1];
+  bool async = cb->IsFunction();
+  Local<Value> start_arg = args[0];
+  Local<Value> end_arg = args[1];
+  Local<Value> seed_arg = args[2];
+  if (start_arg->IsFunction()) start_arg = Local<Value>::New(Undefined());
+  if (end_arg->IsFunction()) end_arg = Local<Value>::New(Undefined());
+  if (seed_arg->IsFunction()) seed_arg = Local<Value>::New(Undefined());
+  RANGE_ARGS(start_arg, end_arg)
+
+  const char *data = buffer->data_ + start;
+  size_t length = end - start;
+  uint32_t crc_in = seed_arg->IsUndefined() ? 0 : seed_arg->Uint32Value();
+  uint64_t seed = seed_arg->IsUndefined() ? 0
+                                          : (uint64_t) seed_arg->IntegerValue();
+
+  if (!async) {
+    if (crc) {
+      return scope.Close(Integer::NewFromUnsigned(
+              ipc_crc32c(crc_in, data, length)));
+    }
+    return scope.Close(HashString(ipc_hash64(data, length, seed)));
+  }
+
+  // The hash only goes one way, but CRCs of pieces can be joined up
+  size_t pieces = crc ? PoolPieces(length, CHECKSUM_PIECE) : 1;
+
+  checksum_job *job = new checksum_job;
+  job->buffer = Persistent<Object>::New(args.This());
+  IPCbuffer::Pin(args.This());
+  job->callback = Persistent<Function>::New(Local<Function>::Cast(cb));
+  job->crc = crc;
+  job->crc_in = crc_in;
+  job->seed = seed;
+  job->hash = 0;
+  job->piece = pieces > 1 ? RoundUp(length, pieces) / pieces : length;
+  job->pieces = pieces;
+  job->crcs = new uint32_t[pieces];
+  job->length = length;
+  job->pending = 0;
+
+  for (size_t i = 0; i < pieces; i++) {
+    checksum_req *r = new checksum_req;
+    r->req.data = r;
+    r->job = job;
+    r->index = i;
+    r->data = data + i * job->piece;
+    r->length = MIN(job->piece, length - i * job->piece);
+    job->pending++;
+    uv_queue_work(uv_default_loop(), &r->req, ChecksumWork, ChecksumAfter);
+  }
+
+  return Undefined();
+}
+
+
+Handle<Value> IPCbuffer::Crc32c(const Arguments &args) {
+  return Checksum(args, true);
+}
+
+
+Handle<Value> IPCbuffer::Hash64(const Arguments &args) {
+  return Checksum(args, false);
+}
+
+// buffer.advise(advice, [start], [end]);
+// advice is "normal", "sequential", "random", "willneed" or "dontneed"
+Handle<Value> IPCbuffer::Advise(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+#ifdef __POSIX__
+  int advice = ParseAdvice(args[0]);
+  if (advice < 0) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Unknown advice")));
+  }
+  RANGE_ARGS(args[1], args[2])
+
+  if (AdviseRange(buffer->data_ + start, end - start, advice,
+                  buffer->backing_ == IPC_BACKING_HEAP) < 0) {
+    return ThrowException(ErrnoException(errno, "madvise"));
+  }
+
+  return Undefined();
+#else
+  return ThrowException(Exception::Error(String::New(
+          "This OS can't take advice")));
+#endif
+}
+
+
+#define PREFAULT_CHUNK (4 * 1024 * 1024)
+
+struct prefault_job {
+  Persistent<Object> buffer;      // Keeps the memory mapped meanwhile
+  Persistent<Function> callback;
+  int pending;
+};
+
+struct prefault_req {
+  uv_work_t req;
+  prefault_job *job;
+  char *start;
+  size_t length;
+  bool write;
+};
+
+
+static void PrefaultWork(uv_work_t *req) {
+  prefault_req *r = (prefault_req*) req->data;
+  PrefaultRange(r->start, r->length, r->write);
+}
+
+
+static void PrefaultAfter(uv_work_t *req) {
+  HandleScope scope;
+  prefault_req *r = (prefault_req*) req->data;
+  prefault_job *job = r->job;
+  delete r;
+
+  if (--job->pending) return;
+
+  Local<Value> argv[1] = { Local<Value>::New(Null()) };
+  IPCbuffer::Unpin(job->buffer);
+
+  TryCatch try_catch;
+  job->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+
+  job->callback.Dispose();
+  job->buffer.Dispose();
+  delete job;
+
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+}
+
+
+// buffer.prefault([start], [end], [callback]);
+// With a callback the range is split up and faulted in across the
+// threadpool, without one it happens here and now.
+Handle<Value> IPCbuffer::Prefault(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+
+  Local<Value> cb = args[args.Length() - 1];
+  bool async = cb->IsFunction();
+  Local<Value> start_arg = args[0];
+  Local<Value> end_arg = args[1];
+  if (start_arg->IsFunction()) start_arg = Local<Value>::New(Undefined());
+  if (end_arg->IsFunction()) end_arg = Local<Value>::New(Undefined());
+  RANGE_ARGS(start_arg, end_arg)
+
+  bool write = WritePrefault(buffer->backing_);
+
+  if (!async) {
+    PrefaultRange(buffer->data_ + start, end - start, write);
+    return Undefined();
+  }
+
+  // One piece per pool thread, but no point splitting small ranges
+  size_t length = end - start;
+  size_t pieces = PoolPieces(length, PREFAULT_CHUNK);
+  size_t piece = RoundUp(RoundUp(length, pieces) / pieces, base_page_size);
+
+  prefault_job *job = new prefault_job;
+  job->buffer = Persistent<Object>::New(args.This());
+  IPCbuffer::Pin(args.This());
+  job->callback = Persistent<Function>::New(Local<Function>::Cast(cb));
+  job->pending = 0;
+
+  size_t at = start;
+  do {
+    prefault_req *r = new prefault_req;
+    r->req.data = r;
+    r->job = job;
+    r->start = buffer->data_ + at;
+    r->length = MIN(piece, end - at);
+    r->write = write;
+    job->pending++;
+    uv_queue_work(uv_default_loop(), &r->req, PrefaultWork, PrefaultAfter);
+    at += r->length;
+  } while (at < end);
 
-  Replace(NULL, length, NULL, NULL);
+  return Undefined();
 }
 
 
-IPCbuffer::~IPCbuffer() {
-  Replace(NULL, 0, NULL, NULL);
-  delete [] fileName_;
+void IPCbuffer::SetDirty(size_t start, size_t end) {
+  size_t first = start / pageSize_;
+  size_t last = (end - 1) / pageSize_;
+
+  for (size_t page = first; page <= last; page++) {
+    dirty_[page / 32] |= 1u << (page % 32);
+  }
 }
 
+
 /*
- * This is where most of the allocation action takes place
+ * Turns the dirty pages between start and end into byte ranges, as pairs
+ * of offsets in a new[] array, and forgets them. Returns how many pairs.
  */
-void IPCbuffer::Replace(char *data, size_t length,
-                     free_callback callback, void *hint) {
-  HandleScope scope;
-
-  int32_t fd_;
-#ifdef __SYSV__
-  uint32_t shmid_;
-#endif
-
-  if (callback_) {
-    callback_(data_, callback_hint_);
-  } else if (length_) {
-#ifdef __POSIX__
-    if (fileName_ && data_) {  //About to close an open memory block
-      if (fileName_[0] != '*'){
-	msync(data_, length_, MS_ASYNC);  // Make sure it syncs
+size_t IPCbuffer::TakeDirty(size_t start, size_t end, size_t **ranges) {
+  *ranges = NULL;
+  if (dirty_ == NULL || start >= end) return 0;
+
+  size_t first = start / pageSize_;
+  size_t last = (end - 1) / pageSize_;
+  size_t count = 0;
+  size_t page;
+
+  // First pass counts the runs so the array is the right size
+  for (page = first; page <= last; page++) {
+    if (dirty_[page / 32] == 0 && page % 32 == 0 && page + 31 <= last) {
+      page += 31;
+      continue;
+    }
+    if ((dirty_[page / 32] >> (page % 32)) & 1) {
+      count++;
+      while (page + 1 <= last && ((dirty_[(page + 1) / 32] >> ((page + 1) % 32)) & 1)) {
+        page++;
       }
-      munmap(data_, length_);  // Unmap it.
-      if (fileName_[0] == '*') {
-	// Remove the shared block. But only if not open elsewhere
-        shm_unlink(&fileName_[1]);
+    }
+  }
+  if (count == 0) return 0;
+
+  size_t *r = *ranges = new size_t[count * 2];
+  for (page = first; page <= last; page++) {
+    if (dirty_[page / 32] == 0 && page % 32 == 0 && page + 31 <= last) {
+      page += 31;
+      continue;
+    }
+    if ((dirty_[page / 32] >> (page % 32)) & 1) {
+      *r++ = MAX(page * pageSize_, start);
+      while (page + 1 <= last && ((dirty_[(page + 1) / 32] >> ((page + 1) % 32)) & 1)) {
+        dirty_[page / 32] &= ~(1u << (page % 32));
+        page++;
       }
-    } else
-#endif
-#ifdef __SYSV__
-    if (id_) {
-      shmdt(data_);		// Detach SYS V memory
-    } else
-#endif
-    {
-      delete [] data_;
-      V8::AdjustAmountOfExternalAllocatedMemory(-(sizeof(IPCbuffer) + length_));
+      dirty_[page / 32] &= ~(1u << (page % 32));
+      *r++ = MIN((page + 1) * pageSize_, end);
     }
   }
 
-  length_ = length;
-  callback_ = callback;
-  callback_hint_ = hint;
+  return count;
+}
 
-  if (callback_) {
-    data_ = data;
-  } else if (length_) {
 
+// msync() wants the start on a page boundary
+static int SyncRange(char *data, size_t start, size_t end) {
 #ifdef __POSIX__
-    if (fileName_) {
-      data_ = NULL;
-      if (fileName_[0] == '*') { 		// Not file backed
-        fd_ = shm_open(&fileName_[1], O_RDWR|O_CREAT, S_IWUSR|S_IRUSR);
-      } else {				// File Backed
-        fd_ = open(fileName_, O_RDWR|O_CREAT, S_IWUSR|S_IRUSR);
-      }
-      if (fd_ != -1) {
-	ftruncate(fd_,length_);		// Bus Error avoidance
-        if ((data_ = (char*) mmap(NULL, length_, PROT_READ|PROT_WRITE,
-	    MAP_SHARED, fd_, 0)) <= (char*) 0) {
-          close(fd_);
-          ThrowException(Exception::Error(String::New(
-	      "Couldn't create shared memory")));
-	}
-	close(fd_);	// We don't need fd anymore.
-      } else {
-        ThrowException(Exception::ReferenceError(String::New(
-	    "Couldn't open share file")));
-      }
-    } else
-#endif
-#ifdef __SYSV__
-    if (id_)  {
-      if (((shmid_ = shmget((key_t)id_, length_, IPC_CREAT | 0666)) < 0) ||
-          ((data_ = (char*) shmat(shmid_, NULL, 0)) == (char*) -1)) {
-	data_ = NULL;
-	perror("Shared ");
-        ThrowException(Exception::ReferenceError(String::New(
-	    "Couldn't create shared memory")));
-      }
-    } else
+  size_t from = start & ~(base_page_size - 1);
+  return msync(data + from, end - from, MS_SYNC);
+#else
+  return 0;
 #endif
-    {
-      data_ = new char[length_];
-      V8::AdjustAmountOfExternalAllocatedMemory(sizeof(IPCbuffer) + length_);
-    }
-    if (data && data_){
-      memcpy(data_, data, length_);
-    }
-  } else {
-    data_ = NULL;
-  }
-
-  handle_->SetIndexedPropertiesToExternalArrayData(data_,
-                                                   kExternalUnsignedByteArray,
-                                                   length_);
-  handle_->Set(length_symbol, Integer::NewFromUnsigned(length_));
 }
 
 
-Handle<Value> IPCbuffer::BinarySlice(const Arguments &args) {
-  HandleScope scope;
-  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
-  SLICE_ARGS(args[0], args[1])
+struct flush_req {
+  uv_work_t req;
+  Persistent<Object> buffer;      // Keeps the mapping alive meanwhile
+  Persistent<Function> callback;
+  char *data;
+  size_t *ranges;
+  size_t count;
+  size_t failed;                  // First range msync didn't like
+  int err;
+};
 
-  char *data = parent->data_ + start;
-  //Local<String> string = String::New(data, end - start);
 
-  Local<Value> b =  Encode(data, end - start, BINARY);
+static void FlushWork(uv_work_t *req) {
+  flush_req *f = (flush_req*) req->data;
 
-  return scope.Close(b);
+  for (f->failed = 0; f->failed < f->count; f->failed++) {
+    size_t *r = f->ranges + f->failed * 2;
+    if (SyncRange(f->data, r[0], r[1]) < 0) {
+      f->err = errno;
+      return;
+    }
+  }
 }
 
 
-Handle<Value> IPCbuffer::AsciiSlice(const Arguments &args) {
+static void FlushAfter(uv_work_t *req) {
   HandleScope scope;
-  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
-  SLICE_ARGS(args[0], args[1])
+  flush_req *f = (flush_req*) req->data;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(f->buffer);
 
-  char* data = parent->data_ + start;
-  Local<String> string = String::New(data, end - start);
+  buffer->CountFlush(f->count, f->err != 0);
 
-  return scope.Close(string);
-}
+  Local<Value> argv[1];
+  if (f->err) {
+    // Whatever didn't make it to disk is still dirty
+    for (size_t i = f->failed; i < f->count; i++) {
+      buffer->MarkDirty(f->ranges[i * 2], f->ranges[i * 2 + 1]);
+    }
+    argv[0] = ErrnoException(f->err, "msync");
+  } else {
+    argv[0] = Local<Value>::New(Null());
+  }
 
+  IPCbuffer::Unpin(f->buffer);
 
-Handle<Value> IPCbuffer::Utf8Slice(const Arguments &args) {
-  HandleScope scope;
-  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
-  SLICE_ARGS(args[0], args[1])
-  char *data = parent->data_ + start;
-  Local<String> string = String::New(data, end - start);
-  return scope.Close(string);
+  TryCatch try_catch;
+  f->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+
+  f->callback.Dispose();
+  f->buffer.Dispose();
+  delete [] f->ranges;
+  delete f;
+
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
 }
 
-static const char *base64_table = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                                  "abcdefghijklmnopqrstuvwxyz"
-                                  "0123456789+/";
-static const int unbase64_table[] =
-  {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-2,-1,-1,-2,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  ,-2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63
-  ,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1
-  ,-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14
-  ,15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1
-  ,-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40
-  ,41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  ,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-  };
-#define unbase64(x) unbase64_table[(uint8_t)(x)]
+
+// What needs writing back: everything between start and end if they are
+// given, otherwise the whole file, or with trackDirty just the pages
+// written since the last flush.
+#define FLUSH_RANGES(start_arg, end_arg)                             \
+  size_t *ranges = NULL;                                             \
+  size_t count = 0;                                                  \
+  if (buffer->dirty_ &&                                              \
+      (start_arg->IsUndefined() || start_arg->IsFunction())) {       \
+    count = buffer->TakeDirty(0, buffer->length_, &ranges);          \
+  } else if (buffer->backing_ == IPC_BACKING_FILE) {                 \
+    RANGE_ARGS(start_arg, (end_arg->IsFunction()                     \
+                           ? Local<Value>::New(Undefined()) : end_arg)) \
+    if (start < end) {                                               \
+      buffer->TakeDirty(start, end, &ranges);                        \
+      delete [] ranges;                                              \
+      ranges = new size_t[2];                                        \
+      ranges[0] = start;                                             \
+      ranges[1] = end;                                               \
+      count = 1;                                                     \
+    }                                                                \
+  }
 
 
-Handle<Value> IPCbuffer::Base64Slice(const Arguments &args) {
+// buffer.flush([start], [end], callback);
+// msync(MS_SYNC) on the threadpool, callback(err) once it's on disk
+Handle<Value> IPCbuffer::Flush(const Arguments &args) {
   HandleScope scope;
-  IPCbuffer *parent = ObjectWrap::Unwrap<IPCbuffer>(args.This());
-  SLICE_ARGS(args[0], args[1])
-
-  int n = end - start;
-  int out_len = (n + 2 - ((n + 2) % 3)) / 3 * 4;
-  char *out = new char[out_len];
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
 
-  uint8_t bitbuf[3];
-  int i = start; // data() index
-  int j = 0; // out index
-  char c;
-  bool b1_oob, b2_oob;
+  Local<Value> cb = args[args.Length() - 1];
+  if (!cb->IsFunction()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Last argument must be a callback")));
+  }
 
-  while (i < end) {
-    bitbuf[0] = parent->data_[i++];
+  FLUSH_RANGES(args[0], args[1])
 
-    if (i < end) {
-      bitbuf[1] = parent->data_[i];
-      b1_oob = false;
-    }  else {
-      bitbuf[1] = 0;
-      b1_oob = true;
-    }
-    i++;
+  flush_req *f = new flush_req;
+  f->req.data = f;
+  f->buffer = Persistent<Object>::New(args.This());
+  IPCbuffer::Pin(args.This());
+  f->callback = Persistent<Function>::New(Local<Function>::Cast(cb));
+  f->data = buffer->data_;
+  f->ranges = ranges;
+  f->count = count;
+  f->failed = 0;
+  f->err = 0;
 
-    if (i < end) {
-      bitbuf[2] = parent->data_[i];
-      b2_oob = false;
-    }  else {
-      bitbuf[2] = 0;
-      b2_oob = true;
-    }
-    i++;
+  uv_queue_work(uv_default_loop(), &f->req, FlushWork, FlushAfter);
 
+  return Undefined();
+}
 
-    c = bitbuf[0] >> 2;
-    assert(c < 64);
-    out[j++] = base64_table[(int)c];
-    assert(j < out_len);
 
-    c = ((bitbuf[0] & 0x03) << 4) | (bitbuf[1] >> 4);
-    assert(c < 64);
-    out[j++] = base64_table[(int)c];
-    assert(j < out_len);
+// buffer.flushSync([start], [end]);
+Handle<Value> IPCbuffer::FlushSync(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
 
-    if (b1_oob) {
-      out[j++] = '=';
-    } else {
-      c = ((bitbuf[1] & 0x0F) << 2) | (bitbuf[2] >> 6);
-      assert(c < 64);
-      out[j++] = base64_table[(int)c];
-    }
-    assert(j < out_len);
+  FLUSH_RANGES(args[0], args[1])
 
-    if (b2_oob) {
-      out[j++] = '=';
-    } else {
-      c = bitbuf[2] & 0x3F;
-      assert(c < 64);
-      out[j++]  = base64_table[(int)c];
+  for (size_t i = 0; i < count; i++) {
+    if (SyncRange(buffer->data_, ranges[i * 2], ranges[i * 2 + 1]) < 0) {
+      int err = errno;
+      buffer->CountFlush(count, true);
+      for (; i < count; i++) {
+        buffer->MarkDirty(ranges[i * 2], ranges[i * 2 + 1]);
+      }
+      delete [] ranges;
+      return ThrowException(ErrnoException(err, "msync"));
     }
-    assert(j <= out_len);
   }
+  delete [] ranges;
+  buffer->CountFlush(count, false);
 
-  Local<String> string = String::New(out, out_len);
-  delete [] out;
-  return scope.Close(string);
+  return Undefined();
 }
 
 
-// var bytesCopied = buffer.copy(target, targetStart, sourceStart, sourceEnd);
-Handle<Value> IPCbuffer::Copy(const Arguments &args) {
+// buffer.markDirty(start, end);
+// For writes the buffer can't see, buff[i] = x and the like
+Handle<Value> IPCbuffer::MarkDirty(const Arguments &args) {
   HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
 
-  IPCbuffer *source = ObjectWrap::Unwrap<IPCbuffer>(args.This());
-
-  if (!IPCbuffer::HasInstance(args[0])) {
-    return ThrowException(Exception::TypeError(String::New(
-            "First arg should be a Buffer")));
-  }
+  RANGE_ARGS(args[0], args[1])
+  buffer->MarkDirty(start, end);
 
-  Local<Object> target = args[0]->ToObject();
-  char *target_data = IPCbuffer::Data(target);
-  size_t target_length = IPCbuffer::Length(target);
+  return Undefined();
+}
 
-  size_t target_start = args[1]->Uint32Value();
-  size_t source_start = args[2]->Uint32Value();
-  size_t source_end = args[3]->IsUint32() ? args[3]->Uint32Value()
-                                          : source->length_;
 
-  if (source_end < source_start) {
-    return ThrowException(Exception::Error(String::New(
-            "sourceEnd < sourceStart")));
+/*
+ * Writes s at p in enc, no more than max_length bytes, the way all the
+ * *Write() methods do. Returns the bytes written, with the characters they
+ * took in chars.
+ */
+static size_t WriteString(char *p, size_t max_length, Handle<String> s,
+                          enum encoding enc, int *chars) {
+  // Strings that came out of a buffer in the first place are often ASCII
+  // already sitting outside the heap, and ASCII is its own UTF-8
+  if ((enc == UTF8 || enc == ASCII) && s->IsExternalAscii()) {
+    String::ExternalAsciiStringResource *r = s->GetExternalAsciiStringResource();
+    size_t written = MIN(r->length(), max_length);
+    memcpy(p, r->data(), written);
+    *chars = written;
+    return written;
   }
 
-  // Copy 0 bytes; we're done
-  if (source_end == source_start) {
-    return scope.Close(Integer::New(0));
-  }
+  switch (enc) {
+    case ASCII:
+      *chars = s->WriteAscii(p, 0, MIN((size_t)s->Length(), max_length),
+                             String::HINT_MANY_WRITES_EXPECTED);
+      return *chars;
 
-  if (target_start < 0 || target_start >= target_length) {
-    return ThrowException(Exception::Error(String::New(
-            "targetStart out of bounds")));
-  }
+    case BINARY:
+      *chars = MIN((size_t)s->Length(), max_length);
+      DecodeWrite(p, *chars, s, BINARY);
+      return *chars;
 
-  if (source_start < 0 || source_start >= source->length_) {
-    return ThrowException(Exception::Error(String::New(
-            "sourceStart out of bounds")));
-  }
+    case BASE64: {
+      String::AsciiValue value(s);
+      *chars = value.length();
+      return ipc_base64_decode(*value, value.length(), p, max_length);
+    }
 
-  if (source_end < 0 || source_end > source->length_) {
-    return ThrowException(Exception::Error(String::New(
-            "sourceEnd out of bounds")));
+    default: {
+      int written = s->WriteUtf8(p, max_length, chars,
+                                 String::HINT_MANY_WRITES_EXPECTED);
+      if (written > 0 && p[written-1] == '\0') written--;
+      return written;
+    }
   }
-
-  ssize_t to_copy = MIN(MIN(source_end - source_start,
-                            target_length - target_start),
-                            source->length_ - source_start);
-
-
-  // need to use slightly slower memmove is the ranges might overlap
-  memmove((void *)(target_data + target_start),
-          (const void*)(source->data_ + source_start),
-          to_copy);
-
-  return scope.Close(Integer::New(to_copy));
 }
 
 
@@ -513,6 +3794,7 @@ Handle<Value> IPCbuffer::Copy(const Arguments &args) {
 Handle<Value> IPCbuffer::Utf8Write(const Arguments &args) {
   HandleScope scope;
   IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NOT_SEALED(buffer)
 
   if (!args[0]->IsString()) {
     return ThrowException(Exception::TypeError(String::New(
@@ -532,21 +3814,17 @@ Handle<Value> IPCbuffer::Utf8Write(const Arguments &args) {
                                              : args[2]->Uint32Value();
   max_length = MIN(buffer->length_ - offset, max_length);
 
-  char* p = buffer->data_ + offset;
-
   int char_written;
-
-  int written = s->WriteUtf8(p,
-                             max_length,
-                             &char_written,
-                             String::HINT_MANY_WRITES_EXPECTED);
+  size_t written = WriteString(buffer->data_ + offset, max_length, s, UTF8,
+                               &char_written);
 
   constructor_template->GetFunction()->Set(chars_written_sym,
                                            Integer::New(char_written));
 
-  if (written > 0 && p[written-1] == '\0') written--;
+  buffer->MarkDirty(offset, offset + written);
+  buffer->CountWritten(IPC_CODEC_UTF8, written);
 
-  return scope.Close(Integer::New(written));
+  return scope.Close(Integer::NewFromUnsigned(written));
 }
 
 
@@ -555,6 +3833,7 @@ Handle<Value> IPCbuffer::AsciiWrite(const Arguments &args) {
   HandleScope scope;
 
   IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NOT_SEALED(buffer)
 
   if (!args[0]->IsString()) {
     return ThrowException(Exception::TypeError(String::New(
@@ -572,15 +3851,14 @@ Handle<Value> IPCbuffer::AsciiWrite(const Arguments &args) {
 
   size_t max_length = args[2]->IsUndefined() ? buffer->length_ - offset
                                              : args[2]->Uint32Value();
-  max_length = MIN((size_t)s->Length(), MIN(buffer->length_ - offset, max_length));
-
-  char *p = buffer->data_ + offset;
+  max_length = MIN(buffer->length_ - offset, max_length);
 
-  int written = s->WriteAscii(p,
-                              0,
-                              max_length,
-                              String::HINT_MANY_WRITES_EXPECTED);
-  return scope.Close(Integer::New(written));
+  int chars;
+  size_t written = WriteString(buffer->data_ + offset, max_length, s, ASCII,
+                               &chars);
+  buffer->MarkDirty(offset, offset + written);
+  buffer->CountWritten(IPC_CODEC_ASCII, written);
+  return scope.Close(Integer::NewFromUnsigned(written));
 }
 
 
@@ -588,18 +3866,8 @@ Handle<Value> IPCbuffer::AsciiWrite(const Arguments &args) {
 Handle<Value> IPCbuffer::Base64Write(const Arguments &args) {
   HandleScope scope;
 
-  assert(unbase64('/') == 63);
-  assert(unbase64('+') == 62);
-  assert(unbase64('T') == 19);
-  assert(unbase64('Z') == 25);
-  assert(unbase64('t') == 45);
-  assert(unbase64('z') == 51);
-
-  assert(unbase64(' ') == -2);
-  assert(unbase64('\n') == -2);
-  assert(unbase64('\r') == -2);
-
   IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NOT_SEALED(buffer)
 
   if (!args[0]->IsString()) {
     return ThrowException(Exception::TypeError(String::New(
@@ -626,48 +3894,12 @@ Handle<Value> IPCbuffer::Base64Write(const Arguments &args) {
             "Buffer too small")));
   }
 
-  char a, b, c, d;
-  char* start = buffer->data_ + offset;
-  char* dst = start;
-  const char *src = *s;
-  const char *const srcEnd = src + s.length();
-
-  while (src < srcEnd) {
-    int remaining = srcEnd - src;
-
-    while (unbase64(*src) < 0 && src < srcEnd) {
-      src++;
-      remaining--;
-    }
-    if (remaining == 0 || *src == '=') break;
-    a = unbase64(*src++);
-
-    while (unbase64(*src) < 0 && src < srcEnd) {
-      src++;
-      remaining--;
-    }
-    if (remaining <= 1 || *src == '=') break;
-    b = unbase64(*src++);
-    *dst++ = (a << 2) | ((b & 0x30) >> 4);
-
-    while (unbase64(*src) < 0 && src < srcEnd) {
-      src++;
-      remaining--;
-    }
-    if (remaining <= 2 || *src == '=') break;
-    c = unbase64(*src++);
-    *dst++ = ((b & 0x0F) << 4) | ((c & 0x3C) >> 2);
-
-    while (unbase64(*src) < 0 && src < srcEnd) {
-      src++;
-      remaining--;
-    }
-    if (remaining <= 3 || *src == '=') break;
-    d = unbase64(*src++);
-    *dst++ = ((c & 0x03) << 6) | (d & 0x3F);
-  }
+  size_t written = ipc_base64_decode(*s, s.length(), buffer->data_ + offset,
+                                     buffer->length_ - offset);
 
-  return scope.Close(Integer::New(dst - start));
+  buffer->MarkDirty(offset, offset + written);
+  buffer->CountWritten(IPC_CODEC_BASE64, written);
+  return scope.Close(Integer::New(written));
 }
 
 
@@ -675,6 +3907,7 @@ Handle<Value> IPCbuffer::BinaryWrite(const Arguments &args) {
   HandleScope scope;
 
   IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NOT_SEALED(buffer)
 
   if (!args[0]->IsString()) {
     return ThrowException(Exception::TypeError(String::New(
@@ -690,12 +3923,127 @@ Handle<Value> IPCbuffer::BinaryWrite(const Arguments &args) {
             "Offset is out of bounds")));
   }
 
-  char *p = (char*)buffer->data_ + offset;
+  int chars;
+  size_t written = WriteString(buffer->data_ + offset,
+                               buffer->length_ - offset, s, BINARY, &chars);
+  buffer->MarkDirty(offset, offset + written);
+  buffer->CountWritten(IPC_CODEC_BINARY, written);
+  return scope.Close(Integer::NewFromUnsigned(written));
+}
 
-  size_t towrite = MIN((unsigned long) s->Length(), buffer->length_ - offset);
 
-  int written = DecodeWrite(p, towrite, s, BINARY);
-  return scope.Close(Integer::New(written));
+// The same string handle as last time is the same encoding as last time,
+// which saves comparing names for every item of a batch
+#define ITEM_ENCODING(value)                                         \
+  if (!(value == last_encoding)) {                                   \
+    last_encoding = value;                                           \
+    enc = ParseEncoding(value, UTF8);                                \
+  }
+
+
+// var at = buffer.writeMany([[string, offset, encoding], ...], [base],
+//                           [limit]);
+// Leave out an offset and it goes straight after the one before. Offsets
+// are from base and nothing's written past limit. Returns [offset, length,
+// ...] from base for each, where it went and how many bytes it took.
+Handle<Value> IPCbuffer::WriteMany(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  NOT_SEALED(buffer)
+
+  if (!args[0]->IsArray()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Argument should be an array of [string, offset, encoding]")));
+  }
+  Local<Array> items = Local<Array>::Cast(args[0]);
+  size_t base = args[1]->IsUint32() ? args[1]->Uint32Value() : 0;
+  size_t limit = args[2]->IsUint32() ? args[2]->Uint32Value() : buffer->length_;
+  uint32_t count = items->Length();
+  Local<Value> last_encoding;
+  enum encoding enc = UTF8;
+
+  if (limit > buffer->length_ || base > limit) {
+    return ThrowException(Exception::RangeError(String::New(
+            "base or limit out of bounds")));
+  }
+
+  // All checked before any are written, so a bad one can't leave it half
+  // done
+  bool base64 = false;
+  for (uint32_t i = 0; i < count; i++) {
+    Local<Value> item = items->Get(i);
+    if (!item->IsArray()) {
+      return ThrowException(Exception::TypeError(String::New(
+              "Argument should be an array of [string, offset, encoding]")));
+    }
+    Local<Array> a = Local<Array>::Cast(item);
+    if (!a->Get(0)->IsString()) {
+      return ThrowException(Exception::TypeError(String::New(
+              "Argument must be a string")));
+    }
+    Local<Value> offset = a->Get(1);
+    if (!offset->IsUndefined() && !offset->IsNull() &&
+        (!offset->IsUint32() || offset->Uint32Value() > limit - base)) {
+      return ThrowException(Exception::RangeError(String::New(
+              "Offset is out of bounds")));
+    }
+    ITEM_ENCODING(a->Get(2))
+    if (!KnownEncoding(enc)) {
+      return ThrowException(Exception::TypeError(String::New(
+              "Unknown encoding")));
+    }
+    if (enc == BASE64) base64 = true;
+  }
+
+  // Other encodings are cut short where the room runs out, as write() does,
+  // but base64 that doesn't fit throws there, so it has to here too. Where
+  // each one lands depends on the ones before, so walk them through. The
+  // sizes are the most each can take, so whatever passes is sure to fit.
+  if (base64) {
+    size_t at = base;
+    for (uint32_t i = 0; i < count; i++) {
+      Local<Array> a = Local<Array>::Cast(items->Get(i));
+      Local<Value> offset = a->Get(1);
+      if (offset->IsUint32()) at = base + offset->Uint32Value();
+      ITEM_ENCODING(a->Get(2))
+
+      Local<String> string = a->Get(0)->ToString();
+      size_t size;
+      if (enc == BASE64) {
+        String::AsciiValue value(string);
+        size = base64_decoded_size(*value, value.length());
+        if (size > limit - at) {
+          return ThrowException(Exception::TypeError(String::New(
+                  "Buffer too small")));
+        }
+      } else {
+        size = MIN(node::ByteLength(string, enc), limit - at);
+      }
+      at += size;
+    }
+  }
+
+  Local<Array> result = Array::New(count * 2);
+  size_t at = base;
+
+  for (uint32_t i = 0; i < count; i++) {
+    Local<Array> a = Local<Array>::Cast(items->Get(i));
+    Local<Value> offset = a->Get(1);
+    if (offset->IsUint32()) at = base + offset->Uint32Value();
+    ITEM_ENCODING(a->Get(2))
+
+    int chars;
+    size_t written = WriteString(buffer->data_ + at, limit - at,
+                                 a->Get(0)->ToString(), enc, &chars);
+    buffer->MarkDirty(at, at + written);
+    buffer->CountWritten(Codec(enc), written);
+
+    result->Set(i * 2, Integer::NewFromUnsigned(at - base));
+    result->Set(i * 2 + 1, Integer::NewFromUnsigned(written));
+    at += written;
+  }
+
+  return scope.Close(result);
 }
 
 
@@ -715,6 +4063,165 @@ Handle<Value> IPCbuffer::ByteLength(const Arguments &args) {
 }
 
 
+// _IPCbuffer.poolConfig(cacheBytes, maxBlock);
+// Either can be left out. Giving the cache nothing trims it.
+Handle<Value> IPCbuffer::PoolConfig(const Arguments &args) {
+  HandleScope scope;
+  IPCpoolStats stats;
+  ipc_pool_stats(&stats);
+
+  size_t limit = args[0]->IsNumber() ? (size_t)args[0]->NumberValue()
+                                     : stats.limit;
+  size_t max_block = args[1]->IsNumber() ? (size_t)args[1]->NumberValue()
+                                         : stats.max_block;
+  ipc_pool_configure(limit, max_block);
+
+  return Undefined();
+}
+
+
+// var stats = _IPCbuffer.poolStats();
+Handle<Value> IPCbuffer::PoolStats(const Arguments &args) {
+  HandleScope scope;
+  IPCpoolStats stats;
+  ipc_pool_stats(&stats);
+
+  Local<Object> o = Object::New();
+  o->Set(String::NewSymbol("allocs"), Number::New(stats.allocs));
+  o->Set(String::NewSymbol("reused"), Number::New(stats.reused));
+  o->Set(String::NewSymbol("frees"), Number::New(stats.frees));
+  o->Set(String::NewSymbol("released"), Number::New(stats.released));
+  o->Set(String::NewSymbol("cached"), Number::New(stats.cached));
+  o->Set(String::NewSymbol("cachedBlocks"), Number::New(stats.cached_blocks));
+  o->Set(String::NewSymbol("cacheBytes"), Number::New(stats.limit));
+  o->Set(String::NewSymbol("maxBlock"), Number::New(stats.max_block));
+  o->Set(String::NewSymbol("externalPending"), Number::New(external_pending));
+
+  return scope.Close(o);
+}
+
+
+#ifdef __POSIX__
+/*
+ * How much of a range is in RAM right now, by mincore(). Whole pages, so
+ * the odd bit either side of it can count too. -1 if it can't tell.
+ */
+static double ResidentBytes(char *data, size_t length) {
+  if (data == NULL || length == 0) return 0;
+
+  uintptr_t from = (uintptr_t)data & ~(uintptr_t)(base_page_size - 1);
+  size_t span = (uintptr_t)data + length - from;
+  size_t pages = (span + base_page_size - 1) / base_page_size;
+#ifdef __linux__
+  unsigned char *vec = new unsigned char[pages];
+#else
+  char *vec = new char[pages];
+#endif
+  double resident = -1;
+
+  if (mincore((void*)from, span, vec) == 0) {
+    size_t count = 0;
+    for (size_t i = 0; i < pages; i++) count += vec[i] & 1;
+    resident = (double)count * base_page_size;
+  }
+  delete [] vec;
+  return resident;
+}
+#endif
+
+
+// var s = buffer.stats();
+Handle<Value> IPCbuffer::Stats(const Arguments &args) {
+  HandleScope scope;
+  IPCbuffer *buffer = ObjectWrap::Unwrap<IPCbuffer>(args.This());
+  IPCbufferStats *stats = &buffer->stats_;
+
+  Local<Object> o = Object::New();
+  o->Set(String::NewSymbol("backing"), String::New(
+          buffer->callback_ ? "external" : backing_names[buffer->backing_]));
+  o->Set(String::NewSymbol("length"), Number::New(buffer->length_));
+  o->Set(String::NewSymbol("mapped"), Number::New(
+          buffer->callback_ ? buffer->length_ : buffer->mapped_));
+  o->Set(String::NewSymbol("pageSize"), Number::New(buffer->pageSize_));
+#ifdef __POSIX__
+  o->Set(String::NewSymbol("resident"), Number::New(
+          ResidentBytes(buffer->data_, buffer->length_)));
+#endif
+  o->Set(String::NewSymbol("pins"), Integer::New(buffer->pins_));
+  o->Set(String::NewSymbol("fixed"), Boolean::New(buffer->fixed_));
+  o->Set(String::NewSymbol("views"), Integer::New(
+          buffer->mapping_ ? buffer->mapping_->views : 1));
+  o->Set(String::NewSymbol("createTime"), Number::New(stats->create_ns / 1e3));
+  o->Set(String::NewSymbol("sliced"), Number::New((double)stats->sliced));
+  o->Set(String::NewSymbol("written"), Number::New((double)stats->written));
+  o->Set(String::NewSymbol("copied"), Number::New((double)stats->copied));
+  o->Set(String::NewSymbol("flushes"), Number::New((double)stats->flushes));
+
+  return scope.Close(o);
+}
+
+
+static Local<Object> CodecStats(uint64_t *counters) {
+  static const char *names[IPC_CODECS] = {
+    "ascii", "utf8", "binary", "base64", "shared"
+  };
+  Local<Object> o = Object::New();
+  for (int i = 0; i < IPC_CODECS; i++) {
+    o->Set(String::NewSymbol(names[i]), Number::New(
+            (double)ipc_load(&counters[i], IPC_RELAXED)));
+  }
+  return o;
+}
+
+
+#define STAT(o, name, counter)                                       \
+  o->Set(String::NewSymbol(name), Number::New(                       \
+          (double)ipc_load(&counter, IPC_RELAXED)))
+
+// var s = Buffer.stats();
+// Counts for the whole process. Times are in microseconds.
+Handle<Value> IPCbuffer::GlobalStats(const Arguments &args) {
+  HandleScope scope;
+
+  Local<Object> o = Object::New();
+  STAT(o, "buffers", ipc_stats.buffers);
+  STAT(o, "createFailures", ipc_stats.create_failures);
+  STAT(o, "hugeFallbacks", ipc_stats.huge_fallbacks);
+
+  Local<Object> backings = Object::New();
+  for (int i = IPC_BACKING_HEAP; i < IPC_BACKINGS; i++) {
+    IPCbackingStats *b = &ipc_stats.backing[i];
+    uint64_t created = ipc_load(&b->created, IPC_RELAXED);
+    if (created == 0) continue;
+
+    Local<Object> s = Object::New();
+    s->Set(String::NewSymbol("created"), Number::New((double)created));
+    STAT(s, "reused", b->reused);
+    s->Set(String::NewSymbol("createTime"), Number::New(
+            ipc_load(&b->create_ns, IPC_RELAXED) / 1e3 / created));
+    STAT(s, "alive", b->alive);
+    STAT(s, "mapped", b->mapped);
+    backings->Set(String::NewSymbol(backing_names[i]), s);
+  }
+  o->Set(String::NewSymbol("backings"), backings);
+
+  size_t mappings, views;
+  ipc_maps_count(&mappings, &views);
+  o->Set(String::NewSymbol("mappings"), Number::New(mappings));
+  o->Set(String::NewSymbol("views"), Number::New(views));
+
+  o->Set(String::NewSymbol("sliced"), CodecStats(ipc_stats.sliced));
+  o->Set(String::NewSymbol("written"), CodecStats(ipc_stats.written));
+  STAT(o, "copied", ipc_stats.copied);
+  STAT(o, "flushes", ipc_stats.flushes);
+  STAT(o, "flushedRanges", ipc_stats.flushed_ranges);
+  STAT(o, "flushErrors", ipc_stats.flush_errors);
+  STAT(o, "resizes", ipc_stats.resizes);
+
+  return scope.Close(o);
+}
+
+
 Handle<Value> IPCbuffer::MakeFastBuffer(const Arguments &args) {
   HandleScope scope;
 
@@ -727,6 +4234,20 @@ Handle<Value> IPCbuffer::MakeFastBuffer(const Arguments &args) {
                                                       kExternalUnsignedByteArray,
                                                       length);
 
+  // "whole" is the Buffer a new parent was made for and "refit" that same
+  // Buffer after a resize, "pooled" one of the small ones sharing the pool.
+  // Anything else is a slice or view, and there's no knowing when the last
+  // of those is done with the memory, so from then on it stays put.
+  if (args[4]->IsString()) {
+    String::AsciiValue how(args[4]);
+    if (strcmp(*how, "pooled") == 0) buffer->pooled_ = true;
+    if (strcmp(*how, "whole") == 0 || strcmp(*how, "refit") == 0 ||
+        buffer->pooled_) {
+      return Undefined();
+    }
+  }
+  buffer->fixed_ = true;
+
   return Undefined();
 }
 
@@ -750,6 +4271,13 @@ void IPCbuffer::Initialize(Handle<Object> target) {
   HandleScope scope;
 
   length_symbol = Persistent<String>::New(String::NewSymbol("length"));
+  page_size_sym = Persistent<String>::New(String::NewSymbol("pageSize"));
+#if __POSIX__ || __SYSV__
+  base_page_size = sysconf(_SC_PAGESIZE);
+#endif
+#ifdef __linux__
+  HugePageSize();   // Read now, not first from the threadpool by open()
+#endif
   chars_written_sym = Persistent<String>::New(String::NewSymbol("_charsWritten"));
 
   Local<FunctionTemplate> t = FunctionTemplate::New(IPCbuffer::New);
@@ -764,12 +4292,48 @@ void IPCbuffer::Initialize(Handle<Object> target) {
   // TODO NODE_SET_PROTOTYPE_METHOD(t, "utf16Slice", Utf16Slice);
   // copy
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "utf8Slice", IPCbuffer::Utf8Slice);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "utf8Check", IPCbuffer::Utf8Check);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "sharedSlice", IPCbuffer::SharedSlice);
 
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "utf8Write", IPCbuffer::Utf8Write);
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "asciiWrite", IPCbuffer::AsciiWrite);
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "binaryWrite", IPCbuffer::BinaryWrite);
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "base64Write", IPCbuffer::Base64Write);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "writeMany", IPCbuffer::WriteMany);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "sliceMany", IPCbuffer::SliceMany);
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "copy", IPCbuffer::Copy);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "copyAsync", IPCbuffer::CopyAsync);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "fill", IPCbuffer::Fill);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "compare", IPCbuffer::Compare);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "equals", IPCbuffer::Equals);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "indexOf", IPCbuffer::IndexOf);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "lastIndexOf", IPCbuffer::LastIndexOf);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "crc32c", IPCbuffer::Crc32c);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "hash64", IPCbuffer::Hash64);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "wait", IPCbuffer::Wait);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "waitSync", IPCbuffer::WaitSync);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "notify", IPCbuffer::Notify);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "load", IPCbuffer::AtomicLoad);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "store", IPCbuffer::AtomicStore);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "exchange", IPCbuffer::AtomicExchange);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "fetchAdd", IPCbuffer::AtomicFetchAdd);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "fetchOr", IPCbuffer::AtomicFetchOr);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "compareExchange", IPCbuffer::AtomicCompareExchange);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "readNumber", IPCbuffer::ReadNumber);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "writeNumber", IPCbuffer::WriteNumber);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "readArray", IPCbuffer::ReadArray);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "writeArray", IPCbuffer::WriteArray);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "advise", IPCbuffer::Advise);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "prefault", IPCbuffer::Prefault);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "flush", IPCbuffer::Flush);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "flushSync", IPCbuffer::FlushSync);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "markDirty", IPCbuffer::MarkDirty);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "resize", IPCbuffer::Resize);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "remap", IPCbuffer::Remap);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "seal", IPCbuffer::Seal);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "fd", IPCbuffer::Fd);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "sendFd", IPCbuffer::SendFd);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "stats", IPCbuffer::Stats);
 
   NODE_SET_METHOD(constructor_template->GetFunction(),
                   "byteLength",
@@ -777,8 +4341,64 @@ void IPCbuffer::Initialize(Handle<Object> target) {
   NODE_SET_METHOD(constructor_template->GetFunction(),
                   "makeFastBuffer",
                   IPCbuffer::MakeFastBuffer);
+  NODE_SET_METHOD(constructor_template->GetFunction(),
+                  "poolConfig",
+                  IPCbuffer::PoolConfig);
+  NODE_SET_METHOD(constructor_template->GetFunction(),
+                  "poolStats",
+                  IPCbuffer::PoolStats);
+  NODE_SET_METHOD(constructor_template->GetFunction(),
+                  "receiveFd",
+                  IPCbuffer::ReceiveFd);
+  NODE_SET_METHOD(constructor_template->GetFunction(),
+                  "stats",
+                  IPCbuffer::GlobalStats);
+  NODE_SET_METHOD(constructor_template->GetFunction(),
+                  "copyConfig",
+                  IPCbuffer::CopyConfig);
+
+  constructor_template->GetFunction()->Set(page_size_sym,
+                                           Integer::NewFromUnsigned(base_page_size));
+
+  ipc_base64_init();
+  constructor_template->GetFunction()->Set(String::NewSymbol("base64Kernel"),
+                                           String::New(ipc_base64_kernel()));
+  uv_check_init(uv_default_loop(), &release_check);
+  uv_unref(uv_default_loop());
+
+  ipc_utf8_init();
+  constructor_template->GetFunction()->Set(String::NewSymbol("utf8Kernel"),
+                                           String::New(ipc_utf8_kernel()));
+
+  ipc_copy_init();
+
+  ipc_hash_init();
+  constructor_template->GetFunction()->Set(String::NewSymbol("hashKernel"),
+                                           String::New(ipc_hash_kernel()));
+
+  ipc_search_init();
+  constructor_template->GetFunction()->Set(String::NewSymbol("searchKernel"),
+                                           String::New(ipc_search_kernel()));
+
+  ipc_swap_init();
+  constructor_template->GetFunction()->Set(String::NewSymbol("swapKernel"),
+                                           String::New(ipc_swap_kernel()));
+
+  Local<Object> types = Object::New();
+  for (size_t i = 0; i < NUMBER_TYPES; i++) {
+    types->Set(String::NewSymbol(number_types[i].name),
+               Integer::New(number_types[i].type));
+  }
+  constructor_template->GetFunction()->Set(String::NewSymbol("numberTypes"),
+                                           types);
 
   target->Set(String::NewSymbol("_IPCbuffer"), constructor_template->GetFunction());
+
+  IPCring::Initialize(target);
+  IPCqueue::Initialize(target);
+  IPCheap::Initialize(target);
+  IPCtable::Initialize(target);
+  IPCsnapshot::Initialize(target);
 }
 
 
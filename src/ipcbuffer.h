@@ -6,6 +6,9 @@
 #include <v8.h>
 #include <assert.h>
 
+#include "ipcstats.h"
+#include "ipcmaps.h"
+
 namespace node {
 
 /* A buffer is a chunk of memory stored outside the V8 heap, mirrored by an
@@ -45,6 +48,27 @@ namespace node {
  */
 
 
+/* Constructor options, the third argument to new _IPCbuffer(). Anything not
+ * given keeps the old behaviour.
+ */
+struct IPCoptions {
+  int huge_pages;     // IPC_HUGE_* below
+  char *huge_path;    // hugetlbfs mount used for "*name" huge page segments
+  bool populate;      // Fault the whole thing in up front
+  int advice;         // madvise() for the whole mapping, -1 for none
+  int fd;             // Attach to a memfd segment some other process sent
+  bool track_dirty;   // flush() with no range only writes pages marked dirty
+};
+
+#define IPC_HUGE_OFF          0
+#define IPC_HUGE_TRY          1   // hugePages: true
+#define IPC_HUGE_REQUIRE      2   // hugePages: "require"
+#define IPC_HUGE_TRANSPARENT  3   // hugePages: "transparent"
+
+
+struct IPCmapError;
+
+
 class IPCbuffer : public ObjectWrap {
  public:
 
@@ -80,6 +104,44 @@ class IPCbuffer : public ObjectWrap {
   static IPCbuffer* New(char *data, size_t length,
                      free_callback callback, void *hint); // public constructor
 
+  // With trackDirty every native write into a file backed buffer notes the
+  // pages it hit, so a plain flush() only has to write those back
+  inline void MarkDirty(size_t start, size_t end) {
+    if (dirty_ && start < end) SetDirty(start, end);
+  }
+  void SetDirty(size_t start, size_t end);
+  size_t TakeDirty(size_t start, size_t end, size_t **ranges);
+
+  // Anything holding on to the data across calls pins the buffer, so a
+  // resize can't move the memory out from under it
+  static void Pin(v8::Handle<v8::Object> obj);
+  static void Unpin(v8::Handle<v8::Object> obj);
+
+  // Strings pointing straight into the mapping hold the buffer, mapping
+  // and all, until they're collected
+  void Hold() { Ref(); pins_++; }
+  void Release() { pins_--; Unref(); }
+
+  // Bytes through one of the IPC_CODEC_* ways, for stats()
+  inline void CountSliced(int codec, size_t n) {
+    ipc_count(&ipc_stats.sliced[codec], n);
+    ipc_count(&stats_.sliced, n);
+  }
+  inline void CountWritten(int codec, size_t n) {
+    ipc_count(&ipc_stats.written[codec], n);
+    ipc_count(&stats_.written, n);
+  }
+  inline void CountFlush(size_t ranges, bool failed) {
+    ipc_count(&ipc_stats.flushes, 1);
+    ipc_count(&ipc_stats.flushed_ranges, ranges);
+    if (failed) ipc_count(&ipc_stats.flush_errors, 1);
+    ipc_count(&stats_.flushes, 1);
+  }
+
+  // A copy out of this buffer is done, count it and dirty the target
+  void Copied(v8::Handle<v8::Object> target, size_t target_start,
+              size_t length);
+
   private:
   static v8::Persistent<v8::FunctionTemplate> constructor_template;
 
@@ -88,16 +150,77 @@ class IPCbuffer : public ObjectWrap {
   static v8::Handle<v8::Value> AsciiSlice(const v8::Arguments &args);
   static v8::Handle<v8::Value> Base64Slice(const v8::Arguments &args);
   static v8::Handle<v8::Value> Utf8Slice(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Utf8Check(const v8::Arguments &args);
+  static v8::Handle<v8::Value> SharedSlice(const v8::Arguments &args);
   static v8::Handle<v8::Value> BinaryWrite(const v8::Arguments &args);
   static v8::Handle<v8::Value> Base64Write(const v8::Arguments &args);
   static v8::Handle<v8::Value> AsciiWrite(const v8::Arguments &args);
   static v8::Handle<v8::Value> Utf8Write(const v8::Arguments &args);
+  static v8::Handle<v8::Value> WriteMany(const v8::Arguments &args);
+  static v8::Handle<v8::Value> SliceMany(const v8::Arguments &args);
   static v8::Handle<v8::Value> ByteLength(const v8::Arguments &args);
   static v8::Handle<v8::Value> MakeFastBuffer(const v8::Arguments &args);
+  static v8::Handle<v8::Value> PoolConfig(const v8::Arguments &args);
+  static v8::Handle<v8::Value> PoolStats(const v8::Arguments &args);
   static v8::Handle<v8::Value> Copy(const v8::Arguments &args);
-
-  IPCbuffer(v8::Handle<v8::Object> wrapper, size_t length, char* path, uint32_t id);
+  static v8::Handle<v8::Value> CopyAsync(const v8::Arguments &args);
+  static v8::Handle<v8::Value> CopyConfig(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Fill(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Compare(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Equals(const v8::Arguments &args);
+  static v8::Handle<v8::Value> IndexOf(const v8::Arguments &args);
+  static v8::Handle<v8::Value> LastIndexOf(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Search(const v8::Arguments &args, bool last);
+  static v8::Handle<v8::Value> Crc32c(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Hash64(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Checksum(const v8::Arguments &args, bool crc);
+  static v8::Handle<v8::Value> Wait(const v8::Arguments &args);
+  static v8::Handle<v8::Value> WaitSync(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Notify(const v8::Arguments &args);
+  static v8::Handle<v8::Value> AtomicLoad(const v8::Arguments &args);
+  static v8::Handle<v8::Value> AtomicStore(const v8::Arguments &args);
+  static v8::Handle<v8::Value> AtomicExchange(const v8::Arguments &args);
+  static v8::Handle<v8::Value> AtomicFetchAdd(const v8::Arguments &args);
+  static v8::Handle<v8::Value> AtomicFetchOr(const v8::Arguments &args);
+  static v8::Handle<v8::Value> AtomicCompareExchange(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Atomic(const v8::Arguments &args, int op);
+  static v8::Handle<v8::Value> ReadNumber(const v8::Arguments &args);
+  static v8::Handle<v8::Value> WriteNumber(const v8::Arguments &args);
+  static v8::Handle<v8::Value> ReadArray(const v8::Arguments &args);
+  static v8::Handle<v8::Value> WriteArray(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Advise(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Prefault(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Flush(const v8::Arguments &args);
+  static v8::Handle<v8::Value> FlushSync(const v8::Arguments &args);
+  static v8::Handle<v8::Value> MarkDirty(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Resize(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Remap(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Seal(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Fd(const v8::Arguments &args);
+  static v8::Handle<v8::Value> SendFd(const v8::Arguments &args);
+  static v8::Handle<v8::Value> ReceiveFd(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Stats(const v8::Arguments &args);
+  static v8::Handle<v8::Value> GlobalStats(const v8::Arguments &args);
+
+  IPCbuffer(v8::Handle<v8::Object> wrapper, size_t length, char* path, uint32_t id,
+            const IPCoptions &options);
   void Replace(char *data, size_t length, free_callback callback, void *hint);
+  v8::Local<v8::Value> Map();
+  bool MapSegment(size_t length, IPCmapError *error, bool *populated);
+  bool Shareable();
+  IPCmapping* FindMapping(size_t length);
+  void Join(IPCmapping *mapping);
+  void Prepare(size_t length, bool populated);
+  void Mapped();
+  void Created(uint64_t ns);
+  void Failed();
+  void Expose();
+  void Open(size_t length, v8::Handle<v8::Function> callback);
+  static void OpenWork(uv_work_t *req);
+  static void OpenAfter(uv_work_t *req);
+  void Unmap();
+  int OpenBacking();
+  v8::Local<v8::Value> Remap(size_t length, bool follow, bool can_move);
 
   size_t length_;
   char* data_;
@@ -106,6 +229,21 @@ class IPCbuffer : public ObjectWrap {
 
   char* fileName_;
   uint32_t id_;
+  IPCoptions options_;
+
+  int backing_;       // Where data_ came from, so we know how to let it go
+  size_t mapped_;     // Bytes actually mapped, length_ rounded up to a page
+  size_t pageSize_;   // Page size the memory really ended up with
+  char* mapPath_;     // hugetlbfs file standing in for a "*name" segment
+  uint32_t* dirty_;   // One bit per page written since the last flush
+  int pins_;          // Rings, queues, heaps, strings and async work using data_
+  bool fixed_;        // A slice has been taken, so data_ never moves again
+  bool pooled_;       // Small Buffers are carved out of it, it never moves
+  int fd_;            // A memfd segment's only name, kept open to hand on
+  bool sealed_;       // Nobody can write it any more, this mapping included
+  bool opening_;      // open() still at it on the threadpool, length_ is 0
+  IPCmapping* mapping_; // Shared with any other buffer here on the segment
+  IPCbufferStats stats_;
 };
 
 
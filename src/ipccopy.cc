@@ -0,0 +1,135 @@
+#include "ipccopy.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define IPC_COPY_X86 1
+# include <immintrin.h>
+#endif
+
+namespace node {
+
+#define DEFAULT_THRESHOLD (4 * 1024 * 1024)   // If the cache won't say
+#define MIN_THRESHOLD     (256 * 1024)
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+// Kernels copy everything, head and tail included, and fence at the end
+typedef void (*stream_kernel)(char *dst, const char *src, size_t length);
+
+static stream_kernel stream_fast = NULL;
+static const char *kernel_name = "memcpy";
+static size_t default_threshold = DEFAULT_THRESHOLD;
+static size_t threshold = DEFAULT_THRESHOLD;
+
+
+#ifdef IPC_COPY_X86
+// Streaming stores have to be aligned, so the head is memcpy'd to get dst
+// there. The loads can be anywhere.
+__attribute__((target("sse2")))
+static void StreamSSE2(char *dst, const char *src, size_t length) {
+  size_t head = MIN((16 - ((uintptr_t) dst & 15)) & 15, length);
+  memcpy(dst, src, head);
+  size_t i = head;
+  for (; length - i >= 64; i += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+    __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+    _mm_stream_si128((__m128i*)(dst + i), a);
+    _mm_stream_si128((__m128i*)(dst + i + 16), b);
+    _mm_stream_si128((__m128i*)(dst + i + 32), c);
+    _mm_stream_si128((__m128i*)(dst + i + 48), d);
+  }
+  _mm_sfence();
+  memcpy(dst + i, src + i, length - i);
+}
+
+
+__attribute__((target("avx2")))
+static void StreamAVX2(char *dst, const char *src, size_t length) {
+  size_t head = MIN((32 - ((uintptr_t) dst & 31)) & 31, length);
+  memcpy(dst, src, head);
+  size_t i = head;
+  for (; length - i >= 128; i += 128) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i*)(src + i + 64));
+    __m256i d = _mm256_loadu_si256((const __m256i*)(src + i + 96));
+    _mm256_stream_si256((__m256i*)(dst + i), a);
+    _mm256_stream_si256((__m256i*)(dst + i + 32), b);
+    _mm256_stream_si256((__m256i*)(dst + i + 64), c);
+    _mm256_stream_si256((__m256i*)(dst + i + 96), d);
+  }
+  _mm_sfence();
+  memcpy(dst + i, src + i, length - i);
+}
+#endif
+
+
+void ipc_copy_init() {
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+  long cache = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (cache <= 0) cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (cache > 0) {
+    default_threshold = (size_t) cache / 2;
+    if (default_threshold < MIN_THRESHOLD) default_threshold = MIN_THRESHOLD;
+    threshold = default_threshold;
+  }
+#endif
+
+#ifdef IPC_COPY_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    stream_fast = StreamAVX2;
+    kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    stream_fast = StreamSSE2;
+    kernel_name = "sse2";
+  }
+#endif
+}
+
+
+const char* ipc_copy_kernel() {
+  return kernel_name;
+}
+
+
+void ipc_copy_configure(size_t stream_threshold) {
+  threshold = stream_threshold ? stream_threshold : default_threshold;
+}
+
+
+size_t ipc_copy_threshold() {
+  return threshold;
+}
+
+
+bool ipc_copy_streams(size_t length) {
+  return stream_fast && length >= threshold;
+}
+
+
+void ipc_copy_stream(void *dst, const void *src, size_t length) {
+  if (stream_fast) {
+    stream_fast((char*) dst, (const char*) src, length);
+  } else {
+    memcpy(dst, src, length);
+  }
+}
+
+
+void ipc_copy(void *dst, const void *src, size_t length) {
+  const char *d = (const char*) dst, *s = (const char*) src;
+  if (d < s + length && s < d + length) {
+    memmove(dst, src, length);
+  } else if (ipc_copy_streams(length)) {
+    stream_fast((char*) dst, s, length);
+  } else {
+    memcpy(dst, src, length);
+  }
+}
+
+}  // namespace node
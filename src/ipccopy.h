@@ -0,0 +1,41 @@
+#ifndef NODE_IPCCOPY_H_
+#define NODE_IPCCOPY_H_
+
+#include <stddef.h>
+
+namespace node {
+
+/* Copying between buffers. Anything that might overlap is memmove, and
+ * small copies are memcpy. Past a threshold, half the last level cache
+ * unless told otherwise, the stores go straight to memory with SSE2 or
+ * AVX2 non-temporal stores. That way copying hundreds of megabytes into
+ * a segment doesn't flush everything else out of a cache that's shared
+ * with the other processes. It ends with a store fence, so the copy is
+ * visible before whatever's stored next, a flag telling another process
+ * it's there, say.
+ *
+ * Elsewhere than x86 it's always memcpy.
+ */
+
+// Picks the kernels for this CPU. Until it's called everything is memcpy.
+void ipc_copy_init();
+
+// "avx2", "sse2" or "memcpy"
+const char* ipc_copy_kernel();
+
+// 0 goes back to the default
+void ipc_copy_configure(size_t stream_threshold);
+size_t ipc_copy_threshold();
+
+// Whether a copy this long gets streamed
+bool ipc_copy_streams(size_t length);
+
+// Streams whatever the length. dst and src mustn't overlap.
+void ipc_copy_stream(void *dst, const void *src, size_t length);
+
+// The right one of memmove, memcpy and ipc_copy_stream for the copy
+void ipc_copy(void *dst, const void *src, size_t length);
+
+}  // namespace node
+
+#endif  // NODE_IPCCOPY_H_
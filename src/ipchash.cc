@@ -0,0 +1,338 @@
+#include "ipchash.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+# define IPC_HASH_X86 1
+# include <immintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+# define IPC_HASH_ARM 1
+# include <arm_acle.h>
+# include <sys/auxv.h>
+# include <asm/hwcap.h>
+#endif
+
+namespace node {
+
+#define CRC32C_POLY 0x82F63B78    // Reflected
+
+typedef uint32_t (*crc_kernel)(uint32_t crc, const uint8_t *p, size_t length);
+
+static crc_kernel crc_fast = NULL;
+static const char *kernel_name = "table";
+
+static uint32_t crc_table[8][256];
+static bool crc_table_built = false;
+
+// x^(2^n) mod P, for getting x to any power in a few multiplies
+static uint32_t x2n_table[32];
+
+
+/*
+ * Polynomials mod P the reflected way round, so x^0 is the top bit. This
+ * is zlib's crc32_combine() arithmetic.
+ */
+static uint32_t MultModP(uint32_t a, uint32_t b) {
+  uint32_t m = 1u << 31, p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) break;
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+  }
+  return p;
+}
+
+
+// x^n mod P
+static uint32_t XPowModP(uint64_t n) {
+  uint32_t p = 1u << 31;
+  for (int k = 0; n; n >>= 1, k++) {
+    if (n & 1) p = MultModP(x2n_table[k & 31], p);
+  }
+  return p;
+}
+
+
+// Both are the same every time, so threads racing to build them is harmless
+static void BuildTables() {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t crc = n;
+    for (int k = 0; k < 8; k++) {
+      crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+    }
+    crc_table[0][n] = crc;
+  }
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t crc = crc_table[0][n];
+    for (int k = 1; k < 8; k++) {
+      crc = crc_table[0][crc & 0xFF] ^ (crc >> 8);
+      crc_table[k][n] = crc;
+    }
+  }
+
+  uint32_t p = 1u << 30;    // x^1
+  x2n_table[0] = p;
+  for (int n = 1; n < 32; n++) {
+    x2n_table[n] = p = MultModP(p, p);
+  }
+  crc_table_built = true;
+}
+
+
+// Slicing by eight, the bytes before that go one at a time
+static uint32_t Crc32cTable(uint32_t crc, const uint8_t *p, size_t length) {
+  while (length && ((uintptr_t) p & 7)) {
+    crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    length--;
+  }
+  while (length >= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    lo = __builtin_bswap32(lo);
+    hi = __builtin_bswap32(hi);
+#endif
+    lo ^= crc;
+    crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+          crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+          crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+          crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+    p += 8;
+    length -= 8;
+  }
+  while (length--) {
+    crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+
+#ifdef IPC_HASH_X86
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSSE42(uint32_t crc, const uint8_t *p, size_t length) {
+  while (length && ((uintptr_t) p & 7)) {
+    crc = _mm_crc32_u8(crc, *p++);
+    length--;
+  }
+  uint64_t c = crc;
+  for (; length >= 8; p += 8, length -= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  crc = (uint32_t) c;
+  while (length--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+
+
+/*
+ * crc32 takes three cycles but a new one can start every cycle, so three
+ * independent streams over three neighbouring blocks run at three times
+ * the speed. Joining them means moving each stream's CRC along past the
+ * blocks after it: multiplying by x^(8n) mod P. A carry-less multiply by
+ * x^(8n-33) leaves a 64 bit product that crc32 of 0 takes the rest of the
+ * way, the 33 being the 32 crc32 itself multiplies by and one more because
+ * the product of two reflected numbers comes out a bit short.
+ */
+#define CRC_LONG  8192    // Bytes per stream
+#define CRC_SHORT 256
+
+static uint64_t shift_long[2], shift_short[2];    // Past one and two blocks
+
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t Shift(uint32_t crc, uint64_t k) {
+  __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+                                         _mm_cvtsi64_si128(k), 0);
+  return (uint32_t) _mm_crc32_u64(0, _mm_cvtsi128_si64(product));
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static inline uint64_t Crc32cBlocks(uint64_t c0, const uint8_t *p,
+                                    size_t block, const uint64_t *shift) {
+  uint64_t c1 = 0, c2 = 0;
+  for (size_t i = 0; i < block; i += 8) {
+    uint64_t v0, v1, v2;
+    memcpy(&v0, p + i, 8);
+    memcpy(&v1, p + block + i, 8);
+    memcpy(&v2, p + 2 * block + i, 8);
+    c0 = _mm_crc32_u64(c0, v0);
+    c1 = _mm_crc32_u64(c1, v1);
+    c2 = _mm_crc32_u64(c2, v2);
+  }
+  return Shift(c0, shift[1]) ^ Shift(c1, shift[0]) ^ c2;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t Crc32cPCLMUL(uint32_t crc, const uint8_t *p, size_t length) {
+  while (length && ((uintptr_t) p & 7)) {
+    crc = _mm_crc32_u8(crc, *p++);
+    length--;
+  }
+  uint64_t c = crc;
+  for (; length >= 3 * CRC_LONG; p += 3 * CRC_LONG, length -= 3 * CRC_LONG) {
+    c = Crc32cBlocks(c, p, CRC_LONG, shift_long);
+  }
+  for (; length >= 3 * CRC_SHORT; p += 3 * CRC_SHORT, length -= 3 * CRC_SHORT) {
+    c = Crc32cBlocks(c, p, CRC_SHORT, shift_short);
+  }
+  return Crc32cSSE42((uint32_t) c, p, length);
+}
+#endif
+
+
+#ifdef IPC_HASH_ARM
+__attribute__((target("+crc")))
+static uint32_t Crc32cARM(uint32_t crc, const uint8_t *p, size_t length) {
+  while (length && ((uintptr_t) p & 7)) {
+    crc = __crc32cb(crc, *p++);
+    length--;
+  }
+  for (; length >= 8; p += 8, length -= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    crc = __crc32cd(crc, v);
+  }
+  while (length--) {
+    crc = __crc32cb(crc, *p++);
+  }
+  return crc;
+}
+#endif
+
+
+void ipc_hash_init() {
+  BuildTables();
+
+#ifdef IPC_HASH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+    shift_long[0] = XPowModP(8 * CRC_LONG - 33);
+    shift_long[1] = XPowModP(16 * CRC_LONG - 33);
+    shift_short[0] = XPowModP(8 * CRC_SHORT - 33);
+    shift_short[1] = XPowModP(16 * CRC_SHORT - 33);
+    crc_fast = Crc32cPCLMUL;
+    kernel_name = "pclmul";
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    crc_fast = Crc32cSSE42;
+    kernel_name = "sse4.2";
+  }
+#elif defined(IPC_HASH_ARM)
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    crc_fast = Crc32cARM;
+    kernel_name = "armv8";
+  }
+#endif
+}
+
+
+const char* ipc_hash_kernel() {
+  return kernel_name;
+}
+
+
+uint32_t ipc_crc32c(uint32_t crc, const char *data, size_t length) {
+  const uint8_t *p = (const uint8_t*) data;
+  if (!crc_table_built) BuildTables();
+  crc = ~crc;
+  crc = crc_fast ? crc_fast(crc, p, length) : Crc32cTable(crc, p, length);
+  return ~crc;
+}
+
+
+uint32_t ipc_crc32c_combine(uint32_t crc1, uint32_t crc2, size_t length2) {
+  if (!crc_table_built) BuildTables();
+  return MultModP(XPowModP((uint64_t) length2 * 8), crc1) ^ crc2;
+}
+
+
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3 1609587929392839161ULL
+#define P4 9650029242287828579ULL
+#define P5 2870177450012600261ULL
+
+static inline uint64_t Rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+static inline uint32_t Read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
+#endif
+  return v;
+}
+
+static inline uint64_t Round(uint64_t acc, uint64_t input) {
+  return Rotl(acc + input * P2, 31) * P1;
+}
+
+static inline uint64_t Merge(uint64_t acc, uint64_t v) {
+  return (acc ^ Round(0, v)) * P1 + P4;
+}
+
+
+// Four lanes a 32 byte stripe at a time, which the compiler keeps going
+// side by side
+uint64_t ipc_hash64(const char *data, size_t length, uint64_t seed) {
+  const uint8_t *p = (const uint8_t*) data;
+  const uint8_t *end = p + length;
+  uint64_t h;
+
+  if (length >= 32) {
+    uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+    const uint8_t *limit = end - 32;
+    do {
+      v1 = Round(v1, Read64(p));
+      v2 = Round(v2, Read64(p + 8));
+      v3 = Round(v3, Read64(p + 16));
+      v4 = Round(v4, Read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+    h = Merge(h, v1);
+    h = Merge(h, v2);
+    h = Merge(h, v3);
+    h = Merge(h, v4);
+  } else {
+    h = seed + P5;
+  }
+
+  h += length;
+  for (; p + 8 <= end; p += 8) {
+    h = Rotl(h ^ Round(0, Read64(p)), 27) * P1 + P4;
+  }
+  if (p + 4 <= end) {
+    h = Rotl(h ^ (uint64_t) Read32(p) * P1, 23) * P2 + P3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h = Rotl(h ^ *p * P5, 11) * P1;
+  }
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+}  // namespace node
@@ -0,0 +1,40 @@
+#ifndef NODE_IPCHASH_H_
+#define NODE_IPCHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace node {
+
+/* Checksums over the buffers.
+ *
+ * CRC-32C, the Castagnoli one iSCSI and ext4 use, is done with the SSE4.2
+ * crc32 instruction. With PCLMUL as well it runs three streams at once and
+ * stitches them together with a carry-less multiply, since one stream only
+ * gets a third of what the instruction can do. 64 bit ARM has a CRC-32C
+ * instruction too. Anything else, and until ipc_hash_init(), uses tables
+ * eight bytes at a time.
+ *
+ * The 64 bit hash is XXH64, so anything else with an xxhash library gets
+ * the same answer. It's no good against someone trying to fool it, only
+ * against accidents.
+ */
+
+// Picks the kernels for this CPU. Until it's called it's all tables.
+void ipc_hash_init();
+
+// "pclmul", "sse4.2", "armv8" or "table"
+const char* ipc_hash_kernel();
+
+// Carries on from crc, which is 0 to start with, like zlib's crc32()
+uint32_t ipc_crc32c(uint32_t crc, const char *data, size_t length);
+
+// The CRC of two pieces one after the other, given each one's CRC and the
+// length of the second, so pieces can be done on different threads
+uint32_t ipc_crc32c_combine(uint32_t crc1, uint32_t crc2, size_t length2);
+
+uint64_t ipc_hash64(const char *data, size_t length, uint64_t seed);
+
+}  // namespace node
+
+#endif  // NODE_IPCHASH_H_
@@ -0,0 +1,373 @@
+
+#include <node.h>
+#include "ipcbuffer.h"
+#include "ipcheap.h"
+
+#include <v8.h>
+
+#include <assert.h>
+#include <string.h> // memset
+
+namespace node {
+
+using namespace v8;
+
+#define HEAP_MAGIC 0x48435049   // "IPCH"
+#define HEAP_EMPTY 0
+#define HEAP_BUSY  1
+#define HEAP_READY 2
+
+#define BLOCK_USED 0x55534544   // "USED"
+#define BLOCK_FREE 0x46524545   // "FREE"
+
+#define HEAP_SLAB       (64 * 1024)
+#define HEAP_SLAB_MAX   4096        // Classes up to here come in slabs
+#define HEAP_MAX_SIZE   ((uint64_t)1 << 40)
+
+// Free list heads are an offset in the low 40 bits with a counter above it
+// that changes on every push, so a pop can't be fooled by a block that was
+// popped and pushed back while it wasn't looking.
+#define HEAD_OFFSET(h)  ((h) & (HEAP_MAX_SIZE - 1))
+#define HEAD_TAG(h)     ((h) >> 40)
+#define HEAD_MAKE(tag, offset) (((uint64_t)(tag) << 40) | (offset))
+
+struct IPCheapBlock {
+  uint32_t size_class;
+  uint32_t state;
+  uint64_t next;        // Only meaningful while the block is free
+};
+
+#define BLOCK_HEADER 8  // What's left of IPCheapBlock once it's handed out
+
+Persistent<FunctionTemplate> IPCheap::constructor_template;
+
+
+static inline uint64_t ClassSize(int c) {
+  if (c == 0) return 16;
+  if (c == 1) return 24;
+  int e = 5 + (c - 2) / 4;
+  int m = 4 + (c - 2) % 4;
+  return (uint64_t)m << (e - 2);
+}
+
+
+// Smallest class that holds n bytes, header included
+static inline int SizeClass(uint64_t n) {
+  if (n <= 16) return 0;
+  if (n <= 24) return 1;
+  if (n <= 32) return 2;
+
+  int e = 63 - __builtin_clzll(n);
+  uint64_t m = (n + ((uint64_t)1 << (e - 2)) - 1) >> (e - 2);
+  if (m == 8) {
+    e++;
+    m = 4;
+  }
+  return 2 + (e - 5) * 4 + (int)(m - 4);
+}
+
+
+static inline IPCheapBlock* Block(IPCheapHeader *heap, uint64_t offset) {
+  return (IPCheapBlock*) ((char*)heap + offset);
+}
+
+
+static inline uint64_t FirstBlock() {
+  return (sizeof(IPCheapHeader) + 15) & ~(uint64_t)15;
+}
+
+
+// Push a chain of blocks, already linked first to last, onto a class list
+static void PushChain(IPCheapHeader *heap, int c, uint64_t first,
+                      uint64_t last) {
+  uint64_t head = ipc_load(&heap->free_[c], IPC_RELAXED);
+  do {
+    Block(heap, last)->next = HEAD_OFFSET(head);
+  } while (!ipc_cas(&heap->free_[c], &head,
+                    HEAD_MAKE(HEAD_TAG(head) + 1, first),
+                    IPC_RELEASE, IPC_RELAXED));
+}
+
+
+static uint64_t Pop(IPCheapHeader *heap, int c) {
+  uint64_t head = ipc_load(&heap->free_[c], IPC_ACQUIRE);
+
+  for (;;) {
+    uint64_t offset = HEAD_OFFSET(head);
+    if (offset == 0) return 0;
+
+    // If someone else takes this block first next is junk, but then the
+    // head has moved on as well and the swap fails
+    uint64_t next = ipc_load(&Block(heap, offset)->next, IPC_RELAXED);
+    if (ipc_cas(&heap->free_[c], &head, HEAD_MAKE(HEAD_TAG(head), next),
+                IPC_ACQUIRE, IPC_ACQUIRE)) {
+      return offset;
+    }
+  }
+}
+
+
+// Take length bytes off the top, 0 if they aren't there
+static uint64_t Carve(IPCheapHeader *heap, uint64_t length) {
+  uint64_t top = ipc_load(&heap->top, IPC_RELAXED);
+
+  do {
+    if (length > heap->size || top > heap->size - length) return 0;
+  } while (!ipc_cas(&heap->top, &top, top + length,
+                    IPC_RELAXED, IPC_RELAXED));
+
+  return top;
+}
+
+
+/*
+ * Lay out a new heap at base, or check the one already there. Returns NULL
+ * when all is well, otherwise what is wrong.
+ */
+const char* ipc_heap_attach(char *base, size_t length) {
+  IPCheapHeader *heap = (IPCheapHeader*) base;
+
+  if ((uintptr_t)base % 16) return "Heap must start on a 16 byte boundary";
+  if (length < FirstBlock() + HEAP_SLAB) return "Buffer too small for a heap";
+  if (length > HEAP_MAX_SIZE) length = HEAP_MAX_SIZE;
+
+  uint32_t state = HEAP_EMPTY;
+  if (ipc_cas(&heap->state, &state, (uint32_t)HEAP_BUSY,
+              IPC_ACQUIRE, IPC_ACQUIRE)) {
+    heap->magic = HEAP_MAGIC;
+    heap->size = length;
+    heap->top = FirstBlock();
+    memset(heap->free_, 0, sizeof(heap->free_));
+    ipc_store(&heap->state, (uint32_t)HEAP_READY, IPC_RELEASE);
+    return NULL;
+  }
+
+  while (ipc_load(&heap->state, IPC_ACQUIRE) == HEAP_BUSY) {
+    ipc_cpu_relax();
+  }
+  if (heap->magic != HEAP_MAGIC) return "Buffer does not contain a heap";
+  if (heap->size > length) return "Heap header does not fit this buffer";
+
+  return NULL;
+}
+
+
+// Returns the offset of size usable bytes from the start of the heap, or 0
+uint64_t ipc_heap_alloc(IPCheapHeader *heap, size_t size) {
+  if (size > heap->size) return 0;
+
+  int c = SizeClass(size + BLOCK_HEADER < 16 ? 16 : size + BLOCK_HEADER);
+  uint64_t class_size = ClassSize(c);
+  uint64_t offset = Pop(heap, c);
+
+  if (offset == 0 && class_size <= HEAP_SLAB_MAX) {
+    // Carve a whole slab, keep the first block and put the rest up for grabs
+    uint64_t count = HEAP_SLAB / class_size;
+    uint64_t slab = Carve(heap, count * class_size);
+    if (slab) {
+      uint64_t i;
+      for (i = 0; i < count; i++) {
+        IPCheapBlock *b = Block(heap, slab + i * class_size);
+        b->size_class = c;
+        b->state = BLOCK_FREE;
+        b->next = slab + (i + 1) * class_size;
+      }
+      if (count > 1) {
+        PushChain(heap, c, slab + class_size, slab + (count - 1) * class_size);
+      }
+      offset = slab;
+    }
+  }
+
+  if (offset == 0) {
+    if ((offset = Carve(heap, class_size)) == 0) return 0;
+  }
+
+  IPCheapBlock *b = Block(heap, offset);
+  b->size_class = c;
+  ipc_store(&b->state, (uint32_t)BLOCK_USED, IPC_RELAXED);
+
+  return offset + BLOCK_HEADER;
+}
+
+
+static IPCheapBlock* UsedBlock(IPCheapHeader *heap, uint64_t offset) {
+  uint64_t top = ipc_load(&heap->top, IPC_ACQUIRE);
+
+  if (offset < FirstBlock() + BLOCK_HEADER || offset >= top || offset % 8) {
+    return NULL;
+  }
+
+  IPCheapBlock *b = Block(heap, offset - BLOCK_HEADER);
+  if (b->size_class >= IPC_HEAP_CLASSES ||
+      ipc_load(&b->state, IPC_ACQUIRE) != BLOCK_USED) {
+    return NULL;
+  }
+
+  return b;
+}
+
+
+// False if offset isn't a block in use, freeing it twice included
+bool ipc_heap_free(IPCheapHeader *heap, uint64_t offset) {
+  IPCheapBlock *b = UsedBlock(heap, offset);
+  if (b == NULL) return false;
+
+  uint32_t state = BLOCK_USED;
+  if (!ipc_cas(&b->state, &state, (uint32_t)BLOCK_FREE,
+               IPC_RELAXED, IPC_RELAXED)) {
+    return false;   // Somebody else got there first
+  }
+
+  uint64_t block = offset - BLOCK_HEADER;
+  PushChain(heap, b->size_class, block, block);
+
+  return true;
+}
+
+
+size_t ipc_heap_usable(IPCheapHeader *heap, uint64_t offset) {
+  IPCheapBlock *b = UsedBlock(heap, offset);
+  if (b == NULL) return 0;
+
+  return ClassSize(b->size_class) - BLOCK_HEADER;
+}
+
+
+// var heap = new _IPCheap(ipcbuffer, [offset], [length]);
+Handle<Value> IPCheap::New(const Arguments &args) {
+  if (!args.IsConstructCall()) {
+    return FromConstructorTemplate(constructor_template, args);
+  }
+
+  HandleScope scope;
+
+  if (!IPCbuffer::HasInstance(args[0])) {
+    return ThrowException(Exception::TypeError(String::New(
+            "First arg should be a Buffer")));
+  }
+
+  Local<Object> buffer = args[0]->ToObject();
+  size_t buffer_length = IPCbuffer::Length(buffer);
+  size_t offset = args[1]->IsUint32() ? args[1]->Uint32Value() : 0;
+
+  if (offset > buffer_length) {
+    return ThrowException(Exception::RangeError(String::New(
+            "offset out of bounds")));
+  }
+
+  size_t length = args[2]->IsUint32() ? args[2]->Uint32Value()
+                                      : buffer_length - offset;
+  if (length > buffer_length - offset) {
+    return ThrowException(Exception::RangeError(String::New(
+            "length out of bounds")));
+  }
+
+  const char *error = ipc_heap_attach(IPCbuffer::Data(buffer) + offset, length);
+  if (error) {
+    return ThrowException(Exception::Error(String::New(error)));
+  }
+
+  new IPCheap(args.This(), buffer, offset);
+
+  return args.This();
+}
+
+
+IPCheap::IPCheap(Handle<Object> wrapper, Handle<Object> buffer,
+                 size_t offset) : ObjectWrap() {
+  Wrap(wrapper);
+
+  buffer_ = Persistent<Object>::New(buffer);
+  IPCbuffer::Pin(buffer);
+  header_ = (IPCheapHeader*) (IPCbuffer::Data(buffer) + offset);
+}
+
+
+IPCheap::~IPCheap() {
+  IPCbuffer::Unpin(buffer_);
+  buffer_.Dispose();
+}
+
+
+// var offset = heap.alloc(size); // null when the heap is full
+Handle<Value> IPCheap::Alloc(const Arguments &args) {
+  HandleScope scope;
+  IPCheap *heap = ObjectWrap::Unwrap<IPCheap>(args.This());
+
+  if (!args[0]->IsNumber() || args[0]->NumberValue() < 0) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Bad argument.")));
+  }
+
+  uint64_t offset = ipc_heap_alloc(heap->header_,
+                                   (size_t)args[0]->IntegerValue());
+  if (offset == 0) return scope.Close(Null());
+
+  return scope.Close(Number::New((double)offset));
+}
+
+
+// heap.free(offset);
+Handle<Value> IPCheap::Free(const Arguments &args) {
+  HandleScope scope;
+  IPCheap *heap = ObjectWrap::Unwrap<IPCheap>(args.This());
+
+  if (!args[0]->IsNumber() ||
+      !ipc_heap_free(heap->header_, (uint64_t)args[0]->IntegerValue())) {
+    return ThrowException(Exception::Error(String::New(
+            "Not an allocated block")));
+  }
+
+  return Undefined();
+}
+
+
+// var bytes = heap.usable(offset); // what the block really holds
+Handle<Value> IPCheap::Usable(const Arguments &args) {
+  HandleScope scope;
+  IPCheap *heap = ObjectWrap::Unwrap<IPCheap>(args.This());
+
+  size_t usable = args[0]->IsNumber()
+                ? ipc_heap_usable(heap->header_,
+                                  (uint64_t)args[0]->IntegerValue())
+                : 0;
+  if (usable == 0) {
+    return ThrowException(Exception::Error(String::New(
+            "Not an allocated block")));
+  }
+
+  return scope.Close(Number::New((double)usable));
+}
+
+
+// var bytes = heap.used(); // carved off so far, free lists included
+Handle<Value> IPCheap::Used(const Arguments &args) {
+  HandleScope scope;
+  IPCheap *heap = ObjectWrap::Unwrap<IPCheap>(args.This());
+
+  return scope.Close(Number::New(
+          (double)ipc_load(&heap->header_->top, IPC_ACQUIRE)));
+}
+
+
+void IPCheap::Initialize(Handle<Object> target) {
+  HandleScope scope;
+
+  assert(SizeClass(ClassSize(IPC_HEAP_CLASSES - 1)) == IPC_HEAP_CLASSES - 1);
+
+  Local<FunctionTemplate> t = FunctionTemplate::New(IPCheap::New);
+  constructor_template = Persistent<FunctionTemplate>::New(t);
+  constructor_template->InstanceTemplate()->SetInternalFieldCount(1);
+  constructor_template->SetClassName(String::NewSymbol("_IPCheap"));
+
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "alloc", IPCheap::Alloc);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "free", IPCheap::Free);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "usable", IPCheap::Usable);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "used", IPCheap::Used);
+
+  target->Set(String::NewSymbol("_IPCheap"), constructor_template->GetFunction());
+}
+
+
+}  // namespace node
@@ -0,0 +1,72 @@
+#ifndef NODE_IPCHEAP_H_
+#define NODE_IPCHEAP_H_
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <v8.h>
+#include <stdint.h>
+
+#include "ipcatomic.h"
+
+namespace node {
+
+/* A heap that lives entirely inside a chunk of an IPCbuffer, so every
+ * process attached to the same segment can allocate from it and free what
+ * the others allocated.
+ *
+ * Nothing in it is a pointer. Blocks are handed out as byte offsets from
+ * the start of the heap, which mean the same thing in every process however
+ * the segment happens to be mapped.
+ *
+ * Sizes are rounded up to one of a set of classes, four to each power of
+ * two, and every class has its own lock free free list. The small classes
+ * are carved out of 64K slabs a whole slab at a time. Freed blocks go back
+ * on their class's list, they never merge, so the heap suits lots of
+ * similar sized objects best.
+ *
+ *   var heap = new _IPCheap(ipcbuffer, offset, length);
+ *   var at = heap.alloc(100);   // offset from the heap, null if it's full
+ *   heap.free(at);
+ */
+
+#define IPC_HEAP_CLASSES 146
+
+struct IPCheapHeader {
+  uint32_t magic;
+  uint32_t state;
+  uint64_t size;                      // Bytes in the heap, header and all
+  uint64_t top;                       // Everything below here is carved up
+  uint64_t free_[IPC_HEAP_CLASSES];   // Tagged free list heads
+};
+
+// Usable from C++ for anything else that wants to keep a heap in a segment
+const char* ipc_heap_attach(char *base, size_t length);
+uint64_t ipc_heap_alloc(IPCheapHeader *heap, size_t size);
+bool ipc_heap_free(IPCheapHeader *heap, uint64_t offset);
+size_t ipc_heap_usable(IPCheapHeader *heap, uint64_t offset);
+
+
+class IPCheap : public ObjectWrap {
+ public:
+  static void Initialize(v8::Handle<v8::Object> target);
+
+ private:
+  static v8::Persistent<v8::FunctionTemplate> constructor_template;
+
+  static v8::Handle<v8::Value> New(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Alloc(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Free(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Usable(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Used(const v8::Arguments &args);
+
+  IPCheap(v8::Handle<v8::Object> wrapper, v8::Handle<v8::Object> buffer,
+          size_t offset);
+  ~IPCheap();
+
+  v8::Persistent<v8::Object> buffer_;   // Keeps the segment mapped
+  IPCheapHeader *header_;
+};
+
+}  // namespace node
+
+#endif  // NODE_IPCHEAP_H_
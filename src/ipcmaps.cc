@@ -0,0 +1,74 @@
+#include "ipcmaps.h"
+
+#include <string.h>
+
+namespace node {
+
+// Processes don't have many segments, a list does
+static IPCmapping *mappings = NULL;
+
+
+static char* Copy(const char *s) {
+  if (s == NULL) return NULL;
+  size_t n = strlen(s) + 1;
+  char *c = new char[n];
+  memcpy(c, s, n);
+  return c;
+}
+
+
+IPCmapping* ipc_maps_find(const char *name, uint32_t key, size_t length,
+                          int huge_pages, IPCmapping *after) {
+  for (IPCmapping *m = after ? after->next : mappings; m; m = m->next) {
+    if (m->key != key || m->length != length || m->huge_pages != huge_pages) {
+      continue;
+    }
+    if (name ? m->name && !strcmp(m->name, name) : !m->name) return m;
+  }
+  return NULL;
+}
+
+
+IPCmapping* ipc_maps_add(const IPCmapping &from) {
+  IPCmapping *m = new IPCmapping(from);
+  m->name = Copy(from.name);
+  m->map_path = Copy(from.map_path);
+  m->views = 1;
+
+  // Newest first, an older one of the same name may be a removed segment
+  m->next = mappings;
+  mappings = m;
+  return m;
+}
+
+
+void ipc_maps_hold(IPCmapping *m) {
+  m->views++;
+}
+
+
+bool ipc_maps_release(IPCmapping *m) {
+  if (--m->views > 0) return false;
+
+  for (IPCmapping **p = &mappings; *p; p = &(*p)->next) {
+    if (*p == m) {
+      *p = m->next;
+      break;
+    }
+  }
+  delete [] m->name;
+  delete [] m->map_path;
+  delete m;
+  return true;
+}
+
+
+void ipc_maps_count(size_t *count, size_t *views) {
+  *count = *views = 0;
+  for (IPCmapping *m = mappings; m; m = m->next) {
+    (*count)++;
+    *views += m->views;
+  }
+}
+
+}  // namespace node
@@ -0,0 +1,52 @@
+#ifndef NODE_IPCMAPS_H_
+#define NODE_IPCMAPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace node {
+
+/* Every shared segment this process has mapped, so opening one it already
+ * has hands out another view of the same mapping instead of opening,
+ * truncating and mapping it all over again. Keyed on the name or System V
+ * key, the length and the huge page option, since those decide what the
+ * mapping looks like.
+ *
+ * It only keeps count. Whoever lets go of the last view is told so and
+ * does the unmapping, the registry never touches the memory itself.
+ *
+ * It isn't thread safe, buffers only come and go on the JS thread.
+ */
+
+struct IPCmapping {
+  IPCmapping *next;
+  char *name;           // "*name" or a file path, NULL for System V
+  uint32_t key;         // System V key, 0 otherwise
+  size_t length;
+  int huge_pages;       // IPC_HUGE_* asked for, not what was got
+  int backing;          // IPC_BACKING_*
+  char *data;
+  size_t mapped;
+  size_t page_size;
+  char *map_path;       // hugetlbfs file standing in for a "*name" segment
+  uint64_t id[2];       // Which segment it was, device and inode or shmid
+  int views;
+};
+
+// The next match after after, the first if that's NULL. Adds no view.
+IPCmapping* ipc_maps_find(const char *name, uint32_t key, size_t length,
+                          int huge_pages, IPCmapping *after);
+
+// Copies m, strings and all, as a mapping with one view
+IPCmapping* ipc_maps_add(const IPCmapping &m);
+
+void ipc_maps_hold(IPCmapping *m);
+
+// True if that was the last view, which also frees m
+bool ipc_maps_release(IPCmapping *m);
+
+void ipc_maps_count(size_t *mappings, size_t *views);
+
+}  // namespace node
+
+#endif  // NODE_IPCMAPS_H_
@@ -0,0 +1,113 @@
+#include "ipcpool.h"
+
+#include <string.h>
+
+namespace node {
+
+#define POOL_CLASSES    100                 // 64 bytes up to 1.75GB
+#define POOL_LIMIT      (16 * 1024 * 1024)
+#define POOL_MAX_BLOCK  (1024 * 1024)
+
+// A free block keeps the next one's address in its first bytes
+struct IPCpoolFree {
+  IPCpoolFree *next;
+};
+
+static IPCpoolFree *free_[POOL_CLASSES];
+static IPCpoolStats stats = { 0, 0, 0, 0, 0, 0, POOL_LIMIT, POOL_MAX_BLOCK };
+
+
+static inline size_t ClassSize(int c) {
+  int e = 6 + c / 4;
+  int m = 4 + c % 4;
+  return (size_t)m << (e - 2);
+}
+
+
+// Smallest class that holds n bytes
+static inline int SizeClass(size_t n) {
+  if (n <= 64) return 0;
+
+  int e = 63 - __builtin_clzll(n);
+  size_t m = (n + ((size_t)1 << (e - 2)) - 1) >> (e - 2);
+  if (m == 8) {
+    e++;
+    m = 4;
+  }
+  return (e - 6) * 4 + (int)(m - 4);
+}
+
+
+void ipc_pool_configure(size_t limit, size_t max_block) {
+  if (max_block > ClassSize(POOL_CLASSES - 1)) {
+    max_block = ClassSize(POOL_CLASSES - 1);
+  }
+  stats.limit = limit;
+  stats.max_block = max_block;
+  if (stats.cached > limit) ipc_pool_trim();
+}
+
+
+void ipc_pool_stats(IPCpoolStats *out) {
+  *out = stats;
+}
+
+
+void ipc_pool_trim() {
+  for (int c = 0; c < POOL_CLASSES; c++) {
+    while (free_[c]) {
+      IPCpoolFree *f = free_[c];
+      free_[c] = f->next;
+      delete [] (char*) f;
+    }
+  }
+  stats.cached = 0;
+  stats.cached_blocks = 0;
+}
+
+
+char* ipc_pool_alloc(size_t length, size_t *capacity) {
+  stats.allocs++;
+
+  if (length > stats.max_block) {
+    *capacity = length;
+    return new char[length];
+  }
+
+  int c = SizeClass(length);
+  *capacity = ClassSize(c);
+
+  if (free_[c]) {
+    IPCpoolFree *f = free_[c];
+    free_[c] = f->next;
+    stats.reused++;
+    stats.cached -= *capacity;
+    stats.cached_blocks--;
+    return (char*) f;
+  }
+
+  return new char[*capacity];
+}
+
+
+void ipc_pool_free(char *data, size_t capacity) {
+  stats.frees++;
+
+  // Only whole classes go back on a list. Anything else was too big to
+  // pool when it was handed out.
+  int c = SizeClass(capacity);
+  if (capacity > stats.max_block || ClassSize(c) != capacity ||
+      stats.cached + capacity > stats.limit) {
+    stats.released++;
+    delete [] data;
+    return;
+  }
+
+  IPCpoolFree *f = (IPCpoolFree*) data;
+  f->next = free_[c];
+  free_[c] = f;
+  stats.cached += capacity;
+  stats.cached_blocks++;
+}
+
+}  // namespace node
@@ -0,0 +1,40 @@
+#ifndef NODE_IPCPOOL_H_
+#define NODE_IPCPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace node {
+
+/* Where in process buffers get their memory. Sizes are rounded up to one
+ * of a set of classes, four to each power of two, and when a buffer goes
+ * its memory is kept on a free list for the next one of that class rather
+ * than handed back to malloc. Only so much is kept, the rest is freed.
+ *
+ * It isn't thread safe, buffers only come and go on the JS thread.
+ */
+
+struct IPCpoolStats {
+  uint64_t allocs;          // Blocks handed out
+  uint64_t reused;          // ... of which came off a free list
+  uint64_t frees;           // Blocks given back
+  uint64_t released;        // ... of which went to the system, no room
+  size_t cached;            // Bytes sitting on free lists
+  size_t cached_blocks;
+  size_t limit;             // Most bytes it'll keep on free lists
+  size_t max_block;         // Anything bigger isn't pooled at all
+};
+
+void ipc_pool_configure(size_t limit, size_t max_block);
+void ipc_pool_stats(IPCpoolStats *stats);
+
+// Lets go of everything on the free lists
+void ipc_pool_trim();
+
+// capacity gets what the block really holds, which can be more than asked
+char* ipc_pool_alloc(size_t length, size_t *capacity);
+void ipc_pool_free(char *data, size_t capacity);
+
+}  // namespace node
+
+#endif  // NODE_IPCPOOL_H_
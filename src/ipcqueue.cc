@@ -0,0 +1,366 @@
+
+#include <node.h>
+#include "ipcbuffer.h"
+#include "ipcqueue.h"
+
+#include <v8.h>
+
+#include <assert.h>
+#include <string.h> // memcpy
+
+namespace node {
+
+using namespace v8;
+
+#define QUEUE_MAGIC 0x51435049  // "IPCQ"
+#define QUEUE_EMPTY 0
+#define QUEUE_BUSY  1
+#define QUEUE_READY 2
+
+#define QUEUE_PUT_OK    1
+#define QUEUE_PUT_FULL  0
+#define QUEUE_PUT_TYPE  -1
+#define QUEUE_PUT_SIZE  -2
+
+static Persistent<String> slots_sym;
+static Persistent<String> max_record_sym;
+Persistent<FunctionTemplate> IPCqueue::constructor_template;
+
+
+// var q = new _IPCqueue(ipcbuffer, [offset], [length], [slotSize]);
+Handle<Value> IPCqueue::New(const Arguments &args) {
+  if (!args.IsConstructCall()) {
+    return FromConstructorTemplate(constructor_template, args);
+  }
+
+  HandleScope scope;
+
+  if (!IPCbuffer::HasInstance(args[0])) {
+    return ThrowException(Exception::TypeError(String::New(
+            "First arg should be a Buffer")));
+  }
+
+  Local<Object> buffer = args[0]->ToObject();
+  size_t buffer_length = IPCbuffer::Length(buffer);
+  size_t offset = args[1]->IsUint32() ? args[1]->Uint32Value() : 0;
+
+  if (offset > buffer_length) {
+    return ThrowException(Exception::RangeError(String::New(
+            "offset out of bounds")));
+  }
+
+  size_t length = args[2]->IsUint32() ? args[2]->Uint32Value()
+                                      : buffer_length - offset;
+  if (length > buffer_length - offset) {
+    return ThrowException(Exception::RangeError(String::New(
+            "length out of bounds")));
+  }
+
+  // Slots are whole cache lines so neighbouring slots don't false share
+  size_t slot_size = args[3]->IsUint32() ? args[3]->Uint32Value() : 256;
+  slot_size = (slot_size + IPC_CACHELINE - 1) & ~(size_t)(IPC_CACHELINE - 1);
+  if (slot_size <= sizeof(IPCqueueSlot)) slot_size = IPC_CACHELINE;
+
+  char *base = IPCbuffer::Data(buffer) + offset;
+  if ((uintptr_t)base % 8) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Queue must start on an 8 byte boundary")));
+  }
+  if (length < sizeof(IPCqueueHeader) + 2 * slot_size) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Buffer too small for a queue")));
+  }
+
+  uint64_t room = (length - sizeof(IPCqueueHeader)) / slot_size;
+  uint64_t slots = 2;
+  while (slots * 2 <= room && slots * 2 <= 0x80000000u) slots *= 2;
+
+  IPCqueueHeader *header = (IPCqueueHeader*) base;
+  uint32_t state = QUEUE_EMPTY;
+
+  if (ipc_cas(&header->state, &state, (uint32_t)QUEUE_BUSY,
+              IPC_ACQUIRE, IPC_ACQUIRE)) {
+    // First one here. Slot i starts out waiting for enqueue number i.
+    header->magic = QUEUE_MAGIC;
+    header->slots = slots;
+    header->slot_size = slot_size;
+    header->enqueue_pos = 0;
+    header->dequeue_pos = 0;
+    char *p = (char*) (header + 1);
+    for (uint64_t i = 0; i < slots; i++, p += slot_size) {
+      ((IPCqueueSlot*) p)->sequence = i;
+    }
+    ipc_store(&header->state, (uint32_t)QUEUE_READY, IPC_RELEASE);
+  } else {
+    while ((state = ipc_load(&header->state, IPC_ACQUIRE)) == QUEUE_BUSY) {
+      ipc_cpu_relax();
+    }
+    if (header->magic != QUEUE_MAGIC) {
+      return ThrowException(Exception::Error(String::New(
+              "Buffer does not contain a queue")));
+    }
+    if ((header->slots & (header->slots - 1)) ||
+        header->slot_size <= sizeof(IPCqueueSlot) ||
+        (uint64_t)header->slots * header->slot_size >
+            length - sizeof(IPCqueueHeader)) {
+      return ThrowException(Exception::Error(String::New(
+              "Queue header does not fit this buffer")));
+    }
+  }
+
+  IPCqueue *queue = new IPCqueue(args.This(), buffer, offset);
+  args.This()->Set(slots_sym, Number::New(queue->mask_ + 1));
+  args.This()->Set(max_record_sym, Number::New(queue->max_record_));
+
+  return args.This();
+}
+
+
+IPCqueue::IPCqueue(Handle<Object> wrapper, Handle<Object> buffer,
+                   size_t offset) : ObjectWrap() {
+  Wrap(wrapper);
+
+  buffer_ = Persistent<Object>::New(buffer);
+  IPCbuffer::Pin(buffer);
+  header_ = (IPCqueueHeader*) (IPCbuffer::Data(buffer) + offset);
+  slots_ = (char*) (header_ + 1);
+  mask_ = header_->slots - 1;
+  slot_size_ = header_->slot_size;
+  max_record_ = slot_size_ - sizeof(IPCqueueSlot);
+}
+
+
+IPCqueue::~IPCqueue() {
+  IPCbuffer::Unpin(buffer_);
+  buffer_.Dispose();
+}
+
+
+/*
+ * Claim the next slot to fill. A slot is free for enqueue number pos when
+ * its sequence is pos; anything less means the consumers haven't emptied it
+ * from the last lap yet, so the queue is full.
+ */
+IPCqueueSlot* IPCqueue::ClaimEnqueue(uint64_t *ret) {
+  uint64_t pos = ipc_load(&header_->enqueue_pos, IPC_RELAXED);
+
+  for (;;) {
+    IPCqueueSlot *slot = Slot(pos);
+    uint64_t seq = ipc_load(&slot->sequence, IPC_ACQUIRE);
+    int64_t diff = (int64_t)(seq - pos);
+
+    if (diff == 0) {
+      if (ipc_cas(&header_->enqueue_pos, &pos, pos + 1,
+                  IPC_RELAXED, IPC_RELAXED)) {
+        *ret = pos;
+        return slot;
+      }
+      // pos now holds whoever beat us to it, try the one after
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = ipc_load(&header_->enqueue_pos, IPC_RELAXED);
+    }
+  }
+}
+
+
+void IPCqueue::ReleaseEnqueue(IPCqueueSlot *slot, uint64_t pos) {
+  ipc_store(&slot->sequence, pos + 1, IPC_RELEASE);
+}
+
+
+/*
+ * Claim the next slot to empty. It holds dequeue number pos once its
+ * sequence is pos + 1, less than that and the producer isn't done yet.
+ */
+IPCqueueSlot* IPCqueue::ClaimDequeue(uint64_t *ret) {
+  uint64_t pos = ipc_load(&header_->dequeue_pos, IPC_RELAXED);
+
+  for (;;) {
+    IPCqueueSlot *slot = Slot(pos);
+    uint64_t seq = ipc_load(&slot->sequence, IPC_ACQUIRE);
+    int64_t diff = (int64_t)(seq - (pos + 1));
+
+    if (diff == 0) {
+      if (ipc_cas(&header_->dequeue_pos, &pos, pos + 1,
+                  IPC_RELAXED, IPC_RELAXED)) {
+        *ret = pos;
+        return slot;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = ipc_load(&header_->dequeue_pos, IPC_RELAXED);
+    }
+  }
+}
+
+
+void IPCqueue::ReleaseDequeue(IPCqueueSlot *slot, uint64_t pos) {
+  // Hand the slot on to the producer one lap from now
+  ipc_store(&slot->sequence, pos + mask_ + 1, IPC_RELEASE);
+}
+
+
+// Enqueue one string (as utf8) or buffer. Sized before a slot is claimed.
+int IPCqueue::Put(Handle<Value> value) {
+  uint64_t pos;
+  IPCqueueSlot *slot;
+  char *p;
+
+  if (value->IsString()) {
+    Local<String> s = value->ToString();
+    size_t length = s->Utf8Length();
+    if (length > max_record_) return QUEUE_PUT_SIZE;
+
+    if ((slot = ClaimEnqueue(&pos)) == NULL) return QUEUE_PUT_FULL;
+    p = (char*) (slot + 1);
+    s->WriteUtf8(p, length, NULL, String::HINT_MANY_WRITES_EXPECTED);
+    slot->length = length;
+  } else if (IPCbuffer::HasInstance(value)) {
+    Local<Object> obj = value->ToObject();
+    size_t length = IPCbuffer::Length(obj);
+    if (length > max_record_) return QUEUE_PUT_SIZE;
+
+    if ((slot = ClaimEnqueue(&pos)) == NULL) return QUEUE_PUT_FULL;
+    p = (char*) (slot + 1);
+    memcpy(p, IPCbuffer::Data(obj), length);
+    slot->length = length;
+  } else {
+    return QUEUE_PUT_TYPE;
+  }
+
+  ReleaseEnqueue(slot, pos);
+  return QUEUE_PUT_OK;
+}
+
+
+// Dequeue one record as a string or a new _IPCbuffer, Null() if empty
+Handle<Value> IPCqueue::Take(enum encoding enc, bool as_string) {
+  HandleScope scope;
+  uint64_t pos;
+  IPCqueueSlot *slot = ClaimDequeue(&pos);
+
+  if (slot == NULL) return Null();
+
+  char *p = (char*) (slot + 1);
+  size_t length = slot->length;
+  if (length > max_record_) length = max_record_;  // Don't trust the segment
+
+  Local<Value> ret;
+  if (!as_string) {
+    ret = Local<Object>::New(IPCbuffer::New(p, length)->handle_);
+  } else if (enc == BINARY) {
+    ret = Encode(p, length, BINARY);
+  } else {
+    ret = String::New(p, length);
+  }
+
+  ReleaseDequeue(slot, pos);
+  return scope.Close(ret);
+}
+
+
+static Handle<Value> PutError(int code) {
+  if (code == QUEUE_PUT_TYPE) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Only strings and Buffers can be queued")));
+  }
+  return ThrowException(Exception::RangeError(String::New(
+          "Record is bigger than a queue slot")));
+}
+
+
+// var queued = q.enqueue(bufferOrString);
+Handle<Value> IPCqueue::Enqueue(const Arguments &args) {
+  HandleScope scope;
+  IPCqueue *queue = ObjectWrap::Unwrap<IPCqueue>(args.This());
+
+  int ret = queue->Put(args[0]);
+  if (ret < 0) return PutError(ret);
+
+  return scope.Close(ret == QUEUE_PUT_OK ? True() : False());
+}
+
+
+// var count = q.enqueueMany([bufferOrString, ...]); // stops when full
+Handle<Value> IPCqueue::EnqueueMany(const Arguments &args) {
+  HandleScope scope;
+  IPCqueue *queue = ObjectWrap::Unwrap<IPCqueue>(args.This());
+
+  if (!args[0]->IsArray()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Argument must be an array")));
+  }
+
+  Local<Array> list = Local<Array>::Cast(args[0]);
+  uint32_t count = list->Length();
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    int ret = queue->Put(list->Get(i));
+    if (ret < 0) return PutError(ret);
+    if (ret == QUEUE_PUT_FULL) break;
+  }
+
+  return scope.Close(Integer::NewFromUnsigned(i));
+}
+
+
+// var record = q.dequeue([encoding]); // null when empty
+Handle<Value> IPCqueue::Dequeue(const Arguments &args) {
+  HandleScope scope;
+  IPCqueue *queue = ObjectWrap::Unwrap<IPCqueue>(args.This());
+
+  bool as_string = args[0]->IsString();
+  enum encoding enc = ParseEncoding(args[0], UTF8);
+
+  return scope.Close(queue->Take(enc, as_string));
+}
+
+
+// var records = q.dequeueMany(max, [encoding]);
+Handle<Value> IPCqueue::DequeueMany(const Arguments &args) {
+  HandleScope scope;
+  IPCqueue *queue = ObjectWrap::Unwrap<IPCqueue>(args.This());
+
+  uint32_t max = args[0]->IsUint32() ? args[0]->Uint32Value()
+                                     : (uint32_t)(queue->mask_ + 1);
+  bool as_string = args[1]->IsString();
+  enum encoding enc = ParseEncoding(args[1], UTF8);
+
+  Local<Array> list = Array::New();
+  uint32_t i;
+
+  for (i = 0; i < max; i++) {
+    Handle<Value> record = queue->Take(enc, as_string);
+    if (record->IsNull()) break;
+    list->Set(i, record);
+  }
+
+  return scope.Close(list);
+}
+
+
+void IPCqueue::Initialize(Handle<Object> target) {
+  HandleScope scope;
+
+  slots_sym = Persistent<String>::New(String::NewSymbol("slots"));
+  max_record_sym = Persistent<String>::New(String::NewSymbol("maxRecord"));
+
+  Local<FunctionTemplate> t = FunctionTemplate::New(IPCqueue::New);
+  constructor_template = Persistent<FunctionTemplate>::New(t);
+  constructor_template->InstanceTemplate()->SetInternalFieldCount(1);
+  constructor_template->SetClassName(String::NewSymbol("_IPCqueue"));
+
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "enqueue", IPCqueue::Enqueue);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "enqueueMany", IPCqueue::EnqueueMany);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "dequeue", IPCqueue::Dequeue);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "dequeueMany", IPCqueue::DequeueMany);
+
+  target->Set(String::NewSymbol("_IPCqueue"), constructor_template->GetFunction());
+}
+
+
+}  // namespace node
@@ -0,0 +1,85 @@
+#ifndef NODE_IPCQUEUE_H_
+#define NODE_IPCQUEUE_H_
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <v8.h>
+#include <stdint.h>
+
+#include "ipcatomic.h"
+
+namespace node {
+
+/* A bounded multi producer / multi consumer queue of fixed size slots laid
+ * over a chunk of an IPCbuffer, for pools of workers all attached to the
+ * same segment.
+ *
+ * It is Dmitry Vyukov's bounded queue: every slot carries a sequence number
+ * that says whether it is waiting for a producer or a consumer for a given
+ * lap, so claiming a slot is a single compare and swap on the enqueue or
+ * dequeue counter and nobody ever holds a lock.
+ *
+ *   var q = new _IPCqueue(ipcbuffer, offset, length, slotSize);
+ *   q.enqueueMany([buffer, "string", ...]);  // how many went in
+ *   q.dequeueMany(32, "utf8");                // up to 32 records
+ */
+
+struct IPCqueueHeader {
+  uint32_t magic;
+  uint32_t state;
+  uint32_t slots;             // Always a power of two
+  uint32_t slot_size;         // Including the IPCqueueSlot header
+  char pad0_[IPC_CACHELINE - 16];
+  uint64_t enqueue_pos;
+  char pad1_[IPC_CACHELINE - 8];
+  uint64_t dequeue_pos;
+  char pad2_[IPC_CACHELINE - 8];
+};
+
+struct IPCqueueSlot {
+  uint64_t sequence;
+  uint32_t length;
+  uint32_t unused_;
+};
+
+
+class IPCqueue : public ObjectWrap {
+ public:
+  static void Initialize(v8::Handle<v8::Object> target);
+
+ private:
+  static v8::Persistent<v8::FunctionTemplate> constructor_template;
+
+  static v8::Handle<v8::Value> New(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Enqueue(const v8::Arguments &args);
+  static v8::Handle<v8::Value> EnqueueMany(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Dequeue(const v8::Arguments &args);
+  static v8::Handle<v8::Value> DequeueMany(const v8::Arguments &args);
+
+  IPCqueue(v8::Handle<v8::Object> wrapper, v8::Handle<v8::Object> buffer,
+           size_t offset);
+  ~IPCqueue();
+
+  IPCqueueSlot* Slot(uint64_t pos) {
+    return (IPCqueueSlot*) (slots_ + (pos & mask_) * slot_size_);
+  }
+
+  IPCqueueSlot* ClaimEnqueue(uint64_t *pos);
+  IPCqueueSlot* ClaimDequeue(uint64_t *pos);
+  void ReleaseEnqueue(IPCqueueSlot *slot, uint64_t pos);
+  void ReleaseDequeue(IPCqueueSlot *slot, uint64_t pos);
+
+  int Put(v8::Handle<v8::Value> value);
+  v8::Handle<v8::Value> Take(enum encoding enc, bool as_string);
+
+  v8::Persistent<v8::Object> buffer_;   // Keeps the segment mapped
+  IPCqueueHeader *header_;
+  char *slots_;
+  uint64_t mask_;
+  size_t slot_size_;
+  size_t max_record_;
+};
+
+}  // namespace node
+
+#endif  // NODE_IPCQUEUE_H_
@@ -0,0 +1,404 @@
+
+#include <node.h>
+#include "ipcbuffer.h"
+#include "ipcring.h"
+
+#include <v8.h>
+
+#include <assert.h>
+#include <string.h> // memcpy
+
+namespace node {
+
+using namespace v8;
+
+#define RING_MAGIC 0x52435049   // "IPCR"
+#define RING_EMPTY 0
+#define RING_BUSY  1
+#define RING_READY 2
+
+#define RING_PAD   0xFFFFFFFFu  // Rest of the lap is unused, go back to 0
+#define RING_ALIGN 8
+#define RING_RECORD(len) (((len) + 4 + RING_ALIGN - 1) & ~(uint64_t)(RING_ALIGN - 1))
+// A record bigger than this might never find room for itself in one piece
+// at either end of the lap, however empty the ring gets
+#define RING_MAX_RECORD(capacity) ((capacity) / 2)
+
+static Persistent<String> record_length_sym;
+static Persistent<String> capacity_sym;
+Persistent<FunctionTemplate> IPCring::constructor_template;
+
+
+// var ring = new _IPCring(ipcbuffer, [offset], [length]);
+Handle<Value> IPCring::New(const Arguments &args) {
+  if (!args.IsConstructCall()) {
+    return FromConstructorTemplate(constructor_template, args);
+  }
+
+  HandleScope scope;
+
+  if (!IPCbuffer::HasInstance(args[0])) {
+    return ThrowException(Exception::TypeError(String::New(
+            "First arg should be a Buffer")));
+  }
+
+  Local<Object> buffer = args[0]->ToObject();
+  size_t buffer_length = IPCbuffer::Length(buffer);
+  size_t offset = args[1]->IsUint32() ? args[1]->Uint32Value() : 0;
+
+  if (offset > buffer_length) {
+    return ThrowException(Exception::RangeError(String::New(
+            "offset out of bounds")));
+  }
+
+  size_t length = args[2]->IsUint32() ? args[2]->Uint32Value()
+                                      : buffer_length - offset;
+  if (length > buffer_length - offset) {
+    return ThrowException(Exception::RangeError(String::New(
+            "length out of bounds")));
+  }
+
+  char *base = IPCbuffer::Data(buffer) + offset;
+  if ((uintptr_t)base % RING_ALIGN) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Ring must start on an 8 byte boundary")));
+  }
+  if (length < sizeof(IPCringHeader) + IPC_CACHELINE) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Buffer too small for a ring")));
+  }
+
+  // The data area is the biggest power of two that fits after the header
+  uint64_t room = length - sizeof(IPCringHeader);
+  uint64_t capacity = IPC_CACHELINE;
+  while (capacity * 2 <= room) capacity *= 2;
+
+  IPCringHeader *header = (IPCringHeader*) base;
+  uint32_t state = RING_EMPTY;
+
+  if (ipc_cas(&header->state, &state, (uint32_t)RING_BUSY,
+              IPC_ACQUIRE, IPC_ACQUIRE)) {
+    // First one here, lay out the header for everyone else
+    header->magic = RING_MAGIC;
+    header->capacity = capacity;
+    header->head = 0;
+    header->tail = 0;
+    ipc_store(&header->state, (uint32_t)RING_READY, IPC_RELEASE);
+  } else {
+    while ((state = ipc_load(&header->state, IPC_ACQUIRE)) == RING_BUSY) {
+      ipc_cpu_relax();
+    }
+    if (header->magic != RING_MAGIC) {
+      return ThrowException(Exception::Error(String::New(
+              "Buffer does not contain a ring")));
+    }
+    if (header->capacity > room ||
+        (header->capacity & (header->capacity - 1))) {
+      return ThrowException(Exception::Error(String::New(
+              "Ring header does not fit this buffer")));
+    }
+  }
+
+  IPCring *ring = new IPCring(args.This(), buffer, offset);
+  args.This()->Set(capacity_sym, Number::New(ring->mask_ + 1));
+
+  return args.This();
+}
+
+
+IPCring::IPCring(Handle<Object> wrapper, Handle<Object> buffer,
+                 size_t offset) : ObjectWrap() {
+  Wrap(wrapper);
+
+  buffer_ = Persistent<Object>::New(buffer);
+  IPCbuffer::Pin(buffer);
+  offset_ = offset;
+  header_ = (IPCringHeader*) (IPCbuffer::Data(buffer) + offset);
+  data_ = (char*) (header_ + 1);
+  mask_ = header_->capacity - 1;
+
+  cached_head_ = ipc_load(&header_->head, IPC_ACQUIRE);
+  cached_tail_ = ipc_load(&header_->tail, IPC_ACQUIRE);
+  reserved_head_ = 0;
+  next_tail_ = 0;
+}
+
+
+IPCring::~IPCring() {
+  IPCbuffer::Unpin(buffer_);
+  buffer_.Dispose();
+}
+
+
+/*
+ * Producer side. Finds room for a record of length bytes, writing a pad
+ * marker first if it would otherwise straddle the end of the ring. Returns
+ * where the payload goes, or NULL if the consumer hasn't caught up yet.
+ * Nothing is visible to the consumer until Commit().
+ */
+char* IPCring::Reserve(size_t length) {
+  uint64_t capacity = mask_ + 1;
+  uint64_t need = RING_RECORD(length);
+  uint64_t head = ipc_load(&header_->head, IPC_RELAXED);
+  uint64_t idx = head & mask_;
+  uint64_t contiguous = capacity - idx;
+  uint64_t total = need > contiguous ? contiguous + need : need;
+
+  if (head + total - cached_tail_ > capacity) {
+    cached_tail_ = ipc_load(&header_->tail, IPC_ACQUIRE);
+    if (head + total - cached_tail_ > capacity) return NULL;
+  }
+
+  if (need > contiguous) {
+    *(uint32_t*)(data_ + idx) = RING_PAD;
+    head += contiguous;
+    idx = 0;
+  }
+
+  *(uint32_t*)(data_ + idx) = (uint32_t)length;
+  reserved_head_ = head + need;
+
+  return data_ + idx + 4;
+}
+
+
+void IPCring::Commit() {
+  ipc_store(&header_->head, reserved_head_, IPC_RELEASE);
+}
+
+
+/*
+ * Consumer side. Returns the payload of the oldest record without copying
+ * it, or NULL when the ring is empty. The space stays owned by the consumer
+ * until the tail is moved past it.
+ */
+char* IPCring::Front(uint32_t *length) {
+  uint64_t tail = ipc_load(&header_->tail, IPC_RELAXED);
+
+  if (tail == cached_head_) {
+    cached_head_ = ipc_load(&header_->head, IPC_ACQUIRE);
+    if (tail == cached_head_) return NULL;
+  }
+
+  uint64_t idx = tail & mask_;
+  uint32_t len = *(uint32_t*)(data_ + idx);
+
+  if (len == RING_PAD) {
+    // The producer only pads when a record follows at the start
+    tail += (mask_ + 1) - idx;
+    idx = 0;
+    len = *(uint32_t*)data_;
+  }
+  uint32_t room = (uint32_t)((mask_ + 1) - idx - 4);
+  if (len > room) len = room;  // Don't trust the segment
+
+  *length = len;
+  next_tail_ = tail + RING_RECORD(len);
+
+  return data_ + idx + 4;
+}
+
+
+// var pushed = ring.push(ipcbuffer, start, end);
+Handle<Value> IPCring::Push(const Arguments &args) {
+  HandleScope scope;
+  IPCring *ring = ObjectWrap::Unwrap<IPCring>(args.This());
+
+  if (!IPCbuffer::HasInstance(args[0])) {
+    return ThrowException(Exception::TypeError(String::New(
+            "First arg should be a Buffer")));
+  }
+
+  Local<Object> source = args[0]->ToObject();
+  char *source_data = IPCbuffer::Data(source);
+  size_t source_length = IPCbuffer::Length(source);
+
+  size_t start = args[1]->Uint32Value();
+  size_t end = args[2]->IsUint32() ? args[2]->Uint32Value() : source_length;
+
+  if (end < start || end > source_length) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Bad argument.")));
+  }
+
+  size_t length = end - start;
+  if (RING_RECORD(length) > RING_MAX_RECORD(ring->mask_ + 1)) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Record is bigger than half the ring")));
+  }
+
+  char *p = ring->Reserve(length);
+  if (p == NULL) return scope.Close(False());
+
+  memcpy(p, source_data + start, length);
+  ring->Commit();
+
+  return scope.Close(True());
+}
+
+
+// var pushed = ring.pushString(string, encoding);
+Handle<Value> IPCring::PushString(const Arguments &args) {
+  HandleScope scope;
+  IPCring *ring = ObjectWrap::Unwrap<IPCring>(args.This());
+
+  if (!args[0]->IsString()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Argument must be a string")));
+  }
+
+  Local<String> s = args[0]->ToString();
+  enum encoding enc = ParseEncoding(args[1], UTF8);
+
+  if (enc != UTF8 && enc != ASCII && enc != BINARY) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Unknown encoding")));
+  }
+
+  // Size the record up front so the string is written straight into the ring
+  size_t length = enc == UTF8 ? s->Utf8Length() : s->Length();
+  if (RING_RECORD(length) > RING_MAX_RECORD(ring->mask_ + 1)) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Record is bigger than half the ring")));
+  }
+
+  char *p = ring->Reserve(length);
+  if (p == NULL) return scope.Close(False());
+
+  if (enc == UTF8) {
+    s->WriteUtf8(p, length, NULL, String::HINT_MANY_WRITES_EXPECTED);
+  } else if (enc == ASCII) {
+    s->WriteAscii(p, 0, length, String::HINT_MANY_WRITES_EXPECTED);
+  } else {
+    DecodeWrite(p, length, s, BINARY);
+  }
+  ring->Commit();
+
+  return scope.Close(True());
+}
+
+
+// var offset = ring.peek(); // offset into the ring's buffer or -1
+Handle<Value> IPCring::Peek(const Arguments &args) {
+  HandleScope scope;
+  IPCring *ring = ObjectWrap::Unwrap<IPCring>(args.This());
+
+  uint32_t length;
+  char *p = ring->Front(&length);
+  if (p == NULL) return scope.Close(Integer::New(-1));
+
+  constructor_template->GetFunction()->Set(record_length_sym,
+                                           Integer::NewFromUnsigned(length));
+
+  return scope.Close(Number::New(p - IPCbuffer::Data(ring->buffer_)));
+}
+
+
+// ring.consume(); // drop the record returned by peek()
+Handle<Value> IPCring::Consume(const Arguments &args) {
+  HandleScope scope;
+  IPCring *ring = ObjectWrap::Unwrap<IPCring>(args.This());
+
+  uint64_t tail = ipc_load(&ring->header_->tail, IPC_RELAXED);
+  if (ring->next_tail_ <= tail) {
+    return ThrowException(Exception::Error(String::New(
+            "Nothing peeked to consume")));
+  }
+
+  ipc_store(&ring->header_->tail, ring->next_tail_, IPC_RELEASE);
+
+  return Undefined();
+}
+
+
+// var length = ring.popInto(target, targetStart); // -1 when empty
+Handle<Value> IPCring::PopInto(const Arguments &args) {
+  HandleScope scope;
+  IPCring *ring = ObjectWrap::Unwrap<IPCring>(args.This());
+
+  if (!IPCbuffer::HasInstance(args[0])) {
+    return ThrowException(Exception::TypeError(String::New(
+            "First arg should be a Buffer")));
+  }
+
+  Local<Object> target = args[0]->ToObject();
+  char *target_data = IPCbuffer::Data(target);
+  size_t target_length = IPCbuffer::Length(target);
+  size_t target_start = args[1]->Uint32Value();
+
+  uint32_t length;
+  char *p = ring->Front(&length);
+  if (p == NULL) return scope.Close(Integer::New(-1));
+
+  if (target_start > target_length || length > target_length - target_start) {
+    // Leave the record where it is so the caller can retry with more room
+    return ThrowException(Exception::RangeError(String::New(
+            "Buffer too small")));
+  }
+
+  memcpy(target_data + target_start, p, length);
+  ipc_store(&ring->header_->tail, ring->next_tail_, IPC_RELEASE);
+
+  return scope.Close(Integer::NewFromUnsigned(length));
+}
+
+
+// var string = ring.popString(encoding); // null when empty
+Handle<Value> IPCring::PopString(const Arguments &args) {
+  HandleScope scope;
+  IPCring *ring = ObjectWrap::Unwrap<IPCring>(args.This());
+
+  enum encoding enc = ParseEncoding(args[0], UTF8);
+
+  uint32_t length;
+  char *p = ring->Front(&length);
+  if (p == NULL) return scope.Close(Null());
+
+  Local<Value> string;
+  if (enc == BINARY) {
+    string = Encode(p, length, BINARY);
+  } else {
+    string = String::New(p, length);
+  }
+  ipc_store(&ring->header_->tail, ring->next_tail_, IPC_RELEASE);
+
+  return scope.Close(string);
+}
+
+
+// var bytes = ring.size(); // bytes waiting, including record headers
+Handle<Value> IPCring::Size(const Arguments &args) {
+  HandleScope scope;
+  IPCring *ring = ObjectWrap::Unwrap<IPCring>(args.This());
+
+  uint64_t tail = ipc_load(&ring->header_->tail, IPC_ACQUIRE);
+  uint64_t head = ipc_load(&ring->header_->head, IPC_ACQUIRE);
+
+  return scope.Close(Number::New(head - tail));
+}
+
+
+void IPCring::Initialize(Handle<Object> target) {
+  HandleScope scope;
+
+  record_length_sym = Persistent<String>::New(String::NewSymbol("_recordLength"));
+  capacity_sym = Persistent<String>::New(String::NewSymbol("capacity"));
+
+  Local<FunctionTemplate> t = FunctionTemplate::New(IPCring::New);
+  constructor_template = Persistent<FunctionTemplate>::New(t);
+  constructor_template->InstanceTemplate()->SetInternalFieldCount(1);
+  constructor_template->SetClassName(String::NewSymbol("_IPCring"));
+
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "push", IPCring::Push);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "pushString", IPCring::PushString);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "peek", IPCring::Peek);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "consume", IPCring::Consume);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "popInto", IPCring::PopInto);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "popString", IPCring::PopString);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "size", IPCring::Size);
+
+  target->Set(String::NewSymbol("_IPCring"), constructor_template->GetFunction());
+}
+
+
+}  // namespace node
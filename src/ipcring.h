@@ -0,0 +1,79 @@
+#ifndef NODE_IPCRING_H_
+#define NODE_IPCRING_H_
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <v8.h>
+#include <stdint.h>
+
+#include "ipcatomic.h"
+
+namespace node {
+
+/* A single producer / single consumer ring of length prefixed records laid
+ * over a chunk of an IPCbuffer. Normally that chunk is a "*name" POSIX
+ * segment so one process pushes and another pops, but any buffer will do.
+ *
+ * The chunk starts with a header that the first process to attach fills in,
+ * anyone attaching later just picks up the capacity from it. Head and tail
+ * are free running byte counters on their own cache lines so the producer
+ * and consumer never fight over a line, and neither side makes a syscall.
+ *
+ *   var ring = new _IPCring(ipcbuffer, offset, length);
+ *   ring.push(ipcbuffer, start, end);  // false when full
+ *   var at = ring.peek();              // -1 when empty
+ *   ...use ipcbuffer[at] .. ipcbuffer[at + _IPCring._recordLength]
+ *   ring.consume();
+ */
+
+struct IPCringHeader {
+  uint32_t magic;
+  uint32_t state;
+  uint64_t capacity;
+  char pad0_[IPC_CACHELINE - 16];
+  uint64_t head;                // Only ever written by the producer
+  char pad1_[IPC_CACHELINE - 8];
+  uint64_t tail;                // Only ever written by the consumer
+  char pad2_[IPC_CACHELINE - 8];
+};
+
+
+class IPCring : public ObjectWrap {
+ public:
+  static void Initialize(v8::Handle<v8::Object> target);
+
+ private:
+  static v8::Persistent<v8::FunctionTemplate> constructor_template;
+
+  static v8::Handle<v8::Value> New(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Push(const v8::Arguments &args);
+  static v8::Handle<v8::Value> PushString(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Peek(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Consume(const v8::Arguments &args);
+  static v8::Handle<v8::Value> PopInto(const v8::Arguments &args);
+  static v8::Handle<v8::Value> PopString(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Size(const v8::Arguments &args);
+
+  IPCring(v8::Handle<v8::Object> wrapper, v8::Handle<v8::Object> buffer,
+          size_t offset);
+  ~IPCring();
+
+  char* Reserve(size_t length);
+  void Commit();
+  char* Front(uint32_t *length);
+
+  v8::Persistent<v8::Object> buffer_;   // Keeps the segment mapped
+  size_t offset_;                       // Of the header within buffer_
+  IPCringHeader *header_;
+  char *data_;
+  uint64_t mask_;
+
+  uint64_t cached_head_;    // Consumer side copy of header_->head
+  uint64_t cached_tail_;    // Producer side copy of header_->tail
+  uint64_t reserved_head_;  // Head once the pending push is committed
+  uint64_t next_tail_;      // Tail once the peeked record is consumed
+};
+
+}  // namespace node
+
+#endif  // NODE_IPCRING_H_
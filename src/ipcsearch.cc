@@ -0,0 +1,292 @@
+#include "ipcsearch.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define IPC_SEARCH_X86 1
+# include <immintrin.h>
+#elif defined(__aarch64__)
+# define IPC_SEARCH_NEON 1
+# include <arm_neon.h>
+#endif
+
+namespace node {
+
+/*
+ * The kernels only look at whole vectors of starting places and are only
+ * called for needles of two bytes or more that fit in hay. A forward one
+ * sets *done to the first place it didn't look at, a backward one *left
+ * to how many places at the front it didn't.
+ */
+typedef const char* (*first_kernel)(const char *hay, size_t length,
+                                    const char *needle, size_t m,
+                                    size_t *done);
+typedef const char* (*last_kernel)(const char *hay, size_t length,
+                                   const char *needle, size_t m,
+                                   size_t *left);
+
+static first_kernel first_fast = NULL;
+static last_kernel last_fast = NULL;
+static const char *kernel_name = "scalar";
+
+
+#ifdef IPC_SEARCH_X86
+// The bits of mask are places where the first and last bytes both match
+__attribute__((target("sse2")))
+static inline uint32_t Candidates128(const char *p, size_t m,
+                                     __m128i first, __m128i last) {
+  __m128i a = _mm_loadu_si128((const __m128i*) p);
+  __m128i b = _mm_loadu_si128((const __m128i*)(p + m - 1));
+  return _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                         _mm_cmpeq_epi8(b, last)));
+}
+
+__attribute__((target("sse2")))
+static const char* FirstSSE2(const char *hay, size_t length,
+                             const char *needle, size_t m, size_t *done) {
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[m - 1]);
+  size_t places = length - m + 1;
+  size_t i = 0;
+  for (; places - i >= 16; i += 16) {
+    uint32_t mask = Candidates128(hay + i, m, first, last);
+    while (mask) {
+      const char *p = hay + i + __builtin_ctz(mask);
+      if (!memcmp(p + 1, needle + 1, m - 2)) return p;
+      mask &= mask - 1;
+    }
+  }
+  *done = i;
+  return NULL;
+}
+
+__attribute__((target("sse2")))
+static const char* LastSSE2(const char *hay, size_t length,
+                            const char *needle, size_t m, size_t *left) {
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[m - 1]);
+  size_t end = length - m + 1;
+  for (; end >= 16; end -= 16) {
+    uint32_t mask = Candidates128(hay + end - 16, m, first, last);
+    while (mask) {
+      int bit = 31 - __builtin_clz(mask);
+      const char *p = hay + end - 16 + bit;
+      if (!memcmp(p + 1, needle + 1, m - 2)) return p;
+      mask &= ~(1u << bit);
+    }
+  }
+  *left = end;
+  return NULL;
+}
+
+
+__attribute__((target("avx2")))
+static inline uint32_t Candidates256(const char *p, size_t m,
+                                     __m256i first, __m256i last) {
+  __m256i a = _mm256_loadu_si256((const __m256i*) p);
+  __m256i b = _mm256_loadu_si256((const __m256i*)(p + m - 1));
+  return _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                               _mm256_cmpeq_epi8(b, last)));
+}
+
+// 64 places a go, it's the loads that cost and two vectors keep more going
+__attribute__((target("avx2")))
+static const char* FirstAVX2(const char *hay, size_t length,
+                             const char *needle, size_t m, size_t *done) {
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+  size_t places = length - m + 1;
+  size_t i = 0;
+  for (; places - i >= 64; i += 64) {
+    uint64_t mask = Candidates256(hay + i, m, first, last) |
+        (uint64_t) Candidates256(hay + i + 32, m, first, last) << 32;
+    while (mask) {
+      const char *p = hay + i + __builtin_ctzll(mask);
+      if (!memcmp(p + 1, needle + 1, m - 2)) return p;
+      mask &= mask - 1;
+    }
+  }
+  for (; places - i >= 32; i += 32) {
+    uint32_t mask = Candidates256(hay + i, m, first, last);
+    while (mask) {
+      const char *p = hay + i + __builtin_ctz(mask);
+      if (!memcmp(p + 1, needle + 1, m - 2)) return p;
+      mask &= mask - 1;
+    }
+  }
+  *done = i;
+  return NULL;
+}
+
+__attribute__((target("avx2")))
+static const char* LastAVX2(const char *hay, size_t length,
+                            const char *needle, size_t m, size_t *left) {
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+  size_t end = length - m + 1;
+  for (; end >= 32; end -= 32) {
+    uint32_t mask = Candidates256(hay + end - 32, m, first, last);
+    while (mask) {
+      int bit = 31 - __builtin_clz(mask);
+      const char *p = hay + end - 32 + bit;
+      if (!memcmp(p + 1, needle + 1, m - 2)) return p;
+      mask &= ~(1u << bit);
+    }
+  }
+  *left = end;
+  return NULL;
+}
+#endif
+
+
+#ifdef IPC_SEARCH_NEON
+// No movemask on NEON, narrowing each 16 bits by 4 leaves a nibble a byte
+static inline uint64_t Candidates(const char *p, size_t m,
+                                  uint8x16_t first, uint8x16_t last) {
+  uint8x16_t a = vld1q_u8((const uint8_t*) p);
+  uint8x16_t b = vld1q_u8((const uint8_t*)(p + m - 1));
+  uint8x16_t eq = vandq_u8(vceqq_u8(a, first), vceqq_u8(b, last));
+  uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+static const char* FirstNEON(const char *hay, size_t length,
+                             const char *needle, size_t m, size_t *done) {
+  const uint8x16_t first = vdupq_n_u8(needle[0]);
+  const uint8x16_t last = vdupq_n_u8(needle[m - 1]);
+  size_t places = length - m + 1;
+  size_t i = 0;
+  for (; places - i >= 16; i += 16) {
+    uint64_t mask = Candidates(hay + i, m, first, last);
+    while (mask) {
+      int nibble = __builtin_ctzll(mask) / 4;
+      const char *p = hay + i + nibble;
+      if (!memcmp(p + 1, needle + 1, m - 2)) return p;
+      mask &= ~(0xFULL << (nibble * 4));
+    }
+  }
+  *done = i;
+  return NULL;
+}
+
+static const char* LastNEON(const char *hay, size_t length,
+                            const char *needle, size_t m, size_t *left) {
+  const uint8x16_t first = vdupq_n_u8(needle[0]);
+  const uint8x16_t last = vdupq_n_u8(needle[m - 1]);
+  size_t end = length - m + 1;
+  for (; end >= 16; end -= 16) {
+    uint64_t mask = Candidates(hay + end - 16, m, first, last);
+    while (mask) {
+      int nibble = (63 - __builtin_clzll(mask)) / 4;
+      const char *p = hay + end - 16 + nibble;
+      if (!memcmp(p + 1, needle + 1, m - 2)) return p;
+      mask &= ~(0xFULL << (nibble * 4));
+    }
+  }
+  *left = end;
+  return NULL;
+}
+#endif
+
+
+void ipc_search_init() {
+#ifdef IPC_SEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    first_fast = FirstAVX2;
+    last_fast = LastAVX2;
+    kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    first_fast = FirstSSE2;
+    last_fast = LastSSE2;
+    kernel_name = "sse2";
+  }
+#elif defined(IPC_SEARCH_NEON)
+  first_fast = FirstNEON;
+  last_fast = LastNEON;
+  kernel_name = "neon";
+#endif
+}
+
+
+const char* ipc_search_kernel() {
+  return kernel_name;
+}
+
+
+static inline const char* LastByte(const char *p, char c, size_t length) {
+#ifdef __GLIBC__
+  return (const char*) memrchr(p, c, length);
+#else
+  while (length--) {
+    if (p[length] == c) return p + length;
+  }
+  return NULL;
+#endif
+}
+
+
+/*
+ * memchr is quicker than any of the kernels while the first byte is rare,
+ * so it starts off with that and only hands over to the kernel once the
+ * first byte has turned up somewhere other than a match too often.
+ */
+#define TOO_MANY_MISSES(misses, scanned) ((misses) > 8 + (scanned) / 256)
+
+
+ssize_t ipc_search_first(const char *hay, size_t length,
+                         const char *needle, size_t m) {
+  if (m == 0) return 0;
+  if (m > length) return -1;
+
+  const char *end = hay + length - m + 1;   // Past the last place it can be
+  size_t misses = 0;
+  bool vector = m > 1 && first_fast;
+
+  for (const char *p = hay; p < end; p++) {
+    p = (const char*) memchr(p, needle[0], end - p);
+    if (p == NULL) break;
+    if (!memcmp(p + 1, needle + 1, m - 1)) return p - hay;
+
+    if (vector && TOO_MANY_MISSES(++misses, (size_t)(p - hay)) &&
+        p + 1 < end) {
+      size_t done = 0;
+      const char *found = first_fast(p + 1, hay + length - (p + 1),
+                                     needle, m, &done);
+      if (found) return found - hay;
+      p += done;
+      vector = false;
+    }
+  }
+  return -1;
+}
+
+
+ssize_t ipc_search_last(const char *hay, size_t length,
+                        const char *needle, size_t m) {
+  if (m == 0) return length;
+  if (m > length) return -1;
+
+  size_t left = length - m + 1;   // Places still to look at
+  size_t misses = 0;
+  bool vector = m > 1 && last_fast;
+
+  while (left > 0) {
+    const char *p = LastByte(hay, needle[0], left);
+    if (p == NULL) break;
+    if (!memcmp(p + 1, needle + 1, m - 1)) return p - hay;
+    left = p - hay;
+
+    if (vector && TOO_MANY_MISSES(++misses, length - m + 1 - left) &&
+        left > 0) {
+      // Only the first left places, but a match there can run on past
+      const char *found = last_fast(hay, left + m - 1, needle, m, &left);
+      if (found) return found - hay;
+      vector = false;
+    }
+  }
+  return -1;
+}
+
+}  // namespace node
@@ -0,0 +1,33 @@
+#ifndef NODE_IPCSEARCH_H_
+#define NODE_IPCSEARCH_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+namespace node {
+
+/* Finding bytes in the buffers. One byte is memchr or memrchr, which libc
+ * already does a vector at a time. Anything longer starts the same way,
+ * jumping from one of its first byte to the next, and if that byte turns
+ * out to be common hands over to a kernel that checks 32 places at once
+ * (16 for SSE2 and NEON) against the first and last bytes, and only does a
+ * memcmp where both match. SSE2 or AVX2 are picked at run time on x86.
+ */
+
+// Picks the kernels for this CPU. Until it's called everything is scalar.
+void ipc_search_init();
+
+// "avx2", "sse2", "neon" or "scalar"
+const char* ipc_search_kernel();
+
+// Where needle first starts in hay, or -1. An empty needle is at 0.
+ssize_t ipc_search_first(const char *hay, size_t length,
+                         const char *needle, size_t needle_length);
+
+// Where needle last starts in hay, or -1. An empty needle is at length.
+ssize_t ipc_search_last(const char *hay, size_t length,
+                        const char *needle, size_t needle_length);
+
+}  // namespace node
+
+#endif  // NODE_IPCSEARCH_H_
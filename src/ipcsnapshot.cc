@@ -0,0 +1,300 @@
+#include <node.h>
+#include "ipcbuffer.h"
+#include "ipcsnapshot.h"
+
+#include <v8.h>
+
+#include <assert.h>
+#include <string.h> // memcpy
+
+namespace node {
+
+using namespace v8;
+
+#define SNAPSHOT_MAGIC 0x53435049  // "IPCS"
+#define SNAPSHOT_EMPTY 0
+#define SNAPSHOT_BUSY  1
+#define SNAPSHOT_READY 2
+
+static Persistent<String> capacity_sym;
+static Persistent<String> length_sym;
+static Persistent<String> version_sym;
+Persistent<FunctionTemplate> IPCsnapshot::constructor_template;
+
+
+// var s = new _IPCsnapshot(ipcbuffer, [offset], [length]);
+Handle<Value> IPCsnapshot::New(const Arguments &args) {
+  if (!args.IsConstructCall()) {
+    return FromConstructorTemplate(constructor_template, args);
+  }
+
+  HandleScope scope;
+
+  if (!IPCbuffer::HasInstance(args[0])) {
+    return ThrowException(Exception::TypeError(String::New(
+            "First arg should be a Buffer")));
+  }
+
+  Local<Object> buffer = args[0]->ToObject();
+  size_t buffer_length = IPCbuffer::Length(buffer);
+  size_t offset = args[1]->IsUint32() ? args[1]->Uint32Value() : 0;
+
+  if (offset > buffer_length) {
+    return ThrowException(Exception::RangeError(String::New(
+            "offset out of bounds")));
+  }
+
+  size_t length = args[2]->IsUint32() ? args[2]->Uint32Value()
+                                      : buffer_length - offset;
+  if (length > buffer_length - offset) {
+    return ThrowException(Exception::RangeError(String::New(
+            "length out of bounds")));
+  }
+
+  char *base = IPCbuffer::Data(buffer) + offset;
+  if ((uintptr_t)base % 8) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Snapshot must start on an 8 byte boundary")));
+  }
+  if (length < sizeof(IPCsnapshotHeader) + 2 * IPC_CACHELINE) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Buffer too small for a snapshot")));
+  }
+
+  // Whole cache lines each, so the copies never share one
+  uint64_t capacity = (length - sizeof(IPCsnapshotHeader)) / 2;
+  capacity &= ~(uint64_t)(IPC_CACHELINE - 1);
+
+  IPCsnapshotHeader *header = (IPCsnapshotHeader*) base;
+  uint32_t state = SNAPSHOT_EMPTY;
+
+  if (ipc_cas(&header->state, &state, (uint32_t)SNAPSHOT_BUSY,
+              IPC_ACQUIRE, IPC_ACQUIRE)) {
+    header->magic = SNAPSHOT_MAGIC;
+    header->capacity = capacity;
+    header->sequence = 0;
+    header->version = 0;
+    header->length = 0;
+    header->writing = 0;
+    ipc_store(&header->state, (uint32_t)SNAPSHOT_READY, IPC_RELEASE);
+  } else {
+    while ((state = ipc_load(&header->state, IPC_ACQUIRE)) == SNAPSHOT_BUSY) {
+      ipc_cpu_relax();
+    }
+    if (header->magic != SNAPSHOT_MAGIC) {
+      return ThrowException(Exception::Error(String::New(
+              "Buffer does not contain a snapshot")));
+    }
+    if (header->capacity > (length - sizeof(IPCsnapshotHeader)) / 2) {
+      return ThrowException(Exception::Error(String::New(
+              "Snapshot header does not fit this buffer")));
+    }
+  }
+
+  IPCsnapshot *snapshot = new IPCsnapshot(args.This(), buffer, offset);
+  args.This()->Set(capacity_sym,
+                   Number::New((double)snapshot->header_->capacity));
+
+  return args.This();
+}
+
+
+IPCsnapshot::IPCsnapshot(Handle<Object> wrapper, Handle<Object> buffer,
+                         size_t offset) : ObjectWrap() {
+  Wrap(wrapper);
+
+  buffer_ = Persistent<Object>::New(buffer);
+  IPCbuffer::Pin(buffer);
+  header_ = (IPCsnapshotHeader*) (IPCbuffer::Data(buffer) + offset);
+}
+
+
+IPCsnapshot::~IPCsnapshot() {
+  IPCbuffer::Unpin(buffer_);
+  buffer_.Dispose();
+}
+
+
+/*
+ * The copy the next version goes in. Whoever's still reading it, from two
+ * versions ago, is told it's stale before a byte of it changes.
+ */
+char* IPCsnapshot::Begin() {
+  uint64_t next = ipc_load(&header_->version, IPC_RELAXED) + 1;
+
+  ipc_store(&header_->writing, next, IPC_RELAXED);
+  ipc_fence(IPC_RELEASE);
+
+  return Copy(next);
+}
+
+
+// Makes what Begin() handed out the latest
+uint64_t IPCsnapshot::Commit(uint64_t length) {
+  uint64_t next = ipc_load(&header_->writing, IPC_RELAXED);
+  uint64_t seq = ipc_load(&header_->sequence, IPC_RELAXED);
+
+  ipc_store(&header_->sequence, seq + 1, IPC_RELAXED);
+  ipc_fence(IPC_RELEASE);
+  ipc_store(&header_->version, next, IPC_RELAXED);
+  ipc_store(&header_->length, length, IPC_RELAXED);
+  ipc_store(&header_->sequence, seq + 2, IPC_RELEASE);
+
+  return next;
+}
+
+
+// var at = s.begin(); // where to write the next version in place
+Handle<Value> IPCsnapshot::Begin(const Arguments &args) {
+  HandleScope scope;
+  IPCsnapshot *snapshot = ObjectWrap::Unwrap<IPCsnapshot>(args.This());
+
+  char *p = snapshot->Begin();
+
+  return scope.Close(Number::New(p - IPCbuffer::Data(snapshot->buffer_)));
+}
+
+
+// var version = s.commit(length);
+Handle<Value> IPCsnapshot::Commit(const Arguments &args) {
+  HandleScope scope;
+  IPCsnapshot *snapshot = ObjectWrap::Unwrap<IPCsnapshot>(args.This());
+
+  uint64_t writing = ipc_load(&snapshot->header_->writing, IPC_RELAXED);
+  if (writing == ipc_load(&snapshot->header_->version, IPC_RELAXED)) {
+    return ThrowException(Exception::Error(String::New(
+            "Nothing begun to commit")));
+  }
+  if (!args[0]->IsNumber() || args[0]->NumberValue() < 0 ||
+      (uint64_t)args[0]->IntegerValue() > snapshot->header_->capacity) {
+    return ThrowException(Exception::RangeError(String::New(
+            "length out of bounds")));
+  }
+
+  uint64_t version = snapshot->Commit((uint64_t)args[0]->IntegerValue());
+
+  return scope.Close(Number::New((double)version));
+}
+
+
+// var version = s.publish(bufferOrString);
+Handle<Value> IPCsnapshot::Publish(const Arguments &args) {
+  HandleScope scope;
+  IPCsnapshot *snapshot = ObjectWrap::Unwrap<IPCsnapshot>(args.This());
+  size_t capacity = snapshot->header_->capacity;
+  size_t length;
+
+  if (args[0]->IsString()) {
+    Local<String> s = args[0]->ToString();
+    if ((length = s->Utf8Length()) > capacity) {
+      return ThrowException(Exception::RangeError(String::New(
+              "Too big for the snapshot")));
+    }
+    s->WriteUtf8(snapshot->Begin(), length, NULL,
+                 String::HINT_MANY_WRITES_EXPECTED);
+  } else if (IPCbuffer::HasInstance(args[0])) {
+    Local<Object> obj = args[0]->ToObject();
+    if ((length = IPCbuffer::Length(obj)) > capacity) {
+      return ThrowException(Exception::RangeError(String::New(
+              "Too big for the snapshot")));
+    }
+    memcpy(snapshot->Begin(), IPCbuffer::Data(obj), length);
+  } else {
+    return ThrowException(Exception::TypeError(String::New(
+            "Argument should be a Buffer or a string")));
+  }
+
+  uint64_t version = snapshot->Commit(length);
+
+  return scope.Close(Number::New((double)version));
+}
+
+
+// var at = s.acquire(); // -1 if nothing's been published
+// Where the latest version is in the buffer. Its length and version are
+// left in _IPCsnapshot._length and _IPCsnapshot._version.
+Handle<Value> IPCsnapshot::Acquire(const Arguments &args) {
+  HandleScope scope;
+  IPCsnapshot *snapshot = ObjectWrap::Unwrap<IPCsnapshot>(args.This());
+  IPCsnapshotHeader *header = snapshot->header_;
+  uint64_t seq, version, length;
+
+  for (;;) {
+    seq = ipc_load(&header->sequence, IPC_ACQUIRE);
+    if (seq & 1) {
+      ipc_cpu_relax();
+      continue;
+    }
+    version = ipc_load(&header->version, IPC_RELAXED);
+    length = ipc_load(&header->length, IPC_RELAXED);
+    ipc_fence(IPC_ACQUIRE);
+    if (ipc_load(&header->sequence, IPC_RELAXED) == seq) break;
+  }
+
+  if (version == 0) return scope.Close(Integer::New(-1));
+  if (length > header->capacity) length = header->capacity;  // Don't trust the segment
+
+  Local<Object> ctor = constructor_template->GetFunction();
+  ctor->Set(length_sym, Number::New((double)length));
+  ctor->Set(version_sym, Number::New((double)version));
+
+  return scope.Close(Number::New(snapshot->Copy(version) -
+                                 IPCbuffer::Data(snapshot->buffer_)));
+}
+
+
+// var ok = s.valid(version);
+// Call it after reading, true if the writer didn't touch it meanwhile
+Handle<Value> IPCsnapshot::Valid(const Arguments &args) {
+  HandleScope scope;
+  IPCsnapshot *snapshot = ObjectWrap::Unwrap<IPCsnapshot>(args.This());
+
+  if (!args[0]->IsNumber()) {
+    return ThrowException(Exception::TypeError(String::New(
+            "Version should be a number")));
+  }
+  uint64_t version = (uint64_t)args[0]->IntegerValue();
+
+  ipc_fence(IPC_ACQUIRE);
+  uint64_t writing = ipc_load(&snapshot->header_->writing, IPC_RELAXED);
+
+  return scope.Close(Boolean::New(version != 0 && writing < version + 2));
+}
+
+
+// var version = s.version(); // the latest, 0 if there isn't one
+Handle<Value> IPCsnapshot::Version(const Arguments &args) {
+  HandleScope scope;
+  IPCsnapshot *snapshot = ObjectWrap::Unwrap<IPCsnapshot>(args.This());
+
+  return scope.Close(Number::New(
+          (double)ipc_load(&snapshot->header_->version, IPC_ACQUIRE)));
+}
+
+
+void IPCsnapshot::Initialize(Handle<Object> target) {
+  HandleScope scope;
+
+  assert(sizeof(IPCsnapshotHeader) == 2 * IPC_CACHELINE);
+
+  capacity_sym = Persistent<String>::New(String::NewSymbol("capacity"));
+  length_sym = Persistent<String>::New(String::NewSymbol("_length"));
+  version_sym = Persistent<String>::New(String::NewSymbol("_version"));
+
+  Local<FunctionTemplate> t = FunctionTemplate::New(IPCsnapshot::New);
+  constructor_template = Persistent<FunctionTemplate>::New(t);
+  constructor_template->InstanceTemplate()->SetInternalFieldCount(1);
+  constructor_template->SetClassName(String::NewSymbol("_IPCsnapshot"));
+
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "begin", IPCsnapshot::Begin);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "commit", IPCsnapshot::Commit);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "publish", IPCsnapshot::Publish);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "acquire", IPCsnapshot::Acquire);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "valid", IPCsnapshot::Valid);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "version", IPCsnapshot::Version);
+
+  target->Set(String::NewSymbol("_IPCsnapshot"), constructor_template->GetFunction());
+}
+
+
+}  // namespace node
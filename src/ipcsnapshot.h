@@ -0,0 +1,74 @@
+#ifndef NODE_IPCSNAPSHOT_H_
+#define NODE_IPCSNAPSHOT_H_
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <v8.h>
+#include <stdint.h>
+
+#include "ipcatomic.h"
+
+namespace node {
+
+/* One writer publishing versions of a blob to any number of readers, laid
+ * over a chunk of an IPCbuffer. There are two copies of the blob. The
+ * writer fills in whichever one isn't the latest and then flips to it, so
+ * the latest is never half written.
+ *
+ * Readers take no lock and copy nothing. They get the latest copy where it
+ * sits and its version, and once they're done with it ask whether it's
+ * still valid. It stops being valid when the writer starts on the version
+ * after next, which goes in the same copy, and then they just read again.
+ *
+ *   var s = new _IPCsnapshot(ipcbuffer, offset, length);
+ *   s.publish(bufferOrString);      // the new version
+ *   var at = s.acquire();           // where the latest is, -1 if none yet
+ *   s.valid(version);               // false once it's being overwritten
+ */
+
+struct IPCsnapshotHeader {
+  uint32_t magic;
+  uint32_t state;
+  uint64_t capacity;          // Bytes in each copy
+  char pad0_[IPC_CACHELINE - 16];
+  uint64_t sequence;          // Odd while version and length are changing
+  uint64_t version;           // Latest published, 0 until there is one
+  uint64_t length;            // ... and how long it is
+  uint64_t writing;           // Version the writer is filling in
+  char pad1_[IPC_CACHELINE - 32];
+};
+
+
+class IPCsnapshot : public ObjectWrap {
+ public:
+  static void Initialize(v8::Handle<v8::Object> target);
+
+ private:
+  static v8::Persistent<v8::FunctionTemplate> constructor_template;
+
+  static v8::Handle<v8::Value> New(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Begin(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Commit(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Publish(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Acquire(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Valid(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Version(const v8::Arguments &args);
+
+  IPCsnapshot(v8::Handle<v8::Object> wrapper, v8::Handle<v8::Object> buffer,
+              size_t offset);
+  ~IPCsnapshot();
+
+  char* Copy(uint64_t version) {
+    return (char*) (header_ + 1) + (version & 1) * header_->capacity;
+  }
+
+  char* Begin();
+  uint64_t Commit(uint64_t length);
+
+  v8::Persistent<v8::Object> buffer_;   // Keeps the segment mapped
+  IPCsnapshotHeader *header_;
+};
+
+}  // namespace node
+
+#endif  // NODE_IPCSNAPSHOT_H_
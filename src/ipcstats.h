@@ -0,0 +1,69 @@
+#ifndef NODE_IPCSTATS_H_
+#define NODE_IPCSTATS_H_
+
+#include <stdint.h>
+
+#include "ipcatomic.h"
+
+namespace node {
+
+/* Counters for what the buffers get up to, cheap enough to leave on.
+ *
+ * Every one of them only ever changes on the JS thread (threadpool work
+ * reports back through its after callback), so each has one writer and is
+ * bumped with a relaxed load and store. That's as cheap as a plain
+ * increment, no locked instruction, but a reader on any thread still never
+ * sees a torn value.
+ */
+
+#define IPC_BACKINGS 8    // IPC_BACKING_NONE to IPC_BACKING_MEMFD
+
+// Which way the bytes went to or from a string
+#define IPC_CODEC_ASCII   0
+#define IPC_CODEC_UTF8    1
+#define IPC_CODEC_BINARY  2
+#define IPC_CODEC_BASE64  3
+#define IPC_CODEC_SHARED  4   // sharedSlice, nothing copied at all
+#define IPC_CODECS        5
+
+struct IPCbackingStats {
+  uint64_t created;
+  uint64_t reused;          // ... of which shared a mapping already here
+  uint64_t create_ns;       // Spent creating them, all told
+  uint64_t alive;
+  uint64_t mapped;          // Bytes really mapped, views counted once
+};
+
+struct IPCstats {
+  uint64_t buffers;         // _IPCbuffer objects alive
+  uint64_t create_failures; // Map() couldn't get the memory
+  uint64_t huge_fallbacks;  // Asked for huge pages and got normal ones
+  IPCbackingStats backing[IPC_BACKINGS];
+  uint64_t sliced[IPC_CODECS];    // Bytes turned into strings
+  uint64_t written[IPC_CODECS];   // Bytes written from strings
+  uint64_t copied;
+  uint64_t flushes;
+  uint64_t flushed_ranges;
+  uint64_t flush_errors;
+  uint64_t resizes;
+};
+
+// Per buffer, only what's worth knowing about one
+struct IPCbufferStats {
+  uint64_t create_ns;
+  uint64_t sliced;
+  uint64_t written;
+  uint64_t copied;
+  uint64_t flushes;
+};
+
+extern IPCstats ipc_stats;
+
+static inline void ipc_count(uint64_t *counter, int64_t n) {
+  ipc_store(counter, ipc_load(counter, IPC_RELAXED) + (uint64_t)n,
+            IPC_RELAXED);
+}
+
+}  // namespace node
+
+#endif  // NODE_IPCSTATS_H_
@@ -0,0 +1,153 @@
+#include "ipcswap.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define IPC_SWAP_X86 1
+# include <immintrin.h>
+#elif defined(__aarch64__)
+# define IPC_SWAP_NEON 1
+# include <arm_neon.h>
+#endif
+
+namespace node {
+
+/*
+ * A kernel only does whole vectors and returns how many bytes it got
+ * through. Vectors hold a whole number of values of any width, so the
+ * rest is always whole values too.
+ */
+typedef size_t (*swap_kernel)(uint8_t *dst, const uint8_t *src,
+                              size_t length, int width);
+
+static swap_kernel swap_fast = NULL;
+static const char *kernel_name = "scalar";
+
+
+#ifdef IPC_SWAP_X86
+// Which byte of the 16 ends up where, for each width. pshufb only works
+// within 16 bytes, which is all byte swapping ever needs.
+__attribute__((target("ssse3")))
+static inline __m128i SwapMask128(int width) {
+  if (width == 2) {
+    return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                         9, 8, 11, 10, 13, 12, 15, 14);
+  }
+  if (width == 4) {
+    return _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                         11, 10, 9, 8, 15, 14, 13, 12);
+  }
+  return _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                       15, 14, 13, 12, 11, 10, 9, 8);
+}
+
+__attribute__((target("ssse3")))
+static size_t SwapSSSE3(uint8_t *dst, const uint8_t *src,
+                        size_t length, int width) {
+  const __m128i mask = SwapMask128(width);
+  size_t done = 0;
+  while (length - done >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + done));
+    _mm_storeu_si128((__m128i*)(dst + done), _mm_shuffle_epi8(v, mask));
+    done += 16;
+  }
+  return done;
+}
+
+
+// The same mask in both halves, vpshufb shuffles each 16 on its own
+__attribute__((target("avx2")))
+static size_t SwapAVX2(uint8_t *dst, const uint8_t *src,
+                       size_t length, int width) {
+  const __m256i mask = _mm256_broadcastsi128_si256(SwapMask128(width));
+  size_t done = 0;
+  while (length - done >= 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(src + done));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src + done + 32));
+    _mm256_storeu_si256((__m256i*)(dst + done), _mm256_shuffle_epi8(a, mask));
+    _mm256_storeu_si256((__m256i*)(dst + done + 32),
+                        _mm256_shuffle_epi8(b, mask));
+    done += 64;
+  }
+  if (length - done >= 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(src + done));
+    _mm256_storeu_si256((__m256i*)(dst + done), _mm256_shuffle_epi8(a, mask));
+    done += 32;
+  }
+  return done;
+}
+#endif
+
+
+#ifdef IPC_SWAP_NEON
+// vrev reverses the bytes within each 16, 32 or 64 bits, exactly this
+static size_t SwapNEON(uint8_t *dst, const uint8_t *src,
+                       size_t length, int width) {
+  size_t done = 0;
+  while (length - done >= 16) {
+    uint8x16_t v = vld1q_u8(src + done);
+    v = width == 2 ? vrev16q_u8(v) : width == 4 ? vrev32q_u8(v) : vrev64q_u8(v);
+    vst1q_u8(dst + done, v);
+    done += 16;
+  }
+  return done;
+}
+#endif
+
+
+void ipc_swap_init() {
+#ifdef IPC_SWAP_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    swap_fast = SwapAVX2;
+    kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("ssse3")) {
+    swap_fast = SwapSSSE3;
+    kernel_name = "ssse3";
+  }
+#elif defined(IPC_SWAP_NEON)
+  swap_fast = SwapNEON;
+  kernel_name = "neon";
+#endif
+}
+
+
+const char* ipc_swap_kernel() {
+  return kernel_name;
+}
+
+
+void ipc_swap_copy(void *dst, const void *src, size_t count, int width) {
+  uint8_t *out = (uint8_t*) dst;
+  const uint8_t *in = (const uint8_t*) src;
+  size_t length = count * width;
+  size_t i = 0;
+
+  if (swap_fast) i = swap_fast(out, in, length, width);
+
+  // memcpy so neither end has to be aligned
+  if (width == 2) {
+    for (; i < length; i += 2) {
+      uint16_t v;
+      memcpy(&v, in + i, 2);
+      v = ipc_bswap16(v);
+      memcpy(out + i, &v, 2);
+    }
+  } else if (width == 4) {
+    for (; i < length; i += 4) {
+      uint32_t v;
+      memcpy(&v, in + i, 4);
+      v = ipc_bswap32(v);
+      memcpy(out + i, &v, 4);
+    }
+  } else {
+    for (; i < length; i += 8) {
+      uint64_t v;
+      memcpy(&v, in + i, 8);
+      v = ipc_bswap64(v);
+      memcpy(out + i, &v, 8);
+    }
+  }
+}
+
+}  // namespace node
@@ -0,0 +1,45 @@
+#ifndef NODE_IPCSWAP_H_
+#define NODE_IPCSWAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace node {
+
+/* Byte order for the numeric accessors. One value at a time is just a
+ * bswap. Whole arrays go through SSSE3 or AVX2 shuffles picked at run time
+ * on x86 and NEON byte reversal on 64 bit ARM, with whatever's left over
+ * on the end done one value at a time.
+ */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define IPC_BIG_ENDIAN 1
+#else
+# define IPC_BIG_ENDIAN 0
+#endif
+
+// Picks the kernels for this CPU. Until it's called everything is scalar.
+void ipc_swap_init();
+
+// "avx2", "ssse3", "neon" or "scalar"
+const char* ipc_swap_kernel();
+
+// Copies count values width bytes wide (2, 4 or 8), reversing the bytes of
+// each. dst and src can be the same, but mustn't otherwise overlap.
+void ipc_swap_copy(void *dst, const void *src, size_t count, int width);
+
+static inline uint16_t ipc_bswap16(uint16_t v) {
+  return (uint16_t)((v >> 8) | (v << 8));
+}
+
+static inline uint32_t ipc_bswap32(uint32_t v) {
+  return __builtin_bswap32(v);
+}
+
+static inline uint64_t ipc_bswap64(uint64_t v) {
+  return __builtin_bswap64(v);
+}
+
+}  // namespace node
+
+#endif  // NODE_IPCSWAP_H_
@@ -0,0 +1,567 @@
+#include <node.h>
+#include "ipcbuffer.h"
+#include "ipctable.h"
+
+#include <v8.h>
+
+#include <assert.h>
+#include <string.h> // memcpy, memcmp
+
+namespace node {
+
+using namespace v8;
+
+#define TABLE_MAGIC 0x54435049  // "IPCT"
+#define TABLE_EMPTY 0
+#define TABLE_BUSY  1
+#define TABLE_READY 2
+
+#define SLOT_EMPTY    0
+#define SLOT_DELETED  1
+
+#define TABLE_STRIPES 64
+#define KEY_STACK     256       // Keys up to here don't need new[]
+#define VALUE_STACK   1024      // Nor do values getString() copies
+
+
+static Persistent<String> slots_sym;
+static Persistent<String> value_length_sym;
+Persistent<FunctionTemplate> IPCtable::constructor_template;
+
+
+static inline uint64_t Align8(uint64_t n) {
+  return (n + 7) & ~(uint64_t)7;
+}
+
+
+// FNV-1a, folded to 32 bits and kept clear of the two reserved values
+static inline uint32_t Hash(const char *key, size_t length) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    h ^= (unsigned char) key[i];
+    h *= 1099511628211ULL;
+  }
+  uint32_t hash = (uint32_t) (h ^ (h >> 32));
+  return hash <= SLOT_DELETED ? hash + 2 : hash;
+}
+
+
+static inline char* EntryKey(IPCtableEntry *e) {
+  return (char*) (e + 1);
+}
+
+
+static inline char* EntryValue(IPCtableEntry *e, uint32_t key_length) {
+  return (char*) (e + 1) + Align8(key_length);
+}
+
+
+/*
+ * Readers note the stripe's sequence, once it's even, do their looking,
+ * and then check it's still the same. If not a writer was in there with
+ * them and they go round again.
+ */
+static inline uint32_t ReadBegin(IPCtableStripe *stripe) {
+  uint32_t seq;
+  while ((seq = ipc_load(&stripe->sequence, IPC_ACQUIRE)) & 1) {
+    ipc_cpu_relax();
+  }
+  return seq;
+}
+
+
+static inline bool ReadValid(IPCtableStripe *stripe, uint32_t seq) {
+  ipc_fence(IPC_ACQUIRE);
+  return ipc_load(&stripe->sequence, IPC_RELAXED) == seq;
+}
+
+
+static inline void WriteLock(IPCtableStripe *stripe) {
+  uint32_t seq = ipc_load(&stripe->sequence, IPC_RELAXED);
+  for (;;) {
+    if (!(seq & 1) &&
+        ipc_cas(&stripe->sequence, &seq, seq + 1, IPC_ACQUIRE, IPC_RELAXED)) {
+      break;
+    }
+    ipc_cpu_relax();
+    seq = ipc_load(&stripe->sequence, IPC_RELAXED);
+  }
+  ipc_fence(IPC_RELEASE);
+}
+
+
+static inline void WriteUnlock(IPCtableStripe *stripe) {
+  ipc_fetch_add(&stripe->sequence, (uint32_t)1, IPC_RELEASE);
+}
+
+
+/*
+ * A key's bytes, wherever they came from. Strings are written out as utf8,
+ * on the stack if they're short.
+ */
+class KeyBytes {
+ public:
+  KeyBytes(Handle<Value> key) : data_(NULL), length_(0), heap_(NULL) {
+    if (key->IsString()) {
+      Local<String> s = key->ToString();
+      length_ = s->Utf8Length();
+      data_ = length_ <= KEY_STACK ? stack_ : (heap_ = new char[length_]);
+      s->WriteUtf8(data_, length_, NULL, String::HINT_MANY_WRITES_EXPECTED);
+    } else if (IPCbuffer::HasInstance(key)) {
+      Local<Object> obj = key->ToObject();
+      data_ = IPCbuffer::Data(obj);
+      length_ = IPCbuffer::Length(obj);
+    }
+  }
+
+  ~KeyBytes() { delete [] heap_; }
+
+  const char* data() const { return data_ ? data_ : stack_; }
+  size_t length() const { return length_; }
+
+ private:
+  char *data_;
+  size_t length_;
+  char *heap_;
+  char stack_[KEY_STACK];
+};
+
+
+#define KEY_ARG(name, arg)                                           \
+  if (!arg->IsString() && !IPCbuffer::HasInstance(arg)) {            \
+    return ThrowException(Exception::TypeError(String::New(          \
+            "Key should be a string or a Buffer")));                 \
+  }                                                                  \
+  KeyBytes name(arg);
+
+
+// var t = new _IPCtable(ipcbuffer, [offset], [length], [slots]);
+Handle<Value> IPCtable::New(const Arguments &args) {
+  if (!args.IsConstructCall()) {
+    return FromConstructorTemplate(constructor_template, args);
+  }
+
+  HandleScope scope;
+
+  if (!IPCbuffer::HasInstance(args[0])) {
+    return ThrowException(Exception::TypeError(String::New(
+            "First arg should be a Buffer")));
+  }
+
+  Local<Object> buffer = args[0]->ToObject();
+  size_t buffer_length = IPCbuffer::Length(buffer);
+  size_t offset = args[1]->IsUint32() ? args[1]->Uint32Value() : 0;
+
+  if (offset > buffer_length) {
+    return ThrowException(Exception::RangeError(String::New(
+            "offset out of bounds")));
+  }
+
+  size_t length = args[2]->IsUint32() ? args[2]->Uint32Value()
+                                      : buffer_length - offset;
+  if (length > buffer_length - offset) {
+    return ThrowException(Exception::RangeError(String::New(
+            "length out of bounds")));
+  }
+
+  char *base = IPCbuffer::Data(buffer) + offset;
+  if ((uintptr_t)base % 16) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Table must start on a 16 byte boundary")));
+  }
+
+  // A slot for every 256 bytes unless told otherwise, which leaves the
+  // heap room for values averaging a bit under that at half full
+  uint64_t want = args[3]->IsUint32() ? args[3]->Uint32Value() : length / 256;
+  uint64_t slots = 16;
+  while (slots * 2 <= want && slots * 2 <= 0x80000000u) slots *= 2;
+  uint64_t stripes = slots < TABLE_STRIPES ? slots : TABLE_STRIPES;
+  uint64_t heap = sizeof(IPCtableHeader) + stripes * sizeof(IPCtableStripe) +
+                  slots * sizeof(IPCtableSlot);
+  heap = (heap + 15) & ~(uint64_t)15;
+
+  IPCtableHeader *header = (IPCtableHeader*) base;
+  uint32_t state = TABLE_EMPTY;
+
+  if (length < sizeof(IPCtableHeader)) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Buffer too small for a table")));
+  }
+
+  if (ipc_cas(&header->state, &state, (uint32_t)TABLE_BUSY,
+              IPC_ACQUIRE, IPC_ACQUIRE)) {
+    const char *error = heap < length
+                      ? ipc_heap_attach(base + heap, length - heap)
+                      : "Buffer too small for a table";
+    if (error) {
+      ipc_store(&header->state, (uint32_t)TABLE_EMPTY, IPC_RELEASE);
+      return ThrowException(Exception::RangeError(String::New(error)));
+    }
+    header->magic = TABLE_MAGIC;
+    header->slots = slots;
+    header->stripes = stripes;
+    header->count = 0;
+    header->heap = heap;
+    header->deleted = 0;
+    memset(base + sizeof(IPCtableHeader), 0, heap - sizeof(IPCtableHeader));
+    ipc_store(&header->state, (uint32_t)TABLE_READY, IPC_RELEASE);
+  } else {
+    while ((state = ipc_load(&header->state, IPC_ACQUIRE)) == TABLE_BUSY) {
+      ipc_cpu_relax();
+    }
+    if (header->magic != TABLE_MAGIC) {
+      return ThrowException(Exception::Error(String::New(
+              "Buffer does not contain a table")));
+    }
+    if ((header->slots & (header->slots - 1)) ||
+        (header->stripes & (header->stripes - 1)) ||
+        header->stripes == 0 || header->heap >= length ||
+        header->heap < sizeof(IPCtableHeader) +
+                       (uint64_t)header->stripes * sizeof(IPCtableStripe) +
+                       (uint64_t)header->slots * sizeof(IPCtableSlot)) {
+      return ThrowException(Exception::Error(String::New(
+              "Table header does not fit this buffer")));
+    }
+    const char *error = ipc_heap_attach(base + header->heap,
+                                        length - header->heap);
+    if (error) {
+      return ThrowException(Exception::Error(String::New(error)));
+    }
+  }
+
+  IPCtable *table = new IPCtable(args.This(), buffer, offset);
+  args.This()->Set(slots_sym, Number::New(table->mask_ + 1));
+
+  return args.This();
+}
+
+
+IPCtable::IPCtable(Handle<Object> wrapper, Handle<Object> buffer,
+                   size_t offset) : ObjectWrap() {
+  Wrap(wrapper);
+
+  buffer_ = Persistent<Object>::New(buffer);
+  IPCbuffer::Pin(buffer);
+  header_ = (IPCtableHeader*) (IPCbuffer::Data(buffer) + offset);
+  stripes_ = (IPCtableStripe*) (header_ + 1);
+  slots_ = (IPCtableSlot*) (stripes_ + header_->stripes);
+  heap_ = (IPCheapHeader*) ((char*)header_ + header_->heap);
+  mask_ = header_->slots - 1;
+}
+
+
+IPCtable::~IPCtable() {
+  IPCbuffer::Unpin(buffer_);
+  buffer_.Dispose();
+}
+
+
+// The entry at offset, or NULL if it would run off the end of the heap.
+// A reader racing a writer can see any old offset or lengths, so they're
+// never trusted: each length is read once, checked, and only that copy used.
+IPCtableEntry* IPCtable::Entry(uint64_t offset, uint32_t *key_length,
+                               uint32_t *value_length) {
+  uint64_t size = heap_->size;
+  if (offset == 0 || offset > size - sizeof(IPCtableEntry)) return NULL;
+
+  IPCtableEntry *e = (IPCtableEntry*) ((char*)heap_ + offset);
+  *key_length = ipc_load(&e->key_length, IPC_RELAXED);
+  *value_length = ipc_load(&e->value_length, IPC_RELAXED);
+  uint64_t length = sizeof(IPCtableEntry) + Align8(*key_length) +
+                    *value_length;
+  if (length > size - offset) return NULL;
+
+  return e;
+}
+
+
+// The key's entry and, if at is given, its slot. 0 if it isn't there.
+uint64_t IPCtable::Probe(const char *key, size_t length, uint32_t hash,
+                         IPCtableSlot **at) {
+  for (uint64_t i = 0; i <= mask_; i++) {
+    IPCtableSlot *slot = slots_ + ((hash + i) & mask_);
+    uint32_t h = ipc_load(&slot->hash, IPC_ACQUIRE);
+
+    if (h == SLOT_EMPTY) break;
+    if (h != hash) continue;
+
+    uint64_t entry = ipc_load(&slot->entry, IPC_ACQUIRE);
+    uint32_t key_length, value_length;
+    IPCtableEntry *e = Entry(entry, &key_length, &value_length);
+    if (e && key_length == length &&
+        memcmp(EntryKey(e), key, length) == 0) {
+      if (at) *at = slot;
+      return entry;
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+ * Takes the first free slot along from hash's home. The caller has the
+ * stripe, so nobody else is adding this key, but writers on other stripes
+ * can be claiming slots in the same run at the same time.
+ */
+IPCtableSlot* IPCtable::Claim(uint32_t hash) {
+  for (uint64_t i = 0; i <= mask_; i++) {
+    IPCtableSlot *slot = slots_ + ((hash + i) & mask_);
+    uint32_t h = ipc_load(&slot->hash, IPC_RELAXED);
+
+    while (h == SLOT_EMPTY || h == SLOT_DELETED) {
+      if (ipc_cas(&slot->hash, &h, hash, IPC_ACQ_REL, IPC_RELAXED)) {
+        if (h == SLOT_DELETED) {
+          ipc_fetch_add(&header_->deleted, (uint64_t)-1, IPC_RELAXED);
+        }
+        return slot;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Puts every key back where a fresh table would have it, which clears out
+ * the slots marked deleted. Every stripe is taken, in order so two of these
+ * can't deadlock, and nobody else ever holds more than one. Readers see
+ * their stripe busy and wait, or look again.
+ */
+void IPCtable::Rehash() {
+  uint64_t stripes = header_->stripes;
+  for (uint64_t i = 0; i < stripes; i++) WriteLock(stripes_ + i);
+
+  if (ipc_load(&header_->deleted, IPC_RELAXED) > mask_ / 4) {
+    uint64_t live = 0;
+    IPCtableSlot *keep = new IPCtableSlot[mask_ + 1];
+    for (uint64_t i = 0; i <= mask_; i++) {
+      if (slots_[i].hash > SLOT_DELETED) keep[live++] = slots_[i];
+    }
+    memset(slots_, 0, (mask_ + 1) * sizeof(IPCtableSlot));
+    for (uint64_t i = 0; i < live; i++) {
+      uint64_t at = keep[i].hash & mask_;
+      while (slots_[at].hash != SLOT_EMPTY) at = (at + 1) & mask_;
+      slots_[at] = keep[i];
+    }
+    delete [] keep;
+    ipc_store(&header_->deleted, (uint64_t)0, IPC_RELAXED);
+  }
+
+  for (uint64_t i = stripes; i > 0; i--) WriteUnlock(stripes_ + i - 1);
+}
+
+
+// var at = t.get(key); // -1 if it isn't there
+// Where the value is in the buffer, its length is left in
+// _IPCtable._valueLength. It's the value in place, so it's only good until
+// somebody sets or deletes that key.
+Handle<Value> IPCtable::Get(const Arguments &args) {
+  HandleScope scope;
+  IPCtable *table = ObjectWrap::Unwrap<IPCtable>(args.This());
+
+  KEY_ARG(key, args[0])
+
+  uint32_t hash = Hash(key.data(), key.length());
+  IPCtableStripe *stripe = table->Stripe(hash);
+  IPCtableEntry *e = NULL;
+  uint32_t seq;
+  uint32_t key_length, length = 0;
+  char *value = NULL;
+
+  do {
+    seq = ReadBegin(stripe);
+    uint64_t entry = table->Probe(key.data(), key.length(), hash, NULL);
+    if ((e = table->Entry(entry, &key_length, &length))) {
+      value = EntryValue(e, key_length);
+    }
+  } while (!ReadValid(stripe, seq));
+
+  if (e == NULL) return scope.Close(Integer::New(-1));
+
+  constructor_template->GetFunction()->Set(value_length_sym,
+                                           Integer::NewFromUnsigned(length));
+
+  return scope.Close(Number::New(value - IPCbuffer::Data(table->buffer_)));
+}
+
+
+// var s = t.getString(key); // null if it isn't there
+// A utf8 copy, checked to be all of one version of the value. The bytes
+// are copied out first and only made a string once the copy's known good.
+Handle<Value> IPCtable::GetString(const Arguments &args) {
+  HandleScope scope;
+  IPCtable *table = ObjectWrap::Unwrap<IPCtable>(args.This());
+
+  KEY_ARG(key, args[0])
+
+  uint32_t hash = Hash(key.data(), key.length());
+  IPCtableStripe *stripe = table->Stripe(hash);
+  IPCtableEntry *e = NULL;
+  uint32_t seq;
+  uint32_t key_length, length = 0;
+  char stack[VALUE_STACK];
+  char *copy = stack;
+  size_t room = sizeof(stack);
+
+  do {
+    seq = ReadBegin(stripe);
+    uint64_t entry = table->Probe(key.data(), key.length(), hash, NULL);
+    if ((e = table->Entry(entry, &key_length, &length))) {
+      if (length > room) {
+        if (copy != stack) delete [] copy;
+        copy = new char[length];
+        room = length;
+      }
+      memcpy(copy, EntryValue(e, key_length), length);
+    }
+  } while (!ReadValid(stripe, seq));
+
+  Local<Value> value;
+  if (e == NULL) {
+    value = Local<Value>::New(Null());
+  } else {
+    value = String::New(copy, length);
+  }
+  if (copy != stack) delete [] copy;
+
+  return scope.Close(value);
+}
+
+
+// var ok = t.set(key, bufferOrString); // false if the table or heap is full
+Handle<Value> IPCtable::Set(const Arguments &args) {
+  HandleScope scope;
+  IPCtable *table = ObjectWrap::Unwrap<IPCtable>(args.This());
+
+  KEY_ARG(key, args[0])
+
+  Handle<Value> v = args[1];
+  Local<String> s;
+  Local<Object> obj;
+  size_t length;
+
+  if (v->IsString()) {
+    s = v->ToString();
+    length = s->Utf8Length();
+  } else if (IPCbuffer::HasInstance(v)) {
+    obj = v->ToObject();
+    length = IPCbuffer::Length(obj);
+  } else {
+    return ThrowException(Exception::TypeError(String::New(
+            "Value should be a string or a Buffer")));
+  }
+  if (key.length() > 0xffffffffu || length > 0xffffffffu) {
+    return ThrowException(Exception::RangeError(String::New(
+            "Key or value too big")));
+  }
+
+  // Build the new entry before taking the stripe, nobody can see it yet
+  uint64_t entry = ipc_heap_alloc(table->heap_, sizeof(IPCtableEntry) +
+                                  Align8(key.length()) + length);
+  if (entry == 0) return scope.Close(False());
+
+  IPCtableEntry *e = (IPCtableEntry*) ((char*)table->heap_ + entry);
+  e->key_length = key.length();
+  e->value_length = length;
+  memcpy(EntryKey(e), key.data(), key.length());
+  if (s.IsEmpty()) {
+    memcpy(EntryValue(e, key.length()), IPCbuffer::Data(obj), length);
+  } else {
+    s->WriteUtf8(EntryValue(e, key.length()), length, NULL,
+                 String::HINT_MANY_WRITES_EXPECTED);
+  }
+
+  uint32_t hash = Hash(key.data(), key.length());
+  IPCtableStripe *stripe = table->Stripe(hash);
+  IPCtableSlot *slot = NULL;
+
+  WriteLock(stripe);
+  uint64_t old = table->Probe(key.data(), key.length(), hash, &slot);
+  if (old == 0 && (slot = table->Claim(hash))) {
+    ipc_fetch_add(&table->header_->count, (uint64_t)1, IPC_RELAXED);
+  }
+  if (slot) ipc_store(&slot->entry, entry, IPC_RELEASE);
+  WriteUnlock(stripe);
+
+  // Anyone who was reading the old one has seen the sequence move by now
+  if (old) ipc_heap_free(table->heap_, old);
+  if (slot == NULL) {
+    ipc_heap_free(table->heap_, entry);
+    return scope.Close(False());
+  }
+
+  return scope.Close(True());
+}
+
+
+// var found = t.delete(key);
+Handle<Value> IPCtable::Delete(const Arguments &args) {
+  HandleScope scope;
+  IPCtable *table = ObjectWrap::Unwrap<IPCtable>(args.This());
+
+  KEY_ARG(key, args[0])
+
+  uint32_t hash = Hash(key.data(), key.length());
+  IPCtableStripe *stripe = table->Stripe(hash);
+  IPCtableSlot *slot;
+
+  WriteLock(stripe);
+  uint64_t old = table->Probe(key.data(), key.length(), hash, &slot);
+  if (old) {
+    // Entry first, the moment the hash says deleted another stripe can
+    // claim the slot and put its own entry in
+    ipc_store(&slot->entry, (uint64_t)0, IPC_RELAXED);
+    ipc_store(&slot->hash, (uint32_t)SLOT_DELETED, IPC_RELEASE);
+    ipc_fetch_add(&table->header_->count, (uint64_t)-1, IPC_RELAXED);
+    ipc_fetch_add(&table->header_->deleted, (uint64_t)1, IPC_RELAXED);
+  }
+  WriteUnlock(stripe);
+
+  if (old) ipc_heap_free(table->heap_, old);
+
+  // Misses have to probe past every deleted slot, so don't let them pile up
+  if (old && ipc_load(&table->header_->deleted, IPC_RELAXED) > table->mask_ / 4) {
+    table->Rehash();
+  }
+
+  return scope.Close(Boolean::New(old != 0));
+}
+
+
+// var keys = t.size();
+Handle<Value> IPCtable::Size(const Arguments &args) {
+  HandleScope scope;
+  IPCtable *table = ObjectWrap::Unwrap<IPCtable>(args.This());
+
+  return scope.Close(Number::New(
+          (double)ipc_load(&table->header_->count, IPC_RELAXED)));
+}
+
+
+void IPCtable::Initialize(Handle<Object> target) {
+  HandleScope scope;
+
+  assert(sizeof(IPCtableHeader) == IPC_CACHELINE);
+  assert(sizeof(IPCtableStripe) == IPC_CACHELINE);
+
+  slots_sym = Persistent<String>::New(String::NewSymbol("slots"));
+  value_length_sym = Persistent<String>::New(String::NewSymbol("_valueLength"));
+
+  Local<FunctionTemplate> t = FunctionTemplate::New(IPCtable::New);
+  constructor_template = Persistent<FunctionTemplate>::New(t);
+  constructor_template->InstanceTemplate()->SetInternalFieldCount(1);
+  constructor_template->SetClassName(String::NewSymbol("_IPCtable"));
+
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "get", IPCtable::Get);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "getString", IPCtable::GetString);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "set", IPCtable::Set);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "delete", IPCtable::Delete);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "size", IPCtable::Size);
+
+  target->Set(String::NewSymbol("_IPCtable"), constructor_template->GetFunction());
+}
+
+
+}  // namespace node
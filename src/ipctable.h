@@ -0,0 +1,104 @@
+#ifndef NODE_IPCTABLE_H_
+#define NODE_IPCTABLE_H_
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <v8.h>
+#include <stdint.h>
+
+#include "ipcatomic.h"
+#include "ipcheap.h"
+
+namespace node {
+
+/* A hash table laid over a chunk of an IPCbuffer, so a pool of workers can
+ * share one cache instead of each keeping their own.
+ *
+ * The slots are open addressed with linear probing, each one a hash and the
+ * offset of an entry holding the key and value. The entries themselves come
+ * out of an IPCheap that takes up the rest of the chunk.
+ *
+ * Keys are spread over a set of stripes. A stripe's sequence number is odd
+ * while a writer has it, so writers on different stripes don't get in each
+ * other's way, and readers take no lock at all: they note the sequence,
+ * look, and look again if it moved meanwhile.
+ *
+ *   var t = new _IPCtable(ipcbuffer, offset, length, slots);
+ *   t.set("key", bufferOrString);   // false if the table is full
+ *   var at = t.get("key");          // where the value is, -1 if it isn't
+ *   t.delete("key");
+ *
+ * A deleted key leaves its slot marked deleted, so probes for keys further
+ * along the run still get past it. Set() reuses them, and once a quarter
+ * of the slots are marked the whole table is rehashed in place.
+ */
+
+struct IPCtableHeader {
+  uint32_t magic;
+  uint32_t state;
+  uint32_t slots;             // Always a power of two
+  uint32_t stripes;           // So is this
+  uint64_t count;             // Keys in it now
+  uint64_t heap;              // Where the heap starts, from the header
+  uint64_t deleted;           // Slots marked deleted, till the next rehash
+  char pad_[IPC_CACHELINE - 40];
+};
+
+struct IPCtableStripe {
+  uint32_t sequence;          // Odd while a writer is busy in here
+  char pad_[IPC_CACHELINE - 4];
+};
+
+struct IPCtableSlot {
+  uint32_t hash;              // 0 never used, 1 deleted
+  uint32_t unused_;
+  uint64_t entry;             // Offset in the heap
+};
+
+// Followed by the key, then the value on the next 8 byte boundary
+struct IPCtableEntry {
+  uint32_t key_length;
+  uint32_t value_length;
+};
+
+
+class IPCtable : public ObjectWrap {
+ public:
+  static void Initialize(v8::Handle<v8::Object> target);
+
+ private:
+  static v8::Persistent<v8::FunctionTemplate> constructor_template;
+
+  static v8::Handle<v8::Value> New(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Get(const v8::Arguments &args);
+  static v8::Handle<v8::Value> GetString(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Set(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Delete(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Size(const v8::Arguments &args);
+
+  IPCtable(v8::Handle<v8::Object> wrapper, v8::Handle<v8::Object> buffer,
+           size_t offset);
+  ~IPCtable();
+
+  IPCtableStripe* Stripe(uint32_t hash) {
+    return stripes_ + (hash & (header_->stripes - 1));
+  }
+
+  IPCtableEntry* Entry(uint64_t offset, uint32_t *key_length,
+                       uint32_t *value_length);
+  uint64_t Probe(const char *key, size_t length, uint32_t hash,
+                 IPCtableSlot **at);
+  IPCtableSlot* Claim(uint32_t hash);
+  void Rehash();
+
+  v8::Persistent<v8::Object> buffer_;   // Keeps the segment mapped
+  IPCtableHeader *header_;
+  IPCtableStripe *stripes_;
+  IPCtableSlot *slots_;
+  IPCheapHeader *heap_;
+  uint64_t mask_;
+};
+
+}  // namespace node
+
+#endif  // NODE_IPCTABLE_H_
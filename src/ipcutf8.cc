@@ -0,0 +1,317 @@
+#include "ipcutf8.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define IPC_UTF8_X86 1
+# include <immintrin.h>
+#elif defined(__aarch64__)
+# define IPC_UTF8_NEON 1
+# include <arm_neon.h>
+#endif
+
+namespace node {
+
+// Both return how far they got, in whole blocks
+typedef size_t (*scan_kernel)(const uint8_t *src, size_t length);
+
+static scan_kernel ascii_fast = NULL;
+static scan_kernel utf8_fast = NULL;
+static const char *kernel_name = "scalar";
+
+
+// Bytes the sequence a lead byte starts is meant to have, 0 if it isn't one
+static inline int SequenceLength(uint8_t c) {
+  if (c < 0x80) return 1;
+  if (c < 0xC2) return 0;
+  if (c < 0xE0) return 2;
+  if (c < 0xF0) return 3;
+  if (c < 0xF5) return 4;
+  return 0;
+}
+
+
+static size_t Utf8Scalar(const uint8_t *src, size_t length) {
+  size_t i = 0;
+
+  while (i < length) {
+    uint8_t c = src[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+
+    int n = SequenceLength(c);
+    if (n == 0 || i + n > length) break;
+
+    // The second byte's range depends on the lead, the rest are any
+    // continuation byte
+    uint8_t c1 = src[i + 1];
+    uint8_t lo = 0x80, hi = 0xBF;
+    if (c == 0xE0) lo = 0xA0;
+    else if (c == 0xED) hi = 0x9F;
+    else if (c == 0xF0) lo = 0x90;
+    else if (c == 0xF4) hi = 0x8F;
+    if (c1 < lo || c1 > hi) break;
+
+    int k;
+    for (k = 2; k < n; k++) {
+      if ((src[i + k] & 0xC0) != 0x80) break;
+    }
+    if (k < n) break;
+
+    i += n;
+  }
+
+  return i;
+}
+
+
+/*
+ * Where the character that straddles pos starts, if one does. A vector
+ * kernel stops on a block boundary, which can be in the middle of one.
+ */
+static inline size_t CharBoundary(const uint8_t *src, size_t pos) {
+  for (size_t back = 1; back <= 3 && back <= pos; back++) {
+    uint8_t c = src[pos - back];
+    if (c < 0x80) break;
+    if (c >= 0xC0) {
+      // A bad lead byte counts too, the scalar code has to see it
+      int n = SequenceLength(c);
+      if (n == 0 || n > (int)back) return pos - back;
+      break;
+    }
+  }
+  return pos;
+}
+
+
+#ifdef IPC_UTF8_X86
+__attribute__((target("sse2")))
+static size_t AsciiSSE2(const uint8_t *src, size_t length) {
+  size_t i = 0;
+  for (; i + 64 <= length; i += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+    __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b),
+                                       _mm_or_si128(c, d)))) {
+      break;
+    }
+  }
+  for (; i + 16 <= length; i += 16) {
+    if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(src + i)))) break;
+  }
+  return i;
+}
+
+
+__attribute__((target("avx2")))
+static size_t AsciiAVX2(const uint8_t *src, size_t length) {
+  size_t i = 0;
+  for (; i + 128 <= length; i += 128) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i*)(src + i + 64));
+    __m256i d = _mm256_loadu_si256((const __m256i*)(src + i + 96));
+    if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(a, b),
+                                             _mm256_or_si256(c, d)))) {
+      break;
+    }
+  }
+  for (; i + 32 <= length; i += 32) {
+    if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(src + i)))) {
+      break;
+    }
+  }
+  return i;
+}
+
+
+/*
+ * John Keiser and Daniel Lemire's lookup method. Every error a pair of
+ * bytes can show is a bit, and three table lookups, on the high and low
+ * nibbles of the first byte and the high nibble of the second, say which
+ * errors each pair might be. A pair is bad if all three agree. The only
+ * thing pairs can't see is whether the third and fourth bytes of a long
+ * sequence are continuations, which comes from looking two and three back.
+ */
+#define TOO_SHORT     (1 << 0)  // 11______ 0_______
+#define TOO_LONG      (1 << 1)  // 0_______ 10______
+#define OVERLONG_3    (1 << 2)  // 11100000 100_____
+#define TOO_LARGE     (1 << 3)  // 11110100 1001____ and up
+#define SURROGATE     (1 << 4)  // 11101101 101_____
+#define OVERLONG_2    (1 << 5)  // 1100000_ 10______
+#define TOO_LARGE_1000 (1 << 6) // 11110101 1000____ and up
+#define OVERLONG_4    (1 << 6)  // 11110000 1000____
+#define TWO_CONTS     (1 << 7)  // 10______ 10______
+#define CARRY         (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static inline __m128i Utf8Errors128(__m128i in, __m128i prev_in) {
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i byte_1_high_lut = _mm_setr_epi8(
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+      TOO_SHORT | OVERLONG_2,
+      TOO_SHORT,
+      TOO_SHORT | OVERLONG_3 | SURROGATE,
+      TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m128i byte_1_low_lut = _mm_setr_epi8(
+      CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+      CARRY | OVERLONG_2,
+      CARRY,
+      CARRY,
+      CARRY | TOO_LARGE,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000);
+  const __m128i byte_2_high_lut = _mm_setr_epi8(
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+  __m128i prev1 = _mm_alignr_epi8(in, prev_in, 15);
+  __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_lut,
+      _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+  __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_lut,
+      _mm_and_si128(prev1, nibble));
+  __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_lut,
+      _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+  __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low),
+                                  byte_2_high);
+
+  // Two back a three or four byte lead, or three back a four byte one,
+  // and this had better be a continuation
+  __m128i prev2 = _mm_alignr_epi8(in, prev_in, 14);
+  __m128i prev3 = _mm_alignr_epi8(in, prev_in, 13);
+  __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80)),
+                                _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80)));
+  __m128i must23_80 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+
+  return _mm_xor_si128(must23_80, special);
+}
+
+#undef TOO_SHORT
+#undef TOO_LONG
+#undef OVERLONG_3
+#undef TOO_LARGE
+#undef SURROGATE
+#undef OVERLONG_2
+#undef TOO_LARGE_1000
+#undef OVERLONG_4
+#undef TWO_CONTS
+#undef CARRY
+
+// Stops at the first block with anything wrong in it. What comes before
+// is only known good up to the last whole character.
+__attribute__((target("ssse3")))
+static size_t Utf8SSSE3(const uint8_t *src, size_t length) {
+  __m128i prev = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i + 16 <= length; i += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i errors;
+    if (_mm_movemask_epi8(in) == 0) {
+      // All ASCII, fine unless the last block left a sequence hanging
+      const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, -1, -1, -1, (char)(0xF0 - 1),
+                                        (char)(0xE0 - 1), (char)(0xC0 - 1));
+      errors = _mm_subs_epu8(prev, max);
+    } else {
+      errors = Utf8Errors128(in, prev);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(errors, _mm_setzero_si128())) != 0xFFFF) {
+      break;
+    }
+    prev = in;
+  }
+
+  return i;
+}
+#endif
+
+
+#ifdef IPC_UTF8_NEON
+static size_t AsciiNEON(const uint8_t *src, size_t length) {
+  size_t i = 0;
+  for (; i + 64 <= length; i += 64) {
+    uint8x16x4_t in = vld1q_u8_x4(src + i);
+    uint8x16_t any = vorrq_u8(vorrq_u8(in.val[0], in.val[1]),
+                              vorrq_u8(in.val[2], in.val[3]));
+    if (vmaxvq_u8(any) >= 0x80) break;
+  }
+  for (; i + 16 <= length; i += 16) {
+    if (vmaxvq_u8(vld1q_u8(src + i)) >= 0x80) break;
+  }
+  return i;
+}
+#endif
+
+
+void ipc_utf8_init() {
+#ifdef IPC_UTF8_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    ascii_fast = AsciiAVX2;
+    kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    ascii_fast = AsciiSSE2;
+    kernel_name = "sse2";
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    utf8_fast = Utf8SSSE3;
+    if (!__builtin_cpu_supports("avx2")) kernel_name = "ssse3";
+  }
+#elif defined(IPC_UTF8_NEON)
+  // NEON only does the ASCII runs, anything else is left to the scalar
+  // checker
+  ascii_fast = AsciiNEON;
+  kernel_name = "neon";
+#endif
+}
+
+
+const char* ipc_utf8_kernel() {
+  return kernel_name;
+}
+
+
+size_t ipc_ascii_prefix(const char *src, size_t length) {
+  const uint8_t *s = (const uint8_t*) src;
+  size_t i = ascii_fast ? ascii_fast(s, length) : 0;
+
+  while (i < length && s[i] < 0x80) i++;
+  return i;
+}
+
+
+size_t ipc_utf8_prefix(const char *src, size_t length) {
+  const uint8_t *s = (const uint8_t*) src;
+  size_t i = ipc_ascii_prefix(src, length);
+
+  if (utf8_fast && i < length) {
+    i += utf8_fast(s + i, length - i);
+    i = CharBoundary(s, i);
+  }
+
+  return i + Utf8Scalar(s + i, length - i);
+}
+
+}  // namespace node
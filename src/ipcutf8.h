@@ -0,0 +1,29 @@
+#ifndef NODE_IPCUTF8_H_
+#define NODE_IPCUTF8_H_
+
+#include <stddef.h>
+
+namespace node {
+
+/* Scanning text in the buffers before it's turned into strings. Whatever
+ * another process left in a shared buffer is untrusted, so it's checked
+ * here first, sixteen or thirty two bytes at a time where the CPU can.
+ * The kernels are picked at run time, same as base64.
+ */
+
+void ipc_utf8_init();
+
+// "avx2", "ssse3", "sse2", "neon" or "scalar"
+const char* ipc_utf8_kernel();
+
+// How many bytes from the start are plain 7 bit ASCII
+size_t ipc_ascii_prefix(const char *src, size_t length);
+
+// How many bytes from the start are well formed UTF-8. Stops before an
+// overlong form, a surrogate, anything past U+10FFFF, or a sequence cut off
+// at the end.
+size_t ipc_utf8_prefix(const char *src, size_t length);
+
+}  // namespace node
+
+#endif  // NODE_IPCUTF8_H_
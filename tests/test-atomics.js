@@ -0,0 +1,88 @@
+
+var spawn = require("child_process").spawn;
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var WORKERS = 4;
+var ADDS = 1000000;	// Per worker
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+// Layout: 0 a 32 bit counter, 8 a 64 bit one, 16 a spin lock guarding the
+// plain counter at 20, and 24 how many workers are done
+function parent(){
+    var buff = new IPCBuffer(4096,"*Atomy");
+    var i, exited = 0;
+    buff.fill(0,0,32);
+
+    // The easy ones first, in this process alone
+    if(buff.exchange(0,5) !== 0 || buff.load(0) !== 5) fail("exchange");
+    if(buff.compareExchange(0,4,6) !== 5 || buff.load(0) !== 5) fail("failed compareExchange changed it");
+    if(buff.compareExchange(0,5,6) !== 5 || buff.load(0) !== 6) fail("compareExchange");
+    if(buff.fetchOr(0,9) !== 6 || buff.load(0) !== 15) fail("fetchOr");
+    buff.store(8,Math.pow(2,40),64);
+    if(buff.fetchAdd(8,1,64) !== Math.pow(2,40) || buff.load(8,64) !== Math.pow(2,40)+1) fail("64 bit fetchAdd");
+    buff.fill(0,0,32);
+
+    // Only inside the Buffer asked, not wherever in its parent
+    var slice = buff.slice(64,128), bad = [[-4],[64],[62],[60,64]];
+    for(i = 0;i < bad.length;i++){
+	try{
+	    slice.fetchAdd(bad[i][0],1,bad[i][1]);
+	    fail("fetchAdd at "+bad[i][0]+" of a 64 byte slice");
+	}catch(e){
+	    if(!(e instanceof RangeError)) throw e;
+	}
+    }
+    slice.store(60,7);
+    if(buff.load(124) !== 7 || slice.load(56,64) !== 7*Math.pow(2,32)) fail("Slice offsets");
+    buff.fill(0,64,128);
+
+    timeit();
+    for(i = 0;i < WORKERS;i++){
+	var proc = spawn("node",[__filename,"child"]);
+	proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+	proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+	proc.on("exit",function(code){
+	    if(code) fail("Child exited with "+code);
+	    if(++exited < WORKERS) return;
+	    console.log(WORKERS+" workers added "+ADDS+" each "+timeit()/1000+" Seconds");
+	    if(buff.load(0) !== WORKERS*ADDS) fail("32 bit counter "+buff.load(0));
+	    if(buff.load(8,64) !== WORKERS*ADDS) fail("64 bit counter "+buff.load(8,64));
+	    if(buff.readUInt32LE(20) !== WORKERS*ADDS/100) fail("Locked counter "+buff.readUInt32LE(20));
+	    if(buff.load(24) !== WORKERS) fail("Done count "+buff.load(24));
+	    console.log("All counts add up");
+	});
+    }
+}
+
+function child(){
+    var buff = new IPCBuffer(4096,"*Atomy");
+    var i;
+
+    for(i = 0;i < ADDS;i++){
+	buff.fetchAdd(0,1);
+	buff.fetchAdd(8,1,64);
+	if(i % 100 === 0){
+	    while(buff.compareExchange(16,0,1,32,'acquire') !== 0);
+	    buff.writeUInt32LE(buff.readUInt32LE(20)+1,20);
+	    buff.store(16,0,32,'release');
+	}
+    }
+    buff.fetchAdd(24,1);
+}
+
+if(process.argv[2] === "child"){
+    child();
+}else{
+    parent();
+}
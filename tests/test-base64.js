@@ -0,0 +1,82 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+var kernel = require("../lib/ipcbuffer")._IPCbuffer.base64Kernel;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+// RFC 4648 section 10
+var vectors = [
+    ["f","Zg=="],
+    ["fo","Zm8="],
+    ["foo","Zm9v"],
+    ["foob","Zm9vYg=="],
+    ["fooba","Zm9vYmE="],
+    ["foobar","Zm9vYmFy"]
+];
+
+var buff = new IPCBuffer(4*1024*1024);
+var i, n;
+console.log("base64 kernel is "+kernel);
+
+if(buff.write("",0,"base64") !== 0 || IPCBuffer.byteLength("","base64") !== 0) fail("Empty string");
+for(i = 0;i < vectors.length;i++){
+    var plain = vectors[i][0], coded = vectors[i][1];
+    buff.write(plain,0,"binary");
+    if(buff.toString("base64",0,plain.length) !== coded) fail("Encoding "+plain+" gave "+buff.toString("base64",0,plain.length));
+    buff.fill(0,0,16);
+    n = buff.write(coded,0,"base64");
+    if(n !== plain.length || buff.toString("binary",0,n) !== plain) fail("Decoding "+coded+" gave "+buff.toString("binary",0,n));
+    if(IPCBuffer.byteLength(coded,"base64") !== plain.length) fail("byteLength of "+coded);
+    // Without the padding too
+    if(buff.write(coded.replace(/=/g,""),0,"base64") !== plain.length) fail("Decoding "+coded+" unpadded");
+}
+
+// Padding ends it, nothing after it is another quantum
+buff.fill(0,0,16);
+if(buff.write("QQ==QQ==",0,"base64") !== 1 || buff[0] !== 65 || buff[1] !== 0) fail("Decoded past the padding");
+if(IPCBuffer.byteLength("QQ==QQ==","base64") !== 1) fail("byteLength past the padding");
+if(buff.write("Zm9v=Zm9v",0,"base64") !== 3) fail("Decoded past a lone =");
+console.log("Known vectors "+timeit()/1000+" Seconds");
+
+// Every length either side of the vector widths, at an odd offset so none
+// of it is aligned, against node's own
+var ref, off = 3;
+for(n = 0;n < 200;n++){
+    ref = new Buffer(n);
+    for(i = 0;i < n;i++){
+	ref[i] = (i*37 + n) & 255;
+	buff[off+i] = ref[i];
+    }
+    var want = ref.toString("base64"), got = n ? buff.toString("base64",off,off+n) : "";
+    if(got !== want) fail("Encoding "+n+" bytes gave "+got+" not "+want);
+    buff.fill(0,off,off+n+4);
+    if(buff.write(want,off,"base64") !== n) fail("Decoding "+n+" bytes");
+    for(i = 0;i < n;i++){
+	if(buff[off+i] !== ref[i]) fail("Decoding "+n+" bytes, byte "+i+" is "+buff[off+i]);
+    }
+    if(buff[off+n] !== 0) fail("Decoding "+n+" bytes wrote past the end");
+}
+console.log("Lengths 0 to 199 "+timeit()/1000+" Seconds");
+
+// Big enough to be made straight into an external string
+n = 3*1024*1024;
+for(i = 0;i < n;i++) buff[i] = (i*7 + (i >> 10)) & 255;
+var big = buff.toString("base64",0,n);
+if(big.length !== n/3*4 || IPCBuffer.byteLength(big,"base64") !== n) fail("Big string is "+big.length+" chars");
+var copy = new IPCBuffer(n);
+if(copy.write(big,0,"base64") !== n) fail("Big string decoded short");
+if(!copy.equals(buff.slice(0,n))) fail("Big round trip changed it");
+console.log("Round trip of "+n+" bytes "+timeit()/1000+" Seconds");
+
+// Line breaks and the like are skipped
+if(copy.write("Zm9v\nYmFy",0,"base64") !== 6 || copy.toString("binary",0,6) !== "foobar") fail("Skipping a line break");
@@ -0,0 +1,99 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BIG = 16*1024*1024;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function pattern(buff,start,end){
+    for(var i = start;i < end;i++) buff[i] = (i*7 + (i >> 12)) & 255;
+}
+
+// The first so many bytes of the pattern: XXH64, XXH64 seeded with 12345,
+// CRC-32C. Lengths either side of the 8 and 32 byte blocks both work in.
+var vectors = [
+    [1,"e934a84adb052768","18b81924b59e1047",0x527d5351],
+    [3,"9ff70a635a6209ab","3df1cac951961c9b",0xb671d518],
+    [4,"ae5acdc00a55ac41","d8650ba0e07c8dbe",0xede36e57],
+    [7,"d734a6b26f3da63e","8d60ffd61dfbdcf6",0xf16adce7],
+    [8,"87116b3365b924eb","07be9dcc0c0f8926",0xa7fe3fce],
+    [31,"0f187c62b1e722b7","cd8e81d282319634",0x846159a7],
+    [32,"91b0cb0931a8c629","1c0b4b43c9e3dd6d",0x8f19d922],
+    [33,"931b043cf8d65b94","e73d613b6256de65",0x70441cbb],
+    [63,"219110bf13e2fa26","685ed2b4aa509ccd",0xb9423f55],
+    [64,"bf3052e3445775d0","6a5ce855fb0444ac",0xfcb776a4],
+    [100,"8e2272c08247d5db","65193c8e88f402df",0xd8aaeaf3],
+    [1000,"25275608a9cfc168","29d23bd22e33513c",0x79a16ae6],
+    [4096,"c8066d80a6fe1426","455e51ec6f3e64e4",0xc0143a6f],
+    [100003,"c32bf041c893e753","22fb4d013a441e25",0xc7e8cac7]
+];
+
+var buff = new IPCBuffer(BIG);
+var i, n;
+
+// The published ones
+buff.write("123456789abc",0,"ascii");
+if(buff.crc32c(0,9) !== 0xe3069283) fail("crc32c of 123456789 is "+buff.crc32c(0,9).toString(16));
+if(buff.crc32c(0,0) !== 0) fail("crc32c of nothing");
+if(buff.hash64(0,0) !== "ef46db3751d8e999") fail("hash64 of nothing is "+buff.hash64(0,0));
+if(buff.hash64(9,12) !== "44bc2cf5ad770999") fail("hash64 of abc is "+buff.hash64(9,12));
+if(buff.slice(9,12).hash64() !== "44bc2cf5ad770999") fail("hash64 of a slice");
+var small = new IPCBuffer(9);	// From the pool, somewhere in the middle of it
+small.write("123456789",0,"ascii");
+if(small.crc32c() !== 0xe3069283) fail("crc32c of a pooled buffer");
+
+pattern(buff,0,BIG);
+for(i = 0;i < vectors.length;i++){
+    n = vectors[i][0];
+    if(buff.hash64(0,n) !== vectors[i][1]) fail("hash64 of "+n+" bytes is "+buff.hash64(0,n));
+    if(buff.hash64(0,n,12345) !== vectors[i][2]) fail("Seeded hash64 of "+n+" bytes is "+buff.hash64(0,n,12345));
+    if(buff.crc32c(0,n) !== vectors[i][3]) fail("crc32c of "+n+" bytes is "+buff.crc32c(0,n).toString(16));
+}
+console.log("Known vectors "+timeit()/1000+" Seconds");
+
+// A CRC carries on from the one before, wherever it's cut
+var whole = buff.crc32c(0,100003);
+for(n = 0;n < 100003;n += 9973){
+    if(buff.crc32c(n,100003,buff.crc32c(0,n)) !== whole) fail("crc32c cut at "+n);
+}
+console.log("CRC chaining "+timeit()/1000+" Seconds");
+
+// The threadpool gets the same answers, the big CRC split between threads
+// and joined back up
+var want = {crc:buff.crc32c(), hash:buff.hash64(), part:buff.crc32c(12345,BIG-7,0xdeadbeef)};
+console.log("Sync over "+BIG+" bytes "+timeit()/1000+" Seconds");
+var pending = 4;
+function done(){
+    if(--pending) return;
+    console.log("Async over "+BIG+" bytes "+timeit()/1000+" Seconds");
+}
+buff.crc32c(function(err,crc){
+    if(err) fail(err);
+    if(crc !== want.crc) fail("Async crc32c "+crc+" not "+want.crc);
+    done();
+});
+buff.hash64(function(err,hash){
+    if(err) fail(err);
+    if(hash !== want.hash) fail("Async hash64 "+hash+" not "+want.hash);
+    done();
+});
+buff.crc32c(12345,BIG-7,0xdeadbeef,function(err,crc){
+    if(err) fail(err);
+    if(crc !== want.part) fail("Async crc32c of a range carrying on "+crc+" not "+want.part);
+    done();
+});
+buff.hash64(0,100003,12345,function(err,hash){
+    if(err) fail(err);
+    if(hash !== vectors[vectors.length-1][2]) fail("Async seeded hash64 "+hash);
+    done();
+});
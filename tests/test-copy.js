@@ -0,0 +1,135 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BIG = 32*1024*1024;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function pattern(buff,start,end){
+    for(var i = start;i < end;i++) buff[i] = (i*7 + (i >> 12)) & 255;
+}
+
+// Where from was copied to at, length bytes of it
+function testcopy(buff,at,from,length,what){
+    for(var i = 0;i < length;i++){
+	if(buff[at+i] !== ((from+i)*7 + ((from+i) >> 12) & 255)) fail(what+" byte "+i+" is "+buff[at+i]);
+    }
+}
+
+var source = new IPCBuffer(BIG,"*Copyfrom");
+var target = new IPCBuffer(BIG,"*Copyto");
+pattern(source,0,BIG);
+var config = IPCBuffer.copyConfig();
+console.log("Copy kernel is "+config.kernel+", streaming from "+config.streamThreshold+" bytes "+timeit()/1000+" Seconds");
+
+// Big enough to be split across the threadpool and streamed
+function big(next){
+    target.fill(0);
+    source.copyAsync(target,function(err,copied){
+	if(err) fail(err);
+	if(copied !== BIG) fail("Copied "+copied+" bytes");
+	console.log("copyAsync of "+BIG+" bytes "+timeit()/1000+" Seconds");
+	testcopy(target,0,0,BIG,"Big copy");
+	next();
+    });
+    // Both are pinned until it's done
+    try{
+	target.resize(BIG/2);
+	fail("Resized a buffer being copied into");
+    }catch(e){}
+}
+
+// Odd offsets and lengths, and a copy clipped to the room in the target
+function ranges(next){
+    target.fill(0);
+    source.copyAsync(target,3,1001,1001+100003,function(err,copied){
+	if(err) fail(err);
+	if(copied !== 100003) fail("Ranged copy copied "+copied);
+	testcopy(target,3,1001,100003,"Ranged copy");
+	if(target[2] !== 0 || target[3+100003] !== 0) fail("Ranged copy went outside its range");
+
+	source.copyAsync(target,BIG-10,0,100,function(err,copied){
+	    if(err) fail(err);
+	    if(copied !== 10) fail("Clipped copy copied "+copied);
+	    testcopy(target,BIG-10,0,10,"Clipped copy");
+
+	    source.copyAsync(target,0,5,5,function(err,copied){
+		if(err || copied !== 0) fail("Empty copy gave "+err+" "+copied);
+		console.log("Ranges "+timeit()/1000+" Seconds");
+		next();
+	    });
+	});
+    });
+}
+
+// Overlapping both ways within one buffer has to be a memmove
+function overlap(next){
+    var length = 4*1024*1024;
+    pattern(target,0,BIG);
+    target.copyAsync(target,1000,0,length,function(err,copied){
+	if(err) fail(err);
+	if(copied !== length) fail("Forward overlap copied "+copied);
+	testcopy(target,1000,0,length,"Forward overlap");
+
+	pattern(target,0,BIG);
+	target.copyAsync(target,0,1000,1000+length,function(err,copied){
+	    if(err) fail(err);
+	    testcopy(target,0,1000,length,"Backward overlap");
+	    console.log("Overlapping copies "+timeit()/1000+" Seconds");
+	    next();
+	});
+    });
+}
+
+// Lots at once, each to its own part of the target, and one into a plain
+// node Buffer
+function many(next){
+    var pending = 16, part = BIG/16, i;
+    var plain = new Buffer(65536);
+    target.fill(0);
+    for(i = 0;i < 16;i++){
+	(function(i){
+	    source.copyAsync(target,i*part,i*part,(i+1)*part,function(err,copied){
+		if(err) fail(err);
+		if(copied !== part) fail("Part "+i+" copied "+copied);
+		if(--pending) return;
+		testcopy(target,0,0,BIG,"Parts");
+		source.copyAsync(plain,0,12345,function(err,copied){
+		    if(err) fail(err);
+		    if(copied !== plain.length) fail("Into a plain Buffer copied "+copied);
+		    testcopy(plain,0,12345,plain.length,"Plain Buffer");
+		    console.log("16 at once and a plain Buffer "+timeit()/1000+" Seconds");
+		    next();
+		});
+	    });
+	})(i);
+    }
+}
+
+// Streaming everything, even small copies, still copies right
+function streamed(){
+    if(IPCBuffer.copyConfig({streamThreshold:1}).streamThreshold !== 1) fail("streamThreshold didn't change");
+    target.fill(0);
+    for(var n = 1;n < 300;n += 7){
+	source.copy(target,n,n*3,n*3+n);
+	testcopy(target,n,n*3,n,"Streamed copy of "+n);
+    }
+    source.copyAsync(target,5,17,17+1000003,function(err,copied){
+	if(err) fail(err);
+	testcopy(target,5,17,1000003,"Streamed copyAsync");
+	if(IPCBuffer.copyConfig({streamThreshold:0}).streamThreshold !== config.streamThreshold) fail("Default threshold not back");
+	console.log("Streaming everything "+timeit()/1000+" Seconds");
+    });
+}
+
+big(function(){ ranges(function(){ overlap(function(){ many(streamed); }); }); });
@@ -0,0 +1,118 @@
+
+var fs = require("fs");
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BUFFSIZE = 1024*1024;
+var FAR = 512*1024;	// Well past the first page, whatever size they are
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+// The file as anyone reading it the ordinary way sees it
+function ondisk(path,at,length){
+    var fd = fs.openSync(path,"r"), b = new Buffer(length);
+    fs.readSync(fd,b,0,length,at);
+    fs.closeSync(fd);
+    return b.toString("binary");
+}
+
+// How many ranges were written since the last time it was asked
+var total = IPCBuffer.stats().flushedRanges, ranges;
+function flushed(){
+    var was = total;
+    total = IPCBuffer.stats().flushedRanges;
+    return ranges = total - was;
+}
+
+var plain = "/tmp/ipcbuffer-flush-"+process.pid;
+var tracked = plain+"-dirty";
+
+function cleanup(){
+    try{ fs.unlinkSync(plain); }catch(e){}
+    try{ fs.unlinkSync(tracked); }catch(e){}
+}
+process.on("exit",cleanup);
+
+// Without trackDirty a flush with no range is the whole file, in one go
+function whole(next){
+    var buff = new IPCBuffer(BUFFSIZE,plain);
+    buff.write("start",0);
+    buff.write("far",FAR);
+    buff.flushSync();
+    if(flushed() !== 1) fail("flushSync of the whole file wrote "+ranges+" ranges");
+    if(ondisk(plain,0,5) !== "start" || ondisk(plain,FAR,3) !== "far") fail("flushSync didn't reach the file");
+
+    buff.write("again",0);
+    buff.flush(function(err){
+	if(err) fail(err);
+	if(flushed() !== 1) fail("flush of the whole file wrote "+ranges+" ranges");
+	if(ondisk(plain,0,5) !== "again") fail("flush didn't reach the file");
+
+	buff[10] = 65;
+	buff.flush(10,11,function(err){
+	    if(err) fail(err);
+	    if(ondisk(plain,10,1) !== "A") fail("Ranged flush didn't reach the file");
+	    console.log("Whole file flushes "+timeit()/1000+" Seconds");
+	    next();
+	});
+    });
+}
+
+// With it only what's been written since goes
+function dirty(next){
+    var buff = new IPCBuffer(BUFFSIZE,tracked,{trackDirty:true});
+    buff.flushSync();
+    flushed();
+
+    buff.write("start",0);
+    buff.write("far",FAR);
+    buff.flush(function(err){
+	if(err) fail(err);
+	if(flushed() !== 2) fail("Two dirty pages flushed as "+ranges+" ranges");
+	if(ondisk(tracked,0,5) !== "start" || ondisk(tracked,FAR,3) !== "far") fail("Dirty pages didn't reach the file");
+
+	buff.flushSync();
+	if(flushed() !== 0) fail("Nothing written and still flushed "+ranges+" ranges");
+
+	// Plain indexing isn't seen, until it's marked
+	buff[FAR] = 70;
+	buff.flushSync();
+	if(flushed() !== 0) fail("Saw a write it can't have");
+	buff.markDirty(FAR,FAR+1);
+	buff.flushSync();
+	if(flushed() !== 1) fail("Marked page flushed as "+ranges+" ranges");
+	if(ondisk(tracked,FAR,3) !== "Far") fail("Marked page didn't reach the file");
+
+	// A slice marks where it is in the parent, the atomics mark themselves
+	var slice = buff.slice(FAR,FAR+16);
+	slice[0] = 102;
+	slice.markDirty();
+	buff.fetchAdd(16,1);
+	buff.flushSync();
+	if(flushed() !== 2) fail("Slice and atomic flushed as "+ranges+" ranges");
+	if(ondisk(tracked,FAR,3) !== "far") fail("Slice's page didn't reach the file");
+	console.log("Dirty page flushes "+timeit()/1000+" Seconds");
+	next();
+    });
+}
+
+// Anything that isn't a file has nothing to flush, but still calls back
+function nofile(){
+    var buff = new IPCBuffer(4096,"*Flushy");
+    buff.flushSync();
+    buff.flush(function(err){
+	if(err) fail(err);
+	console.log("Flushing a segment that isn't a file calls back");
+    });
+}
+
+whole(function(){ dirty(nofile); });
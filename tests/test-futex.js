@@ -0,0 +1,110 @@
+
+var spawn = require("child_process").spawn;
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var ROUNDS = 1000;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+// Ping pong through the int32 at 0: the parent sets it odd and wakes the
+// child, the child sets it even and wakes the parent. Neither polls.
+function parent(){
+    var buff = new IPCBuffer(4096,"*Futexy");
+    var round = 0;
+    buff.store(0,0);
+
+    // Only inside the Buffer asked, not wherever in its parent
+    var slice = buff.slice(64,128);
+    [-4,64,62].forEach(function(offset){
+	try{
+	    slice.notify(offset);
+	    fail("notify at "+offset+" of a 64 byte slice");
+	}catch(e){
+	    if(!(e instanceof RangeError)) throw e;
+	}
+	try{
+	    slice.waitSync(offset,0,0);
+	    fail("waitSync at "+offset+" of a 64 byte slice");
+	}catch(e){
+	    if(!(e instanceof RangeError)) throw e;
+	}
+    });
+
+    // Nothing changes it, so this has to time out, and not for 50ms slices
+    var started = new Date();
+    buff.wait(4,0,200,function(err,result){
+	if(err) fail(err);
+	if(result !== "timed-out") fail("Untouched wait gave "+result);
+	if(new Date() - started < 190) fail("Wait timed out early");
+	if(buff.waitSync(4,1) !== "not-equal") fail("waitSync on a changed value");
+
+	var proc = spawn("node",[__filename,"child"]);
+	proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+	proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+	proc.on("exit",function(code){console.log("Child exited "+(code ? "with "+code : "OK"))});
+	timeit();
+	ping();
+    });
+
+    function ping(){
+	if(round === ROUNDS){
+	    console.log(ROUNDS+" round trips "+timeit()/1000+" Seconds");
+	    buff.store(0,-1);
+	    buff.notify(0);
+	    return;
+	}
+	buff.store(0,round*2+1);
+	buff.notify(0);
+	answer();
+    }
+
+    function answer(){
+	buff.wait(0,round*2+1,function(err,result){
+	    if(err) fail(err);
+	    var value = buff.load(0);
+	    if(value === round*2+1) return answer();	// Woken for nothing
+	    if(value !== round*2+2) fail("Round "+round+" read "+value);
+	    round++;
+	    ping();
+	});
+    }
+}
+
+function child(){
+    var buff = new IPCBuffer(4096,"*Futexy");
+    var seen = 0;
+
+    function pong(){
+	buff.wait(0,seen,function(err,result){
+	    if(err) fail(err);
+	    var value = buff.load(0);
+	    if(value === -1){
+		console.log("Answered "+seen/2+" rounds");
+		return;
+	    }
+	    if(value === seen) return pong();	// Woken for nothing
+	    if(value !== seen+1) fail("Expected "+(seen+1)+" read "+value);
+	    seen = value+1;
+	    buff.store(0,seen);
+	    buff.notify(0);
+	    pong();
+	});
+    }
+    pong();
+}
+
+if(process.argv[2] === "child"){
+    child();
+}else{
+    parent();
+}
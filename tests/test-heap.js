@@ -0,0 +1,97 @@
+
+var spawn = require("child_process").spawn;
+var ipc = require("../lib/ipcbuffer");
+
+var HEAPSIZE = 1024*1024;
+var BLOCKS = 200;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function fillblock(heap,at,size,value){
+    var view = heap.view(at,size), i;
+    for(i = 0;i < size;i++) view[i] = value;
+}
+
+function testblock(heap,at,size,value,name){
+    var view = heap.view(at,size), i;
+    for(i = 0;i < size;i++){
+	if(view[i] !== value) fail(name+" block at "+at+" byte "+i+" is "+view[i]);
+    }
+}
+
+// Blocks are offsets, so they mean the same in every process. The offsets
+// go from one to the other in a second little buffer.
+function parent(){
+    var heap = new ipc.Heap(HEAPSIZE,"*Heapy");
+    var index = new ipc.Buffer(4096,"*Heapidx");
+    var i, at;
+    console.log("Heap of "+HEAPSIZE+" bytes created "+timeit()/1000+" Seconds");
+
+    if(heap.alloc(HEAPSIZE*2) !== null) fail("Allocated more than the heap");
+    at = heap.alloc(100);
+    if(heap.view(at).length < 100) fail("Block smaller than asked for");
+    heap.free(at);
+    var top = heap.used();
+    if(heap.alloc(100) !== at || heap.used() !== top) fail("Freed block not reused");
+    heap.free(at);
+
+    for(i = 0;i < BLOCKS;i++){
+	at = heap.alloc(16+i*8);
+	if(at === null) fail("Heap full at block "+i);
+	fillblock(heap,at,16+i*8,i&255);
+	index.writeUInt32LE(at,i*4);
+    }
+    console.log("Allocated "+BLOCKS+" blocks "+timeit()/1000+" Seconds");
+
+    var proc = spawn("node",[__filename,"child"]);
+    proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+    proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+    proc.on("exit",function(code){
+	if(code) fail("Child exited with "+code);
+	// The child freed the even ones and made new ones, none of which
+	// may have landed on an odd one
+	for(i = 1;i < BLOCKS;i += 2){
+	    testblock(heap,index.readUInt32LE(i*4),16+i*8,i&255,"Parent's");
+	}
+	for(i = 0;i < BLOCKS/2;i++){
+	    testblock(heap,index.readUInt32LE((BLOCKS+i)*4),64,0xAA,"Child's");
+	}
+	console.log("Blocks intact after the child "+timeit()/1000+" Seconds");
+    });
+}
+
+function child(){
+    var heap = new ipc.Heap(HEAPSIZE,"*Heapy");
+    var index = new ipc.Buffer(4096,"*Heapidx");
+    var i, at;
+
+    for(i = 0;i < BLOCKS;i++){
+	testblock(heap,index.readUInt32LE(i*4),16+i*8,i&255,"Parent's");
+    }
+    for(i = 0;i < BLOCKS;i += 2){
+	heap.free(index.readUInt32LE(i*4));
+    }
+    for(i = 0;i < BLOCKS/2;i++){
+	at = heap.alloc(64);
+	if(at === null) fail("Heap full in the child at "+i);
+	fillblock(heap,at,64,0xAA);
+	index.writeUInt32LE(at,(BLOCKS+i)*4);
+    }
+    console.log("Checked, freed and reallocated "+timeit()/1000+" Seconds");
+}
+
+if(process.argv[2] === "child"){
+    child();
+}else{
+    parent();
+}
@@ -0,0 +1,103 @@
+
+var fs = require("fs");
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BUFFSIZE = 8*1024*1024;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function pattern(buff){
+    for(var i = 0;i < buff.length;i += 4096) buff[i] = (i >> 12) & 255;
+}
+
+function testpattern(buff,what){
+    for(var i = 0;i < buff.length;i += 4096){
+	if(buff[i] !== ((i >> 12) & 255)) fail(what+" page "+(i >> 12)+" is "+buff[i]);
+    }
+}
+
+// What the kernel has going, to know whether "require" has to work or
+// has to throw
+function meminfo(name){
+    try{
+	var m = fs.readFileSync("/proc/meminfo","ascii").match(new RegExp(name+":\\s*(\\d+)"));
+	return m ? +m[1] : 0;
+    }catch(e){
+	return 0;
+    }
+}
+var hugeSize = meminfo("Hugepagesize")*1024;
+var hugeFree = meminfo("HugePages_Free");
+var base = IPCBuffer.prototype.PageSize;
+console.log("Pages are "+base+", huge ones "+hugeSize+" and "+hugeFree+" free");
+
+// Whatever it got, the length is what was asked, the mapping whole pages of
+// what it says it got, and the memory all there
+function check(buff,what){
+    var stats = buff.stats();
+    if(buff.length !== BUFFSIZE) fail(what+" is "+buff.length+" bytes");
+    if(buff.PageSize !== stats.pageSize) fail(what+" PageSize "+buff.PageSize+" but stats say "+stats.pageSize);
+    if(stats.pageSize !== base && stats.pageSize !== hugeSize &&
+       stats.backing !== "anon" && stats.backing !== "heap") fail(what+" got "+stats.pageSize+" byte pages");
+    if(stats.mapped % stats.pageSize || stats.mapped < BUFFSIZE) fail(what+" mapped "+stats.mapped+" bytes of "+stats.pageSize+" byte pages");
+    pattern(buff);
+    testpattern(buff,what);
+    return stats;
+}
+
+// Settling for less is fine with true and "transparent"
+var tried = check(new IPCBuffer(BUFFSIZE,{hugePages:true}),"In process, hugePages true");
+var shared = check(new IPCBuffer(BUFFSIZE,"*Hugey"+process.pid,{hugePages:true}),"Shared, hugePages true");
+check(new IPCBuffer(BUFFSIZE,{hugePages:"transparent"}),"Transparent");
+console.log("In process got "+tried.pageSize+", shared "+shared.pageSize+" "+timeit()/1000+" Seconds");
+
+// "require" gets the real thing or throws, never anything in between.
+// What's free now, the ones above may have taken some.
+hugeFree = meminfo("HugePages_Free");
+var enough = hugeSize && hugeFree*hugeSize >= 2*BUFFSIZE;
+try{
+    var required = check(new IPCBuffer(BUFFSIZE,{hugePages:"require"}),"Required");
+    if(!enough) fail("Required huge pages the kernel doesn't have");
+    if(required.pageSize !== hugeSize) fail("Required huge pages and got "+required.pageSize);
+    console.log("Required huge pages "+timeit()/1000+" Seconds");
+}catch(e){
+    if(enough) fail("Required huge pages with "+hugeFree+" free: "+e.message);
+    console.log("Require throws without huge pages "+timeit()/1000+" Seconds");
+}
+
+// A System V key keeps the pages it was made with, whatever whoever
+// attaches later asks for
+var key = 0x48500000 + (process.pid & 0xffff);
+var plain = new IPCBuffer(BUFFSIZE,key);
+if(plain.stats().pageSize !== base) fail("Plain System V segment has "+plain.stats().pageSize+" byte pages");
+pattern(plain);
+// Asking for them here only gets transparent ones, if that
+var asked = new IPCBuffer(BUFFSIZE,key,{hugePages:true});
+testpattern(asked,"Plain key attached asking for huge pages");
+if(asked.stats().mapped % asked.stats().pageSize) fail("Plain key attached asking for huge pages mapped "+asked.stats().mapped);
+try{
+    new IPCBuffer(BUFFSIZE,key,{hugePages:"require"});
+    fail("Required huge pages on a plain key");
+}catch(e){}
+
+if(enough){
+    var hugeKey = key + 0x10000;
+    var made = new IPCBuffer(BUFFSIZE,hugeKey,{hugePages:"require"});
+    if(made.stats().pageSize !== hugeSize) fail("Huge System V segment has "+made.stats().pageSize+" byte pages");
+    pattern(made);
+    var attached = new IPCBuffer(BUFFSIZE,hugeKey);
+    check(attached,"Huge key attached");
+    if(attached.stats().pageSize !== hugeSize) fail("Attaching to a huge key without asking found "+attached.stats().pageSize+" byte pages");
+    if(attached.stats().mapped % hugeSize) fail("Attaching to a huge key mapped "+attached.stats().mapped);
+}
+console.log("System V keys keep their pages "+timeit()/1000+" Seconds");
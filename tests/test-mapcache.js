@@ -0,0 +1,117 @@
+
+var fs = require("fs");
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BUFFSIZE = 1024*1024;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function pattern(buff,add){
+    for(var i = 0;i < buff.length;i += 1000) buff[i] = (i + add) & 255;
+}
+
+function testpattern(buff,add,what){
+    for(var i = 0;i < buff.length;i += 1000){
+	if(buff[i] !== ((i + add) & 255)) fail(what+" byte "+i+" is "+buff[i]);
+    }
+}
+
+// What opening or resizing did to the process's mappings and views
+function counted(before,mappings,views,what){
+    var now = IPCBuffer.stats();
+    if(now.mappings - before.mappings !== mappings || now.views - before.views !== views){
+	fail(what+" made "+(now.mappings-before.mappings)+" mappings and "+(now.views-before.views)+" views, not "+mappings+" and "+views);
+    }
+    return now;
+}
+
+var name = "*Mapcachy"+process.pid;
+var path = "/tmp/ipcbuffer-mapcache-"+process.pid;
+process.on("exit",function(){
+    try{ fs.unlinkSync(path); }catch(e){}
+});
+
+// A second open of the same name, length and hugePages is a view of the
+// first's mapping, the same memory, not another mapping
+var before = IPCBuffer.stats();
+var first = new IPCBuffer(BUFFSIZE,name);
+before = counted(before,1,1,"The first open");
+var reused = IPCBuffer.stats().backings.shm.reused;
+var second = new IPCBuffer(BUFFSIZE,name);
+before = counted(before,0,1,"A second open");
+if(IPCBuffer.stats().backings.shm.reused !== reused+1) fail("Second open wasn't counted as reused");
+if(first.stats().views !== 2 || second.stats().views !== 2) fail("Views of a shared mapping are "+first.stats().views+" and "+second.stats().views);
+pattern(first,0);
+testpattern(second,0,"Second open");
+var third = new IPCBuffer(BUFFSIZE,name);
+before = counted(before,0,1,"A third open");
+if(first.stats().views !== 3) fail("Three opens have "+first.stats().views+" views");
+console.log("Opens of one name share a mapping "+timeit()/1000+" Seconds");
+
+// Anything that changes what the mapping looks like gets one of its own
+var longer = new IPCBuffer(2*BUFFSIZE,name);
+before = counted(before,1,1,"A longer open");
+if(longer.stats().views !== 1) fail("Longer open shares with "+longer.stats().views);
+var huge = new IPCBuffer(BUFFSIZE,name,{hugePages:"transparent"});
+before = counted(before,1,1,"An open with other hugePages");
+var other = new IPCBuffer(BUFFSIZE,name+"other");
+before = counted(before,1,1,"Another name");
+if(first.stats().views !== 3) fail("Opens that didn't share changed the views to "+first.stats().views);
+console.log("Other lengths, huge pages and names don't "+timeit()/1000+" Seconds");
+
+// Resizing one view moves it to a mapping of its own and leaves the others
+// where they were, the same length and the same memory
+second.resize(2*BUFFSIZE);
+before = counted(before,1,0,"Resizing a shared view");
+if(second.stats().views !== 1) fail("Resized view still shares with "+second.stats().views);
+if(first.stats().views !== 2 || third.stats().views !== 2) fail("Left behind views are "+first.stats().views+" and "+third.stats().views);
+if(first.length !== BUFFSIZE || third.length !== BUFFSIZE) fail("Resizing one view changed the others' length");
+testpattern(second.slice(0,BUFFSIZE),0,"Resized view");
+pattern(first,1);
+testpattern(third,1,"Left behind view");
+testpattern(second.slice(0,BUFFSIZE),1,"Resized view after a write through another");
+
+// And the next open at the new length shares the resized one
+var fourth = new IPCBuffer(2*BUFFSIZE,name);
+before = counted(before,0,1,"An open at the resized length");
+if(fourth.stats().views !== 2 || second.stats().views !== 2) fail("Open at the resized length has "+fourth.stats().views+" views");
+console.log("Resizing while shared "+timeit()/1000+" Seconds");
+
+// Files too, until the file's replaced by another, which isn't the same
+// thing any more
+var b = new Buffer(BUFFSIZE);
+b.fill(7);
+fs.writeFileSync(path,b);
+var file = new IPCBuffer(BUFFSIZE,path);
+var again = new IPCBuffer(BUFFSIZE,path);
+before = counted(before,1,2,"Opening a file twice");
+fs.unlinkSync(path);
+b.fill(9);
+fs.writeFileSync(path,b);
+var replaced = new IPCBuffer(BUFFSIZE,path);
+before = counted(before,1,1,"Opening a replaced file");
+if(replaced[0] !== 9 || file[0] !== 7) fail("Replaced file shared the old mapping");
+console.log("Files "+timeit()/1000+" Seconds");
+
+// Letting go of views only unmaps with the last one, which needs the
+// collector to say they've gone
+if(typeof(gc) === "function"){
+    again = longer = huge = other = replaced = fourth = null;
+    gc();
+    var now = IPCBuffer.stats();
+    if(first.stats().views !== 2) fail("A collection changed the views of a mapping still in use");
+    if(second.stats().views !== 1) fail("Collected view still counted");
+    if(now.mappings !== before.mappings - 4) fail("Collecting left "+(now.mappings-before.mappings+4)+" mappings that should have gone");
+    testpattern(first,1,"After collecting the others");
+    console.log("Last view unmaps "+timeit()/1000+" Seconds");
+}
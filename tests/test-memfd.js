@@ -0,0 +1,140 @@
+
+var spawn = require("child_process").spawn;
+var net = require("net");
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BUFFSIZE = 64*1024;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function letters(buff){
+    for(var i = 0;i < buff.length;i++) buff[i] = 97 + i % 26;
+}
+
+function testletters(buff,what){
+    for(var i = 0;i < buff.length;i++){
+	if(buff[i] !== 97 + i % 26) fail(what+" byte "+i+" is "+buff[i]);
+    }
+}
+
+// Every native write into a sealed segment throws, none of them get as far
+// as the read only mapping and a segfault. Indexed writes can't be tested,
+// they do segfault.
+function sealedWrites(sealed,other){
+    var writes = {
+	"write":function(){ sealed.write("xyz",0); },
+	"write ascii":function(){ sealed.write("xyz",0,"ascii"); },
+	"write binary":function(){ sealed.write("xyz",0,"binary"); },
+	"write base64":function(){ sealed.write("eHl6",0,"base64"); },
+	"writeMany":function(){ sealed.writeMany([["xyz",0],["xyz",3]]); },
+	"fill":function(){ sealed.fill(0x55,0,10); },
+	"writeUInt32LE":function(){ sealed.writeUInt32LE(1,0); },
+	"writeDoubleBE":function(){ sealed.writeDoubleBE(1.5,8); },
+	"writeArray":function(){ sealed.writeArray("UInt16LE",0,[1,2,3]); },
+	"copy into it":function(){ other.copy(sealed,0,0,10); },
+	"copy into a slice of it":function(){ other.copy(sealed.slice(100,200),0,0,10); },
+	"copyAsync into it":function(){ other.copyAsync(sealed,0,0,10,function(){ fail("copyAsync into a sealed segment called back"); }); },
+	"store":function(){ sealed.store(0,1); },
+	"store 64":function(){ sealed.store(8,1,64); },
+	"exchange":function(){ sealed.exchange(0,1); },
+	"fetchAdd":function(){ sealed.fetchAdd(0,1); },
+	"fetchOr":function(){ sealed.fetchOr(0,1); },
+	"compareExchange":function(){ sealed.compareExchange(0,sealed.load(0),1); }
+    };
+    for(var what in writes){
+	try{
+	    writes[what]();
+	    fail(what+" into a sealed segment didn't throw");
+	}catch(e){
+	    if(!/sealed read only/.test(e.message)) fail(what+" into a sealed segment threw "+e.message);
+	}
+    }
+    testletters(sealed,"After writes that threw");
+
+    // Reading it and copying out of it are fine
+    sealed.copy(other,0,0,26);
+    if(other.toString("ascii",0,26) !== "abcdefghijklmnopqrstuvwxyz") fail("Copying out of a sealed segment");
+    sealed.load(0);
+    letters(other);
+    console.log("Writes to a sealed segment throw "+timeit()/1000+" Seconds");
+}
+
+// Two segments go to the child: one inherited when it's spawned and
+// attached with {fd:n}, the other sealed read only and sent down a unix
+// socket once it's running
+function parent(){
+    var inherited = new IPCBuffer(BUFFSIZE,"&inherited");
+    var sent = new IPCBuffer(BUFFSIZE,"&sent");
+    var path = "/tmp/ipcbuffer-test-"+process.pid+".sock";
+    console.log("Made two memfd segments "+timeit()/1000+" Seconds");
+
+    letters(inherited);
+    inherited.seal();
+    if(inherited.isSealed()) fail("Sealed read only without being asked");
+    try{
+	inherited.resize(BUFFSIZE*2);
+	fail("Resized a sealed segment");
+    }catch(e){}
+
+    letters(sent);
+    sent.seal(true);
+    if(!sent.isSealed()) fail("Not sealed read only");
+    if(sent.sharedString(0,26) !== "abcdefghijklmnopqrstuvwxyz") fail("sharedString");
+    sent.seal();
+    if(!sent.isSealed()) fail("Sealing again undid read only");
+    sealedWrites(sent,inherited);
+
+    var server = net.createServer(function(socket){
+	sent.sendFd(socket._handle.fd);
+	socket.on("end",function(){socket.end()});
+    });
+    server.listen(path,function(){
+	var proc = spawn("node",[__filename,"child",inherited.fd(true),path]);
+	proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+	proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+	proc.on("exit",function(code){
+	    server.close();
+	    if(code) fail("Child exited with "+code);
+	    for(var i = 0;i < 100;i++){
+		if(inherited[i] !== 0x55) fail("Child's write didn't show at "+i);
+	    }
+	    console.log("Child wrote to the inherited segment "+timeit()/1000+" Seconds");
+	});
+    });
+}
+
+function child(fd,path){
+    var inherited = new IPCBuffer(0,{fd:fd});
+    if(inherited.length !== BUFFSIZE) fail("Inherited "+inherited.length+" bytes");
+    testletters(inherited,"Inherited");
+    inherited.fill(0x55,0,100);
+
+    var socket = net.createConnection(path,function(){
+	IPCBuffer.receive(socket,function(err,sent){
+	    if(err) fail(err);
+	    if(sent.length !== BUFFSIZE) fail("Received "+sent.length+" bytes");
+	    testletters(sent,"Received");
+	    if(!sent.isSealed()) fail("Received segment isn't read only");
+	    if(sent.sharedString(26,52) !== "abcdefghijklmnopqrstuvwxyz") fail("sharedString in the child");
+	    sealedWrites(sent,inherited.slice(200,300));
+	    console.log("Received a sealed segment "+timeit()/1000+" Seconds");
+	    socket.end();
+	});
+    });
+}
+
+if(process.argv[2] === "child"){
+    child(+process.argv[3],process.argv[4]);
+}else{
+    parent();
+}
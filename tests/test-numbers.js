@@ -0,0 +1,122 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function same(a,b){
+    return a === b ? (a !== 0 || 1/a === 1/b) : (a !== a && b !== b);
+}
+
+// Every type, a value, and the bytes it has to come out as
+var vectors = [
+    ["UInt8",200,[0xc8]],
+    ["Int8",-2,[0xfe]],
+    ["UInt16LE",0x1234,[0x34,0x12]],
+    ["UInt16BE",0x1234,[0x12,0x34]],
+    ["Int16LE",-2,[0xfe,0xff]],
+    ["Int16BE",-2,[0xff,0xfe]],
+    ["UInt32LE",0xdeadbeef,[0xef,0xbe,0xad,0xde]],
+    ["UInt32BE",0xdeadbeef,[0xde,0xad,0xbe,0xef]],
+    ["Int32LE",-2,[0xfe,0xff,0xff,0xff]],
+    ["Int32BE",-0x789abcdf,[0x87,0x65,0x43,0x21]],
+    ["UInt64LE",Math.pow(2,53)-1,[0xff,0xff,0xff,0xff,0xff,0xff,0x1f,0x00]],
+    ["UInt64BE",0x123456789abc,[0x00,0x00,0x12,0x34,0x56,0x78,0x9a,0xbc]],
+    ["Int64LE",-2,[0xfe,0xff,0xff,0xff,0xff,0xff,0xff,0xff]],
+    ["Int64BE",-(Math.pow(2,53)-1),[0xff,0xe0,0x00,0x00,0x00,0x00,0x00,0x01]],
+    ["FloatLE",1.5,[0x00,0x00,0xc0,0x3f]],
+    ["FloatBE",-2.5,[0xc0,0x20,0x00,0x00]],
+    ["DoubleLE",1.5,[0x00,0x00,0x00,0x00,0x00,0x00,0xf8,0x3f]],
+    ["DoubleBE",-0.1,[0xbf,0xb9,0x99,0x99,0x99,0x99,0x99,0x9a]]
+];
+
+var buff = new IPCBuffer(4096);
+var i, j, at = 3;	// Nothing lines up
+
+for(i = 0;i < vectors.length;i++){
+    var name = vectors[i][0], value = vectors[i][1], bytes = vectors[i][2];
+    if(IPCBuffer.numberTypes.indexOf(name) < 0) fail(name+" missing from numberTypes");
+    buff.fill(0x55,0,32);
+    if(buff["write"+name](value,at) !== at+bytes.length) fail("write"+name+" returned the wrong offset");
+    for(j = 0;j < bytes.length;j++){
+	if(buff[at+j] !== bytes[j]) fail("write"+name+" byte "+j+" is "+buff[at+j].toString(16));
+    }
+    if(buff[at-1] !== 0x55 || buff[at+bytes.length] !== 0x55) fail("write"+name+" wrote outside its bytes");
+    if(!same(buff["read"+name](at),value)) fail("read"+name+" gave "+buff["read"+name](at));
+    try{
+	buff["read"+name](buff.length-bytes.length+1);
+	fail("read"+name+" off the end");
+    }catch(e){
+	if(!(e instanceof RangeError)) throw e;
+    }
+}
+if(IPCBuffer.numberTypes.length !== vectors.length) fail("numberTypes has "+IPCBuffer.numberTypes.length+" types");
+console.log("Known bytes for every type "+timeit()/1000+" Seconds");
+
+// The awkward doubles survive the trip
+var doubles = [0,-0,NaN,Infinity,-Infinity,Number.MIN_VALUE,Number.MAX_VALUE];
+for(i = 0;i < doubles.length;i++){
+    buff.writeDoubleBE(doubles[i],at);
+    if(!same(buff.readDoubleBE(at),doubles[i])) fail("DoubleBE "+doubles[i]);
+    buff.writeDoubleLE(doubles[i],at);
+    if(!same(buff.readDoubleLE(at),doubles[i])) fail("DoubleLE "+doubles[i]);
+}
+buff.writeFloatLE(0.1,at);
+if(buff.readFloatLE(at) === 0.1 || Math.abs(buff.readFloatLE(at)-0.1) > 1e-8) fail("Float rounding");
+
+// Arrays, typed where there's a typed array for it and plain otherwise
+var values = [1,-2,300,-32768,32767];
+if(buff.writeArray("Int16BE",at,values) !== at+values.length*2) fail("writeArray returned the wrong offset");
+for(i = 0;i < values.length;i++){
+    if(buff.readInt16BE(at+i*2) !== values[i]) fail("writeArray value "+i+" is "+buff.readInt16BE(at+i*2));
+}
+var back = buff.readArray("Int16BE",at,values.length);
+if(back.length !== values.length) fail("readArray gave "+back.length+" values");
+for(i = 0;i < values.length;i++){
+    if(back[i] !== values[i]) fail("readArray value "+i+" is "+back[i]);
+}
+if(typeof(Int16Array) !== "undefined" && !(back instanceof Int16Array)) fail("readArray of Int16 isn't an Int16Array");
+
+var into = [0,0,0];
+if(buff.readArray("Int16BE",at+2,into) !== into || into[0] !== -2 || into[2] !== -32768) fail("readArray into an array");
+
+var big = [Math.pow(2,40),-1,0];
+buff.writeArray("Int64LE",at,big);
+back = buff.readArray("Int64LE",at,3);
+if(!Array.isArray(back) || back[0] !== big[0] || back[1] !== -1 || back[2] !== 0) fail("Int64LE arrays");
+
+var floats = [0.5,-1.25,1e300];
+buff.writeArray("DoubleLE",at,floats);
+back = buff.readArray("DoubleLE",at,3);
+for(i = 0;i < floats.length;i++){
+    if(back[i] !== floats[i]) fail("DoubleLE array value "+i+" is "+back[i]);
+}
+
+try{
+    buff.writeArray("UInt32LE",buff.length-8,[1,2,3]);
+    fail("writeArray off the end");
+}catch(e){
+    if(!(e instanceof RangeError)) throw e;
+}
+try{
+    buff.readArray("UInt128LE",0,1);
+    fail("Read a type there isn't");
+}catch(e){
+    if(!(e instanceof TypeError)) throw e;
+}
+
+// And through a slice, which has its own offset in the parent
+var slice = buff.slice(100,200);
+slice.writeUInt32BE(0x01020304,1);
+if(buff.readUInt32BE(101) !== 0x01020304 || slice.readUInt32LE(1) !== 0x04030201) fail("Slice offsets");
+if(slice.writeArray("UInt8",0,[9,8,7]) !== 3 || buff[100] !== 9) fail("Slice writeArray");
+console.log("Arrays and slices "+timeit()/1000+" Seconds");
@@ -0,0 +1,115 @@
+
+var spawn = require("child_process").spawn;
+var fs = require("fs");
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BUFFSIZE = 4*1024*1024;
+var OPENS = 8;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function pattern(buff){
+    for(var i = 0;i < buff.length;i += 4096) buff[i] = (i >> 12) & 255;
+}
+
+function testpattern(buff,what){
+    for(var i = 0;i < buff.length;i += 4096){
+	if(buff[i] !== ((i >> 12) & 255)) fail(what+" page "+(i >> 12)+" is "+buff[i]);
+    }
+}
+
+var path = "/tmp/ipcbuffer-open-"+process.pid;
+process.on("exit",function(){
+    try{ fs.unlinkSync(path); }catch(e){}
+});
+
+// The parent opens a segment without blocking and fills it, then the child
+// opens it lots of times at once, which all have to end up on one mapping
+function parent(){
+    var sync = true;
+
+    // Errors only ever come through the callback, and never before open returns
+    IPCBuffer.open(BUFFSIZE,"/nonexistent/directory/file",function(err,buff){
+	if(sync) fail("Called back before open returned");
+	if(!err || buff) fail("Opening a file that can't be made worked");
+    });
+    IPCBuffer.open(-1,"*Openy",function(err,buff){
+	if(sync) fail("Bad arguments called back before open returned");
+	if(!err || buff) fail("Opening with a bad length worked");
+    });
+    sync = false;
+
+    IPCBuffer.open(BUFFSIZE,"*Openy",{populate:true},function(err,buff){
+	if(err) fail(err);
+	if(buff.length !== BUFFSIZE) fail("Opened "+buff.length+" bytes");
+	console.log("Opened "+BUFFSIZE+" bytes "+timeit()/1000+" Seconds");
+	pattern(buff);
+
+	var proc = spawn("node",[__filename,"child"]);
+	proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+	proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+	proc.on("exit",function(code){
+	    if(code) fail("Child exited with "+code);
+	    if(buff.readUInt32LE(0) !== OPENS) fail("Child's opens wrote "+buff.readUInt32LE(0));
+	    file();
+	});
+    });
+
+    // A file keeps what was in it
+    function file(){
+	var b = new Buffer(BUFFSIZE);
+	pattern(b);
+	fs.writeFileSync(path,b);
+	IPCBuffer.open(BUFFSIZE,path,function(err,buff){
+	    if(err) fail(err);
+	    testpattern(buff,"File");
+	    console.log("Opened a file "+timeit()/1000+" Seconds");
+	    if(typeof(Promise) === "function") promised();
+	});
+    }
+
+    function promised(){
+	IPCBuffer.open(4096,"*Openpromise").then(function(buff){
+	    if(buff.length !== 4096) fail("Promised "+buff.length+" bytes");
+	    return IPCBuffer.open(4096,"/nonexistent/directory/file");
+	}).then(function(){
+	    fail("Promise of a file that can't be made resolved");
+	},function(err){
+	    console.log("Promises resolve and reject");
+	});
+    }
+}
+
+function child(){
+    var opened = 0, i, buffs = [];
+
+    for(i = 0;i < OPENS;i++){
+	IPCBuffer.open(BUFFSIZE,"*Openy",function(err,buff){
+	    if(err) fail(err);
+	    testpattern(buff,"Opened at once");
+	    buffs.push(buff);
+	    if(++opened < OPENS) return;
+	    var views = buff.stats().views;
+	    if(views !== OPENS) fail(OPENS+" opens at once share "+views+" views");
+	    buffs[0].writeUInt32LE(OPENS,0);
+	    if(buffs[OPENS-1].readUInt32LE(0) !== OPENS) fail("Opens at once aren't the same memory");
+	    console.log(OPENS+" opens at once on one mapping "+timeit()/1000+" Seconds");
+	});
+    }
+}
+
+if(process.argv[2] === "child"){
+    child();
+}else{
+    parent();
+}
@@ -0,0 +1,126 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+// Four classes to each power of two from 64 bytes up: 64, 80, 96, 112,
+// 128, 160 and so on
+function classSize(n){
+    for(var e = 4;;e++){
+	for(var m = 4;m < 8;m++){
+	    if(m << e >= n) return m << e;
+	}
+    }
+}
+
+// The stats that moved between two poolStats()
+function moved(before,after){
+    var d = {};
+    for(var k in after) d[k] = after[k] - before[k];
+    return d;
+}
+
+// Everything made here is kept, so no collection frees anything behind
+// the test's back and every count below is only what the test did
+var keep = [];
+var MAX_BLOCK = 1024*1024;
+IPCBuffer.pool({cache:16*1024*1024,maxBlock:MAX_BLOCK});
+var stats = IPCBuffer.poolStats();
+if(stats.cacheBytes !== 16*1024*1024 || stats.maxBlock !== MAX_BLOCK) fail("pool() didn't take: "+JSON.stringify(stats));
+
+// Bigger than the slab, so each has a block of its own, rounded up to its
+// class. Past maxBlock it's exactly what was asked.
+var lengths = [8193,9000,10240,10241,12287,16384,16385,100000,MAX_BLOCK-1,MAX_BLOCK,MAX_BLOCK+1,3*MAX_BLOCK+7];
+for(var i = 0;i < lengths.length;i++){
+    var before = IPCBuffer.poolStats();
+    var b = new IPCBuffer(lengths[i]);
+    keep.push(b);
+    var want = lengths[i] > MAX_BLOCK ? lengths[i] : classSize(lengths[i]);
+    if(b.length !== lengths[i]) fail(lengths[i]+" bytes came out "+b.length);
+    if(b.stats().mapped !== want) fail(lengths[i]+" bytes got a "+b.stats().mapped+" byte block, not "+want);
+    if(moved(before,IPCBuffer.poolStats()).allocs !== 1) fail(lengths[i]+" bytes wasn't one allocation");
+    b.fill(0x55);
+}
+console.log("Size classes "+timeit()/1000+" Seconds");
+
+// Outgrowing its block frees it to the class's list, and the next buffer
+// of that class gets it back
+var grown = new IPCBuffer(9000);
+keep.push(grown);
+var block = grown.stats().mapped;
+var before = IPCBuffer.poolStats();
+grown.resize(block+1);
+var d = moved(before,IPCBuffer.poolStats());
+if(d.frees !== 1 || d.released !== 0 || d.cached !== block || d.cachedBlocks !== 1) fail("Freeing a "+block+" byte block: "+JSON.stringify(d));
+
+before = IPCBuffer.poolStats();
+var again = new IPCBuffer(block-100);
+keep.push(again);
+d = moved(before,IPCBuffer.poolStats());
+if(d.allocs !== 1 || d.reused !== 1 || d.cached !== -block || d.cachedBlocks !== -1) fail("Reusing a "+block+" byte block: "+JSON.stringify(d));
+if(again.stats().mapped !== block) fail("Reused block is "+again.stats().mapped+" bytes");
+again.fill(0);
+for(i = 0;i < again.length;i += 97){
+    if(again[i] !== 0) fail("Reused block byte "+i+" is "+again[i]);
+}
+
+// A different class doesn't get it
+grown.resize(classSize(block+1)+1);
+before = IPCBuffer.poolStats();
+keep.push(new IPCBuffer(classSize(block+1)*2));
+d = moved(before,IPCBuffer.poolStats());
+if(d.reused !== 0) fail("A bigger class reused a smaller block");
+console.log("Freeing and reusing "+timeit()/1000+" Seconds");
+
+// Past maxBlock it goes straight back to the system
+var huge = new IPCBuffer(MAX_BLOCK*2);
+keep.push(huge);
+before = IPCBuffer.poolStats();
+huge.resize(MAX_BLOCK*4);
+d = moved(before,IPCBuffer.poolStats());
+if(d.frees !== 1 || d.released !== 1 || d.cached !== 0) fail("Freeing past maxBlock: "+JSON.stringify(d));
+
+// cache:0 lets go of everything held, and anything freed after that
+IPCBuffer.pool({cache:0});
+stats = IPCBuffer.poolStats();
+if(stats.cached !== 0 || stats.cachedBlocks !== 0 || stats.cacheBytes !== 0) fail("cache:0 kept "+JSON.stringify(stats));
+var small = new IPCBuffer(20000);
+keep.push(small);
+before = IPCBuffer.poolStats();
+small.resize(classSize(20000)+1);
+d = moved(before,IPCBuffer.poolStats());
+if(d.released !== 1 || d.cached !== 0) fail("Freeing with no cache: "+JSON.stringify(d));
+if(IPCBuffer.poolStats().maxBlock !== MAX_BLOCK) fail("Setting the cache changed maxBlock");
+
+// A cache only so big doesn't keep more. All made first, or the second
+// would just take back the first's block.
+IPCBuffer.pool({cache:3*16384});
+var four = [];
+for(i = 0;i < 4;i++) four.push(new IPCBuffer(16384));
+for(i = 0;i < 4;i++) four[i].resize(16385);
+stats = IPCBuffer.poolStats();
+if(stats.cached !== 3*16384 || stats.cachedBlocks !== 3) fail("Cache of 3 blocks holds "+JSON.stringify(stats));
+console.log("Limits "+timeit()/1000+" Seconds");
+
+// The slab small Buffers share comes out of it too, at whatever size
+IPCBuffer.pool({slab:4000});
+before = IPCBuffer.poolStats();
+var tiny = new IPCBuffer(10);
+keep.push(tiny);
+if(moved(before,IPCBuffer.poolStats()).allocs !== 1) fail("A new slab wasn't allocated");
+if(tiny.stats().mapped !== classSize(4000)) fail("Slab of 4000 got a "+tiny.stats().mapped+" byte block");
+try{
+    tiny.resize(20);
+    fail("Resized a Buffer carved out of the slab");
+}catch(e){}
+console.log("Slab "+timeit()/1000+" Seconds");
@@ -0,0 +1,122 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BIG = 32*1024*1024;
+var PAGE = IPCBuffer.prototype.PageSize;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function pattern(buff,start,end){
+    for(var i = start;i < end;i += 1000) buff[i] = (i >> 10) & 255;
+}
+
+function testpattern(buff,start,end,what){
+    for(var i = start;i < end;i += 1000){
+	if(buff[i] !== ((i >> 10) & 255)) fail(what+" byte "+i+" is "+buff[i]);
+    }
+}
+
+// Whole pages, so at least the range and at most a page either side
+function resident(buff,start,end,what){
+    var got = buff.stats().resident;
+    var from = Math.floor(start/PAGE)*PAGE, to = Math.ceil(end/PAGE)*PAGE;
+    if(got < to - from) fail(what+" left "+(to-from-got)+" bytes out");
+    return got;
+}
+
+// A new segment's pages aren't there until something touches them, and
+// prefault touches them all without changing anything
+var shared = new IPCBuffer(BIG,"*Prefaulty"+process.pid);
+if(shared.stats().resident > 16*PAGE) fail("New segment already has "+shared.stats().resident+" bytes in");
+shared.prefault(5,1024*1024+5);
+resident(shared,5,1024*1024+5,"Sync prefault of a range");
+if(shared.stats().resident > 2*1024*1024) fail("Prefault of a range faulted in "+shared.stats().resident+" bytes");
+console.log("Prefaulted 1MB of a segment "+timeit()/1000+" Seconds");
+
+// Only its own range, counted from where the slice starts
+var slice = shared.slice(8*1024*1024+123,9*1024*1024);
+slice.prefault(0,slice.length);
+resident(shared,8*1024*1024+123,9*1024*1024,"Prefault through a slice");
+try{
+    slice.prefault(0,slice.length+1);
+    fail("Prefaulted past the end of a slice");
+}catch(e){}
+
+// In process memory is written to fault it in, which can't lose what's in it
+var local = new IPCBuffer(BIG);
+pattern(local,0,BIG/2);
+local.prefault();
+testpattern(local,0,BIG/2,"Prefaulted in process");
+for(var i = BIG/2;i < BIG;i += 4096){
+    if(local[i] !== 0) fail("Prefault wrote "+local[i]+" at "+i);
+}
+resident(local,PAGE,BIG-PAGE,"Whole in process prefault");
+console.log("Prefaulted "+BIG+" bytes in process "+timeit()/1000+" Seconds");
+
+// populate does the same when it's made
+var populated = new IPCBuffer(BIG,"*Populy"+process.pid,{populate:true});
+resident(populated,0,BIG,"populate");
+console.log("Populated "+BIG+" bytes "+timeit()/1000+" Seconds");
+
+// Advice, good and bad
+var advice = ["normal","sequential","random","willneed","dontneed"];
+for(i = 0;i < advice.length;i++){
+    shared.advise(advice[i]);
+    shared.advise(advice[i],PAGE+1,3*PAGE-1);
+    new IPCBuffer(BIG,{advice:advice[i]});
+}
+try{
+    shared.advise("sometimes");
+    fail("Took advice there isn't");
+}catch(e){
+    if(!(e instanceof TypeError)) throw e;
+}
+try{
+    new IPCBuffer(4096,"*Advisy"+process.pid,{advice:"sometimes"});
+    fail("Made a buffer with advice there isn't");
+}catch(e){}
+try{
+    shared.advise("normal",0,BIG+1);
+    fail("Advised past the end");
+}catch(e){}
+
+// "dontneed" leaves a shared segment as it was, and throws away the whole
+// pages of an in process one. Its memory needn't start on a page, so only
+// the middle of the range is sure to be one of them.
+pattern(shared,0,BIG);
+shared.advise("dontneed");
+testpattern(shared,0,BIG,"Shared after dontneed");
+local.fill(1);
+local.advise("dontneed",PAGE,3*PAGE);
+if(local[2*PAGE] !== 0) fail("In process dontneed kept the pages");
+if(local[PAGE-1] !== 1 || local[3*PAGE] !== 1) fail("In process dontneed went outside its range");
+console.log("Advice "+timeit()/1000+" Seconds");
+
+// On the threadpool, split across it. The buffer can't be resized till
+// it's done.
+var later = new IPCBuffer(BIG,"*Prefaultlater"+process.pid);
+later.prefault(function(err){
+    if(err) fail(err);
+    resident(later,0,BIG,"Async prefault");
+    console.log("Async prefault of "+BIG+" bytes "+timeit()/1000+" Seconds");
+
+    later.prefault(BIG/4,BIG/2,function(err){
+	if(err) fail(err);
+	later.resize(BIG/2);
+	console.log("Resized once it was done");
+    });
+});
+try{
+    later.resize(BIG/2);
+    fail("Resized while it was being prefaulted");
+}catch(e){}
@@ -0,0 +1,78 @@
+
+var spawn = require("child_process").spawn;
+var ipc = require("../lib/ipcbuffer");
+
+var QUEUESIZE = 1024*1024;
+var WORKERS = 4;
+var MESSAGES = 100000;	// Per worker
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+// Every worker enqueues its own numbered messages, the parent dequeues the
+// lot and checks each worker's came out in order and none went missing
+function consumer(){
+    var queue = new ipc.Queue(QUEUESIZE,"*Queuey");
+    var next = [], done = 0, workers = 0, i;
+    console.log("Queue of "+queue.slots+" slots created "+timeit()/1000+" Seconds");
+
+    for(i = 0;i < WORKERS;i++){
+	next[i] = 0;
+	var proc = spawn("node",[__filename,"child",i]);
+	proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+	proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+	proc.on("exit",function(code){
+	    if(code) console.log("Child exited with "+code);
+	    workers++;
+	});
+    }
+
+    function drain(){
+	var list = queue.dequeueMany(256,"utf8"), k;
+	for(k = 0;k < list.length;k++){
+	    var parts = list[k].split(":"), w = +parts[0], n = +parts[1];
+	    if(n !== next[w]){
+		process.stderr.write("Worker "+w+" out of order, wanted "+next[w]+" got "+n+"\n");
+		process.exit(1);
+	    }
+	    if(++next[w] === MESSAGES) done++;
+	}
+	if(done < WORKERS){
+	    setTimeout(drain,0);
+	}else{
+	    console.log("Dequeued "+WORKERS*MESSAGES+" messages "+timeit()/1000+" Seconds");
+	    if(queue.dequeue() !== null){
+		process.stderr.write("Queue not empty at the end\n");
+		process.exit(1);
+	    }
+	}
+    }
+    drain();
+}
+
+function producer(w){
+    var queue = new ipc.Queue(QUEUESIZE,"*Queuey");
+    var i = 0;
+
+    function fill(){
+	while(i < MESSAGES && queue.enqueue(w+":"+i)){
+	    i++;
+	}
+	if(i < MESSAGES){
+	    setTimeout(fill,0);
+	}else{
+	    console.log("Worker "+w+" enqueued "+MESSAGES+" messages "+timeit()/1000+" Seconds");
+	}
+    }
+    fill();
+}
+
+if(process.argv[2] === "child"){
+    producer(+process.argv[3]);
+}else{
+    consumer();
+}
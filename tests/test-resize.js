@@ -0,0 +1,126 @@
+
+var spawn = require("child_process").spawn;
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var SMALL = 64*1024;
+var BIG = 1024*1024;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function pattern(buff,start,end,add){
+    for(var i = start;i < end;i++) buff[i] = (i+add) & 255;
+}
+
+function testpattern(buff,start,end,add,what){
+    for(var i = start;i < end;i++){
+	if(buff[i] !== ((i+add) & 255)) fail(what+" byte "+i+" is "+buff[i]);
+    }
+}
+
+// Layout: 0 the size word, 4 the child saying it's attached. The pattern
+// starts at 8 so neither word gets in its way.
+function parent(){
+    var buff = new IPCBuffer(SMALL,"*Resizy");
+    pattern(buff,8,SMALL,0);
+    buff.store(0,SMALL);
+    buff.store(4,0);
+
+    // Throws rather than putting a length the next remap would take on a
+    // word that wouldn't survive the shrink
+    try{
+	buff.resize(2,0);
+	fail("resize let the size word fall off the end");
+    }catch(e){}
+
+    var proc = spawn("node",[__filename,"child"]);
+    proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+    proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+    proc.on("exit",function(code){
+	if(code) fail("Child exited with "+code);
+	testpattern(buff,SMALL,BIG,7,"Child's");
+	console.log("Child wrote the grown part "+timeit()/1000+" Seconds");
+	shrink();
+    });
+
+    // Resizing from the wait callback, as the child remaps from its own
+    function attached(){
+	buff.wait(4,0,function(err){
+	    if(err) fail(err);
+	    if(buff.load(4) === 0) return attached();	// Woken for nothing
+	    timeit();
+	    if(buff.resize(BIG,0) !== BIG || buff.length !== BIG) fail("Grew to "+buff.length);
+	    testpattern(buff,8,SMALL,0,"Kept");
+	    console.log("Grew to "+BIG+" "+timeit()/1000+" Seconds");
+	});
+    }
+    attached();
+
+    function shrink(){
+	if(buff.resize(SMALL,0) !== SMALL) fail("Shrank to "+buff.length);
+	testpattern(buff,8,SMALL,0,"Shrunk");
+	if(buff.stats().fixed) fail("Fixed in place without a slice");
+
+	// A slice fixes the memory where it is, so no shrinking, and growing
+	// only if it can be done in place. Whether the slice is still about
+	// makes no difference.
+	buff.slice(0,4);
+	if(!buff.stats().fixed) fail("Slicing didn't fix it in place");
+	if(typeof(gc) === "function") gc();
+	try{
+	    buff.resize(SMALL/2);
+	    fail("Shrank after slicing");
+	}catch(e){}
+	var slice = buff.slice(8,16);
+	try{
+	    buff.resize(SMALL/2);
+	    fail("Shrank with a slice about");
+	}catch(e){}
+	if(buff.length !== SMALL) fail("Failed shrink changed the length");
+	try{
+	    buff.resize(BIG);
+	    console.log("Grew in place with a slice about");
+	}catch(e){
+	    console.log("Couldn't grow in place with a slice about");
+	}
+	testpattern(slice,0,8,8,"Slice");
+	try{
+	    slice.resize(BIG);
+	    fail("Resized a slice");
+	}catch(e){}
+    }
+}
+
+function child(){
+    var buff = new IPCBuffer(SMALL,"*Resizy");
+    testpattern(buff,8,SMALL,0,"Parent's");
+    buff.store(4,1);
+    buff.notify(4);
+
+    function grown(){
+	buff.wait(0,SMALL,function(err){
+	    if(err) fail(err);
+	    if(buff.load(0) === SMALL) return grown();	// Woken for nothing
+	    if(buff.remap(0) !== BIG || buff.length !== BIG) fail("Remapped to "+buff.length);
+	    testpattern(buff,8,SMALL,0,"Remapped");
+	    pattern(buff,SMALL,BIG,7);
+	    console.log("Remapped to "+buff.length);
+	});
+    }
+    grown();
+}
+
+if(process.argv[2] === "child"){
+    child();
+}else{
+    parent();
+}
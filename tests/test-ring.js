@@ -0,0 +1,65 @@
+
+var spawn = require("child_process").spawn;
+var ipc = require("../lib/ipcbuffer");
+
+var RINGSIZE = 1024*1024;
+var MESSAGES = 1000000;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function producer(){
+    var ring = new ipc.Ring(RINGSIZE,"*Ringy");
+    var i = 0;
+    console.log("Ring of "+ring.capacity+" bytes created "+timeit()/1000+" Seconds");
+
+    var proc = spawn("node",[__filename,"child"]);
+    proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+    proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+    proc.on("exit",function(code){console.log("Child exited "+(code ? "with "+code : "OK"))});
+
+    function fill(){
+	while(i < MESSAGES && ring.push("message "+i)){
+	    i++;
+	}
+	if(i < MESSAGES){
+	    setTimeout(fill,0);
+	}else{
+	    ring.push("done");
+	    console.log("Pushed "+MESSAGES+" messages "+timeit()/1000+" Seconds");
+	}
+    }
+    fill();
+}
+
+function consumer(){
+    var ring = new ipc.Ring(RINGSIZE,"*Ringy");
+    var i = 0;
+
+    function drain(){
+	var msg;
+	while((msg = ring.pop("utf8")) !== null){
+	    if(msg === "done"){
+		console.log("Popped "+i+" messages "+timeit()/1000+" Seconds");
+		return;
+	    }
+	    if(msg !== "message "+i){
+		process.stderr.write("Ring out of order at "+i+" got "+msg+"\n");
+		process.exit(1);
+	    }
+	    i++;
+	}
+	setTimeout(drain,0);
+    }
+    drain();
+}
+
+if(process.argv[2] === "child"){
+    consumer();
+}else{
+    producer();
+}
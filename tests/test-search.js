@@ -0,0 +1,112 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+var kernel = require("../lib/ipcbuffer")._IPCbuffer.searchKernel;
+
+var BUFFSIZE = 64*1024;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+// The slow obvious way, to check the fast ones against
+function naiveIndex(buff,needle,from,last){
+    var i, j, n = needle.length;
+    if(last){
+	for(i = Math.min(from,buff.length-n);i >= 0;i--){
+	    for(j = 0;j < n && buff[i+j] === needle[j];j++);
+	    if(j === n) return i;
+	}
+    }else{
+	for(i = from;i + n <= buff.length;i++){
+	    for(j = 0;j < n && buff[i+j] === needle[j];j++);
+	    if(j === n) return i;
+	}
+    }
+    return -1;
+}
+
+var seed = 1;
+function random(){
+    seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+    return seed >> 16;
+}
+
+var buff = new IPCBuffer(BUFFSIZE);
+var other = new IPCBuffer(BUFFSIZE,"*Searchy");
+var plain = new Buffer(16);
+var i, n;
+console.log("Search kernel is "+kernel);
+
+// fill
+buff.fill(7);
+for(i = 0;i < BUFFSIZE;i++){
+    if(buff[i] !== 7) fail("fill(7) missed byte "+i);
+}
+buff.fill(0,0,BUFFSIZE);
+buff.fill("abc",5,5+3*1000+2);
+for(i = 0;i < 3*1000+2;i++){
+    if(buff[5+i] !== "abc".charCodeAt(i % 3)) fail("fill(\"abc\") byte "+i+" is "+buff[5+i]);
+}
+if(buff[4] !== 0 || buff[5+3*1000+2] !== 0) fail("fill went outside its range");
+for(n = 0;n < 70;n++){
+    buff.fill(0,0,100);
+    buff.fill(255,3,3+n);
+    for(i = 0;i < 100;i++){
+	if(buff[i] !== (i >= 3 && i < 3+n ? 255 : 0)) fail("fill of "+n+" bytes, byte "+i+" is "+buff[i]);
+    }
+}
+console.log("fill "+timeit()/1000+" Seconds");
+
+// equals and compare, the difference anywhere, against other kinds of buffer
+for(i = 0;i < BUFFSIZE;i++) buff[i] = other[i] = random() & 255;
+if(!buff.equals(other) || buff.compare(other) !== 0 || IPCBuffer.compare(buff,other) !== 0) fail("Same bytes not equal");
+for(i = 0;i < 200;i++){
+    var at = i < 100 ? i : BUFFSIZE-1-(i-100);
+    other[at] = buff[at] ^ 1;
+    if(buff.equals(other)) fail("Byte "+at+" different and still equal");
+    if(buff.compare(other) !== (buff[at] < other[at] ? -1 : 1)) fail("compare with byte "+at+" different");
+    if(other.compare(buff) !== -buff.compare(other)) fail("compare isn't symmetric at "+at);
+    other[at] = buff[at];
+}
+if(buff.slice(0,10).compare(other) !== -1 || other.compare(buff.slice(0,10)) !== 1) fail("Shorter doesn't sort first");
+if(buff.compare(other,0,10,0,10) !== 0) fail("Ranges");
+for(i = 0;i < 16;i++) plain[i] = buff[100+i];
+if(!buff.slice(100,116).equals(plain) || buff.compare(plain,0,16,100,116) !== 0) fail("Against a plain node Buffer");
+console.log("equals and compare "+timeit()/1000+" Seconds");
+
+// indexOf and lastIndexOf, on a small alphabet so first bytes match all
+// over the place and the whole needle only now and then
+for(i = 0;i < BUFFSIZE;i++) buff[i] = 97 + random() % 4;
+var needles = ["a","d","ab","abcd","dcba","aaaaaa","abcdabcd","bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"];
+for(n = 0;n < needles.length;n++){
+    var needle = new Buffer(needles[n],"ascii");
+    var froms = [0,1,17,4095,BUFFSIZE-40,BUFFSIZE-1];
+    for(i = 0;i < froms.length;i++){
+	var want = naiveIndex(buff,needle,froms[i],false);
+	if(buff.indexOf(needles[n],froms[i]) !== want) fail("indexOf "+needles[n]+" from "+froms[i]+" gave "+buff.indexOf(needles[n],froms[i])+" not "+want);
+	if(buff.indexOf(needle,froms[i]) !== want) fail("indexOf a Buffer of "+needles[n]);
+	want = naiveIndex(buff,needle,froms[i],true);
+	if(buff.lastIndexOf(needles[n],froms[i]) !== want) fail("lastIndexOf "+needles[n]+" from "+froms[i]+" gave "+buff.lastIndexOf(needles[n],froms[i])+" not "+want);
+    }
+}
+if(buff.indexOf(101) !== -1 || buff.indexOf("e") !== -1) fail("Found a byte that isn't there");
+buff[BUFFSIZE-1] = 101;
+if(buff.indexOf(101) !== BUFFSIZE-1 || buff.lastIndexOf(101) !== BUFFSIZE-1) fail("Byte at the very end");
+if(buff.indexOf(101,-1) !== BUFFSIZE-1 || buff.indexOf(101,-1000) !== BUFFSIZE-1) fail("Negative from");
+if(buff.lastIndexOf(101,-2) !== -1) fail("lastIndexOf from before the only one");
+
+// Only inside the slice, positions counted from its start
+var slice = buff.slice(1000,1100);
+slice.fill("x");
+buff[999] = buff[1100] = 120;
+if(slice.indexOf("xx") !== 0 || slice.lastIndexOf("xx") !== 98) fail("Slice searched outside itself");
+if(slice.indexOf("y") !== -1 || slice.indexOf(new Buffer(101)) !== -1) fail("Slice found too much");
+console.log("indexOf and lastIndexOf "+timeit()/1000+" Seconds");
@@ -0,0 +1,102 @@
+
+var spawn = require("child_process").spawn;
+var ipc = require("../lib/ipcbuffer");
+
+var SNAPSIZE = 256*1024;
+var VERSIONS = 20000;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+// Version n is n*100 bytes (wrapped to the capacity) all of value n&255, so a
+// reader that got half of one version and half of the next would see it
+function write(snap,n){
+    var view = snap.begin(), length = (n*100) % snap.capacity || 1, i;
+    for(i = 0;i < length;i++) view[i] = n & 255;
+    return snap.commit(length);
+}
+
+function check(view){
+    if(!view) return true;
+    var value = view[0], i;
+    for(i = 1;i < view.length;i++){
+	if(view[i] !== value) return false;
+    }
+    return true;
+}
+
+function parent(){
+    var snap = new ipc.Snapshot(SNAPSIZE,"*Snappy");
+    var control = new ipc.Buffer(4096,"*Snapctl");
+    var n = 0;
+    control.store(0,0);
+    console.log("Snapshot of "+snap.capacity+" bytes a version "+timeit()/1000+" Seconds");
+
+    if(snap.acquire() !== null || snap.copy() !== null) fail("Read before anything was published");
+    var first = snap.publish("hello");
+    if(snap.copy().toString() !== "hello" || snap.version() !== first) fail("publish then copy");
+    var view = snap.acquire();
+    if(view.version !== first || view.toString() !== "hello") fail("acquire");
+    if(snap.publish(new Buffer("there")) !== first+1) fail("Versions count up by one");
+    if(snap.copy().toString() !== "there" || !snap.valid(first)) fail("Second version");
+    write(snap,1);
+    if(snap.valid(first)) fail("Version two back still valid");
+
+    var proc = spawn("node",[__filename,"child"]);
+    proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+    proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+    proc.on("exit",function(code){
+	if(code) fail("Child exited with "+code);
+	console.log("Reader saw only whole versions");
+    });
+
+    // Keep publishing while the child is reading, then tell it to stop
+    function publish(){
+	var until = n+500, version;
+	for(;n < until && n < VERSIONS;n++){
+	    version = write(snap,n);
+	}
+	if(n < VERSIONS){
+	    setTimeout(publish,0);
+	}else{
+	    console.log("Published "+VERSIONS+" versions "+timeit()/1000+" Seconds");
+	    control.store(0,version);
+	}
+    }
+    publish();
+}
+
+function child(){
+    var snap = new ipc.Snapshot(SNAPSIZE,"*Snappy");
+    var control = new ipc.Buffer(4096,"*Snapctl");
+    var reads = 0, last = 0, stop;
+
+    while(!(stop = control.load(0)) || last < stop){
+	var version = snap.read(function(view,version){
+	    // Torn reads are allowed to happen here, just never to get out
+	    return check(view) ? version : -1;
+	});
+	if(version === -1) fail("Read a torn version");
+	if(version < last) fail("Version went backwards from "+last+" to "+version);
+	last = version;
+	var copy = snap.copy();
+	if(!check(copy)) fail("Copied a torn version");
+	reads++;
+    }
+    console.log("Read "+reads+" times up to version "+last+" "+timeit()/1000+" Seconds");
+}
+
+if(process.argv[2] === "child"){
+    child();
+}else{
+    parent();
+}
@@ -0,0 +1,87 @@
+
+var spawn = require("child_process").spawn;
+var ipc = require("../lib/ipcbuffer");
+
+var TABLESIZE = 4*1024*1024;
+var WORKERS = 4;
+var KEYS = 2000;	// Per worker
+var ROUNDS = 20;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+// Each worker keeps setting, reading back and deleting its own keys while
+// the others do theirs, which gets the stripes, the probing past deleted
+// slots and the rehash that clears them out all going at once
+function parent(){
+    var table = new ipc.Table(TABLESIZE,"*Tably");
+    var i, exited = 0;
+    console.log("Table of "+table.slots+" slots created "+timeit()/1000+" Seconds");
+
+    if(table.get("missing") !== null) fail("Found a key that isn't there");
+    if(!table.set("key","value") || table.get("key","utf8") !== "value") fail("set then get");
+    if(!table.set("key","other") || table.get("key").toString() !== "other") fail("set over a key");
+    if(table.size() !== 1) fail("Size after setting one key twice");
+    if(!table["delete"]("key") || table.has("key") || table["delete"]("key")) fail("delete");
+    var big = new Array(2000).join("x");
+    if(!table.set(big,big) || table.get(big,"utf8") !== big) fail("Long key and value");
+    table["delete"](big);
+
+    for(i = 0;i < WORKERS;i++){
+	var proc = spawn("node",[__filename,"child",i]);
+	proc.stdout.on("data",function(data){process.stdout.write("Child:"+data.toString())});
+	proc.stderr.on("data",function(data){process.stderr.write("Error:Child:"+data.toString())});
+	proc.on("exit",function(code){
+	    if(code) fail("Child exited with "+code);
+	    if(++exited < WORKERS) return;
+	    console.log(WORKERS+" workers done "+timeit()/1000+" Seconds");
+	    // Every worker leaves its odd keys behind
+	    for(var w = 0;w < WORKERS;w++){
+		for(var k = 1;k < KEYS;k += 2){
+		    if(table.get(w+"/"+k,"utf8") !== "value "+w+"/"+k+"/"+(ROUNDS-1)){
+			fail("Worker "+w+" key "+k+" is "+table.get(w+"/"+k,"utf8"));
+		    }
+		}
+	    }
+	    if(table.size() !== WORKERS*KEYS/2) fail("Size "+table.size());
+	    console.log("All keys where they should be");
+	});
+    }
+}
+
+function child(w){
+    var table = new ipc.Table(TABLESIZE,"*Tably");
+    var r, k, key;
+
+    for(r = 0;r < ROUNDS;r++){
+	for(k = 0;k < KEYS;k++){
+	    key = w+"/"+k;
+	    if(!table.set(key,"value "+key+"/"+r)) fail("Table full at "+key);
+	}
+	for(k = 0;k < KEYS;k++){
+	    key = w+"/"+k;
+	    if(table.get(key,"utf8") !== "value "+key+"/"+r) fail("Read back "+key+" in round "+r);
+	}
+	if(r < ROUNDS-1){
+	    for(k = 0;k < KEYS;k++) table["delete"](w+"/"+k);
+	}else{
+	    for(k = 0;k < KEYS;k += 2) table["delete"](w+"/"+k);
+	}
+    }
+    console.log("Worker "+w+" did "+ROUNDS+" rounds "+timeit()/1000+" Seconds");
+}
+
+if(process.argv[2] === "child"){
+    child(+process.argv[3]);
+}else{
+    parent();
+}
@@ -0,0 +1,122 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+var kernel = require("../lib/ipcbuffer")._IPCbuffer.utf8Kernel;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function put(buff,at,bytes){
+    for(var i = 0;i < bytes.length;i++) buff[at+i] = bytes[i];
+}
+
+// One, two, three and four byte characters and what they are in UTF-8
+var good = [
+    ["A",[0x41]],
+    ["\u00e9",[0xc3,0xa9]],
+    ["\u20ac",[0xe2,0x82,0xac]],
+    ["\uffff",[0xef,0xbf,0xbf]],
+    ["\ud800\udf48",[0xf0,0x90,0x8d,0x88]],
+    ["\udbff\udfff",[0xf4,0x8f,0xbf,0xbf]]
+];
+
+// Not UTF-8, and the byte the trouble starts at
+var bad = [
+    ["lone continuation",[0x80],0],
+    ["overlong NUL",[0xc0,0x80],0],
+    ["overlong three byte",[0xe0,0x80,0xaf],0],
+    ["surrogate",[0xed,0xa0,0x80],0],
+    ["past U+10FFFF",[0xf4,0x90,0x80,0x80],0],
+    ["never a lead byte",[0xf5,0x80,0x80,0x80],0],
+    ["cut short",[0x61,0xe2,0x82],1],
+    ["lead then ASCII",[0x61,0x62,0xc3,0x41],2]
+];
+
+var buff = new IPCBuffer(256*1024);
+var i, j, n;
+console.log("UTF-8 kernel is "+kernel);
+
+for(i = 0;i < good.length;i++){
+    var s = good[i][0], bytes = good[i][1];
+    buff.fill(0,0,8);
+    if(s.length === 1){
+	n = buff.write(s,0,"utf8");
+	if(n !== bytes.length || IPCBuffer.byteLength(s,"utf8") !== n) fail("Writing "+escape(s)+" took "+n+" bytes");
+	for(j = 0;j < n;j++){
+	    if(buff[j] !== bytes[j]) fail("Writing "+escape(s)+" byte "+j+" is "+buff[j]);
+	}
+    }else{
+	// Only read, older V8s write a surrogate pair as two three byte ones
+	put(buff,0,bytes);
+	n = bytes.length;
+    }
+    if(buff.toString("utf8",0,n,true) !== s) fail("Reading "+escape(s)+" back");
+    if(buff.utf8Check(0,n) !== -1) fail(escape(s)+" not valid");
+}
+
+for(i = 0;i < bad.length;i++){
+    put(buff,0,bad[i][1]);
+    n = bad[i][1].length;
+    if(buff.utf8Check(0,n) !== bad[i][2]) fail(bad[i][0]+" found at "+buff.utf8Check(0,n));
+    try{
+	buff.toString("utf8",0,n,true);
+	fail(bad[i][0]+" didn't throw");
+    }catch(e){
+	if(e.message !== "Invalid UTF-8 at byte "+bad[i][2]) fail(bad[i][0]+" said "+e.message);
+    }
+    buff.toString("utf8",0,n);	// Doesn't throw without strict
+}
+console.log("Known sequences "+timeit()/1000+" Seconds");
+
+// A bad byte anywhere in a long run of ASCII and multi-byte text, so it
+// lands in every lane of the vectors and in the tail after them
+var text = "plain ascii then \u20ac\u00e9 and more ";
+while(IPCBuffer.byteLength(text,"utf8") < 300) text += text;
+var length = buff.write(text,0,"utf8");
+if(buff.toString("utf8",0,length,true) !== text) fail("Long text round trip");
+for(i = 0;i < length;i++){
+    if((buff[i] & 0xc0) === 0x80) continue;	// Breaking a character in the middle moves where it starts
+    var was = buff[i];
+    buff[i] = 0xff;
+    if(buff.utf8Check(0,length) !== i) fail("0xff at "+i+" found at "+buff.utf8Check(0,length));
+    buff[i] = was;
+}
+if(buff.utf8Check(0,length) !== -1) fail("Long text not valid after putting it back");
+console.log("Bad byte at every position "+timeit()/1000+" Seconds");
+
+// Positions count from the start of the Buffer asked, wherever it is in
+// its parent, slices and pooled little ones alike
+var small = new IPCBuffer(16);
+small.fill(0x61);
+small[3] = 0xff;
+if(small.utf8Check() !== 3) fail("Pooled buffer's bad byte at "+small.utf8Check());
+try{
+    small.toString("utf8",0,4,true);
+    fail("Pooled buffer didn't throw");
+}catch(e){
+    if(e.message !== "Invalid UTF-8 at byte 3") fail("Pooled buffer said "+e.message);
+}
+var slice = buff.slice(100,200);
+put(slice,0,[0x61,0x62,0xc3,0x41]);
+try{
+    slice.toString("utf8",0,4,true);
+    fail("Slice didn't throw");
+}catch(e){
+    if(e.message !== "Invalid UTF-8 at byte 2") fail("Slice said "+e.message);
+}
+
+// Plain ASCII both ways, which is just a copy
+var ascii = "";
+for(i = 0;i < 100000;i++) ascii += String.fromCharCode(32 + i % 95);
+if(buff.write(ascii,0,"utf8") !== ascii.length) fail("ASCII took more bytes than characters");
+if(buff.toString("utf8",0,ascii.length,true) !== ascii) fail("ASCII round trip");
+if(buff.toString("utf8",0,ascii.length) !== buff.toString("ascii",0,ascii.length)) fail("ASCII as utf8 and ascii differ");
+console.log("ASCII round trip of "+ascii.length+" bytes "+timeit()/1000+" Seconds");
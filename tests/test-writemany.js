@@ -0,0 +1,139 @@
+
+var IPCBuffer = require("../lib/ipcbuffer").Buffer;
+
+var BUFFSIZE = 4096;
+
+var timed = new Date();
+function timeit(){
+    var when = timed;
+    timed = new Date();
+    return(timed - when);
+}
+
+function fail(why){
+    process.stderr.write(why+"\n");
+    process.exit(1);
+}
+
+function same(a,b,start,end,what){
+    for(var i = start;i < end;i++){
+	if(a[i] !== b[i]) fail(what+" byte "+i+" is "+a[i]+" not "+b[i]);
+    }
+}
+
+// What writeMany has to come out the same as: write() one at a time, each
+// carrying on from the one before unless it says where
+function oneByOne(buff,items){
+    var at = 0, where = [];
+    for(var i = 0;i < items.length;i++){
+	if(items[i][1] !== undefined && items[i][1] !== null) at = items[i][1];
+	var n = at < buff.length ? buff.write(items[i][0],at,items[i][2] || "utf8") : 0;
+	where.push(at,n);
+	at += n;
+    }
+    return where;
+}
+
+var buff = new IPCBuffer(BUFFSIZE);
+var check = new IPCBuffer(BUFFSIZE);
+
+// Every encoding, with and without offsets, and a string that's cut short
+// at the end
+var records = [
+    [["hello"],[" "],["world"]],
+    [["café",10],["中文"],["😀",100,"utf8"]],
+    [["plain",0,"ascii"],["binÿ",20,"binary"],["aGVsbG8=",30,"base64"],["tail"]],
+    [["x",BUFFSIZE-3],["éé"],["never"]],
+    [["",5],["",6],["after the empty ones"]],
+    []
+];
+for(var r = 0;r < records.length;r++){
+    buff.fill(0x55);
+    check.fill(0x55);
+    var where = buff.writeMany(records[r]);
+    var want = oneByOne(check,records[r]);
+    if(where.length !== want.length) fail("Record "+r+" gave "+where.length/2+" positions");
+    for(var i = 0;i < want.length;i++){
+	if(where[i] !== want[i]) fail("Record "+r+" field "+(i >> 1)+" "+(i & 1 ? "length" : "offset")+" is "+where[i]+" not "+want[i]);
+    }
+    same(buff,check,0,BUFFSIZE,"Record "+r);
+}
+console.log("writeMany matches write "+timeit()/1000+" Seconds");
+
+// Through a slice it's all relative to the slice, and can't get out of it
+var slice = buff.slice(1000,1010);
+buff.fill(0x55);
+where = slice.writeMany([["abc",2],["defghijklmnop"]]);
+if(where[0] !== 2 || where[1] !== 3 || where[2] !== 5 || where[3] !== 5) fail("Slice writeMany gave "+where);
+if(buff.toString("ascii",1002,1010) !== "abcdefgh") fail("Slice writeMany wrote "+buff.toString("ascii",1000,1010));
+if(buff[999] !== 0x55 || buff[1010] !== 0x55) fail("Slice writeMany went outside the slice");
+
+// Anything wrong throws before a single byte's written: bad fields, and
+// base64 that won't fit wherever it is in the list
+var bad = [
+    [["fine",0],["past the end",BUFFSIZE+1]],
+    [["fine",0],[12345]],
+    [["fine",0],["x",0,"klingon"]],
+    [["fine",0],"not an array"],
+    [["fine",0],["aGVsbG8=",BUFFSIZE-4,"base64"]],
+    [["fine",0],["x",BUFFSIZE-5],["aGVsbG8=",null,"base64"]],
+    [["fine",BUFFSIZE-7],["aGVsbG8=",null,"base64"],["more"]]
+];
+for(i = 0;i < bad.length;i++){
+    buff.fill(0x55);
+    try{
+	buff.writeMany(bad[i]);
+	fail("Bad record "+i+" didn't throw");
+    }catch(e){}
+    for(var j = 0;j < BUFFSIZE;j++){
+	if(buff[j] !== 0x55) fail("Bad record "+i+" wrote byte "+j);
+    }
+}
+try{
+    slice.writeMany([["aGVsbG8=",6,"base64"]]);
+    fail("base64 past the end of a slice didn't throw");
+}catch(e){}
+
+// base64 that fits exactly is fine, padding or not
+buff.fill(0x55);
+where = buff.writeMany([["aGVsbG8=",BUFFSIZE-5,"base64"]]);
+if(where[1] !== 5 || buff.toString("ascii",BUFFSIZE-5) !== "hello") fail("base64 to the very end");
+where = buff.writeMany([["YWI",BUFFSIZE-2,"base64"]]);
+if(where[1] !== 2 || buff.toString("ascii",BUFFSIZE-2) !== "ab") fail("Unpadded base64 to the very end");
+console.log("All or nothing "+timeit()/1000+" Seconds");
+
+// sliceMany is toString over a list of ranges, either shape of list
+buff.fill(0);
+buff.write("hello world été 中文",0);
+var ranges = [0,5,6,11,12,17,0,0,12,buff.length];
+var encodings = ["utf8","ascii","binary","base64"];
+for(var e = 0;e < encodings.length;e++){
+    var strings = buff.sliceMany(ranges,encodings[e]);
+    var pairs = [];
+    for(i = 0;i < ranges.length;i += 2) pairs.push([ranges[i],ranges[i+1]]);
+    var nested = buff.sliceMany(pairs,encodings[e]);
+    if(strings.length !== ranges.length/2 || nested.length !== strings.length) fail("sliceMany "+encodings[e]+" gave "+strings.length+" strings");
+    for(i = 0;i < strings.length;i++){
+	var s = buff.toString(encodings[e],ranges[i*2],ranges[i*2+1]);
+	if(strings[i] !== s) fail("sliceMany "+encodings[e]+" range "+i+" is "+strings[i]+" not "+s);
+	if(nested[i] !== s) fail("sliceMany "+encodings[e]+" of pairs, range "+i+" is "+nested[i]);
+    }
+}
+if(buff.sliceMany([]).length !== 0) fail("sliceMany of nothing");
+
+// Relative to a slice, and out of range anywhere throws
+slice = buff.slice(6,11);
+strings = slice.sliceMany([0,5,1,3]);
+if(strings[0] !== "world" || strings[1] !== "or") fail("sliceMany through a slice gave "+strings);
+var badRanges = [[0,6],[3,2],[0,5,-1,2],[0,"x"]];
+for(i = 0;i < badRanges.length;i++){
+    try{
+	slice.sliceMany(badRanges[i]);
+	fail("sliceMany of bad ranges "+badRanges[i]+" didn't throw");
+    }catch(e){}
+}
+try{
+    buff.sliceMany([0,1],"klingon");
+    fail("sliceMany in an encoding there isn't");
+}catch(e){}
+console.log("sliceMany "+timeit()/1000+" Seconds");